@@ -1,7 +1,115 @@
 #include "accounting_decision_tree.h"
+#include "bytecode_vm.h"
+#include "columnar_batch.h"
+#include "flat_tree.h"
+#include "native_codegen.h"
+#include "path_id.h"
+#include "thread_pool.h"
 
-OutcomeNode::OutcomeNode(Result value, Action action)
-    : value_(value), action_(action) {}
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+template <typename Fn>
+void forEachChunk(ThreadPool& pool, std::size_t count, std::size_t chunkSize,
+                  Fn&& fn) {
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+    std::size_t chunks = (count + chunkSize - 1) / chunkSize;
+    pool.parallelFor(chunks, [&](std::size_t chunk) {
+        std::size_t begin = chunk * chunkSize;
+        fn(begin, std::min(chunkSize, count - begin));
+    });
+}
+
+// parseExpr() text for expressions, {"native": name} for registered native
+// conditions and null for any other lambda.
+void writeCondition(JsonWriter& out, const Predicate& predicate) {
+    if (predicate.getExpr()) {
+        out.string(predicate.toString());
+    } else if (!predicate.getName().empty()) {
+        out.raw('{').key("native").string(predicate.getName()).raw('}');
+    } else {
+        out.raw("null");
+    }
+}
+
+}
+
+Predicate::Predicate(ExprPtr expr) : expr_(std::move(expr)) {}
+
+Predicate::Predicate(const Expr& expr) : expr_(expr.get()) {}
+
+bool Predicate::test(const Context& context) const {
+    if (expr_) {
+        return expr_->evaluate(context);
+    }
+    if (condition_) {
+        return condition_(context);
+    }
+    if (slotCondition_) {
+        throw std::logic_error("slot condition evaluated without a FlatContext");
+    }
+    throw std::logic_error("empty predicate evaluated");
+}
+
+bool Predicate::test(const FlatContext& context) const {
+    if (expr_) {
+        return expr_->evaluate(context);
+    }
+    if (slotCondition_) {
+        return slotCondition_(context);
+    }
+    if (condition_) {
+        return condition_(context.toContext());
+    }
+    throw std::logic_error("empty predicate evaluated");
+}
+
+bool Predicate::isSlotCondition() const {
+    return static_cast<bool>(slotCondition_);
+}
+
+const ExprPtr& Predicate::getExpr() const {
+    return expr_;
+}
+
+const std::string& Predicate::getName() const {
+    static const std::string unnamed;
+    return name_ ? *name_ : unnamed;
+}
+
+const void* Predicate::registration() const {
+    return name_.get();
+}
+
+std::string Predicate::toString() const {
+    return expr_ ? expr_->toString() : std::string();
+}
+
+Predicate::operator bool() const {
+    return condition_ || slotCondition_ || expr_;
+}
+
+std::string Node::toJson(int indent) const {
+    std::string json;
+    JsonWriter out(json);
+    writeJson(out, indent);
+    return json;
+}
+
+void Node::toJson(std::ostream& out, JsonStyle style) const {
+    JsonWriter writer(out, style);
+    writeJson(writer, 0);
+}
+
+OutcomeNode::OutcomeNode(Result value, Action action, std::string actionName)
+    : value_(value), action_(action) {
+    if (!actionName.empty()) {
+        actionName_ = std::make_shared<const std::string>(std::move(actionName));
+    }
+}
 
 Result OutcomeNode::evaluate(const Context& context) const {
     if (action_) {
@@ -10,32 +118,78 @@ Result OutcomeNode::evaluate(const Context& context) const {
     return value_;
 }
 
+Result OutcomeNode::evaluate(const FlatContext& context) const {
+    if (action_) {
+        action_(context.toContext());
+    }
+    return value_;
+}
+
+NodeKind OutcomeNode::kind() const {
+    return NodeKind::Outcome;
+}
+
 std::string OutcomeNode::getType() const {
     return "OutcomeNode";
 }
 
-std::string OutcomeNode::toJson(int indent) const {
-    std::string indentStr(indent, ' ');
-    std::string nextIndentStr(indent + 2, ' ');
+const Result& OutcomeNode::getValue() const {
+    return value_;
+}
 
-    std::string json = indentStr + "{\n";
-    json += nextIndentStr + "\"type\": \"outcome\",\n";
-    json += nextIndentStr + "\"value\": \"" + resultToString(value_) + "\",\n";
-    json += nextIndentStr + "\"hasAction\": " + (action_ ? "true" : "false") + "\n";
-    json += indentStr + "}";
+const Action& OutcomeNode::getAction() const {
+    return action_;
+}
 
-    return json;
+const std::string& OutcomeNode::getActionName() const {
+    static const std::string unnamed;
+    return actionName_ ? *actionName_ : unnamed;
+}
+
+const void* OutcomeNode::actionRegistration() const {
+    return actionName_.get();
+}
+
+void OutcomeNode::writeJson(JsonWriter& out, int indent) const {
+    out.indent(indent).raw('{').newline();
+    out.indent(indent + 2).key("type").string("outcome").raw(',').newline();
+    out.indent(indent + 2).key("value");
+    if (const auto* text = std::get_if<std::string>(&value_)) {
+        out.string(*text);
+    } else {
+        out.raw(formatLiteral(value_));
+    }
+    out.raw(',').newline();
+    out.indent(indent + 2).key("hasAction").raw(action_ ? "true" : "false");
+    if (action_ && actionName_) {
+        out.raw(',').newline();
+        out.indent(indent + 2).key("action").string(*actionName_);
+    }
+    out.newline();
+    out.indent(indent).raw('}');
 }
 
 DecisionNode::DecisionNode(const std::string& name,
-                           Condition condition,
+                           Predicate condition,
                            NodePtr trueNode,
                            NodePtr falseNode)
     : name_(name), condition_(condition),
       trueNode_(trueNode), falseNode_(falseNode) {}
 
 Result DecisionNode::evaluate(const Context& context) const {
-    bool result = condition_(context);
+    bool result = condition_.test(context);
+
+    if (result && trueNode_) {
+        return trueNode_->evaluate(context);
+    } else if (!result && falseNode_) {
+        return falseNode_->evaluate(context);
+    }
+
+    return std::string("NO_RESULT");
+}
+
+Result DecisionNode::evaluate(const FlatContext& context) const {
+    bool result = condition_.test(context);
 
     if (result && trueNode_) {
         return trueNode_->evaluate(context);
@@ -46,6 +200,10 @@ Result DecisionNode::evaluate(const Context& context) const {
     return std::string("NO_RESULT");
 }
 
+NodeKind DecisionNode::kind() const {
+    return NodeKind::Decision;
+}
+
 std::string DecisionNode::getType() const {
     return "DecisionNode: " + name_;
 }
@@ -58,34 +216,56 @@ void DecisionNode::setFalseNode(NodePtr node) {
     falseNode_ = node;
 }
 
-std::string DecisionNode::toJson(int indent) const {
-    std::string indentStr(indent, ' ');
-    std::string nextIndentStr(indent + 2, ' ');
+const std::string& DecisionNode::getName() const {
+    return name_;
+}
 
-    std::string json = indentStr + "{\n";
-    json += nextIndentStr + "\"type\": \"decision\",\n";
-    json += nextIndentStr + "\"name\": \"" + name_ + "\",\n";
+const Predicate& DecisionNode::getCondition() const {
+    return condition_;
+}
+
+const NodePtr& DecisionNode::getTrueNode() const {
+    return trueNode_;
+}
+
+const NodePtr& DecisionNode::getFalseNode() const {
+    return falseNode_;
+}
+
+void DecisionNode::writeJson(JsonWriter& out, int indent) const {
+    out.indent(indent).raw('{').newline();
+    out.indent(indent + 2).key("type").string("decision").raw(',').newline();
+    out.indent(indent + 2).key("name").string(name_).raw(',').newline();
+
+    out.indent(indent + 2).key("condition");
+    writeCondition(out, condition_);
+    if (trueNode_ || falseNode_) {
+        out.raw(',');
+    }
+    out.newline();
 
     if (trueNode_) {
-        json += nextIndentStr + "\"trueBranch\": \n";
-        json += trueNode_->toJson(indent + 2);
-        json += ",\n";
+        out.indent(indent + 2).key("trueBranch").newline();
+        trueNode_->writeJson(out, indent + 2);
+        if (falseNode_) {
+            out.raw(',');
+        }
+        out.newline();
     }
 
     if (falseNode_) {
-        json += nextIndentStr + "\"falseBranch\": \n";
-        json += falseNode_->toJson(indent + 2);
-        json += "\n";
+        out.indent(indent + 2).key("falseBranch").newline();
+        falseNode_->writeJson(out, indent + 2);
+        out.newline();
     }
 
-    json += indentStr + "}";
-    return json;
+    out.indent(indent).raw('}');
 }
 
 MultiBranchNode::MultiBranchNode(const std::string& name)
     : name_(name), defaultNode_(nullptr) {}
 
-MultiBranchNode& MultiBranchNode::addBranch(Condition condition, NodePtr node) {
+MultiBranchNode& MultiBranchNode::addBranch(Predicate condition, NodePtr node) {
     branches_.emplace_back(condition, node);
     return *this;
 }
@@ -97,7 +277,7 @@ MultiBranchNode& MultiBranchNode::setDefault(NodePtr node) {
 
 Result MultiBranchNode::evaluate(const Context& context) const {
     for (const auto& [condition, node] : branches_) {
-        if (condition(context)) {
+        if (condition.test(context)) {
             return node->evaluate(context);
         }
     }
@@ -109,52 +289,320 @@ Result MultiBranchNode::evaluate(const Context& context) const {
     return std::string("NO_MATCH");
 }
 
+Result MultiBranchNode::evaluate(const FlatContext& context) const {
+    for (const auto& [condition, node] : branches_) {
+        if (condition.test(context)) {
+            return node->evaluate(context);
+        }
+    }
+
+    if (defaultNode_) {
+        return defaultNode_->evaluate(context);
+    }
+
+    return std::string("NO_MATCH");
+}
+
+NodeKind MultiBranchNode::kind() const {
+    return NodeKind::MultiBranch;
+}
+
 std::string MultiBranchNode::getType() const {
     return "MultiBranchNode: " + name_;
 }
 
-std::string MultiBranchNode::toJson(int indent) const {
-    std::string indentStr(indent, ' ');
-    std::string nextIndentStr(indent + 2, ' ');
-    std::string arrayIndentStr(indent + 4, ' ');
+const std::string& MultiBranchNode::getName() const {
+    return name_;
+}
 
-    std::string json = indentStr + "{\n";
-    json += nextIndentStr + "\"type\": \"multibranch\",\n";
-    json += nextIndentStr + "\"name\": \"" + name_ + "\",\n";
-    json += nextIndentStr + "\"branches\": [\n";
+const std::vector<std::pair<Predicate, NodePtr>>& MultiBranchNode::getBranches() const {
+    return branches_;
+}
+
+const NodePtr& MultiBranchNode::getDefaultNode() const {
+    return defaultNode_;
+}
+
+void MultiBranchNode::writeJson(JsonWriter& out, int indent) const {
+    out.indent(indent).raw('{').newline();
+    out.indent(indent + 2).key("type").string("multibranch").raw(',').newline();
+    out.indent(indent + 2).key("name").string(name_).raw(',').newline();
+    out.indent(indent + 2).key("branches").raw('[').newline();
 
     for (size_t i = 0; i < branches_.size(); ++i) {
-        json += arrayIndentStr + "{\n";
-        json += arrayIndentStr + "  \"condition\": \"branch_" + std::to_string(i) + "\",\n";
-        json += arrayIndentStr + "  \"node\": \n";
-        json += branches_[i].second->toJson(indent + 6);
-        json += "\n" + arrayIndentStr + "}";
+        out.indent(indent + 4).raw('{').newline();
+        out.indent(indent + 6).key("condition");
+        writeCondition(out, branches_[i].first);
+        out.raw(',').newline();
+        out.indent(indent + 6).key("node").newline();
+        if (branches_[i].second) {
+            branches_[i].second->writeJson(out, indent + 6);
+        } else {
+            out.indent(indent + 6).raw("null");
+        }
+        out.newline().indent(indent + 4).raw('}');
 
         if (i < branches_.size() - 1 || defaultNode_) {
-            json += ",";
+            out.raw(',');
         }
-        json += "\n";
+        out.newline();
     }
 
     if (defaultNode_) {
-        json += arrayIndentStr + "{\n";
-        json += arrayIndentStr + "  \"condition\": \"default\",\n";
-        json += arrayIndentStr + "  \"node\": \n";
-        json += defaultNode_->toJson(indent + 6);
-        json += "\n" + arrayIndentStr + "}\n";
+        out.indent(indent + 4).raw('{').newline();
+        out.indent(indent + 6).key("condition").string("default").raw(',').newline();
+        out.indent(indent + 6).key("node").newline();
+        defaultNode_->writeJson(out, indent + 6);
+        out.newline().indent(indent + 4).raw('}').newline();
     }
 
-    json += nextIndentStr + "]\n";
-    json += indentStr + "}";
+    out.indent(indent + 2).raw(']').newline();
+    out.indent(indent).raw('}');
+}
+
+SwitchNode::SwitchNode(const std::string& name, const Expr& feature)
+    : name_(name), feature_(feature.get()), defaultNode_(nullptr) {
+    if (feature_->kind() != ExprKind::Feature) {
+        throw std::runtime_error("switch '" + name + "' must dispatch on a feature, not " +
+                                 feature_->toString());
+    }
+}
 
-    return json;
+void SwitchNode::rebuildTable() {
+    std::vector<Result> keys;
+    for (const auto& entry : cases_) {
+        keys.push_back(entry.first);
+    }
+    table_ = SwitchTable(keys);
+}
+
+SwitchNode& SwitchNode::addCase(const Result& value, NodePtr node) {
+    cases_.emplace_back(value, node);
+    rebuildTable();
+    return *this;
+}
+
+SwitchNode& SwitchNode::addCases(std::vector<std::pair<Result, NodePtr>> cases) {
+    for (auto& entry : cases) {
+        cases_.push_back(std::move(entry));
+    }
+    rebuildTable();
+    return *this;
+}
+
+SwitchNode& SwitchNode::setDefault(NodePtr node) {
+    defaultNode_ = node;
+    return *this;
+}
+
+template <typename ContextT>
+Result SwitchNode::dispatch(const ContextT& context) const {
+    std::uint32_t index = table_.select(feature_->read(context));
+    const NodePtr& node = index < cases_.size() ? cases_[index].second : defaultNode_;
+    if (node) {
+        return node->evaluate(context);
+    }
+    return std::string("NO_MATCH");
+}
+
+Result SwitchNode::evaluate(const Context& context) const {
+    return dispatch(context);
+}
+
+Result SwitchNode::evaluate(const FlatContext& context) const {
+    return dispatch(context);
+}
+
+NodeKind SwitchNode::kind() const {
+    return NodeKind::Switch;
+}
+
+std::string SwitchNode::getType() const {
+    return "SwitchNode: " + name_;
+}
+
+const std::string& SwitchNode::getName() const {
+    return name_;
+}
+
+const ExprPtr& SwitchNode::getFeature() const {
+    return feature_;
+}
+
+const std::vector<std::pair<Result, NodePtr>>& SwitchNode::getCases() const {
+    return cases_;
+}
+
+const NodePtr& SwitchNode::getDefaultNode() const {
+    return defaultNode_;
+}
+
+const SwitchTable& SwitchNode::getTable() const {
+    return table_;
+}
+
+void SwitchNode::writeJson(JsonWriter& out, int indent) const {
+    out.indent(indent).raw('{').newline();
+    out.indent(indent + 2).key("type").string("switch").raw(',').newline();
+    out.indent(indent + 2).key("name").string(name_).raw(',').newline();
+    out.indent(indent + 2).key("feature").string(feature_->toString()).raw(',').newline();
+    out.indent(indent + 2).key("cases").raw('[').newline();
+
+    for (size_t i = 0; i < cases_.size(); ++i) {
+        out.indent(indent + 4).raw('{').newline();
+        out.indent(indent + 6).key("case")
+            .string(ConditionExpr::constant(cases_[i].first)->toString())
+            .raw(',')
+            .newline();
+        out.indent(indent + 6).key("node").newline();
+        if (cases_[i].second) {
+            cases_[i].second->writeJson(out, indent + 6);
+        } else {
+            out.indent(indent + 6).raw("null");
+        }
+        out.newline().indent(indent + 4).raw('}');
+
+        if (i < cases_.size() - 1 || defaultNode_) {
+            out.raw(',');
+        }
+        out.newline();
+    }
+
+    if (defaultNode_) {
+        out.indent(indent + 4).raw('{').newline();
+        out.indent(indent + 6).key("case").string("default").raw(',').newline();
+        out.indent(indent + 6).key("node").newline();
+        defaultNode_->writeJson(out, indent + 6);
+        out.newline().indent(indent + 4).raw('}').newline();
+    }
+
+    out.indent(indent + 2).raw(']').newline();
+    out.indent(indent).raw('}');
+}
+
+DecisionTreeEngine::DecisionTreeEngine(NodePtr root,
+                                       std::shared_ptr<const FeatureSchema> schema)
+    : root_(root), schema_(schema),
+      flat_(std::make_shared<FlatTree>(FlatTree::freeze(root))),
+      mode_(ExecutionMode::Interpreted) {}
+
+// Native code and the Node graph do not report their path, so observed
+// evaluations in those modes take the equivalent flattened walk.
+template <typename ContextT>
+NodeIndex DecisionTreeEngine::observedLeaf(const ContextT& context,
+                                           EvaluationSession& session) const {
+    if (session.hits_ && &session.hits_->owner().getTree() != flat_.get()) {
+        throw std::logic_error("hit counters were built for a different tree");
+    }
+
+    PathEncoder path(*flat_);
+    session.trace_.clear();
+    auto visit = [&](NodeIndex node, std::uint32_t branch) {
+        if (session.tracing_) {
+            session.trace_.record(node, branch);
+        }
+        if (session.recordingPath_) {
+            path(node, branch);
+        }
+        if (session.hits_) {
+            session.hits_->record(node, branch);
+        }
+    };
+
+    NodeIndex leaf;
+    if constexpr (std::is_same_v<ContextT, FlatContext>) {
+        if (mode_ == ExecutionMode::Bytecode) {
+            checkSchema(context);
+            leaf = program_->findLeaf(*flat_, context, visit);
+        } else {
+            leaf = flat_->findLeaf(context, visit);
+        }
+    } else {
+        leaf = flat_->findLeaf(context, visit);
+    }
+
+    session.trace_.finish(leaf);
+    session.path_ = path.id();
+    if (session.hits_) {
+        session.hits_->record(leaf, 0);
+    }
+    return leaf;
+}
+
+EvaluationSession::EvaluationSession(bool tracing, std::size_t traceCapacity)
+    : traceCapacity_(traceCapacity) {
+    setTracing(tracing);
+}
+
+void EvaluationSession::setTracing(bool enabled) {
+    if (enabled && trace_.capacity() != traceCapacity_) {
+        trace_.setCapacity(traceCapacity_);
+    }
+    tracing_ = enabled;
 }
 
-DecisionTreeEngine::DecisionTreeEngine(NodePtr root) : root_(root) {}
+bool EvaluationSession::isTracing() const {
+    return tracing_;
+}
+
+const DecisionTrace& EvaluationSession::getTrace() const {
+    return trace_;
+}
+
+void EvaluationSession::setPathRecording(bool enabled) {
+    recordingPath_ = enabled;
+}
+
+bool EvaluationSession::isRecordingPath() const {
+    return recordingPath_;
+}
+
+PathId EvaluationSession::getPathId() const {
+    return path_;
+}
+
+void EvaluationSession::setHitCounters(HitCounters* counters) {
+    hits_.reset();
+    if (counters) {
+        hits_ = counters->acquire();
+    }
+}
+
+bool EvaluationSession::isCountingHits() const {
+    return hits_ != nullptr;
+}
+
+std::size_t EvaluationSession::getEvaluationCount() const {
+    return evaluations_;
+}
 
-Result DecisionTreeEngine::evaluate(const Context& context, bool enableTrace) {
-    if (enableTrace) {
-        trace_.clear();
+Result DecisionTreeEngine::evaluate(const Context& context) const {
+    EvaluationSession session;
+    return evaluate(context, session);
+}
+
+Result DecisionTreeEngine::evaluate(const FlatContext& context) const {
+    EvaluationSession session;
+    return evaluate(context, session);
+}
+
+Result DecisionTreeEngine::evaluate(const Context& context,
+                                    EvaluationSession& session) const {
+    if (schema_) {
+        if (!session.scratch_ || &session.scratch_->schema() != schema_.get()) {
+            session.scratch_.emplace(*schema_);
+        }
+        session.scratch_->assign(context);
+        return evaluate(*session.scratch_, session);
+    }
+
+    ++session.evaluations_;
+    if (session.isObserving()) {
+        return flat_->outcomeOf(observedLeaf(context, session), context);
+    }
+
+    if (mode_ == ExecutionMode::Flattened) {
+        return flat_->evaluate(context);
     }
 
     if (!root_) {
@@ -164,17 +612,326 @@ Result DecisionTreeEngine::evaluate(const Context& context, bool enableTrace) {
     return root_->evaluate(context);
 }
 
-const std::vector<std::string>& DecisionTreeEngine::getTrace() const {
-    return trace_;
+Result DecisionTreeEngine::evaluate(const FlatContext& context,
+                                    EvaluationSession& session) const {
+    ++session.evaluations_;
+    if (session.isObserving()) {
+        return flat_->outcomeOf(observedLeaf(context, session), context);
+    }
+
+    if (mode_ != ExecutionMode::Interpreted) {
+        return flat_->outcomeOf(leafOf(context), context);
+    }
+
+    if (!root_) {
+        return std::string("NO_ROOT");
+    }
+
+    return root_->evaluate(context);
+}
+
+// Bytecode and native code read slots by the engine schema's layout, so a
+// FlatContext from any other schema would be read at the wrong slots.
+void DecisionTreeEngine::checkSchema(const FlatContext& context) const {
+    if (&context.schema() != schema_.get()) {
+        throw std::logic_error("FlatContext was built from a different schema than the engine's");
+    }
+}
+
+NodeIndex DecisionTreeEngine::leafOf(const FlatContext& context) const {
+    switch (mode_) {
+        case ExecutionMode::Bytecode:
+            checkSchema(context);
+            return program_->findLeaf(*flat_, context);
+        case ExecutionMode::Native:
+            checkSchema(context);
+            return native_->findLeaf(*flat_, context);
+        case ExecutionMode::Interpreted:
+        case ExecutionMode::Flattened:
+            break;
+    }
+    return flat_->findLeaf(context);
+}
+
+OutcomeId DecisionTreeEngine::evaluateLeaf(const Context& context) const {
+    EvaluationSession session;
+    return evaluateLeaf(context, session);
+}
+
+OutcomeId DecisionTreeEngine::evaluateLeaf(const FlatContext& context) const {
+    return flat_->outcomeIdOf(leafOf(context), context);
+}
+
+OutcomeId DecisionTreeEngine::evaluateLeaf(const Context& context,
+                                           EvaluationSession& session) const {
+    if (schema_) {
+        if (!session.scratch_ || &session.scratch_->schema() != schema_.get()) {
+            session.scratch_.emplace(*schema_);
+        }
+        session.scratch_->assign(context);
+        return evaluateLeaf(*session.scratch_, session);
+    }
+
+    ++session.evaluations_;
+    NodeIndex leaf = session.isObserving()
+        ? observedLeaf(context, session)
+        : flat_->findLeaf(context);
+    return flat_->outcomeIdOf(leaf, context);
+}
+
+OutcomeId DecisionTreeEngine::evaluateLeaf(const FlatContext& context,
+                                           EvaluationSession& session) const {
+    ++session.evaluations_;
+    NodeIndex leaf = session.isObserving()
+        ? observedLeaf(context, session)
+        : leafOf(context);
+    return flat_->outcomeIdOf(leaf, context);
+}
+
+const Result& DecisionTreeEngine::getOutcome(OutcomeId id) const {
+    return flat_->getResult(id);
+}
+
+const std::vector<Result>& DecisionTreeEngine::getOutcomeTable() const {
+    return flat_->getResults();
+}
+
+template <typename Load, typename Visit>
+void DecisionTreeEngine::forEachLeaf(std::size_t count, Load&& load,
+                                     Visit&& visit) const {
+    switch (mode_) {
+        case ExecutionMode::Bytecode:
+            for (std::size_t i = 0; i < count; ++i) {
+                const FlatContext& input = load(i);
+                checkSchema(input);
+                visit(i, input, program_->findLeaf(*flat_, input));
+            }
+            return;
+        case ExecutionMode::Native:
+            for (std::size_t i = 0; i < count; ++i) {
+                const FlatContext& input = load(i);
+                checkSchema(input);
+                visit(i, input, native_->findLeaf(*flat_, input));
+            }
+            return;
+        case ExecutionMode::Interpreted:
+        case ExecutionMode::Flattened:
+            for (std::size_t i = 0; i < count; ++i) {
+                const FlatContext& input = load(i);
+                visit(i, input, flat_->findLeaf(input));
+            }
+            return;
+    }
+}
+
+void DecisionTreeEngine::evaluateBatch(const Context* inputs, std::size_t count,
+                                       Result* results) const {
+    if (!schema_) {
+        for (std::size_t i = 0; i < count; ++i) {
+            results[i] = flat_->evaluate(inputs[i]);
+        }
+        return;
+    }
+
+    FlatContext scratch(*schema_);
+    forEachLeaf(
+        count,
+        [&](std::size_t i) -> const FlatContext& {
+            scratch.assign(inputs[i]);
+            return scratch;
+        },
+        [&](std::size_t i, const FlatContext& input, NodeIndex leaf) {
+            results[i] = flat_->outcomeOf(leaf, input);
+        });
+}
+
+void DecisionTreeEngine::evaluateBatch(const FlatContext* inputs, std::size_t count,
+                                       Result* results) const {
+    forEachLeaf(
+        count,
+        [&](std::size_t i) -> const FlatContext& { return inputs[i]; },
+        [&](std::size_t i, const FlatContext& input, NodeIndex leaf) {
+            results[i] = flat_->outcomeOf(leaf, input);
+        });
+}
+
+void DecisionTreeEngine::evaluateBatch(const Context* inputs, std::size_t count,
+                                       NodeIndex* leaves) const {
+    if (!schema_) {
+        for (std::size_t i = 0; i < count; ++i) {
+            leaves[i] = flat_->findLeaf(inputs[i]);
+        }
+        return;
+    }
+
+    FlatContext scratch(*schema_);
+    forEachLeaf(
+        count,
+        [&](std::size_t i) -> const FlatContext& {
+            scratch.assign(inputs[i]);
+            return scratch;
+        },
+        [&](std::size_t i, const FlatContext&, NodeIndex leaf) { leaves[i] = leaf; });
+}
+
+void DecisionTreeEngine::evaluateBatch(const FlatContext* inputs, std::size_t count,
+                                       NodeIndex* leaves) const {
+    forEachLeaf(
+        count,
+        [&](std::size_t i) -> const FlatContext& { return inputs[i]; },
+        [&](std::size_t i, const FlatContext&, NodeIndex leaf) { leaves[i] = leaf; });
+}
+
+void DecisionTreeEngine::evaluateBatch(const ColumnarBatch& batch,
+                                       Result* results) const {
+    std::vector<NodeIndex> leaves(batch.rows());
+    findLeavesColumnar(*flat_, batch, leaves.data());
+
+    FlatContext scratch(batch.schema());
+    for (std::size_t row = 0; row < leaves.size(); ++row) {
+        const FlatOutcome& outcome = flat_->getOutcome(flat_->getNode(leaves[row]).operand);
+        if (outcome.action) {
+            batch.loadRow(row, scratch);
+            outcome.action(scratch.toContext());
+        }
+        results[row] = flat_->getResult(outcome.id);
+    }
+}
+
+void DecisionTreeEngine::evaluateBatch(const ColumnarBatch& batch,
+                                       NodeIndex* leaves) const {
+    findLeavesColumnar(*flat_, batch, leaves);
 }
 
-void DecisionTreeEngine::printTree() const {
+void DecisionTreeEngine::evaluateBatch(const Context* inputs, std::size_t count,
+                                       Result* results, ThreadPool& pool,
+                                       std::size_t chunkSize) const {
+    forEachChunk(pool, count, chunkSize, [&](std::size_t begin, std::size_t size) {
+        evaluateBatch(inputs + begin, size, results + begin);
+    });
+}
+
+void DecisionTreeEngine::evaluateBatch(const FlatContext* inputs, std::size_t count,
+                                       Result* results, ThreadPool& pool,
+                                       std::size_t chunkSize) const {
+    forEachChunk(pool, count, chunkSize, [&](std::size_t begin, std::size_t size) {
+        evaluateBatch(inputs + begin, size, results + begin);
+    });
+}
+
+void DecisionTreeEngine::evaluateBatch(const Context* inputs, std::size_t count,
+                                       NodeIndex* leaves, ThreadPool& pool,
+                                       std::size_t chunkSize) const {
+    forEachChunk(pool, count, chunkSize, [&](std::size_t begin, std::size_t size) {
+        evaluateBatch(inputs + begin, size, leaves + begin);
+    });
+}
+
+void DecisionTreeEngine::evaluateBatch(const FlatContext* inputs, std::size_t count,
+                                       NodeIndex* leaves, ThreadPool& pool,
+                                       std::size_t chunkSize) const {
+    forEachChunk(pool, count, chunkSize, [&](std::size_t begin, std::size_t size) {
+        evaluateBatch(inputs + begin, size, leaves + begin);
+    });
+}
+
+void DecisionTreeEngine::ensureSchema() {
+    if (!schema_) {
+        auto schema = std::make_shared<FeatureSchema>();
+        flat_->collectFeatures(*schema);
+        schema_ = schema;
+    }
+}
+
+void DecisionTreeEngine::setExecutionMode(ExecutionMode mode) {
+    if (mode == ExecutionMode::Bytecode && !program_) {
+        ensureSchema();
+        program_ = std::make_shared<BytecodeProgram>(
+            BytecodeProgram::compile(*flat_, *schema_));
+    }
+    if (mode == ExecutionMode::Native && !native_) {
+        compileNative(NativeCompileOptions());
+    }
+    mode_ = mode;
+}
+
+void DecisionTreeEngine::compileNative(const NativeCompileOptions& options,
+                                       const std::vector<FlatContext>& samples) {
+    ensureSchema();
+    std::shared_ptr<NativeEvaluator> evaluator =
+        NativeEvaluator::compile(*flat_, *schema_, options);
+
+    std::string report;
+    if (!verifyNativeEvaluator(*evaluator, *flat_, *schema_, samples,
+                               options.verificationSamples, &report)) {
+        throw std::runtime_error("native evaluator failed verification: " + report);
+    }
+
+    native_ = evaluator;
+}
+
+ExecutionMode DecisionTreeEngine::getExecutionMode() const {
+    return mode_;
+}
+
+const FlatTree& DecisionTreeEngine::getFlatTree() const {
+    return *flat_;
+}
+
+const BytecodeProgram* DecisionTreeEngine::getBytecodeProgram() const {
+    return program_.get();
+}
+
+const NativeEvaluator* DecisionTreeEngine::getNativeEvaluator() const {
+    return native_.get();
+}
+
+const FeatureSchema* DecisionTreeEngine::getSchema() const {
+    return schema_.get();
+}
+
+void DecisionTreeEngine::printTree(JsonStyle style) const {
     if (!root_) {
         std::cout << "{ \"error\": \"No root node\" }" << std::endl;
         return;
     }
 
-    std::cout << root_->toJson(0) << std::endl;
+    root_->toJson(std::cout, style);
+    std::cout << std::endl;
+}
+
+std::vector<const Node*> reachableNodes(const NodePtr& root) {
+    std::vector<const Node*> nodes;
+    std::unordered_set<const Node*> seen;
+    std::vector<const Node*> pending{root.get()};
+    while (!pending.empty()) {
+        const Node* node = pending.back();
+        pending.pop_back();
+        if (!node || !seen.insert(node).second) {
+            continue;
+        }
+        nodes.push_back(node);
+
+        if (node->kind() == NodeKind::Decision) {
+            const auto& decision = static_cast<const DecisionNode&>(*node);
+            pending.push_back(decision.getFalseNode().get());
+            pending.push_back(decision.getTrueNode().get());
+        } else if (node->kind() == NodeKind::MultiBranch) {
+            const auto& multi = static_cast<const MultiBranchNode&>(*node);
+            pending.push_back(multi.getDefaultNode().get());
+            for (auto it = multi.getBranches().rbegin(); it != multi.getBranches().rend(); ++it) {
+                pending.push_back(it->second.get());
+            }
+        } else if (node->kind() == NodeKind::Switch) {
+            const auto& switchNode = static_cast<const SwitchNode&>(*node);
+            pending.push_back(switchNode.getDefaultNode().get());
+            for (auto it = switchNode.getCases().rbegin(); it != switchNode.getCases().rend();
+                 ++it) {
+                pending.push_back(it->second.get());
+            }
+        }
+    }
+    return nodes;
 }
 
 std::string resultToString(const Result& result) {
@@ -193,15 +950,14 @@ std::string resultToString(const Result& result) {
     }, result);
 }
 
-void loanApprovalExample() {
-    std::cout << "=== Loan Approval Decision Tree ===\n\n";
+NodePtr buildLoanApprovalTree(FeatureSchema& schema, Action onApproved) {
+    schema.intern("amount", ValueType::Int);
+    schema.intern("income", ValueType::Int);
+    schema.intern("credit_score", ValueType::Int);
 
     auto approved = std::make_shared<OutcomeNode>(
         std::string("APPROVED"),
-        [](const Context& ctx) {
-            int amount = getContextValue<int>(ctx, "amount", 0);
-            std::cout << "  -> Loan approved for $" << amount << "\n";
-        }
+        onApproved
     );
 
     auto deniedIncome = std::make_shared<OutcomeNode>(
@@ -218,32 +974,64 @@ void loanApprovalExample() {
 
     auto creditCheck = std::make_shared<DecisionNode>(
         "Credit Score Check",
-        [](const Context& ctx) {
-            return getContextValue<int>(ctx, "credit_score", 0) >= 650;
-        },
+        feature(schema, "credit_score", 0) >= 650,
         approved,
         deniedCredit
     );
 
     auto incomeCheck = std::make_shared<DecisionNode>(
         "Income Check",
-        [](const Context& ctx) {
-            return getContextValue<int>(ctx, "income", 0) >= 50000;
-        },
+        feature(schema, "income", 0) >= 50000,
         creditCheck,
         deniedIncome
     );
 
-    auto amountCheck = std::make_shared<DecisionNode>(
+    return std::make_shared<DecisionNode>(
         "Loan Amount Check",
-        [](const Context& ctx) {
-            return getContextValue<int>(ctx, "amount", 0) <= 100000;
-        },
+        feature(schema, "amount", 0) <= 100000,
         incomeCheck,
         manualReview
     );
+}
+
+NodePtr buildRiskAssessmentTree(FeatureSchema& schema) {
+    auto lowRisk = std::make_shared<OutcomeNode>(std::string("LOW RISK"));
+    auto mediumRisk = std::make_shared<OutcomeNode>(std::string("MEDIUM RISK"));
+    auto highRisk = std::make_shared<OutcomeNode>(std::string("HIGH RISK"));
+    auto criticalRisk = std::make_shared<OutcomeNode>(std::string("CRITICAL RISK"));
+
+    schema.intern("credit_score", ValueType::Int);
+    schema.intern("debt_ratio", ValueType::Double);
+
+    Expr creditScore = feature(schema, "credit_score", 0);
+    Expr debtRatio = feature(schema, "debt_ratio", 1.0);
+
+    auto riskAssessment = std::make_shared<MultiBranchNode>("Risk Level");
+
+    riskAssessment->addBranch(
+        creditScore >= 750 && debtRatio < 0.3,
+        lowRisk
+    ).addBranch(
+        creditScore >= 650 && debtRatio < 0.5,
+        mediumRisk
+    ).addBranch(
+        creditScore >= 550,
+        highRisk
+    ).setDefault(criticalRisk);
+
+    return riskAssessment;
+}
+
+void loanApprovalExample() {
+    std::cout << "=== Loan Approval Decision Tree ===\n\n";
+
+    auto schema = std::make_shared<FeatureSchema>();
+    NodePtr root = buildLoanApprovalTree(*schema, [](const Context& ctx) {
+        int amount = getContextValue<int>(ctx, "amount", 0);
+        std::cout << "  -> Loan approved for $" << amount << "\n";
+    });
 
-    DecisionTreeEngine engine(amountCheck);
+    DecisionTreeEngine engine(root, schema);
 
     std::cout << "\n=== Tree Structure (JSON) ===\n";
     engine.printTree();
@@ -272,33 +1060,8 @@ void loanApprovalExample() {
 void riskAssessmentExample() {
     std::cout << "\n=== Risk Assessment (Multi-Branch) ===\n\n";
 
-    auto lowRisk = std::make_shared<OutcomeNode>(std::string("LOW RISK"));
-    auto mediumRisk = std::make_shared<OutcomeNode>(std::string("MEDIUM RISK"));
-    auto highRisk = std::make_shared<OutcomeNode>(std::string("HIGH RISK"));
-    auto criticalRisk = std::make_shared<OutcomeNode>(std::string("CRITICAL RISK"));
-
-    auto riskAssessment = std::make_shared<MultiBranchNode>("Risk Level");
-
-    riskAssessment->addBranch(
-        [](const Context& ctx) {
-            return getContextValue<int>(ctx, "credit_score", 0) >= 750 &&
-                   getContextValue<double>(ctx, "debt_ratio", 1.0) < 0.3;
-        },
-        lowRisk
-    ).addBranch(
-        [](const Context& ctx) {
-            return getContextValue<int>(ctx, "credit_score", 0) >= 650 &&
-                   getContextValue<double>(ctx, "debt_ratio", 1.0) < 0.5;
-        },
-        mediumRisk
-    ).addBranch(
-        [](const Context& ctx) {
-            return getContextValue<int>(ctx, "credit_score", 0) >= 550;
-        },
-        highRisk
-    ).setDefault(criticalRisk);
-
-    DecisionTreeEngine riskEngine(riskAssessment);
+    auto schema = std::make_shared<FeatureSchema>();
+    DecisionTreeEngine riskEngine(buildRiskAssessmentTree(*schema), schema);
 
     std::cout << "=== Tree Structure (JSON) ===\n";
     riskEngine.printTree();
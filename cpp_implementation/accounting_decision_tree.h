@@ -1,106 +1,369 @@
 #pragma once
 
-#include <any>
+#include "condition_expr.h"
+#include "context.h"
+#include "decision_trace.h"
+#include "hit_counters.h"
+#include "json_writer.h"
+#include "switch_table.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <optional>
 #include <string>
-#include <variant>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-using Context = std::map<std::string, std::any>;
-
-using Result = std::variant<std::string, int, double, bool>;
-
-template <typename T>
-T getContextValue(const Context &ctx, const std::string &key, T defaultValue) {
-  auto it = ctx.find(key);
-  if (it != ctx.end()) {
-    try {
-      return std::any_cast<T>(it->second);
-    } catch (const std::bad_any_cast &) {
-      return defaultValue;
-    }
-  }
-  return defaultValue;
-}
+enum class NodeKind { Outcome, Decision, MultiBranch, Switch };
 
 class Node {
 public:
   virtual ~Node() = default;
   virtual Result evaluate(const Context &context) const = 0;
+  virtual Result evaluate(const FlatContext &context) const = 0;
+  virtual NodeKind kind() const = 0;
   virtual std::string getType() const = 0;
-  virtual std::string toJson(int indent = 0) const = 0;
+  // Streams this subtree in one pass. In pretty style every line of the
+  // node is indented by indent, its opening line included.
+  virtual void writeJson(JsonWriter &out, int indent = 0) const = 0;
+
+  std::string toJson(int indent = 0) const;
+  void toJson(std::ostream &out, JsonStyle style = JsonStyle::Pretty) const;
 };
 
 using NodePtr = std::shared_ptr<Node>;
 using Condition = std::function<bool(const Context &)>;
+using SlotCondition = std::function<bool(const FlatContext &)>;
 using Action = std::function<void(const Context &)>;
 
+class NativeRegistry;
+
+// A node condition in one of three forms: a Condition over the keyed
+// Context, a SlotCondition that reads a FlatContext by slot, or a
+// ConditionExpr the engine can inspect. Slot conditions can only be
+// evaluated through a FlatContext (see DecisionTreeEngine's schema).
+// Conditions taken from a NativeRegistry also carry the name they were
+// registered under, which toJson() writes in place of the function.
+class Predicate {
+private:
+  Condition condition_;
+  SlotCondition slotCondition_;
+  ExprPtr expr_;
+  // Shared by every copy of one registration.
+  std::shared_ptr<const std::string> name_;
+
+  friend class NativeRegistry;
+
+public:
+  Predicate() = default;
+  Predicate(ExprPtr expr);
+  Predicate(const Expr &expr);
+
+  template <typename F,
+            std::enable_if_t<std::is_invocable_r_v<bool, F, const Context &>,
+                             int> = 0>
+  Predicate(F condition) : condition_(std::move(condition)) {}
+
+  template <typename F,
+            std::enable_if_t<
+                !std::is_invocable_r_v<bool, F, const Context &> &&
+                    std::is_invocable_r_v<bool, F, const FlatContext &>,
+                int> = 0>
+  Predicate(F condition) : slotCondition_(std::move(condition)) {}
+
+  bool test(const Context &context) const;
+  bool test(const FlatContext &context) const;
+
+  bool isSlotCondition() const;
+  const ExprPtr &getExpr() const;
+  // The registered name of a native condition; empty otherwise.
+  const std::string &getName() const;
+  // Identifies the registration a native condition came from: copies share
+  // it, while registering the name again, or in another registry, makes a
+  // new one. nullptr for other conditions.
+  const void *registration() const;
+  std::string toString() const;
+  explicit operator bool() const;
+};
+
 class OutcomeNode : public Node {
 private:
   Result value_;
   Action action_;
+  // Shared by every outcome of one NativeRegistry registration.
+  std::shared_ptr<const std::string> actionName_;
+
+  friend class NativeRegistry;
 
 public:
-  OutcomeNode(Result value, Action action = nullptr);
+  // actionName is the name action is registered under in a NativeRegistry,
+  // if any; only named actions survive toJson().
+  OutcomeNode(Result value, Action action = nullptr,
+              std::string actionName = std::string());
 
   Result evaluate(const Context &context) const override;
+  Result evaluate(const FlatContext &context) const override;
+  NodeKind kind() const override;
   std::string getType() const override;
-  std::string toJson(int indent = 0) const override;
+  void writeJson(JsonWriter &out, int indent = 0) const override;
+
+  const Result &getValue() const;
+  const Action &getAction() const;
+  const std::string &getActionName() const;
+  // Like Predicate::registration(): outcomes from NativeRegistry::outcome()
+  // share it with every other outcome of the same registration, and each
+  // outcome given a name directly has its own. nullptr without a name.
+  const void *actionRegistration() const;
 };
 
 class DecisionNode : public Node {
 private:
   std::string name_;
-  Condition condition_;
+  Predicate condition_;
   NodePtr trueNode_;
   NodePtr falseNode_;
 
 public:
-  DecisionNode(const std::string &name, Condition condition,
+  DecisionNode(const std::string &name, Predicate condition,
                NodePtr trueNode = nullptr, NodePtr falseNode = nullptr);
 
   Result evaluate(const Context &context) const override;
+  Result evaluate(const FlatContext &context) const override;
+  NodeKind kind() const override;
   std::string getType() const override;
-  std::string toJson(int indent = 0) const override;
+  void writeJson(JsonWriter &out, int indent = 0) const override;
 
   void setTrueNode(NodePtr node);
   void setFalseNode(NodePtr node);
+
+  const std::string &getName() const;
+  const Predicate &getCondition() const;
+  const NodePtr &getTrueNode() const;
+  const NodePtr &getFalseNode() const;
 };
 
 class MultiBranchNode : public Node {
 private:
   std::string name_;
-  std::vector<std::pair<Condition, NodePtr>> branches_;
+  std::vector<std::pair<Predicate, NodePtr>> branches_;
   NodePtr defaultNode_;
 
 public:
   explicit MultiBranchNode(const std::string &name);
 
-  MultiBranchNode &addBranch(Condition condition, NodePtr node);
+  MultiBranchNode &addBranch(Predicate condition, NodePtr node);
   MultiBranchNode &setDefault(NodePtr node);
 
   Result evaluate(const Context &context) const override;
+  Result evaluate(const FlatContext &context) const override;
+  NodeKind kind() const override;
   std::string getType() const override;
-  std::string toJson(int indent = 0) const override;
+  void writeJson(JsonWriter &out, int indent = 0) const override;
+
+  const std::string &getName() const;
+  const std::vector<std::pair<Predicate, NodePtr>> &getBranches() const;
+  const NodePtr &getDefaultNode() const;
+};
+
+// Dispatches on the value of one feature (read with its fallback, if any)
+// through a SwitchTable instead of testing equality conditions in turn.
+// Values no case equals go to the default, or NO_MATCH without one.
+class SwitchNode : public Node {
+private:
+  std::string name_;
+  ExprPtr feature_;
+  std::vector<std::pair<Result, NodePtr>> cases_;
+  NodePtr defaultNode_;
+  SwitchTable table_;
+
+  void rebuildTable();
+  template <typename ContextT> Result dispatch(const ContextT &context) const;
+
+public:
+  // Throws std::runtime_error unless feature is a feature reference.
+  SwitchNode(const std::string &name, const Expr &feature);
+
+  // Each call rebuilds the table; add large case lists with addCases().
+  SwitchNode &addCase(const Result &value, NodePtr node);
+  SwitchNode &addCases(std::vector<std::pair<Result, NodePtr>> cases);
+  SwitchNode &setDefault(NodePtr node);
+
+  Result evaluate(const Context &context) const override;
+  Result evaluate(const FlatContext &context) const override;
+  NodeKind kind() const override;
+  std::string getType() const override;
+  void writeJson(JsonWriter &out, int indent = 0) const override;
+
+  const std::string &getName() const;
+  const ExprPtr &getFeature() const;
+  const std::vector<std::pair<Result, NodePtr>> &getCases() const;
+  const NodePtr &getDefaultNode() const;
+  const SwitchTable &getTable() const;
+};
+
+class ColumnarBatch;
+class FlatTree;
+class BytecodeProgram;
+class NativeEvaluator;
+struct NativeCompileOptions;
+class ThreadPool;
+
+// Interpreted walks the Node graph through virtual calls; Flattened runs the
+// FlatTree frozen from it when the engine was constructed; Bytecode walks
+// the same FlatTree with conditions compiled for the BytecodeProgram VM;
+// Native calls a generated, compiled and verified NativeEvaluator.
+enum class ExecutionMode { Interpreted, Flattened, Bytecode, Native };
+
+// Per-call evaluation state: the trace, path id, hit counter shard and
+// Context conversion scratch. The engine itself is immutable once
+// configured, so threads share one engine and each keeps its own session.
+// The trace buffer is allocated when tracing is first enabled and reused by
+// every later evaluation.
+class EvaluationSession {
+private:
+  bool tracing_ = false;
+  bool recordingPath_ = false;
+  std::size_t traceCapacity_;
+  DecisionTrace trace_;
+  PathId path_ = 0;
+  std::size_t evaluations_ = 0;
+  std::optional<FlatContext> scratch_;
+  HitCounters::Lease hits_;
+
+  bool isObserving() const { return tracing_ || recordingPath_ || hits_; }
+
+  friend class DecisionTreeEngine;
+
+public:
+  explicit EvaluationSession(
+      bool tracing = false,
+      std::size_t traceCapacity = DecisionTrace::kDefaultCapacity);
+
+  void setTracing(bool enabled);
+  bool isTracing() const;
+  const DecisionTrace &getTrace() const;
+  // When enabled every evaluation also packs its path into getPathId().
+  void setPathRecording(bool enabled);
+  bool isRecordingPath() const;
+  PathId getPathId() const;
+  // Leases a shard of counters (built from this engine's getFlatTree()) and
+  // counts every branch and outcome this session takes into it; nullptr
+  // returns the shard. Counting uses the observed walk, like tracing.
+  void setHitCounters(HitCounters *counters);
+  bool isCountingHits() const;
+  std::size_t getEvaluationCount() const;
 };
 
 class DecisionTreeEngine {
+public:
+  static constexpr std::size_t kDefaultChunkSize = 1024;
+
 private:
   NodePtr root_;
-  mutable std::vector<std::string> trace_;
+  std::shared_ptr<const FeatureSchema> schema_;
+  std::shared_ptr<const FlatTree> flat_;
+  std::shared_ptr<const BytecodeProgram> program_;
+  std::shared_ptr<const NativeEvaluator> native_;
+  ExecutionMode mode_;
+
+  void ensureSchema();
+  void checkSchema(const FlatContext &context) const;
+  NodeIndex leafOf(const FlatContext &context) const;
+  template <typename ContextT>
+  NodeIndex observedLeaf(const ContextT &context,
+                         EvaluationSession &session) const;
+  template <typename Load, typename Visit>
+  void forEachLeaf(std::size_t count, Load &&load, Visit &&visit) const;
 
 public:
-  explicit DecisionTreeEngine(NodePtr root);
+  explicit DecisionTreeEngine(NodePtr root,
+                              std::shared_ptr<const FeatureSchema> schema =
+                                  nullptr);
 
-  Result evaluate(const Context &context, bool enableTrace = false);
-  const std::vector<std::string> &getTrace() const;
-  void printTree() const;
+  // evaluate() and evaluateBatch() are const and keep no state in the
+  // engine; configure the mode before sharing an engine across threads.
+  // In Bytecode and Native mode FlatContext inputs must be built from
+  // getSchema(); any other schema throws std::logic_error.
+  Result evaluate(const Context &context) const;
+  Result evaluate(const FlatContext &context) const;
+  Result evaluate(const Context &context, EvaluationSession &session) const;
+  Result evaluate(const FlatContext &context,
+                  EvaluationSession &session) const;
+
+  // Like evaluate() but returns the dense id of the reached outcome; resolve
+  // it with getOutcome() only when the value is needed. With a FlatContext,
+  // or a Context and a reused session, nothing is allocated per call.
+  OutcomeId evaluateLeaf(const Context &context) const;
+  OutcomeId evaluateLeaf(const FlatContext &context) const;
+  OutcomeId evaluateLeaf(const Context &context,
+                         EvaluationSession &session) const;
+  OutcomeId evaluateLeaf(const FlatContext &context,
+                         EvaluationSession &session) const;
+  const Result &getOutcome(OutcomeId id) const;
+  // Every distinct outcome value, including NO_RESULT, NO_MATCH and NO_ROOT
+  // when the tree can reach them, indexed by OutcomeId.
+  const std::vector<Result> &getOutcomeTable() const;
+
+  // Evaluates inputs[0..count) into the output buffer in the current mode.
+  // Batches walk the frozen tree (Interpreted batches use the flattened
+  // walk), convert Context inputs through one reused FlatContext and never
+  // record a trace. The NodeIndex overloads only locate leaves: no Result
+  // is copied and no action runs.
+  void evaluateBatch(const Context *inputs, std::size_t count,
+                     Result *results) const;
+  void evaluateBatch(const FlatContext *inputs, std::size_t count,
+                     Result *results) const;
+  void evaluateBatch(const Context *inputs, std::size_t count,
+                     NodeIndex *leaves) const;
+  void evaluateBatch(const FlatContext *inputs, std::size_t count,
+                     NodeIndex *leaves) const;
+  // Columnar batches are evaluated node by node with SIMD comparison
+  // kernels regardless of the execution mode; results[i] is row i.
+  void evaluateBatch(const ColumnarBatch &batch, Result *results) const;
+  void evaluateBatch(const ColumnarBatch &batch, NodeIndex *leaves) const;
+
+  // Parallel batches: inputs are split into chunks of chunkSize that the
+  // pool's workers evaluate with the serial overloads above. Each chunk
+  // writes only its own slice of the output, so the output order matches
+  // the input order whatever the schedule. Actions and lambda conditions
+  // run on worker threads and must be thread-safe.
+  void evaluateBatch(const Context *inputs, std::size_t count, Result *results,
+                     ThreadPool &pool,
+                     std::size_t chunkSize = kDefaultChunkSize) const;
+  void evaluateBatch(const FlatContext *inputs, std::size_t count,
+                     Result *results, ThreadPool &pool,
+                     std::size_t chunkSize = kDefaultChunkSize) const;
+  void evaluateBatch(const Context *inputs, std::size_t count,
+                     NodeIndex *leaves, ThreadPool &pool,
+                     std::size_t chunkSize = kDefaultChunkSize) const;
+  void evaluateBatch(const FlatContext *inputs, std::size_t count,
+                     NodeIndex *leaves, ThreadPool &pool,
+                     std::size_t chunkSize = kDefaultChunkSize) const;
+
+  void setExecutionMode(ExecutionMode mode);
+  void compileNative(const NativeCompileOptions &options,
+                     const std::vector<FlatContext> &samples = {});
+  ExecutionMode getExecutionMode() const;
+  const FlatTree &getFlatTree() const;
+  const BytecodeProgram *getBytecodeProgram() const;
+  const NativeEvaluator *getNativeEvaluator() const;
+  const FeatureSchema *getSchema() const;
+  void printTree(JsonStyle style = JsonStyle::Pretty) const;
 };
 
 std::string resultToString(const Result &result);
 
+// Every distinct node reachable from root, each once, parents before their
+// children.
+std::vector<const Node *> reachableNodes(const NodePtr &root);
+
+NodePtr buildLoanApprovalTree(FeatureSchema &schema,
+                              Action onApproved = nullptr);
+NodePtr buildRiskAssessmentTree(FeatureSchema &schema);
+
 void loanApprovalExample();
 void riskAssessmentExample();
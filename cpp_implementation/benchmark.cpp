@@ -0,0 +1,1365 @@
+#include "benchmark.h"
+#include "accounting_decision_tree.h"
+#include "branch_reorder.h"
+#include "bytecode_vm.h"
+#include "columnar_batch.h"
+#include "flat_tree.h"
+#include "hit_counters.h"
+#include "native_codegen.h"
+#include "native_registry.h"
+#include "static_tree.h"
+#include "subtree_sharing.h"
+#include "thread_pool.h"
+#include "tree_image.h"
+#include "tree_loader.h"
+#include "tree_optimizer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <tuple>
+
+namespace {
+
+constexpr std::size_t kInputCount = 4096;
+constexpr std::size_t kRounds = 200;
+
+volatile std::size_t sink;
+
+namespace st = static_tree;
+
+struct Amount {
+    static constexpr const char* name = "amount";
+    static constexpr SlotId slot = 0;
+};
+struct Income {
+    static constexpr const char* name = "income";
+    static constexpr SlotId slot = 1;
+};
+struct LoanCreditScore {
+    static constexpr const char* name = "credit_score";
+    static constexpr SlotId slot = 2;
+};
+struct RiskCreditScore {
+    static constexpr const char* name = "credit_score";
+    static constexpr SlotId slot = 0;
+};
+struct DebtRatio {
+    static constexpr const char* name = "debt_ratio";
+    static constexpr SlotId slot = 1;
+};
+
+struct LoanAmountCheck { static constexpr const char* value = "Loan Amount Check"; };
+struct IncomeCheck { static constexpr const char* value = "Income Check"; };
+struct CreditScoreCheck { static constexpr const char* value = "Credit Score Check"; };
+struct RiskLevel { static constexpr const char* value = "Risk Level"; };
+struct Approved { static constexpr const char* value = "APPROVED"; };
+struct DeniedIncome { static constexpr const char* value = "DENIED - Insufficient Income"; };
+struct DeniedCredit { static constexpr const char* value = "DENIED - Low Credit Score"; };
+struct ManualReview { static constexpr const char* value = "MANUAL REVIEW REQUIRED"; };
+struct LowRisk { static constexpr const char* value = "LOW RISK"; };
+struct MediumRisk { static constexpr const char* value = "MEDIUM RISK"; };
+struct HighRisk { static constexpr const char* value = "HIGH RISK"; };
+struct CriticalRisk { static constexpr const char* value = "CRITICAL RISK"; };
+
+using StaticLoanTree = st::Tree<st::Decision<
+    LoanAmountCheck,
+    st::Le<st::Feature<Amount, st::Int<0>>, st::Int<100000>>,
+    st::Decision<
+        IncomeCheck,
+        st::Ge<st::Feature<Income, st::Int<0>>, st::Int<50000>>,
+        st::Decision<
+            CreditScoreCheck,
+            st::Ge<st::Feature<LoanCreditScore, st::Int<0>>, st::Int<650>>,
+            st::Outcome<Approved>, st::Outcome<DeniedCredit>>,
+        st::Outcome<DeniedIncome>>,
+    st::Outcome<ManualReview>>>;
+
+using RiskScore = st::Feature<RiskCreditScore, st::Int<0>>;
+using RiskDebt = st::Feature<DebtRatio, st::Ratio<1>>;
+
+using StaticRiskTree = st::Tree<st::MultiBranch<
+    RiskLevel, st::Outcome<CriticalRisk>,
+    st::Branch<st::And<st::Ge<RiskScore, st::Int<750>>,
+                       st::Lt<RiskDebt, st::Ratio<3, 10>>>,
+               st::Outcome<LowRisk>>,
+    st::Branch<st::And<st::Ge<RiskScore, st::Int<650>>,
+                       st::Lt<RiskDebt, st::Ratio<5, 10>>>,
+               st::Outcome<MediumRisk>>,
+    st::Branch<st::Ge<RiskScore, st::Int<550>>, st::Outcome<HighRisk>>>>;
+
+NodePtr buildLambdaLoanTree() {
+    auto approved = std::make_shared<OutcomeNode>(std::string("APPROVED"));
+    auto deniedIncome = std::make_shared<OutcomeNode>(std::string("DENIED - Insufficient Income"));
+    auto deniedCredit = std::make_shared<OutcomeNode>(std::string("DENIED - Low Credit Score"));
+    auto manualReview = std::make_shared<OutcomeNode>(std::string("MANUAL REVIEW REQUIRED"));
+
+    auto creditCheck = std::make_shared<DecisionNode>(
+        "Credit Score Check",
+        [](const Context& ctx) {
+            return getContextValue<int>(ctx, "credit_score", 0) >= 650;
+        },
+        approved, deniedCredit);
+
+    auto incomeCheck = std::make_shared<DecisionNode>(
+        "Income Check",
+        [](const Context& ctx) {
+            return getContextValue<int>(ctx, "income", 0) >= 50000;
+        },
+        creditCheck, deniedIncome);
+
+    return std::make_shared<DecisionNode>(
+        "Loan Amount Check",
+        [](const Context& ctx) {
+            return getContextValue<int>(ctx, "amount", 0) <= 100000;
+        },
+        incomeCheck, manualReview);
+}
+
+NodePtr buildLambdaRiskTree() {
+    auto riskAssessment = std::make_shared<MultiBranchNode>("Risk Level");
+
+    riskAssessment->addBranch(
+        [](const Context& ctx) {
+            return getContextValue<int>(ctx, "credit_score", 0) >= 750 &&
+                   getContextValue<double>(ctx, "debt_ratio", 1.0) < 0.3;
+        },
+        std::make_shared<OutcomeNode>(std::string("LOW RISK"))
+    ).addBranch(
+        [](const Context& ctx) {
+            return getContextValue<int>(ctx, "credit_score", 0) >= 650 &&
+                   getContextValue<double>(ctx, "debt_ratio", 1.0) < 0.5;
+        },
+        std::make_shared<OutcomeNode>(std::string("MEDIUM RISK"))
+    ).addBranch(
+        [](const Context& ctx) {
+            return getContextValue<int>(ctx, "credit_score", 0) >= 550;
+        },
+        std::make_shared<OutcomeNode>(std::string("HIGH RISK"))
+    ).setDefault(std::make_shared<OutcomeNode>(std::string("CRITICAL RISK")));
+
+    return riskAssessment;
+}
+
+std::vector<Context> loanInputs() {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> amount(10000, 150000);
+    std::uniform_int_distribution<int> income(20000, 120000);
+    std::uniform_int_distribution<int> credit(450, 850);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"amount", amount(rng)},
+                          {"income", income(rng)},
+                          {"credit_score", credit(rng)}});
+    }
+    return inputs;
+}
+
+std::vector<Context> riskInputs() {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> credit(450, 850);
+    std::uniform_real_distribution<double> debt(0.0, 1.0);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"credit_score", credit(rng)}, {"debt_ratio", debt(rng)}});
+    }
+    return inputs;
+}
+
+template <typename Fn>
+double nanosPerCall(std::size_t calls, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+std::size_t checksum(const Result& result) {
+    return std::get<std::string>(result).size();
+}
+
+void report(const char* label, double nanos, std::size_t sum, std::size_t expected) {
+    std::printf("  %-34s %9.1f ns/eval%s\n", label, nanos,
+                sum == expected ? "" : "  (RESULT MISMATCH)");
+}
+
+void compareModes(const char* title, const NodePtr& lambdaTree,
+                  NodePtr exprTree, std::shared_ptr<FeatureSchema> schema,
+                  const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    DecisionTreeEngine lambdaEngine(lambdaTree);
+    std::size_t expected = 0;
+    double nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : inputs) {
+                expected += checksum(lambdaEngine.evaluate(input));
+            }
+        }
+    });
+    report("lambda (std::map Context)", nanos, expected, expected);
+
+    DecisionTreeEngine engine(exprTree, schema);
+    const std::pair<const char*, ExecutionMode> modes[] = {
+        {"expr interpreted (FlatContext)", ExecutionMode::Interpreted},
+        {"expr flattened (FlatContext)", ExecutionMode::Flattened},
+        {"bytecode (FlatContext)", ExecutionMode::Bytecode},
+    };
+
+    for (const auto& [label, mode] : modes) {
+        engine.setExecutionMode(mode);
+        std::size_t sum = 0;
+        nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(engine.evaluate(input));
+                }
+            }
+        });
+        report(label, nanos, sum, expected);
+    }
+
+    EvaluationSession session;
+    std::size_t sessionSum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : inputs) {
+                sessionSum += checksum(engine.evaluate(input, session));
+            }
+        }
+    });
+    report("bytecode (Context, session)", nanos, sessionSum, expected);
+
+    EvaluationSession traced(true);
+    std::size_t tracedSum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                tracedSum += checksum(engine.evaluate(input, traced));
+            }
+        }
+    });
+    report("bytecode traced (FlatContext)", nanos, tracedSum, expected);
+
+    EvaluationSession pathSession;
+    pathSession.setPathRecording(true);
+    std::size_t pathSum = 0;
+    std::uint64_t paths = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                pathSum += checksum(engine.evaluate(input, pathSession));
+                paths ^= pathSession.getPathId();
+            }
+        }
+    });
+    sink = static_cast<std::size_t>(paths);
+    report("bytecode path id (FlatContext)", nanos, pathSum, expected);
+
+    HitCounters hits(engine.getFlatTree());
+    EvaluationSession countingSession;
+    countingSession.setHitCounters(&hits);
+    std::size_t countedSum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                countedSum += checksum(engine.evaluate(input, countingSession));
+            }
+        }
+    });
+    report("bytecode hit counts (FlatContext)", nanos, countedSum, expected);
+
+    std::vector<Result> results(inputs.size());
+    for (const auto& [label, mode] : {
+             std::pair<const char*, ExecutionMode>{"batch flattened (Context)", ExecutionMode::Flattened},
+             std::pair<const char*, ExecutionMode>{"batch bytecode (Context)", ExecutionMode::Bytecode}}) {
+        engine.setExecutionMode(mode);
+        std::size_t sum = 0;
+        nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                engine.evaluateBatch(inputs.data(), inputs.size(), results.data());
+                for (const auto& result : results) {
+                    sum += checksum(result);
+                }
+            }
+        });
+        report(label, nanos, sum, expected);
+    }
+
+    std::size_t sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            engine.evaluateBatch(flatInputs.data(), flatInputs.size(), results.data());
+            for (const auto& result : results) {
+                sum += checksum(result);
+            }
+        }
+    });
+    report("batch bytecode (FlatContext)", nanos, sum, expected);
+
+    ThreadPool pool;
+    char label[64];
+    std::snprintf(label, sizeof(label), "parallel bytecode (%zu threads)", pool.size());
+    sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            engine.evaluateBatch(flatInputs.data(), flatInputs.size(), results.data(),
+                                 pool, 256);
+            for (const auto& result : results) {
+                sum += checksum(result);
+            }
+        }
+    });
+    report(label, nanos, sum, expected);
+
+    const FlatTree& flat = engine.getFlatTree();
+    const BytecodeProgram& program = *engine.getBytecodeProgram();
+    std::size_t leaves = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                leaves += program.findLeaf(flat, input);
+            }
+        }
+    });
+    std::printf("  %-34s %9.1f ns/eval\n", "bytecode leaf only (no Result copy)", nanos);
+
+    std::size_t idSum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                idSum += checksum(engine.getOutcome(engine.evaluateLeaf(input)));
+            }
+        }
+    });
+    report("bytecode evaluateLeaf (OutcomeId)", nanos, idSum, expected);
+
+    ColumnarBatch columns = ColumnarBatch::fromRows(*schema, flatInputs.data(),
+                                                    flatInputs.size());
+    std::vector<NodeIndex> columnLeaves(flatInputs.size());
+    std::size_t differing = 0;
+    engine.evaluateBatch(columns, columnLeaves.data());
+    for (std::size_t i = 0; i < flatInputs.size(); ++i) {
+        differing += columnLeaves[i] != flat.findLeaf(flatInputs[i]);
+    }
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            engine.evaluateBatch(columns, columnLeaves.data());
+            leaves += columnLeaves[round % columnLeaves.size()];
+        }
+    });
+    std::printf("  %-34s %9.1f ns/eval%s\n",
+                columnarUsesAvx2() ? "columnar leaf only (AVX2)" : "columnar leaf only (scalar)",
+                nanos, differing ? "  (RESULT MISMATCH)" : "");
+
+    sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            engine.evaluateBatch(columns, results.data());
+            for (const auto& result : results) {
+                sum += checksum(result);
+            }
+        }
+    });
+    report("columnar batch (Result)", nanos, sum, expected);
+
+    try {
+        engine.compileNative(NativeCompileOptions(), flatInputs);
+        engine.setExecutionMode(ExecutionMode::Native);
+        std::size_t sum = 0;
+        nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(engine.evaluate(input));
+                }
+            }
+        });
+        report("native (dlopen, verified)", nanos, sum, expected);
+
+        const NativeEvaluator& native = *engine.getNativeEvaluator();
+        leaves = 0;
+        nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    leaves += native.findLeaf(flat, input);
+                }
+            }
+        });
+        std::printf("  %-34s %9.1f ns/eval\n", "native leaf only (no Result copy)", nanos);
+    } catch (const std::exception& e) {
+        std::printf("  native unavailable: %s\n", e.what());
+    }
+
+    sink = leaves;
+
+    std::printf("  bytecode: %zu instructions, flat tree: %zu nodes, %zu bytes\n\n",
+                program.instructionCount(), flat.nodeCount(), flat.memoryFootprint());
+}
+
+template <typename StaticTree>
+void compareStatic(const char* title, const NodePtr& runtimeTree,
+                   std::shared_ptr<FeatureSchema> schema,
+                   const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    if (!StaticTree::bindsTo(*schema)) {
+        std::printf("  static tree slots do not match the schema\n\n");
+        return;
+    }
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    DecisionTreeEngine engine(runtimeTree, schema);
+    engine.setExecutionMode(ExecutionMode::Flattened);
+    DecisionTreeEngine converted(StaticTree::toNode(*schema), schema);
+
+    // Besides the traffic, every slot of a few inputs is replaced by a
+    // fractional double, a string and a missing value.
+    std::vector<FlatContext> probes = flatInputs;
+    for (std::size_t i = 0; i < flatInputs.size() && i < 8; ++i) {
+        for (SlotId slot = 0; slot < schema->size(); ++slot) {
+            FlatContext probe = flatInputs[i];
+            probe.set(slot, 650.7);
+            probes.push_back(probe);
+            probe.set(slot, std::string("650"));
+            probes.push_back(probe);
+            probe.clear(slot);
+            probes.push_back(probe);
+        }
+    }
+    std::size_t mismatches = 0;
+    for (const auto& input : probes) {
+        const Result& result = StaticTree::evaluate(input);
+        if (result != engine.evaluate(input) || result != converted.evaluate(input)) {
+            ++mismatches;
+        }
+    }
+    bool sameShape = runtimeTree->toJson() == StaticTree::toNode(*schema)->toJson();
+    std::printf("  equivalence: %zu/%zu inputs differ, toNode() %s the runtime tree\n",
+                mismatches, probes.size(), sameShape ? "matches" : "differs from");
+
+    std::size_t expected = 0;
+    double nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                expected += checksum(engine.evaluate(input));
+            }
+        }
+    });
+    report("expr flattened (FlatContext)", nanos, expected, expected);
+
+    std::size_t sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                sum += checksum(StaticTree::evaluate(input));
+            }
+        }
+    });
+    report("static tree (FlatContext)", nanos, sum, expected);
+    std::printf("\n");
+}
+
+// Income bands tested low to high, with most traffic in the top band.
+NodePtr buildIncomeBandTree(FeatureSchema& schema) {
+    schema.intern("income", ValueType::Int);
+    Expr income = feature(schema, "income", 0);
+
+    auto bands = std::make_shared<MultiBranchNode>("Income Band");
+    for (int band = 0; band < 8; ++band) {
+        bands->addBranch(income >= band * 20000 && income < (band + 1) * 20000,
+                         std::make_shared<OutcomeNode>("BAND " + std::to_string(band)));
+    }
+    bands->setDefault(std::make_shared<OutcomeNode>(std::string("UNBANDED")));
+    return bands;
+}
+
+std::vector<Context> incomeBandInputs() {
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<int> low(0, 139999);
+    std::uniform_int_distribution<int> top(140000, 159999);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"income", percent(rng) < 90 ? top(rng) : low(rng)}});
+    }
+    return inputs;
+}
+
+void compareReordered(const char* title, const NodePtr& tree,
+                      std::shared_ptr<FeatureSchema> schema,
+                      const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    // Interpreted: the frozen tree may compile a ladder into an
+    // IntervalIndex, which does not depend on branch order.
+    DecisionTreeEngine engine(tree, schema);
+    HitCounters hits(engine.getFlatTree());
+    EvaluationSession profiling;
+    profiling.setHitCounters(&hits);
+    for (const auto& input : flatInputs) {
+        engine.evaluate(input, profiling);
+    }
+
+    BranchReorderReport reorder;
+    DecisionTreeEngine reordered(
+        reorderBranches(tree, engine.getFlatTree(), hits.snapshot(), &reorder), schema);
+    std::printf("  reordered %zu nodes with %zu swaps: %.2f -> %.2f condition cost/eval\n",
+                reorder.nodesReordered, reorder.swaps, reorder.costBefore, reorder.costAfter);
+
+    for (const auto& [label, target] : {
+             std::pair<const char*, const DecisionTreeEngine*>{"interpreted (profiled order)", &engine},
+             std::pair<const char*, const DecisionTreeEngine*>{"interpreted (reordered)", &reordered}}) {
+        std::size_t sum = 0;
+        double nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(target->evaluate(input));
+                }
+            }
+        });
+        if (target == &engine) {
+            sink = sum;
+        }
+        report(label, nanos, sum, sink);
+    }
+    std::printf("\n");
+}
+
+// A 40-rung tax bracket ladder, highest bracket first.
+NodePtr buildTaxBracketTree(FeatureSchema& schema) {
+    schema.intern("income", ValueType::Int);
+    Expr income = feature(schema, "income", 0);
+
+    auto brackets = std::make_shared<MultiBranchNode>("Tax Bracket");
+    for (int rung = 40; rung > 0; --rung) {
+        brackets->addBranch(income >= rung * 5000,
+                            std::make_shared<OutcomeNode>("BRACKET " + std::to_string(rung)));
+    }
+    brackets->setDefault(std::make_shared<OutcomeNode>(std::string("EXEMPT")));
+    return brackets;
+}
+
+std::vector<Context> taxBracketInputs() {
+    std::mt19937 rng(13);
+    std::uniform_int_distribution<int> income(0, 210000);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"income", income(rng)}});
+    }
+    return inputs;
+}
+
+void compareIndexed(const char* title, const NodePtr& tree,
+                    std::shared_ptr<FeatureSchema> schema,
+                    const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    DecisionTreeEngine engine(tree, schema);
+    const FlatTree& flat = engine.getFlatTree();
+    if (const IntervalIndex* index = flat.getIntervalIndex(flat.getRoot())) {
+        std::printf("  interval index on %s: %zu regions\n",
+                    index->getPrimary().getFeature().c_str(), index->regionCount());
+    } else {
+        std::printf("  no interval index\n");
+    }
+
+    std::size_t expected = 0;
+    double nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                NodeIndex leaf = flat.walk(
+                    [&](std::uint32_t predicate) {
+                        return flat.getPredicate(predicate).test(input);
+                    },
+                    [&](const FlatSwitch& node) { return node.select(input); });
+                expected += checksum(flat.getResult(flat.outcomeIdOf(leaf)));
+            }
+        }
+    });
+    report("flattened linear scan", nanos, expected, expected);
+
+    for (const auto& [label, mode] : {
+             std::pair<const char*, ExecutionMode>{"flattened interval index", ExecutionMode::Flattened},
+             std::pair<const char*, ExecutionMode>{"bytecode interval index", ExecutionMode::Bytecode}}) {
+        engine.setExecutionMode(mode);
+        std::size_t sum = 0;
+        nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(engine.getOutcome(engine.evaluateLeaf(input)));
+                }
+            }
+        });
+        report(label, nanos, sum, expected);
+    }
+    std::printf("\n");
+}
+
+// One split of a generated score ladder. Like the output of a rule learner,
+// every split rechecks the bounds its ancestors already established, and
+// neighbouring leaves often land in the same tier.
+NodePtr generatedScoreSplit(const Expr& score, std::optional<int> lo, std::optional<int> hi,
+                            int from, int to, int depth) {
+    if (depth == 0) {
+        return std::make_shared<OutcomeNode>("TIER " + std::to_string(from / 150));
+    }
+    int mid = (from + to) / 2;
+    Expr condition = score >= mid;
+    if (lo) {
+        condition = score >= *lo && condition;
+    }
+    if (hi) {
+        condition = condition && score < *hi;
+    }
+    return std::make_shared<DecisionNode>("Score " + std::to_string(mid), condition,
+                                          generatedScoreSplit(score, mid, hi, mid, to, depth - 1),
+                                          generatedScoreSplit(score, lo, mid, from, mid, depth - 1));
+}
+
+NodePtr buildGeneratedScoreTree(FeatureSchema& schema) {
+    schema.intern("credit_score", ValueType::Int);
+    return generatedScoreSplit(feature(schema, "credit_score", 0), std::nullopt, std::nullopt,
+                               300, 900, 7);
+}
+
+std::vector<Context> generatedScoreInputs() {
+    std::mt19937 rng(19);
+    std::uniform_int_distribution<int> score(250, 949);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"credit_score", score(rng)}});
+    }
+    return inputs;
+}
+
+void compareOptimized(const char* title, const NodePtr& tree,
+                      std::shared_ptr<FeatureSchema> schema,
+                      const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    TreeOptimizerReport optimized;
+    DecisionTreeEngine original(tree, schema);
+    DecisionTreeEngine engine(optimizeTree(tree, &optimized), schema);
+    std::printf("  %zu -> %zu nodes: %zu conditions folded, %zu simplified, %zu branches pruned, "
+                "%zu nodes collapsed\n",
+                optimized.nodesBefore, optimized.nodesAfter, optimized.conditionsFolded,
+                optimized.conditionsSimplified, optimized.branchesPruned,
+                optimized.nodesCollapsed);
+
+    std::size_t expected = 0;
+    for (const auto& [label, target, mode] : {
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "interpreted (as built)", &original, ExecutionMode::Interpreted},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "interpreted (optimized)", &engine, ExecutionMode::Interpreted},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "bytecode (as built)", &original, ExecutionMode::Bytecode},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "bytecode (optimized)", &engine, ExecutionMode::Bytecode}}) {
+        target->setExecutionMode(mode);
+        std::size_t sum = 0;
+        double nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(target->evaluate(input));
+                }
+            }
+        });
+        if (expected == 0) {
+            expected = sum;
+        }
+        report(label, nanos, sum, expected);
+    }
+    std::printf("\n");
+}
+
+// A generated ruleset: a score split 8 levels deep whose every leaf is a
+// freshly allocated copy of the same debt and income check.
+NodePtr generatedRulesetSplit(const Expr& score, const Expr& debt, const Expr& income, int from,
+                              int to, int depth) {
+    if (depth == 0) {
+        auto review = std::make_shared<DecisionNode>(
+            "Income Check", income >= 50000, std::make_shared<OutcomeNode>(std::string("REVIEW")),
+            std::make_shared<OutcomeNode>(std::string("DECLINE")));
+        return std::make_shared<DecisionNode>(
+            "Debt Check", debt < 0.4, std::make_shared<OutcomeNode>(std::string("APPROVE")),
+            review);
+    }
+    int mid = (from + to) / 2;
+    return std::make_shared<DecisionNode>(
+        "Score " + std::to_string(mid), score >= mid,
+        generatedRulesetSplit(score, debt, income, mid, to, depth - 1),
+        generatedRulesetSplit(score, debt, income, from, mid, depth - 1));
+}
+
+NodePtr buildGeneratedRuleset(FeatureSchema& schema) {
+    schema.intern("credit_score", ValueType::Int);
+    schema.intern("debt_ratio", ValueType::Double);
+    schema.intern("income", ValueType::Int);
+    return generatedRulesetSplit(feature(schema, "credit_score", 0),
+                                 feature(schema, "debt_ratio", 1.0),
+                                 feature(schema, "income", 0), 300, 900, 8);
+}
+
+std::vector<Context> generatedRulesetInputs() {
+    std::mt19937 rng(23);
+    std::uniform_int_distribution<int> score(300, 899);
+    std::uniform_real_distribution<double> debt(0.0, 0.8);
+    std::uniform_int_distribution<int> income(20000, 120000);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"credit_score", score(rng)},
+                          {"debt_ratio", debt(rng)},
+                          {"income", income(rng)}});
+    }
+    return inputs;
+}
+
+void compareShared(const char* title, const NodePtr& tree, std::shared_ptr<FeatureSchema> schema,
+                   const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    SubtreeSharingReport shared;
+    DecisionTreeEngine original(tree, schema);
+    DecisionTreeEngine engine(shareSubtrees(tree, &shared), schema);
+    std::printf("  %zu -> %zu nodes, %zu -> %zu bytes (flattened %zu -> %zu bytes)\n",
+                shared.nodesBefore, shared.nodesAfter, shared.bytesBefore, shared.bytesAfter,
+                original.getFlatTree().memoryFootprint(), engine.getFlatTree().memoryFootprint());
+
+    std::size_t expected = 0;
+    for (const auto& [label, target, mode] : {
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "interpreted (tree)", &original, ExecutionMode::Interpreted},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "interpreted (shared DAG)", &engine, ExecutionMode::Interpreted},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "flattened (tree)", &original, ExecutionMode::Flattened},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "flattened (shared DAG)", &engine, ExecutionMode::Flattened}}) {
+        target->setExecutionMode(mode);
+        std::size_t sum = 0;
+        double nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(target->evaluate(input));
+                }
+            }
+        });
+        if (expected == 0) {
+            expected = sum;
+        }
+        report(label, nanos, sum, expected);
+    }
+    std::printf("\n");
+}
+
+// 16 product offers, each a different conjunction of a score, a debt and an
+// income or tenure check, so every check is shared by four or eight offers.
+NodePtr buildOfferRules(FeatureSchema& schema) {
+    schema.intern("credit_score", ValueType::Int);
+    schema.intern("debt_ratio", ValueType::Double);
+    schema.intern("income", ValueType::Int);
+    schema.intern("tenure", ValueType::Int);
+    Expr score = feature(schema, "credit_score", 0);
+    Expr debt = feature(schema, "debt_ratio", 1.0);
+    Expr income = feature(schema, "income", 0);
+    Expr tenure = feature(schema, "tenure", 0);
+    const Expr checks[] = {score >= 720, score >= 650,      debt < 0.25,   debt < 0.4,
+                           income >= 90000, income >= 50000, tenure >= 5, tenure >= 2};
+
+    auto offers = std::make_shared<MultiBranchNode>("Offer");
+    for (int i = 0; i < 16; ++i) {
+        offers->addBranch(checks[i % 2] && checks[2 + (i / 2) % 2] && checks[4 + i / 4],
+                          std::make_shared<OutcomeNode>("OFFER " + std::to_string(i)));
+    }
+    offers->setDefault(std::make_shared<OutcomeNode>(std::string("NO OFFER")));
+    return offers;
+}
+
+std::vector<Context> offerInputs() {
+    std::mt19937 rng(29);
+    std::uniform_int_distribution<int> score(500, 799);
+    std::uniform_real_distribution<double> debt(0.1, 0.6);
+    std::uniform_int_distribution<int> income(20000, 99999);
+    std::uniform_int_distribution<int> tenure(0, 5);
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        inputs.push_back({{"credit_score", score(rng)},
+                          {"debt_ratio", debt(rng)},
+                          {"income", income(rng)},
+                          {"tenure", tenure(rng)}});
+    }
+    return inputs;
+}
+
+void compareMemoized(const char* title, const NodePtr& tree,
+                     std::shared_ptr<FeatureSchema> schema,
+                     const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    DecisionTreeEngine engine(tree, schema);
+    engine.setExecutionMode(ExecutionMode::Bytecode);
+    const FlatTree& flat = engine.getFlatTree();
+    const BytecodeProgram& program = *engine.getBytecodeProgram();
+    std::printf("  %zu conditions, %zu distinct predicates, %zu memoized atoms\n",
+                flat.conditionCount(), flat.predicateCount(), program.memoSlotCount());
+
+    engine.setExecutionMode(ExecutionMode::Interpreted);
+    std::size_t expected = 0;
+    double nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                expected += checksum(engine.evaluate(input));
+            }
+        }
+    });
+    report("interpreted", nanos, expected, expected);
+
+    std::size_t sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                NodeIndex leaf = flat.walk(
+                    [&](std::uint32_t predicate) { return program.run(predicate, input); },
+                    [&](const auto& index) { return index.select(input); });
+                sum += checksum(flat.getResult(flat.outcomeIdOf(leaf)));
+            }
+        }
+    });
+    report("bytecode (no memo)", nanos, sum, expected);
+
+    sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                sum += checksum(flat.getResult(flat.outcomeIdOf(program.findLeaf(flat, input))));
+            }
+        }
+    });
+    report("bytecode (memoized atoms)", nanos, sum, expected);
+    std::printf("\n");
+}
+
+// The offer rules as chains of native slot conditions, one decision per
+// check, built from the registry's named predicates or from the same
+// functions left unnamed.
+const char* const kOfferChecks[] = {"score_720", "score_650",   "debt_25",   "debt_40",
+                                    "income_90k", "income_50k", "tenure_5", "tenure_2"};
+
+void registerOfferChecks(NativeRegistry& natives, const FeatureSchema& schema) {
+    SlotId score = schema.find("credit_score");
+    SlotId debt = schema.find("debt_ratio");
+    SlotId income = schema.find("income");
+    SlotId tenure = schema.find("tenure");
+    natives
+        .addPredicate("score_720",
+                      [=](const FlatContext& ctx) { return ctx.get<int>(score, 0) >= 720; })
+        .addPredicate("score_650",
+                      [=](const FlatContext& ctx) { return ctx.get<int>(score, 0) >= 650; })
+        .addPredicate("debt_25",
+                      [=](const FlatContext& ctx) { return ctx.get<double>(debt, 1.0) < 0.25; })
+        .addPredicate("debt_40",
+                      [=](const FlatContext& ctx) { return ctx.get<double>(debt, 1.0) < 0.4; })
+        .addPredicate("income_90k",
+                      [=](const FlatContext& ctx) { return ctx.get<int>(income, 0) >= 90000; })
+        .addPredicate("income_50k",
+                      [=](const FlatContext& ctx) { return ctx.get<int>(income, 0) >= 50000; })
+        .addPredicate("tenure_5",
+                      [=](const FlatContext& ctx) { return ctx.get<int>(tenure, 0) >= 5; })
+        .addPredicate("tenure_2",
+                      [=](const FlatContext& ctx) { return ctx.get<int>(tenure, 0) >= 2; });
+}
+
+NodePtr buildNativeOfferChain(const NativeRegistry& natives, bool named) {
+    auto check = [&](int i) {
+        const Predicate& predicate = natives.predicate(kOfferChecks[i]);
+        return named ? predicate : Predicate([predicate](const FlatContext& ctx) {
+            return predicate.test(ctx);
+        });
+    };
+
+    // Only the first check falls through to the next offer, so toJson()
+    // writes each node once.
+    NodePtr next = std::make_shared<OutcomeNode>(std::string("NO OFFER"));
+    for (int i = 15; i >= 0; --i) {
+        NodePtr offer = std::make_shared<OutcomeNode>("OFFER " + std::to_string(i));
+        NodePtr declined = std::make_shared<OutcomeNode>(std::string("DECLINED"));
+        NodePtr third = std::make_shared<DecisionNode>("Offer " + std::to_string(i) + " c",
+                                                       check(4 + i / 4), offer, declined);
+        NodePtr second = std::make_shared<DecisionNode>("Offer " + std::to_string(i) + " b",
+                                                        check(2 + (i / 2) % 2), third, declined);
+        next = std::make_shared<DecisionNode>("Offer " + std::to_string(i), check(i % 2),
+                                              second, next);
+    }
+    return next;
+}
+
+void compareNative(const char* title, std::shared_ptr<FeatureSchema> schema,
+                   const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    NativeRegistry natives;
+    registerOfferChecks(natives, *schema);
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    NodePtr named = buildNativeOfferChain(natives, true);
+    std::string json = named->toJson();
+    NodePtr loaded;
+    auto start = std::chrono::steady_clock::now();
+    loaded = loadTreeJson(json, schema.get(), &natives);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                          start)
+                    .count();
+    std::printf("  %-34s %9.3f ms%s\n", "loadTreeJson with native names", ms,
+                loaded->toJson() == json ? "" : "  (TREE MISMATCH)");
+
+    std::size_t expected = 0;
+    DecisionTreeEngine unnamedEngine(buildNativeOfferChain(natives, false), schema);
+    double nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                expected += checksum(unnamedEngine.evaluate(input));
+            }
+        }
+    });
+    report("unnamed lambdas (flattened)", nanos, expected, expected);
+
+    DecisionTreeEngine engine(loaded, schema);
+    std::printf("  %zu conditions, %zu distinct predicates\n",
+                engine.getFlatTree().conditionCount(), engine.getFlatTree().predicateCount());
+    for (const auto& [label, mode] : {
+             std::pair<const char*, ExecutionMode>{"loaded natives (flattened)",
+                                                   ExecutionMode::Flattened},
+             std::pair<const char*, ExecutionMode>{"loaded natives (bytecode)",
+                                                   ExecutionMode::Bytecode}}) {
+        engine.setExecutionMode(mode);
+        std::size_t sum = 0;
+        nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(engine.evaluate(input));
+                }
+            }
+        });
+        report(label, nanos, sum, expected);
+    }
+    std::printf("\n");
+}
+
+// A complete binary ruleset of 2^depth - 1 decisions over credit_score.
+NodePtr buildBalancedRuleset(const Expr& score, int depth, int& counter) {
+    int id = counter++;
+    if (depth == 0) {
+        return std::make_shared<OutcomeNode>("TIER " + std::to_string(id % 7));
+    }
+    NodePtr high = buildBalancedRuleset(score, depth - 1, counter);
+    NodePtr low = buildBalancedRuleset(score, depth - 1, counter);
+    return std::make_shared<DecisionNode>("Score " + std::to_string(id), score >= id % 900,
+                                          high, low);
+}
+
+// Discards everything, so only serialization is timed.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+void compareSerialization(const char* title, const NodePtr& tree) {
+    std::printf("%s\n", title);
+
+    std::size_t bytes = 0;
+    auto millis = [](auto&& fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    };
+
+    double ms = millis([&] { bytes = tree->toJson().size(); });
+    std::printf("  %-34s %9.1f ms, %zu bytes\n", "toJson (string)", ms, bytes);
+
+    for (const auto& [label, style] : {
+             std::pair<const char*, JsonStyle>{"stream to ostream (pretty)", JsonStyle::Pretty},
+             std::pair<const char*, JsonStyle>{"stream to ostream (compact)", JsonStyle::Compact}}) {
+        std::ostringstream out;
+        ms = millis([&] { tree->toJson(out, style); });
+        std::printf("  %-34s %9.1f ms, %zu bytes\n", label, ms,
+                    static_cast<std::size_t>(out.tellp()));
+    }
+
+    NullBuffer discard;
+    std::ostream null(&discard);
+    ms = millis([&] { tree->toJson(null, JsonStyle::Pretty); });
+    std::printf("  %-34s %9.1f ms\n", "stream to null sink (pretty)", ms);
+
+    for (const auto& [label, style] : {
+             std::pair<const char*, JsonStyle>{"loadTreeJson (pretty)", JsonStyle::Pretty},
+             std::pair<const char*, JsonStyle>{"loadTreeJson (compact)", JsonStyle::Compact}}) {
+        std::ostringstream out;
+        tree->toJson(out, style);
+        std::string json = out.str();
+        NodePtr loaded;
+        ms = millis([&] { loaded = loadTreeJson(json); });
+        std::printf("  %-34s %9.1f ms%s\n", label, ms,
+                    loaded->toJson() == tree->toJson() ? "" : "  (TREE MISMATCH)");
+    }
+    std::printf("\n");
+}
+
+// Startup cost and evaluation speed of a tree served from a mapped image,
+// against building the same engine from its JSON.
+void compareImage(const char* title, const NodePtr& tree, std::shared_ptr<FeatureSchema> schema,
+                  const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    auto millis = [](auto&& fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    };
+
+    DecisionTreeEngine engine(tree, schema);
+    engine.setExecutionMode(ExecutionMode::Bytecode);
+    std::string path =
+        (std::filesystem::temp_directory_path() / "decision_tree_bench.img").string();
+    writeTreeImageFile(engine, path);
+
+    std::string json = tree->toJson();
+    double ms = millis([&] {
+        auto loadedSchema = std::make_shared<FeatureSchema>();
+        DecisionTreeEngine loaded(loadTreeJson(json, loadedSchema.get()), loadedSchema);
+        loaded.setExecutionMode(ExecutionMode::Bytecode);
+    });
+    std::printf("  %-34s %9.3f ms\n", "JSON load + bytecode compile", ms);
+
+    std::optional<TreeImage> image;
+    ms = millis([&] { image.emplace(TreeImage::open(path)); });
+    std::printf("  %-34s %9.3f ms, %zu bytes\n", "TreeImage::open", ms, image->byteSize());
+    std::filesystem::remove(path);
+
+    std::vector<FlatContext> flatInputs;
+    std::vector<FlatContext> imageInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+        imageInputs.push_back(FlatContext::fromContext(image->getSchema(), input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    std::size_t expected = 0;
+    engine.setExecutionMode(ExecutionMode::Flattened);
+    double nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                expected += checksum(engine.getOutcome(engine.evaluateLeaf(input)));
+            }
+        }
+    });
+    report("flattened", nanos, expected, expected);
+
+    std::size_t sum = 0;
+    engine.setExecutionMode(ExecutionMode::Bytecode);
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : flatInputs) {
+                sum += checksum(engine.getOutcome(engine.evaluateLeaf(input)));
+            }
+        }
+    });
+    report("bytecode", nanos, sum, expected);
+
+    // Outcome strings are only measured, not copied out of the image.
+    const std::vector<Result>& outcomes = engine.getOutcomeTable();
+    sum = 0;
+    nanos = nanosPerCall(calls, [&] {
+        for (std::size_t round = 0; round < kRounds; ++round) {
+            for (const auto& input : imageInputs) {
+                sum += checksum(outcomes[image->outcomeIdOf(image->findLeaf(input))]);
+            }
+        }
+    });
+    report("mapped image", nanos, sum, expected);
+    std::printf("\n");
+}
+
+// 32 general ledger account codes mapped to their statement line, once as
+// an equality chain and once as a SwitchNode.
+const char* const kLedgerAccounts[] = {
+    "1000", "1010", "1100", "1200", "1300", "1400", "1500", "1600",
+    "2000", "2100", "2200", "2300", "2400", "2500", "3000", "3100",
+    "4000", "4100", "4200", "4300", "5000", "5100", "5200", "5300",
+    "6000", "6100", "6200", "6300", "7000", "7100", "8000", "9000"};
+
+NodePtr buildLedgerChain(FeatureSchema& schema) {
+    Expr account = feature(schema, "account");
+    auto chain = std::make_shared<MultiBranchNode>("Statement Line");
+    for (const char* code : kLedgerAccounts) {
+        chain->addBranch(account == code, std::make_shared<OutcomeNode>("LINE " + std::string(code)));
+    }
+    chain->setDefault(std::make_shared<OutcomeNode>(std::string("SUSPENSE")));
+    return chain;
+}
+
+NodePtr buildLedgerSwitch(FeatureSchema& schema) {
+    auto lines = std::make_shared<SwitchNode>("Statement Line", feature(schema, "account"));
+    std::vector<std::pair<Result, NodePtr>> cases;
+    for (const char* code : kLedgerAccounts) {
+        cases.emplace_back(std::string(code),
+                           std::make_shared<OutcomeNode>("LINE " + std::string(code)));
+    }
+    lines->addCases(std::move(cases));
+    lines->setDefault(std::make_shared<OutcomeNode>(std::string("SUSPENSE")));
+    return lines;
+}
+
+std::vector<Context> ledgerInputs() {
+    std::mt19937 rng(17);
+    std::uniform_int_distribution<std::size_t> pick(0, std::size(kLedgerAccounts));
+
+    std::vector<Context> inputs;
+    for (std::size_t i = 0; i < kInputCount; ++i) {
+        std::size_t account = pick(rng);
+        inputs.push_back({{"account", account < std::size(kLedgerAccounts)
+                                          ? std::string(kLedgerAccounts[account])
+                                          : std::string("9999")}});
+    }
+    return inputs;
+}
+
+void compareSwitch(const char* title, const NodePtr& chain, const NodePtr& table,
+                   std::shared_ptr<FeatureSchema> schema, const std::vector<Context>& inputs) {
+    std::printf("%s\n", title);
+
+    std::vector<FlatContext> flatInputs;
+    for (const auto& input : inputs) {
+        flatInputs.push_back(FlatContext::fromContext(*schema, input));
+    }
+    const std::size_t calls = inputs.size() * kRounds;
+
+    DecisionTreeEngine chainEngine(chain, schema);
+    DecisionTreeEngine switchEngine(table, schema);
+    std::size_t expected = 0;
+    for (const auto& [label, engine, mode] : {
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "interpreted equality chain", &chainEngine, ExecutionMode::Interpreted},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "interpreted switch", &switchEngine, ExecutionMode::Interpreted},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "bytecode equality chain", &chainEngine, ExecutionMode::Bytecode},
+             std::tuple<const char*, DecisionTreeEngine*, ExecutionMode>{
+                 "bytecode switch", &switchEngine, ExecutionMode::Bytecode}}) {
+        engine->setExecutionMode(mode);
+        std::size_t sum = 0;
+        double nanos = nanosPerCall(calls, [&] {
+            for (std::size_t round = 0; round < kRounds; ++round) {
+                for (const auto& input : flatInputs) {
+                    sum += checksum(engine->evaluate(input));
+                }
+            }
+        });
+        if (expected == 0) {
+            expected = sum;
+        }
+        report(label, nanos, sum, expected);
+    }
+    std::printf("\n");
+}
+
+}
+
+void benchmarkExecutionModes() {
+    std::printf("=== Execution Modes ===\n");
+
+    auto loanSchema = std::make_shared<FeatureSchema>();
+    NodePtr loanTree = buildLoanApprovalTree(*loanSchema);
+    compareModes("Loan approval", buildLambdaLoanTree(), loanTree, loanSchema,
+                 loanInputs());
+
+    auto riskSchema = std::make_shared<FeatureSchema>();
+    NodePtr riskTree = buildRiskAssessmentTree(*riskSchema);
+    compareModes("Risk assessment", buildLambdaRiskTree(), riskTree, riskSchema,
+                 riskInputs());
+}
+
+void benchmarkStaticTrees() {
+    std::printf("=== Static Trees ===\n");
+
+    auto loanSchema = std::make_shared<FeatureSchema>();
+    NodePtr loanTree = buildLoanApprovalTree(*loanSchema);
+    compareStatic<StaticLoanTree>("Loan approval", loanTree, loanSchema, loanInputs());
+
+    auto riskSchema = std::make_shared<FeatureSchema>();
+    NodePtr riskTree = buildRiskAssessmentTree(*riskSchema);
+    compareStatic<StaticRiskTree>("Risk assessment", riskTree, riskSchema, riskInputs());
+}
+
+void benchmarkBranchReordering() {
+    std::printf("=== Profile-Guided Branch Order ===\n");
+
+    auto bandSchema = std::make_shared<FeatureSchema>();
+    compareReordered("Income bands", buildIncomeBandTree(*bandSchema), bandSchema,
+                     incomeBandInputs());
+
+    auto riskSchema = std::make_shared<FeatureSchema>();
+    compareReordered("Risk assessment", buildRiskAssessmentTree(*riskSchema), riskSchema,
+                     riskInputs());
+}
+
+void benchmarkIntervalIndex() {
+    std::printf("=== Interval Index ===\n");
+
+    auto taxSchema = std::make_shared<FeatureSchema>();
+    compareIndexed("Tax brackets", buildTaxBracketTree(*taxSchema), taxSchema,
+                   taxBracketInputs());
+
+    auto riskSchema = std::make_shared<FeatureSchema>();
+    compareIndexed("Risk assessment", buildRiskAssessmentTree(*riskSchema), riskSchema,
+                   riskInputs());
+}
+
+void benchmarkSwitchDispatch() {
+    std::printf("=== Switch Dispatch ===\n");
+
+    auto ledgerSchema = std::make_shared<FeatureSchema>();
+    NodePtr chain = buildLedgerChain(*ledgerSchema);
+    NodePtr table = buildLedgerSwitch(*ledgerSchema);
+    compareSwitch("Ledger accounts", chain, table, ledgerSchema, ledgerInputs());
+}
+
+void benchmarkTreeOptimizer() {
+    std::printf("=== Static Tree Optimizer ===\n");
+
+    auto scoreSchema = std::make_shared<FeatureSchema>();
+    compareOptimized("Generated score ladder", buildGeneratedScoreTree(*scoreSchema), scoreSchema,
+                     generatedScoreInputs());
+
+    auto riskSchema = std::make_shared<FeatureSchema>();
+    compareOptimized("Risk assessment", buildRiskAssessmentTree(*riskSchema), riskSchema,
+                     riskInputs());
+}
+
+void benchmarkSubtreeSharing() {
+    std::printf("=== Subtree Sharing ===\n");
+
+    auto rulesetSchema = std::make_shared<FeatureSchema>();
+    compareShared("Generated ruleset", buildGeneratedRuleset(*rulesetSchema), rulesetSchema,
+                  generatedRulesetInputs());
+}
+
+void benchmarkSharedPredicates() {
+    std::printf("=== Shared Predicates ===\n");
+
+    auto offerSchema = std::make_shared<FeatureSchema>();
+    compareMemoized("Offer rules", buildOfferRules(*offerSchema), offerSchema, offerInputs());
+
+    auto riskSchema = std::make_shared<FeatureSchema>();
+    compareMemoized("Risk assessment", buildRiskAssessmentTree(*riskSchema), riskSchema,
+                    riskInputs());
+}
+
+void benchmarkJsonSerialization() {
+    std::printf("=== JSON Serialization ===\n");
+
+    for (int depth : {11, 15, 18}) {
+        int nodes = 0;
+        NodePtr tree = buildBalancedRuleset(feature("credit_score", 0), depth, nodes);
+        std::string title = "Balanced ruleset, " + std::to_string(nodes) + " nodes";
+        compareSerialization(title.c_str(), tree);
+    }
+}
+
+void benchmarkNativePredicates() {
+    std::printf("=== Named Native Predicates ===\n");
+
+    auto offerSchema = std::make_shared<FeatureSchema>();
+    buildOfferRules(*offerSchema);
+    compareNative("Offer chains", offerSchema, offerInputs());
+}
+
+void benchmarkTreeImages() {
+    std::printf("=== Mapped Tree Images ===\n");
+
+    auto offerSchema = std::make_shared<FeatureSchema>();
+    compareImage("Offer rules", buildOfferRules(*offerSchema), offerSchema, offerInputs());
+
+    auto ledgerSchema = std::make_shared<FeatureSchema>();
+    compareImage("Ledger switch", buildLedgerSwitch(*ledgerSchema), ledgerSchema, ledgerInputs());
+
+    auto rulesetSchema = std::make_shared<FeatureSchema>();
+    int nodes = 0;
+    NodePtr ruleset = buildBalancedRuleset(feature(*rulesetSchema, "credit_score", 0), 15, nodes);
+    std::string title = "Balanced ruleset, " + std::to_string(nodes) + " nodes";
+    compareImage(title.c_str(), ruleset, rulesetSchema, riskInputs());
+}
+
+void runBenchmarks() {
+    benchmarkExecutionModes();
+    benchmarkStaticTrees();
+    benchmarkBranchReordering();
+    benchmarkIntervalIndex();
+    benchmarkSwitchDispatch();
+    benchmarkTreeOptimizer();
+    benchmarkSubtreeSharing();
+    benchmarkSharedPredicates();
+    benchmarkJsonSerialization();
+    benchmarkTreeImages();
+    benchmarkNativePredicates();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+void benchmarkExecutionModes();
+
+void benchmarkStaticTrees();
+
+void benchmarkBranchReordering();
+
+void benchmarkIntervalIndex();
+
+void benchmarkSwitchDispatch();
+
+void benchmarkTreeOptimizer();
+
+void benchmarkSubtreeSharing();
+
+void benchmarkSharedPredicates();
+
+void benchmarkJsonSerialization();
+
+void benchmarkTreeImages();
+
+void benchmarkNativePredicates();
+
+void runBenchmarks();
@@ -0,0 +1,222 @@
+#include "branch_reorder.h"
+#include "flat_tree.h"
+#include "hit_counters.h"
+#include "interval_index.h"
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+bool exclusive(const std::optional<FeatureConstraints>& a,
+               const std::optional<FeatureConstraints>& b) {
+    if (!a || !b) {
+        return false;
+    }
+    for (const auto& [key, bound] : a->bounds) {
+        auto it = b->bounds.find(key);
+        if (it != b->bounds.end() && !bound.interval.intersects(it->second.interval)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::size_t exprCost(const ExprPtr& expr) {
+    switch (expr->kind()) {
+        case ExprKind::Compare:
+        case ExprKind::In:
+            return 1;
+        case ExprKind::And:
+        case ExprKind::Or:
+        case ExprKind::Not: {
+            std::size_t cost = 0;
+            for (const auto& operand : expr->getOperands()) {
+                cost += exprCost(operand);
+            }
+            return cost;
+        }
+        case ExprKind::Feature:
+        case ExprKind::Constant:
+            break;
+    }
+    return 0;
+}
+
+// Condition cost spent at a multi-branch node: inputs taking branch k paid
+// for branches 0..k, inputs taking the default paid for all of them.
+double branchCost(const std::vector<std::uint64_t>& hits,
+                  const std::vector<std::size_t>& costs,
+                  const std::vector<std::size_t>& order,
+                  std::uint64_t defaultHits) {
+    double total = 0.0;
+    std::size_t prefix = 0;
+    for (std::size_t branch : order) {
+        prefix += costs[branch];
+        total += static_cast<double>(hits[branch]) * static_cast<double>(prefix);
+    }
+    return total + static_cast<double>(defaultHits) * static_cast<double>(prefix);
+}
+
+class Reorderer {
+private:
+    const HitSnapshot& hits_;
+    BranchReorderReport& report_;
+    std::unordered_map<const Node*, NodeIndex> indices_;
+    std::unordered_map<const Node*, NodePtr> rebuilt_;
+
+    std::vector<std::size_t> reorder(const MultiBranchNode& multi, NodeIndex index) {
+        const auto& branches = multi.getBranches();
+        std::vector<std::uint64_t> hits;
+        std::vector<std::size_t> costs;
+        std::vector<std::optional<FeatureConstraints>> constraints;
+        for (std::uint32_t branch = 0; branch < branches.size(); ++branch) {
+            hits.push_back(hits_.branchHits(index, branch));
+            costs.push_back(conditionCost(branches[branch].first));
+            constraints.push_back(featureConstraints(branches[branch].first));
+        }
+
+        std::vector<std::size_t> order(branches.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::uint64_t defaultHits =
+            hits_.branchHits(index, static_cast<std::uint32_t>(branches.size()));
+        report_.costBefore += branchCost(hits, costs, order, defaultHits);
+
+        // Each swap strictly lowers the expected cost, so this terminates.
+        bool swapped = true;
+        while (swapped) {
+            swapped = false;
+            for (std::size_t k = 0; k + 1 < order.size(); ++k) {
+                std::size_t a = order[k];
+                std::size_t b = order[k + 1];
+                if (hits[b] * costs[a] > hits[a] * costs[b] &&
+                    exclusive(constraints[a], constraints[b])) {
+                    std::swap(order[k], order[k + 1]);
+                    ++report_.swaps;
+                    swapped = true;
+                }
+            }
+        }
+
+        report_.costAfter += branchCost(hits, costs, order, defaultHits);
+        return order;
+    }
+
+public:
+    Reorderer(const FlatTree& tree, const HitSnapshot& hits, BranchReorderReport& report)
+        : hits_(hits), report_(report) {
+        for (NodeIndex index = 0; index < tree.nodeCount(); ++index) {
+            if (const Node* source = tree.getSource(index)) {
+                indices_.emplace(source, index);
+            }
+        }
+    }
+
+    NodePtr rebuild(const NodePtr& node) {
+        if (!node) {
+            return node;
+        }
+        auto found = rebuilt_.find(node.get());
+        if (found != rebuilt_.end()) {
+            return found->second;
+        }
+
+        NodePtr result = node;
+        if (node->kind() == NodeKind::Decision) {
+            const auto& decision = static_cast<const DecisionNode&>(*node);
+            NodePtr trueNode = rebuild(decision.getTrueNode());
+            NodePtr falseNode = rebuild(decision.getFalseNode());
+            if (trueNode != decision.getTrueNode() || falseNode != decision.getFalseNode()) {
+                result = std::make_shared<DecisionNode>(decision.getName(), decision.getCondition(),
+                                                        trueNode, falseNode);
+            }
+        } else if (node->kind() == NodeKind::MultiBranch) {
+            const auto& multi = static_cast<const MultiBranchNode&>(*node);
+            const auto& branches = multi.getBranches();
+            std::vector<std::size_t> newOrder = reorder(multi, indices_.at(node.get()));
+
+            bool changed = false;
+            std::vector<NodePtr> children;
+            for (std::size_t branch = 0; branch < branches.size(); ++branch) {
+                children.push_back(rebuild(branches[branch].second));
+                changed |= children.back() != branches[branch].second ||
+                           newOrder[branch] != branch;
+            }
+            NodePtr defaultNode = rebuild(multi.getDefaultNode());
+            changed |= defaultNode != multi.getDefaultNode();
+
+            if (changed) {
+                auto copy = std::make_shared<MultiBranchNode>(multi.getName());
+                for (std::size_t branch : newOrder) {
+                    copy->addBranch(branches[branch].first, children[branch]);
+                }
+                copy->setDefault(defaultNode);
+                result = copy;
+            }
+            for (std::size_t k = 0; k < newOrder.size(); ++k) {
+                if (newOrder[k] != k) {
+                    ++report_.nodesReordered;
+                    break;
+                }
+            }
+        } else if (node->kind() == NodeKind::Switch) {
+            // Cases are dispatched by table, so only their subtrees change.
+            const auto& switchNode = static_cast<const SwitchNode&>(*node);
+            bool changed = false;
+            std::vector<std::pair<Result, NodePtr>> cases;
+            for (const auto& [value, child] : switchNode.getCases()) {
+                cases.emplace_back(value, rebuild(child));
+                changed |= cases.back().second != child;
+            }
+            NodePtr defaultNode = rebuild(switchNode.getDefaultNode());
+            changed |= defaultNode != switchNode.getDefaultNode();
+
+            if (changed) {
+                auto copy = std::make_shared<SwitchNode>(switchNode.getName(),
+                                                         switchNode.getFeature());
+                copy->addCases(std::move(cases));
+                copy->setDefault(defaultNode);
+                result = copy;
+            }
+        }
+
+        rebuilt_.emplace(node.get(), result);
+        return result;
+    }
+};
+
+}
+
+std::size_t conditionCost(const Predicate& predicate) {
+    if (const ExprPtr& expr = predicate.getExpr()) {
+        return std::max<std::size_t>(1, exprCost(expr));
+    }
+    return kOpaqueConditionCost;
+}
+
+bool provablyExclusive(const Predicate& a, const Predicate& b) {
+    return exclusive(featureConstraints(a), featureConstraints(b));
+}
+
+NodePtr reorderBranches(const NodePtr& root, const FlatTree& tree,
+                        const HitSnapshot& hits, BranchReorderReport* report) {
+    if (root.get() != tree.getSource(tree.getRoot())) {
+        throw std::runtime_error("hit counts were recorded for a different tree");
+    }
+
+    BranchReorderReport local;
+    BranchReorderReport& out = report ? *report : local;
+    out = BranchReorderReport();
+
+    NodePtr result = Reorderer(tree, hits, out).rebuild(root);
+
+    std::uint64_t evaluations = hits.nodeHits(tree, tree.getRoot());
+    if (evaluations) {
+        out.costBefore /= static_cast<double>(evaluations);
+        out.costAfter /= static_cast<double>(evaluations);
+    }
+    return result;
+}
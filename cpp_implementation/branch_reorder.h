@@ -0,0 +1,36 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <cstddef>
+
+class HitSnapshot;
+
+// What reorderBranches() changed. Costs are the expected condition cost per
+// evaluation spent testing multi-branch conditions, over the profiled
+// traffic.
+struct BranchReorderReport {
+  std::size_t nodesReordered = 0;
+  std::size_t swaps = 0;
+  double costBefore = 0.0;
+  double costAfter = 0.0;
+};
+
+// Relative cost of testing a condition: one per comparison or in-set in an
+// expression, kOpaqueConditionCost for a lambda.
+constexpr std::size_t kOpaqueConditionCost = 4;
+std::size_t conditionCost(const Predicate &predicate);
+
+// True only when no input can satisfy both conditions: their
+// featureConstraints() put disjoint bounds on the same feature. Lambdas are
+// never exclusive.
+bool provablyExclusive(const Predicate &a, const Predicate &b);
+
+// Returns root with the branches of every MultiBranchNode reordered by hits
+// per unit of condition cost, as profiled in hits for tree (frozen from
+// root). Only adjacent branches that are provablyExclusive() are swapped, so
+// every input still takes the same branch. Unchanged subtrees are shared
+// with root; changed nodes are copied and root itself is left untouched.
+NodePtr reorderBranches(const NodePtr &root, const FlatTree &tree,
+                        const HitSnapshot &hits,
+                        BranchReorderReport *report = nullptr);
@@ -0,0 +1,361 @@
+#include "bytecode_vm.h"
+
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+CompareOp mirror(CompareOp op) {
+    switch (op) {
+        case CompareOp::Lt:
+            return CompareOp::Gt;
+        case CompareOp::Le:
+            return CompareOp::Ge;
+        case CompareOp::Gt:
+            return CompareOp::Lt;
+        case CompareOp::Ge:
+            return CompareOp::Le;
+        default:
+            return op;
+    }
+}
+
+SlotId slotOf(const ConditionExpr& feature, const FeatureSchema& schema) {
+    return feature.getSchema() == &schema ? feature.getSlot()
+                                          : schema.find(feature.getFeature());
+}
+
+const char* opName(OpCode op) {
+    switch (op) {
+        case OpCode::CompareSlotInt:
+            return "cmp.i";
+        case OpCode::CompareSlot:
+            return "cmp";
+        case OpCode::InSlot:
+            return "in";
+        case OpCode::TestSlot:
+            return "test";
+        case OpCode::SetAcc:
+            return "set";
+        case OpCode::Not:
+            return "not";
+        case OpCode::JumpIfFalse:
+            return "jf";
+        case OpCode::JumpIfTrue:
+            return "jt";
+        case OpCode::EvalExpr:
+            return "expr";
+        case OpCode::CallPredicate:
+            return "call";
+        case OpCode::LoadMemo:
+            return "memo.ld";
+        case OpCode::StoreMemo:
+            return "memo.st";
+        case OpCode::Return:
+            return "ret";
+    }
+    return "?";
+}
+
+bool isAtom(const ConditionExpr& expr) {
+    return expr.kind() == ExprKind::Compare || expr.kind() == ExprKind::In;
+}
+
+// How often each distinct atom is reached, counting a predicate once for
+// every decision or branch that tests it.
+class AtomCounter {
+private:
+    std::unordered_multimap<std::size_t, std::size_t> byHash_;
+
+public:
+    std::vector<std::pair<const ConditionExpr*, std::uint32_t>> atoms;
+
+    void count(const ConditionExpr& expr, std::uint32_t uses) {
+        if (!isAtom(expr)) {
+            for (const auto& operand : expr.getOperands()) {
+                count(*operand, uses);
+            }
+            return;
+        }
+        std::size_t hash = hashExpr(expr);
+        auto [begin, end] = byHash_.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            if (sameExpr(*atoms[it->second].first, expr)) {
+                atoms[it->second].second += uses;
+                return;
+            }
+        }
+        byHash_.emplace(hash, atoms.size());
+        atoms.emplace_back(&expr, uses);
+    }
+};
+
+}
+
+std::uint32_t BytecodeProgram::addConstant(const Result& value) {
+    auto it = constantIndex_.find(value);
+    if (it != constantIndex_.end()) {
+        return it->second;
+    }
+    auto index = static_cast<std::uint32_t>(constants_.size());
+    constants_.push_back(value);
+    constantIndex_.emplace(value, index);
+    return index;
+}
+
+void BytecodeProgram::emit(OpCode op, CompareOp cmp, std::uint32_t a,
+                           std::uint32_t b, std::uint32_t c) {
+    code_.push_back({op, cmp, a, b, c});
+}
+
+bool BytecodeProgram::compileComparison(const ConditionExpr& expr,
+                                        const FeatureSchema& schema) {
+    const ExprPtr& lhs = expr.getOperands()[0];
+    const ExprPtr& rhs = expr.getOperands()[1];
+    CompareOp op = expr.op();
+
+    const ConditionExpr* featureExpr = nullptr;
+    const ConditionExpr* constantExpr = nullptr;
+    if (lhs->kind() == ExprKind::Feature && rhs->kind() == ExprKind::Constant) {
+        featureExpr = lhs.get();
+        constantExpr = rhs.get();
+    } else if (lhs->kind() == ExprKind::Constant && rhs->kind() == ExprKind::Feature) {
+        featureExpr = rhs.get();
+        constantExpr = lhs.get();
+        op = mirror(op);
+    } else if (lhs->kind() == ExprKind::Constant && rhs->kind() == ExprKind::Constant) {
+        emit(OpCode::SetAcc, CompareOp::Eq, expr.evaluate(Context{}) ? 1 : 0);
+        return true;
+    } else {
+        return false;
+    }
+
+    std::uint32_t fallback = featureExpr->hasFallback()
+                                 ? addConstant(featureExpr->getValue())
+                                 : kNoConstant;
+    std::uint32_t constant = addConstant(constantExpr->getValue());
+    OpCode code = std::holds_alternative<int>(constantExpr->getValue())
+                      ? OpCode::CompareSlotInt
+                      : OpCode::CompareSlot;
+    emit(code, op, slotOf(*featureExpr, schema), constant, fallback);
+    return true;
+}
+
+std::uint32_t BytecodeProgram::memoSlotOf(const ConditionExpr& expr) const {
+    auto [begin, end] = memoIndex_.equal_range(hashExpr(expr));
+    for (auto it = begin; it != end; ++it) {
+        if (sameExpr(*it->second.first, expr)) {
+            return it->second.second;
+        }
+    }
+    return kNoConstant;
+}
+
+void BytecodeProgram::compileAtom(const ExprPtr& expr, const FeatureSchema& schema) {
+    std::uint32_t slot = memoIndex_.empty() ? kNoConstant : memoSlotOf(*expr);
+    if (slot == kNoConstant) {
+        compileExpr(expr, schema);
+        return;
+    }
+    std::size_t load = code_.size();
+    emit(OpCode::LoadMemo, CompareOp::Eq, slot);
+    compileExpr(expr, schema);
+    emit(OpCode::StoreMemo, CompareOp::Eq, slot);
+    code_[load].b = static_cast<std::uint32_t>(code_.size());
+}
+
+void BytecodeProgram::compileExpr(const ExprPtr& expr, const FeatureSchema& schema) {
+    switch (expr->kind()) {
+        case ExprKind::Feature:
+            emit(OpCode::TestSlot, CompareOp::Eq, slotOf(*expr, schema), 0,
+                 expr->hasFallback() ? addConstant(expr->getValue()) : kNoConstant);
+            return;
+        case ExprKind::Constant:
+            emit(OpCode::SetAcc, CompareOp::Eq, expr->evaluate(Context{}) ? 1 : 0);
+            return;
+        case ExprKind::Compare:
+            if (compileComparison(*expr, schema)) {
+                return;
+            }
+            break;
+        case ExprKind::In: {
+            const ExprPtr& operand = expr->getOperands()[0];
+            if (operand->kind() != ExprKind::Feature) {
+                break;
+            }
+            auto set = static_cast<std::uint32_t>(sets_.size());
+            sets_.push_back(expr->getValues());
+            emit(OpCode::InSlot, CompareOp::Eq, slotOf(*operand, schema), set,
+                 operand->hasFallback() ? addConstant(operand->getValue()) : kNoConstant);
+            return;
+        }
+        case ExprKind::And:
+        case ExprKind::Or: {
+            OpCode jump = expr->kind() == ExprKind::And ? OpCode::JumpIfFalse
+                                                        : OpCode::JumpIfTrue;
+            std::vector<std::size_t> patches;
+            const auto& operands = expr->getOperands();
+            for (std::size_t i = 0; i < operands.size(); ++i) {
+                compileAtom(operands[i], schema);
+                if (i + 1 < operands.size()) {
+                    patches.push_back(code_.size());
+                    emit(jump);
+                }
+            }
+            for (std::size_t patch : patches) {
+                code_[patch].a = static_cast<std::uint32_t>(code_.size());
+            }
+            return;
+        }
+        case ExprKind::Not:
+            compileAtom(expr->getOperands()[0], schema);
+            emit(OpCode::Not);
+            return;
+    }
+
+    emit(OpCode::EvalExpr, CompareOp::Eq, static_cast<std::uint32_t>(expressions_.size()));
+    expressions_.push_back(expr);
+}
+
+BytecodeProgram BytecodeProgram::compile(const FlatTree& tree,
+                                         const FeatureSchema& schema) {
+    BytecodeProgram program;
+
+    AtomCounter counter;
+    for (std::uint32_t i = 0; i < tree.predicateCount(); ++i) {
+        if (const ExprPtr& expr = tree.getPredicate(i).getExpr()) {
+            counter.count(*expr, tree.getPredicateUses(i));
+        }
+    }
+    for (const auto& [atom, uses] : counter.atoms) {
+        if (uses > 1) {
+            program.memoIndex_.emplace(hashExpr(*atom),
+                                       std::make_pair(atom, program.memoSlots_++));
+        }
+    }
+
+    for (std::uint32_t i = 0; i < tree.predicateCount(); ++i) {
+        const Predicate& predicate = tree.getPredicate(i);
+        program.entries_.push_back(static_cast<std::uint32_t>(program.code_.size()));
+
+        if (predicate.getExpr()) {
+            program.compileAtom(predicate.getExpr(), schema);
+        } else {
+            // A registered native predicate the tree tests in several places
+            // is called once per walk, like a shared atom.
+            bool memoized = !predicate.getName().empty() && tree.getPredicateUses(i) > 1;
+            std::size_t load = program.code_.size();
+            if (memoized) {
+                program.emit(OpCode::LoadMemo, CompareOp::Eq, program.memoSlots_);
+            }
+            program.emit(OpCode::CallPredicate, CompareOp::Eq,
+                         static_cast<std::uint32_t>(program.predicates_.size()));
+            program.predicates_.push_back(predicate);
+            if (memoized) {
+                program.emit(OpCode::StoreMemo, CompareOp::Eq, program.memoSlots_++);
+                program.code_[load].b = static_cast<std::uint32_t>(program.code_.size());
+            }
+        }
+        program.emit(OpCode::Return);
+    }
+
+    for (const auto& constant : program.constants_) {
+        program.resolved_.push_back(resolveResult(constant));
+    }
+    for (const auto& set : program.sets_) {
+        std::vector<FeatureValue> resolved;
+        for (const auto& value : set) {
+            resolved.push_back(resolveResult(value));
+        }
+        program.resolvedSets_.push_back(std::move(resolved));
+    }
+    program.memoIndex_.clear();
+
+    return program;
+}
+
+bool BytecodeProgram::run(std::uint32_t predicate, const FlatContext& context,
+                          PredicateMemo* memo) const {
+    return runBytecode(code_.data(), entries_[predicate], context, Operands{*this}, memo);
+}
+
+NodeIndex BytecodeProgram::findLeaf(const FlatTree& tree, const FlatContext& context) const {
+    return findLeaf(tree, context, NoVisit());
+}
+
+std::size_t BytecodeProgram::instructionCount() const {
+    return code_.size();
+}
+
+std::size_t BytecodeProgram::memoSlotCount() const {
+    return memoSlots_;
+}
+
+const std::vector<Instruction>& BytecodeProgram::getCode() const {
+    return code_;
+}
+
+const std::vector<std::uint32_t>& BytecodeProgram::getEntries() const {
+    return entries_;
+}
+
+const std::vector<Result>& BytecodeProgram::getConstants() const {
+    return constants_;
+}
+
+const std::vector<std::vector<Result>>& BytecodeProgram::getSets() const {
+    return sets_;
+}
+
+std::size_t BytecodeProgram::expressionCount() const {
+    return expressions_.size();
+}
+
+std::size_t BytecodeProgram::callCount() const {
+    return predicates_.size();
+}
+
+std::string BytecodeProgram::disassemble() const {
+    std::ostringstream out;
+    std::size_t entry = 0;
+
+    for (std::size_t pc = 0; pc < code_.size(); ++pc) {
+        while (entry < entries_.size() && entries_[entry] == pc) {
+            out << "predicate " << entry++ << ":\n";
+        }
+
+        const Instruction& in = code_[pc];
+        out << "  " << pc << ": " << opName(in.op);
+        switch (in.op) {
+            case OpCode::CompareSlotInt:
+            case OpCode::CompareSlot:
+                out << " slot" << in.a << " " << compareOpSymbol(in.cmp) << " k" << in.b;
+                break;
+            case OpCode::InSlot:
+                out << " slot" << in.a << " set" << in.b;
+                break;
+            case OpCode::TestSlot:
+                out << " slot" << in.a;
+                break;
+            case OpCode::LoadMemo:
+                out << " m" << in.a << " " << in.b;
+                break;
+            case OpCode::StoreMemo:
+                out << " m" << in.a;
+                break;
+            case OpCode::SetAcc:
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfTrue:
+            case OpCode::EvalExpr:
+            case OpCode::CallPredicate:
+                out << " " << in.a;
+                break;
+            case OpCode::Not:
+            case OpCode::Return:
+                break;
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "flat_tree.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Condition bytecode. Every test writes a single boolean accumulator, and
+// and/or short-circuit by jumping to the end of their operand list, so no
+// value stack is needed.
+enum class OpCode : std::uint8_t {
+  CompareSlotInt,  // acc = slot[a] (or constant c) <cmp> int constant b
+  CompareSlot,     // acc = slot[a] (or constant c) <cmp> constant b
+  InSlot,          // acc = slot[a] (or constant c) in set b
+  TestSlot,        // acc = truthiness of slot[a] (or constant c)
+  SetAcc,          // acc = a != 0
+  Not,             // acc = !acc
+  JumpIfFalse,     // if (!acc) pc = a
+  JumpIfTrue,      // if (acc) pc = a
+  EvalExpr,        // acc = expressions[a] evaluated by the AST interpreter
+  CallPredicate,   // acc = predicates[a], for lambda conditions
+  LoadMemo,        // if memo slot a is known: acc = its value, pc = b
+  StoreMemo,       // memo slot a = acc
+  Return
+};
+
+constexpr std::uint32_t kNoConstant = static_cast<std::uint32_t>(-1);
+
+struct Instruction {
+  OpCode op;
+  CompareOp cmp;
+  std::uint32_t a;
+  std::uint32_t b;
+  std::uint32_t c;
+};
+
+// The interpreter loop behind BytecodeProgram::run(), shared with TreeImage,
+// which runs code straight from a mapped file. operands.value(i) is a
+// reference to constant i, operands.contains(set, value) tests an InSlot set,
+// and operands.evaluate(i, context) and operands.call(i, context) run
+// EvalExpr and CallPredicate.
+template <typename Operands>
+bool runBytecode(const Instruction *code, std::uint32_t entry,
+                 const FlatContext &context, const Operands &operands,
+                 PredicateMemo *memo);
+
+// The predicates of a FlatTree compiled against a schema. Each predicate
+// index of the tree maps to an entry point in one shared code buffer.
+// Comparisons and set tests that the tree reaches from more than one place
+// (the same atom in several conditions, or a condition used by several
+// nodes) get a memo slot, so findLeaf computes each at most once per walk;
+// so do registered native predicates used by several nodes.
+class BytecodeProgram {
+private:
+  struct Operands {
+    const BytecodeProgram &program;
+
+    const FeatureValue &value(std::uint32_t index) const {
+      return program.resolved_[index];
+    }
+    bool contains(std::uint32_t set, const FeatureValue &value) const {
+      for (const auto &candidate : program.resolvedSets_[set]) {
+        if (compareValues(CompareOp::Eq, value, candidate)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    bool evaluate(std::uint32_t index, const FlatContext &context) const {
+      return program.expressions_[index]->evaluate(context);
+    }
+    bool call(std::uint32_t index, const FlatContext &context) const {
+      return program.predicates_[index].test(context);
+    }
+  };
+
+  std::vector<Instruction> code_;
+  std::vector<std::uint32_t> entries_;
+  std::vector<Result> constants_;
+  std::vector<FeatureValue> resolved_;
+  std::vector<std::vector<Result>> sets_;
+  std::vector<std::vector<FeatureValue>> resolvedSets_;
+  std::vector<ExprPtr> expressions_;
+  std::vector<Predicate> predicates_;
+  std::map<Result, std::uint32_t> constantIndex_;
+  // Memo slots by hashExpr() of their atom; only used while compiling.
+  std::unordered_multimap<std::size_t,
+                          std::pair<const ConditionExpr *, std::uint32_t>>
+      memoIndex_;
+  std::uint32_t memoSlots_ = 0;
+
+  std::uint32_t addConstant(const Result &value);
+  void emit(OpCode op, CompareOp cmp = CompareOp::Eq, std::uint32_t a = 0,
+            std::uint32_t b = 0, std::uint32_t c = kNoConstant);
+  std::uint32_t memoSlotOf(const ConditionExpr &expr) const;
+  void compileAtom(const ExprPtr &expr, const FeatureSchema &schema);
+  void compileExpr(const ExprPtr &expr, const FeatureSchema &schema);
+  bool compileComparison(const ConditionExpr &expr,
+                         const FeatureSchema &schema);
+
+public:
+  BytecodeProgram() = default;
+  BytecodeProgram(const BytecodeProgram &) = delete;
+  BytecodeProgram(BytecodeProgram &&) = default;
+  BytecodeProgram &operator=(const BytecodeProgram &) = delete;
+  BytecodeProgram &operator=(BytecodeProgram &&) = default;
+
+  static BytecodeProgram compile(const FlatTree &tree,
+                                 const FeatureSchema &schema);
+
+  // Without a memo every atom is computed afresh.
+  bool run(std::uint32_t predicate, const FlatContext &context,
+           PredicateMemo *memo = nullptr) const;
+  NodeIndex findLeaf(const FlatTree &tree, const FlatContext &context) const;
+  template <typename VisitFn>
+  NodeIndex findLeaf(const FlatTree &tree, const FlatContext &context,
+                     VisitFn &&visit) const;
+
+  std::size_t instructionCount() const;
+  std::size_t memoSlotCount() const;
+  const std::vector<Instruction> &getCode() const;
+  // Code offset of each predicate.
+  const std::vector<std::uint32_t> &getEntries() const;
+  const std::vector<Result> &getConstants() const;
+  const std::vector<std::vector<Result>> &getSets() const;
+  // Conditions left to the AST interpreter and lambda conditions; code
+  // using either cannot run without this program.
+  std::size_t expressionCount() const;
+  std::size_t callCount() const;
+  std::string disassemble() const;
+};
+
+template <typename VisitFn>
+NodeIndex BytecodeProgram::findLeaf(const FlatTree &tree,
+                                    const FlatContext &context,
+                                    VisitFn &&visit) const {
+  if (memoSlots_ != 0) {
+    PredicateMemo memo(memoSlots_);
+    return tree.walk(
+        [&](std::uint32_t predicate) { return run(predicate, context, &memo); },
+        [&](const auto &index) { return index.select(context); }, visit);
+  }
+  return tree.walk(
+      [&](std::uint32_t predicate) { return run(predicate, context); },
+      [&](const auto &index) { return index.select(context); }, visit);
+}
+
+template <typename Operands>
+bool runBytecode(const Instruction *code, std::uint32_t entry,
+                 const FlatContext &context, const Operands &operands,
+                 PredicateMemo *memo) {
+  const Instruction *pc = code + entry;
+  bool acc = false;
+
+  // The slot, or the fallback constant when it is missing and c names one.
+  auto operand = [&](const Instruction &in) {
+    const FeatureValue *v = &context.value(in.a);
+    if (v->type == ValueType::Missing && in.c != kNoConstant) {
+      v = &operands.value(in.c);
+    }
+    return v;
+  };
+
+  for (;;) {
+    const Instruction &in = *pc++;
+
+    switch (in.op) {
+    case OpCode::CompareSlotInt: {
+      const FeatureValue *v = operand(in);
+      const auto &k = operands.value(in.b);
+      if (v->type == ValueType::Int) {
+        switch (in.cmp) {
+        case CompareOp::Lt:
+          acc = v->i < k.i;
+          break;
+        case CompareOp::Le:
+          acc = v->i <= k.i;
+          break;
+        case CompareOp::Gt:
+          acc = v->i > k.i;
+          break;
+        case CompareOp::Ge:
+          acc = v->i >= k.i;
+          break;
+        case CompareOp::Eq:
+          acc = v->i == k.i;
+          break;
+        case CompareOp::Ne:
+          acc = v->i != k.i;
+          break;
+        }
+      } else {
+        acc = compareValues(in.cmp, *v, k);
+      }
+      break;
+    }
+    case OpCode::CompareSlot:
+      acc = compareValues(in.cmp, *operand(in), operands.value(in.b));
+      break;
+    case OpCode::InSlot:
+      acc = operands.contains(in.b, *operand(in));
+      break;
+    case OpCode::TestSlot: {
+      bool value = false;
+      Coercion coercion = convertValue(*operand(in), value);
+      acc = (coercion == Coercion::Exact || coercion == Coercion::Coerced) &&
+            value;
+      break;
+    }
+    case OpCode::SetAcc:
+      acc = in.a != 0;
+      break;
+    case OpCode::Not:
+      acc = !acc;
+      break;
+    case OpCode::JumpIfFalse:
+      if (!acc) {
+        pc = code + in.a;
+      }
+      break;
+    case OpCode::JumpIfTrue:
+      if (acc) {
+        pc = code + in.a;
+      }
+      break;
+    case OpCode::EvalExpr:
+      acc = operands.evaluate(in.a, context);
+      break;
+    case OpCode::CallPredicate:
+      acc = operands.call(in.a, context);
+      break;
+    case OpCode::LoadMemo:
+      if (memo && memo->known(in.a)) {
+        acc = memo->value(in.a);
+        pc = code + in.b;
+      }
+      break;
+    case OpCode::StoreMemo:
+      if (memo) {
+        memo->set(in.a, acc);
+      }
+      break;
+    case OpCode::Return:
+      return acc;
+    }
+  }
+}
@@ -0,0 +1,690 @@
+#include "columnar_batch.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLUMNAR_AVX2 1
+#endif
+
+namespace {
+
+constexpr double kExactIntegerLimit = 9007199254740992.0;  // 2^53
+
+// Byte i of entry m is bit i of m, so a SIMD movemask expands to one 0/1
+// byte per lane with a single 8-byte store.
+struct SpreadTable {
+    std::uint64_t bytes[256];
+
+    constexpr SpreadTable() : bytes() {
+        for (unsigned mask = 0; mask < 256; ++mask) {
+            for (unsigned bit = 0; bit < 8; ++bit) {
+                if (mask & (1u << bit)) {
+                    bytes[mask] |= std::uint64_t{1} << (bit * 8);
+                }
+            }
+        }
+    }
+};
+
+constexpr SpreadTable kSpread;
+
+CompareOp mirror(CompareOp op) {
+    switch (op) {
+        case CompareOp::Lt:
+            return CompareOp::Gt;
+        case CompareOp::Le:
+            return CompareOp::Ge;
+        case CompareOp::Gt:
+            return CompareOp::Lt;
+        case CompareOp::Ge:
+            return CompareOp::Le;
+        default:
+            return op;
+    }
+}
+
+template <typename T>
+bool applyOp(CompareOp op, T lhs, T rhs) {
+    switch (op) {
+        case CompareOp::Lt:
+            return lhs < rhs;
+        case CompareOp::Le:
+            return lhs <= rhs;
+        case CompareOp::Gt:
+            return lhs > rhs;
+        case CompareOp::Ge:
+            return lhs >= rhs;
+        case CompareOp::Eq:
+            return lhs == rhs;
+        case CompareOp::Ne:
+            return lhs != rhs;
+    }
+    return false;
+}
+
+bool isDense(const std::uint32_t* rows, std::size_t n) {
+    return n > 0 && rows[n - 1] - rows[0] == n - 1;
+}
+
+void fill(std::uint8_t* out, std::size_t n, bool value) {
+    std::memset(out, value ? 1 : 0, n);
+}
+
+template <typename T>
+void compareScalar(const T* column, const std::uint32_t* rows, std::size_t n,
+                   CompareOp op, T key, std::uint8_t* out) {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = applyOp(op, column[rows[i]], key);
+    }
+}
+
+#ifdef COLUMNAR_AVX2
+
+__attribute__((target("avx2")))
+void compareInt32Avx2(const std::int32_t* column, const std::uint32_t* rows,
+                      std::size_t n, CompareOp op, std::int32_t key,
+                      std::uint8_t* out) {
+    const __m256i k = _mm256_set1_epi32(key);
+    const bool dense = isDense(rows, n);
+    const std::int32_t* base = n > 0 ? column + rows[0] : column;
+    const bool invert = op == CompareOp::Le || op == CompareOp::Ge || op == CompareOp::Ne;
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = dense
+            ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + i))
+            : _mm256_i32gather_epi32(
+                  column, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i)), 4);
+        __m256i m;
+        if (op == CompareOp::Lt || op == CompareOp::Ge) {
+            m = _mm256_cmpgt_epi32(k, x);
+        } else if (op == CompareOp::Gt || op == CompareOp::Le) {
+            m = _mm256_cmpgt_epi32(x, k);
+        } else {
+            m = _mm256_cmpeq_epi32(x, k);
+        }
+        unsigned bits = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        if (invert) {
+            bits ^= 0xFFu;
+        }
+        std::memcpy(out + i, &kSpread.bytes[bits], 8);
+    }
+    compareScalar(column, rows + i, n - i, op, key, out + i);
+}
+
+template <int Predicate>
+__attribute__((target("avx2")))
+void compareDoubleAvx2(const double* column, const std::uint32_t* rows,
+                       std::size_t n, double key, std::uint8_t* out) {
+    const __m256d k = _mm256_set1_pd(key);
+    // The masked gather with an explicit zero source and all lanes enabled
+    // is the plain gather without its undefined source operand.
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    const bool dense = isDense(rows, n);
+    const double* base = n > 0 ? column + rows[0] : column;
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = dense
+            ? _mm256_loadu_pd(base + i)
+            : _mm256_mask_i32gather_pd(
+                  _mm256_setzero_pd(), column,
+                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + i)), all, 8);
+        unsigned bits = static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(x, k, Predicate)));
+        std::memcpy(out + i, &kSpread.bytes[bits], 4);
+    }
+    for (; i < n; ++i) {
+        __m128d x = _mm_set_sd(column[rows[i]]);
+        out[i] = static_cast<std::uint8_t>(
+            _mm_movemask_pd(_mm_cmp_sd(x, _mm_set_sd(key), Predicate)) & 1);
+    }
+}
+
+void compareDoubleAvx2(const double* column, const std::uint32_t* rows,
+                       std::size_t n, CompareOp op, double key, std::uint8_t* out) {
+    switch (op) {
+        case CompareOp::Lt:
+            return compareDoubleAvx2<_CMP_LT_OQ>(column, rows, n, key, out);
+        case CompareOp::Le:
+            return compareDoubleAvx2<_CMP_LE_OQ>(column, rows, n, key, out);
+        case CompareOp::Gt:
+            return compareDoubleAvx2<_CMP_GT_OQ>(column, rows, n, key, out);
+        case CompareOp::Ge:
+            return compareDoubleAvx2<_CMP_GE_OQ>(column, rows, n, key, out);
+        case CompareOp::Eq:
+            return compareDoubleAvx2<_CMP_EQ_OQ>(column, rows, n, key, out);
+        case CompareOp::Ne:
+            return compareDoubleAvx2<_CMP_NEQ_UQ>(column, rows, n, key, out);
+    }
+}
+
+#endif
+
+void compareInt32(const std::int32_t* column, const std::uint32_t* rows,
+                  std::size_t n, CompareOp op, std::int32_t key, std::uint8_t* out) {
+#ifdef COLUMNAR_AVX2
+    if (columnarUsesAvx2()) {
+        return compareInt32Avx2(column, rows, n, op, key, out);
+    }
+#endif
+    compareScalar(column, rows, n, op, key, out);
+}
+
+void compareDouble(const double* column, const std::uint32_t* rows,
+                   std::size_t n, CompareOp op, double key, std::uint8_t* out) {
+#ifdef COLUMNAR_AVX2
+    if (columnarUsesAvx2()) {
+        return compareDoubleAvx2(column, rows, n, op, key, out);
+    }
+#endif
+    compareScalar(column, rows, n, op, key, out);
+}
+
+double numericValue(const FeatureValue& v) {
+    switch (v.type) {
+        case ValueType::Int:
+            return static_cast<double>(v.i);
+        case ValueType::Double:
+            return v.d;
+        case ValueType::Bool:
+            return v.b ? 1.0 : 0.0;
+        default:
+            return 0.0;
+    }
+}
+
+// "x op key" over int32 x, rewritten as an int32 comparison. A non-integral
+// key moves to the nearest integer threshold that keeps the same answer for
+// every integer (x < 2.5 is x < 3, x <= 2.5 is x <= 2); keys no int32 can
+// reach make the comparison constant.
+struct IntPlan {
+    bool constant;
+    bool value;
+    CompareOp op;
+    std::int32_t key;
+};
+
+IntPlan planIntComparison(CompareOp op, double key) {
+    if (std::isnan(key)) {
+        return {true, op == CompareOp::Ne, op, 0};
+    }
+
+    double threshold = key;
+    switch (op) {
+        case CompareOp::Lt:
+        case CompareOp::Ge:
+            threshold = std::ceil(key);
+            break;
+        case CompareOp::Le:
+        case CompareOp::Gt:
+            threshold = std::floor(key);
+            break;
+        case CompareOp::Eq:
+        case CompareOp::Ne:
+            if (std::floor(key) != key) {
+                return {true, op == CompareOp::Ne, op, 0};
+            }
+            break;
+    }
+
+    if (threshold > std::numeric_limits<std::int32_t>::max()) {
+        bool below = op == CompareOp::Lt || op == CompareOp::Le || op == CompareOp::Ne;
+        return {true, below, op, 0};
+    }
+    if (threshold < std::numeric_limits<std::int32_t>::min()) {
+        bool above = op == CompareOp::Gt || op == CompareOp::Ge || op == CompareOp::Ne;
+        return {true, above, op, 0};
+    }
+    return {false, false, op, static_cast<std::int32_t>(threshold)};
+}
+
+bool isNumeric(ValueType type) {
+    return type == ValueType::Int || type == ValueType::Double ||
+           type == ValueType::Bool;
+}
+
+class ColumnarEvaluator {
+private:
+    const FlatTree& tree_;
+    const ColumnarBatch& batch_;
+    FlatContext scratch_;
+
+    SlotId slotOf(const ConditionExpr& feature) const {
+        if (feature.getSchema() == &batch_.schema()) {
+            return feature.getSlot();
+        }
+        return batch_.schema().find(feature.getFeature());
+    }
+
+    void evaluateRows(const std::uint32_t* rows, std::size_t n, std::uint8_t* out,
+                      const Predicate& predicate) {
+        for (std::size_t i = 0; i < n; ++i) {
+            batch_.loadRow(rows[i], scratch_);
+            out[i] = predicate.test(scratch_);
+        }
+    }
+
+    // feature <op> constant over the selected rows. Missing rows compare the
+    // fallback (or are false without one), as ConditionExpr does.
+    void compareFeature(const ConditionExpr& feature, CompareOp op,
+                        const FeatureValue& key, const std::uint32_t* rows,
+                        std::size_t n, std::uint8_t* out) {
+        SlotId slot = slotOf(feature);
+        FeatureValue fallback = feature.hasFallback()
+            ? resolveResult(feature.getValue())
+            : FeatureValue();
+        bool missingResult = compareValues(op, fallback, key);
+
+        if (slot == kInvalidSlot || slot >= batch_.schema().size()) {
+            fill(out, n, missingResult);
+            return;
+        }
+
+        ColumnType type = batch_.columnType(slot);
+        bool exactKey = key.type != ValueType::Int ||
+                        std::fabs(static_cast<double>(key.i)) <= kExactIntegerLimit;
+
+        if (type == ColumnType::Int32 && isNumeric(key.type) && exactKey) {
+            IntPlan plan = planIntComparison(op, numericValue(key));
+            if (plan.constant) {
+                fill(out, n, plan.value);
+            } else {
+                compareInt32(batch_.intColumn(slot), rows, n, plan.op, plan.key, out);
+            }
+        } else if (type == ColumnType::Double && isNumeric(key.type) && exactKey) {
+            compareDouble(batch_.doubleColumn(slot), rows, n, op, numericValue(key), out);
+        } else {
+            for (std::size_t i = 0; i < n; ++i) {
+                FeatureValue v = batch_.value(slot, rows[i]);
+                out[i] = compareValues(op, v.type == ValueType::Missing ? fallback : v, key);
+            }
+            return;
+        }
+
+        if (const std::uint8_t* present = batch_.presence(slot)) {
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!present[rows[i]]) {
+                    out[i] = missingResult;
+                }
+            }
+        }
+    }
+
+    void evaluateExpr(const ConditionExpr& expr, const Predicate& predicate,
+                      const std::uint32_t* rows, std::size_t n, std::uint8_t* out) {
+        const auto& operands = expr.getOperands();
+
+        switch (expr.kind()) {
+            case ExprKind::Compare: {
+                const ConditionExpr& lhs = *operands[0];
+                const ConditionExpr& rhs = *operands[1];
+                if (lhs.kind() == ExprKind::Feature && rhs.kind() == ExprKind::Constant) {
+                    return compareFeature(lhs, expr.op(), resolveResult(rhs.getValue()),
+                                          rows, n, out);
+                }
+                if (lhs.kind() == ExprKind::Constant && rhs.kind() == ExprKind::Feature) {
+                    return compareFeature(rhs, mirror(expr.op()),
+                                          resolveResult(lhs.getValue()), rows, n, out);
+                }
+                break;
+            }
+            case ExprKind::And:
+            case ExprKind::Or: {
+                bool isAnd = expr.kind() == ExprKind::And;
+                std::vector<std::uint8_t> operand(n);
+                evaluateExpr(*operands[0], Predicate(operands[0]), rows, n, out);
+                for (std::size_t j = 1; j < operands.size(); ++j) {
+                    evaluateExpr(*operands[j], Predicate(operands[j]), rows, n,
+                                 operand.data());
+                    for (std::size_t i = 0; i < n; ++i) {
+                        out[i] = isAnd ? (out[i] & operand[i]) : (out[i] | operand[i]);
+                    }
+                }
+                return;
+            }
+            case ExprKind::Not:
+                evaluateExpr(*operands[0], Predicate(operands[0]), rows, n, out);
+                for (std::size_t i = 0; i < n; ++i) {
+                    out[i] ^= 1;
+                }
+                return;
+            case ExprKind::In:
+                if (operands[0]->kind() == ExprKind::Feature) {
+                    std::vector<std::uint8_t> match(n);
+                    fill(out, n, false);
+                    for (const auto& value : expr.getValues()) {
+                        compareFeature(*operands[0], CompareOp::Eq, resolveResult(value),
+                                       rows, n, match.data());
+                        for (std::size_t i = 0; i < n; ++i) {
+                            out[i] |= match[i];
+                        }
+                    }
+                    return;
+                }
+                break;
+            case ExprKind::Feature:
+            case ExprKind::Constant:
+                break;
+        }
+
+        evaluateRows(rows, n, out, predicate);
+    }
+
+public:
+    ColumnarEvaluator(const FlatTree& tree, const ColumnarBatch& batch)
+        : tree_(tree), batch_(batch), scratch_(batch.schema()) {}
+
+    void test(std::uint32_t predicate, const std::uint32_t* rows, std::size_t n,
+              std::uint8_t* out) {
+        const Predicate& condition = tree_.getPredicate(predicate);
+        if (condition.getExpr()) {
+            evaluateExpr(*condition.getExpr(), condition, rows, n, out);
+        } else {
+            evaluateRows(rows, n, out, condition);
+        }
+    }
+
+    // The case each selected row takes at a switch; a missing column reads
+    // the feature's fallback, as ConditionExpr does.
+    void select(const FlatSwitch& flatSwitch, const std::uint32_t* rows, std::size_t n,
+                std::uint32_t* out) const {
+        const ConditionExpr& feature = *flatSwitch.feature;
+        SlotId slot = slotOf(feature);
+        FeatureValue fallback = feature.hasFallback()
+            ? resolveResult(feature.getValue())
+            : FeatureValue();
+        bool known = slot != kInvalidSlot && slot < batch_.schema().size();
+        for (std::size_t i = 0; i < n; ++i) {
+            FeatureValue v = known ? batch_.value(slot, rows[i]) : FeatureValue();
+            out[i] = flatSwitch.table.select(v.type == ValueType::Missing ? fallback : v);
+        }
+    }
+};
+
+struct Selection {
+    NodeIndex node;
+    std::vector<std::uint32_t> rows;
+};
+
+void partition(const std::vector<std::uint32_t>& rows, const std::uint8_t* mask,
+               std::vector<std::uint32_t>& matched, std::vector<std::uint32_t>& rest) {
+    matched.resize(rows.size());
+    rest.resize(rows.size());
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        matched[hits] = rows[i];
+        rest[misses] = rows[i];
+        hits += mask[i];
+        misses += 1 - mask[i];
+    }
+    matched.resize(hits);
+    rest.resize(misses);
+}
+
+}
+
+bool columnarUsesAvx2() {
+#ifdef COLUMNAR_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+ColumnarBatch::ColumnarBatch(const FeatureSchema& schema, std::size_t rows)
+    : schema_(&schema), rows_(rows), columns_(schema.size()) {
+    for (auto& column : columns_) {
+        column.ints.assign(rows, 0);
+        column.present.assign(rows, 0);
+        column.missing = rows;
+    }
+}
+
+ColumnarBatch ColumnarBatch::fromRows(const FeatureSchema& schema,
+                                      const FlatContext* rows, std::size_t count) {
+    ColumnarBatch batch(schema, count);
+
+    for (SlotId slot = 0; slot < schema.size(); ++slot) {
+        bool allInt32 = true;
+        bool allExactNumbers = true;
+        for (std::size_t row = 0; row < count; ++row) {
+            const FeatureValue& v = rows[row].value(slot);
+            if (v.type == ValueType::Int) {
+                allInt32 &= v.i >= std::numeric_limits<std::int32_t>::min() &&
+                            v.i <= std::numeric_limits<std::int32_t>::max();
+                allExactNumbers &= std::fabs(static_cast<double>(v.i)) <= kExactIntegerLimit;
+            } else if (v.type == ValueType::Double) {
+                allInt32 = false;
+            } else if (v.type != ValueType::Missing) {
+                allInt32 = false;
+                allExactNumbers = false;
+            }
+        }
+
+        Column& column = batch.columns_[slot];
+        column.type = allInt32 ? ColumnType::Int32
+                    : allExactNumbers ? ColumnType::Double
+                    : ColumnType::Generic;
+        if (column.type != ColumnType::Int32) {
+            column.ints.clear();
+            column.ints.shrink_to_fit();
+        }
+        if (column.type == ColumnType::Double) {
+            column.doubles.assign(count, 0.0);
+        } else if (column.type == ColumnType::Generic) {
+            column.values.assign(count, FeatureValue());
+        }
+
+        for (std::size_t row = 0; row < count; ++row) {
+            FeatureValue v = rows[row].value(slot);
+            if (v.type == ValueType::Missing) {
+                continue;
+            }
+            column.present[row] = 1;
+            --column.missing;
+            switch (column.type) {
+                case ColumnType::Int32:
+                    column.ints[row] = static_cast<std::int32_t>(v.i);
+                    break;
+                case ColumnType::Double:
+                    column.doubles[row] = numericValue(v);
+                    break;
+                case ColumnType::Generic:
+                    if (v.type == ValueType::String) {
+                        batch.strings_.emplace_front(v.s, v.length);
+                        v.s = batch.strings_.front().data();
+                    }
+                    column.values[row] = v;
+                    break;
+            }
+        }
+    }
+
+    return batch;
+}
+
+void ColumnarBatch::setColumn(SlotId slot, std::vector<std::int32_t> values) {
+    if (values.size() != rows_) {
+        throw std::invalid_argument("column length does not match the batch");
+    }
+    Column& column = columns_.at(slot);
+    column = Column();
+    column.type = ColumnType::Int32;
+    column.ints = std::move(values);
+    column.present.assign(rows_, 1);
+}
+
+void ColumnarBatch::setColumn(SlotId slot, std::vector<double> values) {
+    if (values.size() != rows_) {
+        throw std::invalid_argument("column length does not match the batch");
+    }
+    Column& column = columns_.at(slot);
+    column = Column();
+    column.type = ColumnType::Double;
+    column.doubles = std::move(values);
+    column.present.assign(rows_, 1);
+}
+
+void ColumnarBatch::setMissing(SlotId slot, std::size_t row) {
+    Column& column = columns_.at(slot);
+    if (column.present.at(row)) {
+        column.present[row] = 0;
+        ++column.missing;
+    }
+}
+
+std::size_t ColumnarBatch::rows() const {
+    return rows_;
+}
+
+const FeatureSchema& ColumnarBatch::schema() const {
+    return *schema_;
+}
+
+ColumnType ColumnarBatch::columnType(SlotId slot) const {
+    return columns_[slot].type;
+}
+
+const std::int32_t* ColumnarBatch::intColumn(SlotId slot) const {
+    return columns_[slot].type == ColumnType::Int32 ? columns_[slot].ints.data() : nullptr;
+}
+
+const double* ColumnarBatch::doubleColumn(SlotId slot) const {
+    return columns_[slot].type == ColumnType::Double ? columns_[slot].doubles.data() : nullptr;
+}
+
+const std::uint8_t* ColumnarBatch::presence(SlotId slot) const {
+    return columns_[slot].missing ? columns_[slot].present.data() : nullptr;
+}
+
+FeatureValue ColumnarBatch::value(SlotId slot, std::size_t row) const {
+    const Column& column = columns_[slot];
+    FeatureValue v;
+    if (!column.present[row]) {
+        return v;
+    }
+    switch (column.type) {
+        case ColumnType::Int32:
+            v.type = ValueType::Int;
+            v.i = column.ints[row];
+            break;
+        case ColumnType::Double:
+            v.type = ValueType::Double;
+            v.d = column.doubles[row];
+            break;
+        case ColumnType::Generic:
+            v = column.values[row];
+            break;
+    }
+    return v;
+}
+
+void ColumnarBatch::loadRow(std::size_t row, FlatContext& out) const {
+    out.reset();
+    for (SlotId slot = 0; slot < columns_.size() && slot < out.size(); ++slot) {
+        FeatureValue v = value(slot, row);
+        switch (v.type) {
+            case ValueType::Int:
+                out.set(slot, v.i);
+                break;
+            case ValueType::Double:
+                out.set(slot, v.d);
+                break;
+            case ValueType::Bool:
+                out.set(slot, v.b);
+                break;
+            case ValueType::String:
+                out.set(slot, std::string(v.s, v.length));
+                break;
+            case ValueType::Missing:
+                break;
+        }
+    }
+}
+
+void findLeavesColumnar(const FlatTree& tree, const ColumnarBatch& batch,
+                        NodeIndex* leaves) {
+    if (batch.rows() == 0) {
+        return;
+    }
+
+    ColumnarEvaluator evaluator(tree, batch);
+    std::vector<std::uint8_t> mask;
+    std::vector<Selection> pending(1);
+    pending[0].node = tree.getRoot();
+    pending[0].rows.resize(batch.rows());
+    std::iota(pending[0].rows.begin(), pending[0].rows.end(), 0u);
+
+    while (!pending.empty()) {
+        Selection selection = std::move(pending.back());
+        pending.pop_back();
+        const FlatNode& node = tree.getNode(selection.node);
+
+        switch (node.kind) {
+            case FlatNodeKind::Outcome:
+                for (std::uint32_t row : selection.rows) {
+                    leaves[row] = selection.node;
+                }
+                break;
+            case FlatNodeKind::Decision: {
+                mask.resize(selection.rows.size());
+                evaluator.test(node.operand, selection.rows.data(),
+                               selection.rows.size(), mask.data());
+                Selection taken{node.first, {}};
+                Selection rest{node.second, {}};
+                partition(selection.rows, mask.data(), taken.rows, rest.rows);
+                if (!rest.rows.empty()) {
+                    pending.push_back(std::move(rest));
+                }
+                if (!taken.rows.empty()) {
+                    pending.push_back(std::move(taken));
+                }
+                break;
+            }
+            case FlatNodeKind::MultiBranch: {
+                std::vector<std::uint32_t> remaining = std::move(selection.rows);
+                for (std::uint32_t i = 0; i < node.first && !remaining.empty(); ++i) {
+                    const FlatBranch& branch = tree.getBranch(node.operand + i);
+                    mask.resize(remaining.size());
+                    evaluator.test(branch.predicate, remaining.data(),
+                                   remaining.size(), mask.data());
+                    Selection taken{branch.child, {}};
+                    std::vector<std::uint32_t> rest;
+                    partition(remaining, mask.data(), taken.rows, rest);
+                    if (!taken.rows.empty()) {
+                        pending.push_back(std::move(taken));
+                    }
+                    remaining = std::move(rest);
+                }
+                if (!remaining.empty()) {
+                    pending.push_back({node.second, std::move(remaining)});
+                }
+                break;
+            }
+            case FlatNodeKind::Switch: {
+                const FlatSwitch& flatSwitch = tree.getSwitch(node.operand);
+                std::vector<std::uint32_t> cases(selection.rows.size());
+                evaluator.select(flatSwitch, selection.rows.data(), selection.rows.size(),
+                                 cases.data());
+                std::vector<std::vector<std::uint32_t>> buckets(node.first + 1);
+                for (std::size_t i = 0; i < cases.size(); ++i) {
+                    buckets[cases[i]].push_back(selection.rows[i]);
+                }
+                for (std::uint32_t i = 0; i <= node.first; ++i) {
+                    if (!buckets[i].empty()) {
+                        pending.push_back({tree.childOf(selection.node, i), std::move(buckets[i])});
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
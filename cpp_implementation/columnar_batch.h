@@ -0,0 +1,62 @@
+#pragma once
+
+#include "flat_tree.h"
+
+#include <cstdint>
+#include <forward_list>
+#include <string>
+#include <vector>
+
+enum class ColumnType : std::uint8_t { Int32, Double, Generic };
+
+// A struct-of-arrays batch: one contiguous typed array per schema slot plus a
+// presence byte per row. Int32 and Double columns feed the SIMD comparison
+// kernels; columns holding strings, bools, mixed types or integers that a
+// double cannot represent exactly are stored as Generic FeatureValues.
+class ColumnarBatch {
+private:
+  struct Column {
+    ColumnType type = ColumnType::Int32;
+    std::vector<std::int32_t> ints;
+    std::vector<double> doubles;
+    std::vector<FeatureValue> values;
+    std::vector<std::uint8_t> present;
+    std::size_t missing = 0;
+  };
+
+  const FeatureSchema *schema_;
+  std::size_t rows_;
+  std::vector<Column> columns_;
+  std::forward_list<std::string> strings_;
+
+public:
+  // Every column starts as an Int32 column with all rows missing.
+  ColumnarBatch(const FeatureSchema &schema, std::size_t rows);
+
+  static ColumnarBatch fromRows(const FeatureSchema &schema,
+                                const FlatContext *rows, std::size_t count);
+
+  void setColumn(SlotId slot, std::vector<std::int32_t> values);
+  void setColumn(SlotId slot, std::vector<double> values);
+  void setMissing(SlotId slot, std::size_t row);
+
+  std::size_t rows() const;
+  const FeatureSchema &schema() const;
+  ColumnType columnType(SlotId slot) const;
+  const std::int32_t *intColumn(SlotId slot) const;
+  const double *doubleColumn(SlotId slot) const;
+  // Null when every row of the column is present.
+  const std::uint8_t *presence(SlotId slot) const;
+  FeatureValue value(SlotId slot, std::size_t row) const;
+  void loadRow(std::size_t row, FlatContext &out) const;
+};
+
+// Evaluates the tree node by node instead of row by row: each node partitions
+// the row indices that reached it, with comparisons against constants run as
+// SIMD kernels over the columns. Other conditions fall back to evaluating the
+// row through a FlatContext. Writes the reached leaf of every row.
+void findLeavesColumnar(const FlatTree &tree, const ColumnarBatch &batch,
+                        NodeIndex *leaves);
+
+// True when the AVX2 kernels are in use on this machine.
+bool columnarUsesAvx2();
@@ -0,0 +1,528 @@
+#include "condition_expr.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+bool isNumeric(ValueType type) {
+    return type == ValueType::Int || type == ValueType::Double ||
+           type == ValueType::Bool;
+}
+
+double numericValue(const FeatureValue& v) {
+    switch (v.type) {
+        case ValueType::Int:
+            return static_cast<double>(v.i);
+        case ValueType::Double:
+            return v.d;
+        case ValueType::Bool:
+            return v.b ? 1.0 : 0.0;
+        default:
+            return 0.0;
+    }
+}
+
+template <typename T>
+bool applyOp(CompareOp op, const T& lhs, const T& rhs) {
+    switch (op) {
+        case CompareOp::Lt:
+            return lhs < rhs;
+        case CompareOp::Le:
+            return lhs <= rhs;
+        case CompareOp::Gt:
+            return lhs > rhs;
+        case CompareOp::Ge:
+            return lhs >= rhs;
+        case CompareOp::Eq:
+            return lhs == rhs;
+        case CompareOp::Ne:
+            return lhs != rhs;
+    }
+    return false;
+}
+
+bool truthy(const FeatureValue& v) {
+    bool value = false;
+    Coercion coercion = convertValue(v, value);
+    return (coercion == Coercion::Exact || coercion == Coercion::Coerced) && value;
+}
+
+
+int precedence(ExprKind kind) {
+    switch (kind) {
+        case ExprKind::Or:
+            return 1;
+        case ExprKind::And:
+            return 2;
+        case ExprKind::Not:
+            return 3;
+        case ExprKind::Compare:
+        case ExprKind::In:
+            return 4;
+        case ExprKind::Feature:
+        case ExprKind::Constant:
+            return 5;
+    }
+    return 0;
+}
+
+// A feature name as parseExpr() reads it back: bare when it is a plain
+// word, otherwise in backquotes with ` and \ escaped. "default" is quoted
+// too, since a bare "default" condition marks a multi-branch default in
+// toJson() output.
+std::string formatFeatureName(const std::string& name) {
+    constexpr std::string_view kSpecial = " \t\n\r()[],!<>=&|?\"`\\";
+    bool plain = !name.empty() && name != "true" && name != "false" && name != "inf" &&
+                 name != "nan" && name != "default" && !(name[0] >= '0' && name[0] <= '9') &&
+                 name[0] != '-' && name[0] != '.';
+    for (char c : name) {
+        plain = plain && kSpecial.find(c) == std::string_view::npos;
+    }
+    if (plain) {
+        return name;
+    }
+
+    std::string out = "`";
+    for (char c : name) {
+        if (c == '`' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "`";
+}
+
+std::string formatOperand(const ExprPtr& operand, int parentPrecedence) {
+    std::string text = operand->toString();
+    bool needsParens = precedence(operand->kind()) <= parentPrecedence ||
+                       (operand->kind() == ExprKind::Feature &&
+                        operand->hasFallback() && parentPrecedence >= 3);
+    return needsParens ? "(" + text + ")" : text;
+}
+
+}
+
+std::string formatLiteral(const Result& value) {
+    if (const auto* str = std::get_if<std::string>(&value)) {
+        std::string out = "\"";
+        for (char c : *str) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    if (const auto* d = std::get_if<double>(&value)) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.15g", *d);
+        if (std::strtod(buffer, nullptr) != *d) {
+            std::snprintf(buffer, sizeof(buffer), "%.17g", *d);
+        }
+        std::string out = buffer;
+        if (out.find_first_of(".eEn") == std::string::npos) {
+            out += ".0";
+        }
+        return out;
+    }
+
+    if (const auto* b = std::get_if<bool>(&value)) {
+        return *b ? "true" : "false";
+    }
+
+    return std::to_string(std::get<int>(value));
+}
+
+bool compareValues(CompareOp op, const FeatureValue& lhs, const FeatureValue& rhs) {
+    if (lhs.type == ValueType::Missing || rhs.type == ValueType::Missing) {
+        return false;
+    }
+
+    if (lhs.type == ValueType::Int && rhs.type == ValueType::Int) {
+        return applyOp(op, lhs.i, rhs.i);
+    }
+
+    if (isNumeric(lhs.type) && isNumeric(rhs.type)) {
+        return applyOp(op, numericValue(lhs), numericValue(rhs));
+    }
+
+    if (lhs.type == ValueType::String && rhs.type == ValueType::String) {
+        std::string_view left(lhs.s, lhs.length);
+        std::string_view right(rhs.s, rhs.length);
+        return applyOp(op, left, right);
+    }
+
+    return op == CompareOp::Ne;
+}
+
+const char* compareOpSymbol(CompareOp op) {
+    switch (op) {
+        case CompareOp::Lt:
+            return "<";
+        case CompareOp::Le:
+            return "<=";
+        case CompareOp::Gt:
+            return ">";
+        case CompareOp::Ge:
+            return ">=";
+        case CompareOp::Eq:
+            return "==";
+        case CompareOp::Ne:
+            return "!=";
+    }
+    return "?";
+}
+
+ConditionExpr::ConditionExpr(ExprKind kind) : kind_(kind) {}
+
+ExprPtr ConditionExpr::feature(const std::string& name, const FeatureSchema* schema) {
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(ExprKind::Feature));
+    expr->feature_ = name;
+    expr->schema_ = schema;
+    expr->slot_ = schema ? schema->find(name) : kInvalidSlot;
+    return expr;
+}
+
+ExprPtr ConditionExpr::feature(const std::string& name,
+                               const Result& fallback,
+                               const FeatureSchema* schema) {
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(ExprKind::Feature));
+    expr->feature_ = name;
+    expr->schema_ = schema;
+    expr->slot_ = schema ? schema->find(name) : kInvalidSlot;
+    expr->hasFallback_ = true;
+    expr->value_ = fallback;
+    expr->resolved_ = resolveResult(expr->value_);
+    return expr;
+}
+
+ExprPtr ConditionExpr::constant(const Result& value) {
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(ExprKind::Constant));
+    expr->value_ = value;
+    expr->resolved_ = resolveResult(expr->value_);
+    return expr;
+}
+
+ExprPtr ConditionExpr::compare(CompareOp op, ExprPtr lhs, ExprPtr rhs) {
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(ExprKind::Compare));
+    expr->op_ = op;
+    expr->operands_ = {std::move(lhs), std::move(rhs)};
+    return expr;
+}
+
+ExprPtr ConditionExpr::logical(ExprKind kind, std::vector<ExprPtr> operands) {
+    if (operands.size() == 1) {
+        return std::move(operands[0]);
+    }
+    if (operands.empty()) {
+        return constant(kind == ExprKind::And);
+    }
+
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(kind));
+    for (auto& operand : operands) {
+        if (operand->kind() == kind) {
+            for (const auto& nested : operand->operands_) {
+                expr->operands_.push_back(nested);
+            }
+        } else {
+            expr->operands_.push_back(std::move(operand));
+        }
+    }
+    return expr;
+}
+
+ExprPtr ConditionExpr::negate(ExprPtr operand) {
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(ExprKind::Not));
+    expr->operands_ = {std::move(operand)};
+    return expr;
+}
+
+ExprPtr ConditionExpr::in(ExprPtr operand, std::vector<Result> values) {
+    auto expr = std::shared_ptr<ConditionExpr>(new ConditionExpr(ExprKind::In));
+    expr->operands_ = {std::move(operand)};
+    expr->values_ = std::move(values);
+    for (const auto& value : expr->values_) {
+        expr->resolvedValues_.push_back(resolveResult(value));
+    }
+    return expr;
+}
+
+FeatureValue ConditionExpr::lookup(const Context& context) const {
+    auto it = context.find(feature_);
+    if (it != context.end()) {
+        FeatureValue v = resolveAny(it->second);
+        if (v.type != ValueType::Missing) {
+            return v;
+        }
+    }
+    return resolved_;
+}
+
+FeatureValue ConditionExpr::lookup(const FlatContext& context) const {
+    SlotId slot = schema_ == &context.schema() ? slot_
+                                               : context.schema().find(feature_);
+    const FeatureValue& v = context.value(slot);
+    return v.type != ValueType::Missing ? v : resolved_;
+}
+
+template <typename ContextT>
+FeatureValue ConditionExpr::valueOf(const ContextT& context) const {
+    if (kind_ == ExprKind::Feature) {
+        return lookup(context);
+    }
+
+    if (kind_ == ExprKind::Constant) {
+        return resolved_;
+    }
+
+    FeatureValue v;
+    v.type = ValueType::Bool;
+    v.b = test(context);
+    return v;
+}
+
+template <typename ContextT>
+bool ConditionExpr::test(const ContextT& context) const {
+    switch (kind_) {
+        case ExprKind::Feature:
+        case ExprKind::Constant:
+            return truthy(valueOf(context));
+        case ExprKind::Compare:
+            return compareValues(op_, operands_[0]->valueOf(context),
+                                 operands_[1]->valueOf(context));
+        case ExprKind::And:
+            for (const auto& operand : operands_) {
+                if (!operand->test(context)) {
+                    return false;
+                }
+            }
+            return true;
+        case ExprKind::Or:
+            for (const auto& operand : operands_) {
+                if (operand->test(context)) {
+                    return true;
+                }
+            }
+            return false;
+        case ExprKind::Not:
+            return !operands_[0]->test(context);
+        case ExprKind::In: {
+            FeatureValue v = operands_[0]->valueOf(context);
+            for (const auto& candidate : resolvedValues_) {
+                if (compareValues(CompareOp::Eq, v, candidate)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+bool ConditionExpr::evaluate(const Context& context) const {
+    return test(context);
+}
+
+bool ConditionExpr::evaluate(const FlatContext& context) const {
+    return test(context);
+}
+
+FeatureValue ConditionExpr::read(const Context& context) const {
+    return valueOf(context);
+}
+
+FeatureValue ConditionExpr::read(const FlatContext& context) const {
+    return valueOf(context);
+}
+
+ExprKind ConditionExpr::kind() const {
+    return kind_;
+}
+
+CompareOp ConditionExpr::op() const {
+    return op_;
+}
+
+const std::string& ConditionExpr::getFeature() const {
+    return feature_;
+}
+
+SlotId ConditionExpr::getSlot() const {
+    return slot_;
+}
+
+const FeatureSchema* ConditionExpr::getSchema() const {
+    return schema_;
+}
+
+bool ConditionExpr::hasFallback() const {
+    return hasFallback_;
+}
+
+const Result& ConditionExpr::getValue() const {
+    return value_;
+}
+
+const std::vector<ExprPtr>& ConditionExpr::getOperands() const {
+    return operands_;
+}
+
+const std::vector<Result>& ConditionExpr::getValues() const {
+    return values_;
+}
+
+std::string ConditionExpr::toString() const {
+    int level = precedence(kind_);
+
+    switch (kind_) {
+        case ExprKind::Feature:
+            return hasFallback_ ? formatFeatureName(feature_) + " ?? " + formatLiteral(value_)
+                                : formatFeatureName(feature_);
+        case ExprKind::Constant:
+            return formatLiteral(value_);
+        case ExprKind::Compare:
+            return formatOperand(operands_[0], level) + " " + compareOpSymbol(op_) +
+                   " " + formatOperand(operands_[1], level);
+        case ExprKind::And:
+        case ExprKind::Or: {
+            std::string text;
+            for (size_t i = 0; i < operands_.size(); ++i) {
+                if (i > 0) {
+                    text += kind_ == ExprKind::And ? " && " : " || ";
+                }
+                text += formatOperand(operands_[i], level);
+            }
+            return text;
+        }
+        case ExprKind::Not:
+            return "!" + formatOperand(operands_[0], precedence(ExprKind::Compare));
+        case ExprKind::In: {
+            std::string text = formatOperand(operands_[0], level) + " in [";
+            for (size_t i = 0; i < values_.size(); ++i) {
+                if (i > 0) {
+                    text += ", ";
+                }
+                text += formatLiteral(values_[i]);
+            }
+            return text + "]";
+        }
+    }
+    return "";
+}
+
+std::size_t hashExpr(const ConditionExpr& expr) {
+    std::size_t hash = static_cast<std::size_t>(expr.kind()) * 31 +
+                       static_cast<std::size_t>(expr.op());
+    auto mix = [&](std::size_t value) {
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    };
+    mix(std::hash<std::string>()(expr.getFeature()));
+    mix(expr.getSlot());
+    mix(std::hash<const FeatureSchema*>()(expr.getSchema()));
+    mix(expr.hasFallback());
+    mix(std::hash<Result>()(expr.getValue()));
+    for (const auto& value : expr.getValues()) {
+        mix(std::hash<Result>()(value));
+    }
+    for (const auto& operand : expr.getOperands()) {
+        mix(hashExpr(*operand));
+    }
+    return hash;
+}
+
+bool sameExpr(const ConditionExpr& a, const ConditionExpr& b) {
+    if (&a == &b) {
+        return true;
+    }
+    if (a.kind() != b.kind() || a.op() != b.op() || a.getFeature() != b.getFeature() ||
+        a.getSlot() != b.getSlot() || a.getSchema() != b.getSchema() ||
+        a.hasFallback() != b.hasFallback() || a.getValue() != b.getValue() ||
+        a.getValues() != b.getValues() || a.getOperands().size() != b.getOperands().size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a.getOperands().size(); ++i) {
+        if (!sameExpr(*a.getOperands()[i], *b.getOperands()[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Expr::Expr(ExprPtr expr) : expr_(std::move(expr)) {}
+
+Expr::Expr(int value) : expr_(ConditionExpr::constant(value)) {}
+
+Expr::Expr(double value) : expr_(ConditionExpr::constant(value)) {}
+
+Expr::Expr(bool value) : expr_(ConditionExpr::constant(value)) {}
+
+Expr::Expr(const char* value) : expr_(ConditionExpr::constant(std::string(value))) {}
+
+Expr::Expr(const std::string& value) : expr_(ConditionExpr::constant(value)) {}
+
+Expr Expr::in(std::vector<Result> values) const {
+    return ConditionExpr::in(expr_, std::move(values));
+}
+
+const ExprPtr& Expr::get() const {
+    return expr_;
+}
+
+Expr feature(const std::string& name) {
+    return ConditionExpr::feature(name);
+}
+
+Expr feature(const std::string& name, const Result& fallback) {
+    return ConditionExpr::feature(name, fallback);
+}
+
+Expr feature(FeatureSchema& schema, const std::string& name) {
+    schema.intern(name);
+    return ConditionExpr::feature(name, &schema);
+}
+
+Expr feature(FeatureSchema& schema, const std::string& name, const Result& fallback) {
+    schema.intern(name);
+    return ConditionExpr::feature(name, fallback, &schema);
+}
+
+Expr operator<(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::compare(CompareOp::Lt, lhs.get(), rhs.get());
+}
+
+Expr operator<=(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::compare(CompareOp::Le, lhs.get(), rhs.get());
+}
+
+Expr operator>(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::compare(CompareOp::Gt, lhs.get(), rhs.get());
+}
+
+Expr operator>=(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::compare(CompareOp::Ge, lhs.get(), rhs.get());
+}
+
+Expr operator==(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::compare(CompareOp::Eq, lhs.get(), rhs.get());
+}
+
+Expr operator!=(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::compare(CompareOp::Ne, lhs.get(), rhs.get());
+}
+
+Expr operator&&(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::logical(ExprKind::And, {lhs.get(), rhs.get()});
+}
+
+Expr operator||(const Expr& lhs, const Expr& rhs) {
+    return ConditionExpr::logical(ExprKind::Or, {lhs.get(), rhs.get()});
+}
+
+Expr operator!(const Expr& operand) {
+    return ConditionExpr::negate(operand.get());
+}
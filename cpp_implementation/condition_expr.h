@@ -0,0 +1,138 @@
+#pragma once
+
+#include "context.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ExprKind : std::uint8_t {
+  Feature,
+  Constant,
+  Compare,
+  And,
+  Or,
+  Not,
+  In
+};
+
+enum class CompareOp : std::uint8_t { Lt, Le, Gt, Ge, Eq, Ne };
+
+class ConditionExpr;
+
+using ExprPtr = std::shared_ptr<const ConditionExpr>;
+
+// An inspectable node condition. Feature references read a feature by name
+// (or by slot once bound to a schema) and fall back to an optional default
+// when it is missing. Comparisons between numbers compare numerically,
+// strings compare lexicographically, and any comparison involving a missing
+// value or mixing strings with numbers is false (!= is true for the latter).
+class ConditionExpr {
+private:
+  ExprKind kind_;
+  CompareOp op_ = CompareOp::Eq;
+  std::string feature_;
+  SlotId slot_ = kInvalidSlot;
+  const FeatureSchema *schema_ = nullptr;
+  bool hasFallback_ = false;
+  Result value_;
+  FeatureValue resolved_;
+  std::vector<ExprPtr> operands_;
+  std::vector<Result> values_;
+  std::vector<FeatureValue> resolvedValues_;
+
+  explicit ConditionExpr(ExprKind kind);
+
+  FeatureValue lookup(const Context &context) const;
+  FeatureValue lookup(const FlatContext &context) const;
+
+  template <typename ContextT>
+  FeatureValue valueOf(const ContextT &context) const;
+
+  template <typename ContextT> bool test(const ContextT &context) const;
+
+public:
+  ConditionExpr(const ConditionExpr &) = delete;
+  ConditionExpr &operator=(const ConditionExpr &) = delete;
+
+  static ExprPtr feature(const std::string &name,
+                         const FeatureSchema *schema = nullptr);
+  static ExprPtr feature(const std::string &name, const Result &fallback,
+                         const FeatureSchema *schema = nullptr);
+  static ExprPtr constant(const Result &value);
+  static ExprPtr compare(CompareOp op, ExprPtr lhs, ExprPtr rhs);
+  // Nested operands of the same kind are spliced in; a single operand is
+  // returned as is and none becomes the constant true (And) or false (Or).
+  static ExprPtr logical(ExprKind kind, std::vector<ExprPtr> operands);
+  static ExprPtr negate(ExprPtr operand);
+  static ExprPtr in(ExprPtr operand, std::vector<Result> values);
+
+  bool evaluate(const Context &context) const;
+  bool evaluate(const FlatContext &context) const;
+  // The value a Feature (with its fallback) or Constant compares with.
+  FeatureValue read(const Context &context) const;
+  FeatureValue read(const FlatContext &context) const;
+
+  ExprKind kind() const;
+  CompareOp op() const;
+  const std::string &getFeature() const;
+  SlotId getSlot() const;
+  const FeatureSchema *getSchema() const;
+  bool hasFallback() const;
+  const Result &getValue() const;
+  const std::vector<ExprPtr> &getOperands() const;
+  const std::vector<Result> &getValues() const;
+
+  std::string toString() const;
+};
+
+bool compareValues(CompareOp op, const FeatureValue &lhs,
+                   const FeatureValue &rhs);
+
+const char *compareOpSymbol(CompareOp op);
+
+// value as it appears in a condition: strings quoted with " and \ escaped,
+// doubles with enough digits to read back exactly and always a '.', an
+// exponent, "inf" or "nan", so they never read back as ints.
+std::string formatLiteral(const Result &value);
+
+// Structural identity: the same kinds, operators, feature bindings and
+// constants throughout, so both expressions evaluate alike on any input.
+std::size_t hashExpr(const ConditionExpr &expr);
+bool sameExpr(const ConditionExpr &a, const ConditionExpr &b);
+
+// Builder for ConditionExpr trees, e.g.
+//   feature("credit_score") >= 750 && feature("debt_ratio", 1.0) < 0.3
+class Expr {
+private:
+  ExprPtr expr_;
+
+public:
+  Expr(ExprPtr expr);
+  Expr(int value);
+  Expr(double value);
+  Expr(bool value);
+  Expr(const char *value);
+  Expr(const std::string &value);
+
+  Expr in(std::vector<Result> values) const;
+
+  const ExprPtr &get() const;
+};
+
+Expr feature(const std::string &name);
+Expr feature(const std::string &name, const Result &fallback);
+Expr feature(FeatureSchema &schema, const std::string &name);
+Expr feature(FeatureSchema &schema, const std::string &name,
+             const Result &fallback);
+
+Expr operator<(const Expr &lhs, const Expr &rhs);
+Expr operator<=(const Expr &lhs, const Expr &rhs);
+Expr operator>(const Expr &lhs, const Expr &rhs);
+Expr operator>=(const Expr &lhs, const Expr &rhs);
+Expr operator==(const Expr &lhs, const Expr &rhs);
+Expr operator!=(const Expr &lhs, const Expr &rhs);
+Expr operator&&(const Expr &lhs, const Expr &rhs);
+Expr operator||(const Expr &lhs, const Expr &rhs);
+Expr operator!(const Expr &operand);
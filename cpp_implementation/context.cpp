@@ -0,0 +1,306 @@
+#include "context.h"
+
+#include <cstring>
+
+SlotId FeatureSchema::intern(const std::string& name, ValueType expected) {
+    auto it = slots_.find(name);
+    if (it != slots_.end()) {
+        if (expected != ValueType::Missing) {
+            types_[it->second] = expected;
+        }
+        return it->second;
+    }
+
+    SlotId slot = static_cast<SlotId>(names_.size());
+    slots_.emplace(name, slot);
+    names_.push_back(name);
+    types_.push_back(expected);
+    return slot;
+}
+
+SlotId FeatureSchema::find(const std::string& name) const {
+    auto it = slots_.find(name);
+    return it != slots_.end() ? it->second : kInvalidSlot;
+}
+
+const std::string& FeatureSchema::name(SlotId slot) const {
+    return names_.at(slot);
+}
+
+ValueType FeatureSchema::expectedType(SlotId slot) const {
+    return slot < types_.size() ? types_[slot] : ValueType::Missing;
+}
+
+std::size_t FeatureSchema::size() const {
+    return names_.size();
+}
+
+FeatureValue resolveAny(const std::any& value) {
+    FeatureValue v;
+    const std::type_info& type = value.type();
+
+    if (type == typeid(int)) {
+        v.type = ValueType::Int;
+        v.i = *std::any_cast<int>(&value);
+    } else if (type == typeid(double)) {
+        v.type = ValueType::Double;
+        v.d = *std::any_cast<double>(&value);
+    } else if (type == typeid(bool)) {
+        v.type = ValueType::Bool;
+        v.b = *std::any_cast<bool>(&value);
+    } else if (type == typeid(std::string)) {
+        const std::string& str = *std::any_cast<std::string>(&value);
+        v.type = ValueType::String;
+        v.s = str.data();
+        v.length = static_cast<std::uint32_t>(str.size());
+    } else if (type == typeid(long)) {
+        v.type = ValueType::Int;
+        v.i = *std::any_cast<long>(&value);
+    } else if (type == typeid(long long)) {
+        v.type = ValueType::Int;
+        v.i = *std::any_cast<long long>(&value);
+    } else if (type == typeid(unsigned)) {
+        v.type = ValueType::Int;
+        v.i = *std::any_cast<unsigned>(&value);
+    } else if (type == typeid(float)) {
+        v.type = ValueType::Double;
+        v.d = *std::any_cast<float>(&value);
+    } else if (type == typeid(const char*)) {
+        const char* str = *std::any_cast<const char*>(&value);
+        v.type = ValueType::String;
+        v.s = str;
+        v.length = static_cast<std::uint32_t>(std::strlen(str));
+    }
+
+    return v;
+}
+
+FeatureValue resolveResult(const Result& value) {
+    FeatureValue v;
+
+    if (const auto* str = std::get_if<std::string>(&value)) {
+        v.type = ValueType::String;
+        v.s = str->data();
+        v.length = static_cast<std::uint32_t>(str->size());
+    } else if (const auto* i = std::get_if<int>(&value)) {
+        v.type = ValueType::Int;
+        v.i = *i;
+    } else if (const auto* d = std::get_if<double>(&value)) {
+        v.type = ValueType::Double;
+        v.d = *d;
+    } else if (const auto* b = std::get_if<bool>(&value)) {
+        v.type = ValueType::Bool;
+        v.b = *b;
+    }
+
+    return v;
+}
+
+Coercion coerceValue(FeatureValue& v, ValueType target) {
+    if (v.type == ValueType::Missing) {
+        return Coercion::Missing;
+    }
+
+    if (target == ValueType::Missing || v.type == target) {
+        return Coercion::Exact;
+    }
+
+    Coercion coercion = Coercion::Mismatch;
+    FeatureValue out;
+    switch (target) {
+        case ValueType::Int:
+            coercion = convertValue(v, out.i);
+            break;
+        case ValueType::Double:
+            coercion = convertValue(v, out.d);
+            break;
+        case ValueType::Bool:
+            coercion = convertValue(v, out.b);
+            break;
+        case ValueType::String:
+        case ValueType::Missing:
+            break;
+    }
+
+    if (coercion == Coercion::Mismatch) {
+        v = FeatureValue();
+        return coercion;
+    }
+
+    out.type = target;
+    v = out;
+    return coercion;
+}
+
+FlatContext::FlatContext(const FeatureSchema& schema)
+    : schema_(&schema), source_(nullptr), values_(schema.size()) {}
+
+FlatContext::FlatContext(const FlatContext& other)
+    : schema_(other.schema_), source_(other.source_), values_(other.values_),
+      stats_(other.stats_) {
+    for (SlotId slot = 0; slot < values_.size(); ++slot) {
+        const FeatureValue& v = other.values_[slot];
+        if (v.type == ValueType::String) {
+            values_[slot].s = ownString(slot, v.s, v.length);
+        }
+    }
+}
+
+FlatContext& FlatContext::operator=(const FlatContext& other) {
+    if (this != &other) {
+        FlatContext copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+FlatContext FlatContext::fromContext(const FeatureSchema& schema,
+                                     const Context& context) {
+    FlatContext flat(schema);
+    flat.assign(context);
+    return flat;
+}
+
+void FlatContext::assign(const Context& context) {
+    reset();
+
+    for (const auto& [key, any] : context) {
+        SlotId slot = schema_->find(key);
+        if (slot == kInvalidSlot) {
+            continue;
+        }
+
+        FeatureValue& v = values_[slot];
+        v = resolveAny(any);
+        switch (coerceValue(v, schema_->expectedType(slot))) {
+            case Coercion::Coerced:
+                stats_.countCoercion();
+                break;
+            case Coercion::Mismatch:
+                stats_.countMismatch();
+                break;
+            case Coercion::Exact:
+            case Coercion::Missing:
+                break;
+        }
+    }
+
+    source_ = &context;
+}
+
+void FlatContext::reset() {
+    values_.assign(schema_->size(), FeatureValue{});
+    source_ = nullptr;
+    materialized_.reset();
+    stats_.clear();
+}
+
+const char* FlatContext::ownString(SlotId slot, const char* data, std::size_t length) {
+    if (strings_.empty()) {
+        strings_.resize(values_.size());
+    }
+    return strings_[slot].assign(data, length).data();
+}
+
+void FlatContext::set(SlotId slot, int value) {
+    set(slot, static_cast<std::int64_t>(value));
+}
+
+void FlatContext::set(SlotId slot, std::int64_t value) {
+    FeatureValue& v = values_.at(slot);
+    v.type = ValueType::Int;
+    v.i = value;
+    source_ = nullptr;
+    materialized_.reset();
+}
+
+void FlatContext::set(SlotId slot, double value) {
+    FeatureValue& v = values_.at(slot);
+    v.type = ValueType::Double;
+    v.d = value;
+    source_ = nullptr;
+    materialized_.reset();
+}
+
+void FlatContext::set(SlotId slot, bool value) {
+    FeatureValue& v = values_.at(slot);
+    v.type = ValueType::Bool;
+    v.b = value;
+    source_ = nullptr;
+    materialized_.reset();
+}
+
+void FlatContext::set(SlotId slot, const std::string& value) {
+    FeatureValue& v = values_.at(slot);
+    v.type = ValueType::String;
+    v.s = ownString(slot, value.data(), value.size());
+    v.length = static_cast<std::uint32_t>(value.size());
+    source_ = nullptr;
+    materialized_.reset();
+}
+
+void FlatContext::set(SlotId slot, const char* value) {
+    set(slot, std::string(value));
+}
+
+void FlatContext::clear(SlotId slot) {
+    values_.at(slot) = FeatureValue();
+    source_ = nullptr;
+    materialized_.reset();
+}
+
+const FeatureValue& FlatContext::value(SlotId slot) const {
+    static const FeatureValue missing;
+    return slot < values_.size() ? values_[slot] : missing;
+}
+
+bool FlatContext::has(SlotId slot) const {
+    return value(slot).type != ValueType::Missing;
+}
+
+const FeatureValue* FlatContext::data() const {
+    return values_.data();
+}
+
+std::size_t FlatContext::size() const {
+    return values_.size();
+}
+
+const FeatureSchema& FlatContext::schema() const {
+    return *schema_;
+}
+
+const Context& FlatContext::toContext() const {
+    if (source_) {
+        return *source_;
+    }
+
+    return materialized_.get([this] {
+        Context context;
+        for (SlotId slot = 0; slot < values_.size(); ++slot) {
+            const FeatureValue& v = values_[slot];
+            const std::string& name = schema_->name(slot);
+            switch (v.type) {
+                case ValueType::Int:
+                    context[name] = static_cast<int>(v.i);
+                    break;
+                case ValueType::Double:
+                    context[name] = v.d;
+                    break;
+                case ValueType::Bool:
+                    context[name] = v.b;
+                    break;
+                case ValueType::String:
+                    context[name] = std::string(v.s, v.length);
+                    break;
+                case ValueType::Missing:
+                    break;
+            }
+        }
+        return context;
+    });
+}
+
+CoercionStats FlatContext::coercionStats() const {
+    return stats_.snapshot();
+}
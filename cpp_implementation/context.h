@@ -0,0 +1,311 @@
+#pragma once
+
+#include <any>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+using Context = std::map<std::string, std::any>;
+
+using Result = std::variant<std::string, int, double, bool>;
+
+using SlotId = std::uint32_t;
+
+constexpr SlotId kInvalidSlot = static_cast<SlotId>(-1);
+
+enum class ValueType : std::uint8_t { Missing, Int, Double, Bool, String };
+
+// Interns feature names into dense slot ids. Build it once, before any
+// FlatContext is created from it; slots are never renumbered. A feature may
+// declare the type it is read as, and FlatContext::fromContext coerces
+// incoming values to it once per Context. ValueType::Missing leaves the
+// feature untyped.
+class FeatureSchema {
+private:
+  std::unordered_map<std::string, SlotId> slots_;
+  std::vector<std::string> names_;
+  std::vector<ValueType> types_;
+
+public:
+  SlotId intern(const std::string &name,
+                ValueType expected = ValueType::Missing);
+  SlotId find(const std::string &name) const;
+
+  const std::string &name(SlotId slot) const;
+  ValueType expectedType(SlotId slot) const;
+  std::size_t size() const;
+};
+
+struct FeatureValue {
+  ValueType type = ValueType::Missing;
+  std::uint32_t length = 0;
+  union {
+    std::int64_t i;
+    double d;
+    bool b;
+    const char *s;
+  };
+
+  FeatureValue() : i(0) {}
+};
+
+enum class Coercion : std::uint8_t { Exact, Coerced, Mismatch, Missing };
+
+// Coercion rules, applied without throwing:
+//   int    <- double holding an integral value in range, bool as 0/1
+//   double <- int, bool as 0/1
+//   bool   <- int or double holding exactly 0 or 1
+//   string <- string only
+// Anything else is a Mismatch and the caller falls back to its default.
+template <typename T> Coercion convertValue(const FeatureValue &v, T &out) {
+  if (v.type == ValueType::Missing) {
+    return Coercion::Missing;
+  }
+
+  if constexpr (std::is_same_v<T, bool>) {
+    switch (v.type) {
+    case ValueType::Bool:
+      out = v.b;
+      return Coercion::Exact;
+    case ValueType::Int:
+      if (v.i == 0 || v.i == 1) {
+        out = v.i == 1;
+        return Coercion::Coerced;
+      }
+      return Coercion::Mismatch;
+    case ValueType::Double:
+      if (v.d == 0.0 || v.d == 1.0) {
+        out = v.d == 1.0;
+        return Coercion::Coerced;
+      }
+      return Coercion::Mismatch;
+    default:
+      return Coercion::Mismatch;
+    }
+  } else if constexpr (std::is_integral_v<T>) {
+    switch (v.type) {
+    case ValueType::Int:
+      if (v.i < static_cast<std::int64_t>(std::numeric_limits<T>::min()) ||
+          v.i > static_cast<std::int64_t>(std::numeric_limits<T>::max())) {
+        return Coercion::Mismatch;
+      }
+      out = static_cast<T>(v.i);
+      return Coercion::Exact;
+    case ValueType::Double:
+      if (std::trunc(v.d) != v.d ||
+          v.d < static_cast<double>(std::numeric_limits<T>::min()) ||
+          v.d >= static_cast<double>(std::numeric_limits<T>::max()) + 1.0) {
+        return Coercion::Mismatch;
+      }
+      out = static_cast<T>(v.d);
+      return Coercion::Coerced;
+    case ValueType::Bool:
+      out = v.b ? 1 : 0;
+      return Coercion::Coerced;
+    default:
+      return Coercion::Mismatch;
+    }
+  } else if constexpr (std::is_floating_point_v<T>) {
+    switch (v.type) {
+    case ValueType::Double:
+      out = static_cast<T>(v.d);
+      return Coercion::Exact;
+    case ValueType::Int:
+      out = static_cast<T>(v.i);
+      return Coercion::Coerced;
+    case ValueType::Bool:
+      out = v.b ? 1 : 0;
+      return Coercion::Coerced;
+    default:
+      return Coercion::Mismatch;
+    }
+  } else if constexpr (std::is_same_v<T, std::string>) {
+    if (v.type != ValueType::String) {
+      return Coercion::Mismatch;
+    }
+    out.assign(v.s, v.length);
+    return Coercion::Exact;
+  } else {
+    static_assert(sizeof(T) == 0, "unsupported context value type");
+  }
+}
+
+// Reads the stored type of a std::any once. String values point into the
+// any, which must outlive the returned FeatureValue.
+FeatureValue resolveAny(const std::any &value);
+
+// Views a Result as a FeatureValue. String values point into the Result.
+FeatureValue resolveResult(const Result &value);
+
+// Converts v in place to the given type; returns how the value was produced.
+// On Mismatch v becomes Missing.
+Coercion coerceValue(FeatureValue &v, ValueType target);
+
+template <typename T>
+T getContextValue(const Context &ctx, const std::string &key, T defaultValue) {
+  auto it = ctx.find(key);
+  if (it == ctx.end()) {
+    return defaultValue;
+  }
+
+  if (const T *exact = std::any_cast<T>(&it->second)) {
+    return *exact;
+  }
+
+  T value{};
+  Coercion coercion = convertValue(resolveAny(it->second), value);
+  if (coercion == Coercion::Exact || coercion == Coercion::Coerced) {
+    return value;
+  }
+  return defaultValue;
+}
+
+struct CoercionStats {
+  std::uint32_t coercions = 0;
+  std::uint32_t mismatches = 0;
+};
+
+// CoercionStats as counted by FlatContext's const reads. The counters are
+// relaxed atomics so threads may read one FlatContext concurrently; copies
+// take a snapshot.
+class CoercionCounters {
+private:
+  std::atomic<std::uint32_t> coercions_{0};
+  std::atomic<std::uint32_t> mismatches_{0};
+
+public:
+  CoercionCounters() = default;
+  CoercionCounters(const CoercionCounters &other) noexcept { *this = other; }
+  CoercionCounters &operator=(const CoercionCounters &other) noexcept {
+    CoercionStats stats = other.snapshot();
+    coercions_.store(stats.coercions, std::memory_order_relaxed);
+    mismatches_.store(stats.mismatches, std::memory_order_relaxed);
+    return *this;
+  }
+
+  void countCoercion() { coercions_.fetch_add(1, std::memory_order_relaxed); }
+  void countMismatch() { mismatches_.fetch_add(1, std::memory_order_relaxed); }
+  void clear() { *this = CoercionCounters(); }
+  CoercionStats snapshot() const {
+    return {coercions_.load(std::memory_order_relaxed),
+            mismatches_.load(std::memory_order_relaxed)};
+  }
+};
+
+// The Context FlatContext::toContext() builds on first use. The first
+// caller builds it under a mutex and later ones see the published copy, so
+// threads may call toContext() on one FlatContext concurrently. reset() is
+// for FlatContext's mutators, which must not race with readers. Copies
+// start empty.
+class ContextCache {
+private:
+  std::mutex mutex_;
+  std::atomic<bool> ready_{false};
+  std::optional<Context> context_;
+
+public:
+  ContextCache() = default;
+  ContextCache(const ContextCache &) noexcept {}
+  ContextCache &operator=(const ContextCache &) noexcept {
+    reset();
+    return *this;
+  }
+
+  template <typename Build> const Context &get(Build &&build) {
+    if (!ready_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!ready_.load(std::memory_order_relaxed)) {
+        context_ = build();
+        ready_.store(true, std::memory_order_release);
+      }
+    }
+    return *context_;
+  }
+  void reset() {
+    context_.reset();
+    ready_.store(false, std::memory_order_relaxed);
+  }
+};
+
+// A Context laid out by slot: one tagged value per schema feature, so
+// lookups are an array index instead of a map walk plus std::any_cast.
+class FlatContext {
+private:
+  const FeatureSchema *schema_;
+  const Context *source_;
+  std::vector<FeatureValue> values_;
+  // One buffer per slot, sized on the first owned string, so setting a
+  // string slot again reuses its buffer instead of adding another.
+  std::vector<std::string> strings_;
+  mutable ContextCache materialized_;
+  mutable CoercionCounters stats_;
+
+  const char *ownString(SlotId slot, const char *data, std::size_t length);
+
+public:
+  explicit FlatContext(const FeatureSchema &schema);
+  FlatContext(const FlatContext &other);
+  FlatContext(FlatContext &&other) = default;
+  FlatContext &operator=(const FlatContext &other);
+  FlatContext &operator=(FlatContext &&other) = default;
+
+  // Borrows context rather than copying it: String slots point into its
+  // std::any values and toContext() returns it, so context must outlive the
+  // FlatContext or be replaced by another assign() before the next read.
+  static FlatContext fromContext(const FeatureSchema &schema,
+                                 const Context &context);
+
+  // Reloads every slot from context, keeping the slot storage, so one
+  // FlatContext can be reused across many inputs. As with fromContext(),
+  // context is borrowed and must stay alive while this FlatContext is read.
+  void assign(const Context &context);
+  // Marks every slot missing. Owned string buffers are kept for the next
+  // set() of the same slot.
+  void reset();
+
+  void set(SlotId slot, int value);
+  void set(SlotId slot, std::int64_t value);
+  void set(SlotId slot, double value);
+  void set(SlotId slot, bool value);
+  void set(SlotId slot, const std::string &value);
+  void set(SlotId slot, const char *value);
+  void clear(SlotId slot);
+
+  const FeatureValue &value(SlotId slot) const;
+  bool has(SlotId slot) const;
+  const FeatureValue *data() const;
+  std::size_t size() const;
+
+  template <typename T> T get(SlotId slot, T defaultValue) const;
+
+  const FeatureSchema &schema() const;
+  const Context &toContext() const;
+  CoercionStats coercionStats() const;
+};
+
+template <typename T>
+T FlatContext::get(SlotId slot, T defaultValue) const {
+  T out{};
+  switch (convertValue(value(slot), out)) {
+  case Coercion::Exact:
+    return out;
+  case Coercion::Coerced:
+    stats_.countCoercion();
+    return out;
+  case Coercion::Mismatch:
+    stats_.countMismatch();
+    return defaultValue;
+  case Coercion::Missing:
+    break;
+  }
+  return defaultValue;
+}
@@ -0,0 +1,60 @@
+#include "decision_trace.h"
+#include "flat_tree.h"
+
+DecisionTrace::DecisionTrace(std::size_t capacity) : steps_(capacity) {}
+
+void DecisionTrace::setCapacity(std::size_t capacity) {
+    steps_.resize(capacity);
+    clear();
+}
+
+std::size_t DecisionTrace::capacity() const {
+    return steps_.size();
+}
+
+std::size_t DecisionTrace::size() const {
+    return size_;
+}
+
+std::size_t DecisionTrace::dropped() const {
+    return dropped_;
+}
+
+const TraceStep* DecisionTrace::steps() const {
+    return steps_.data();
+}
+
+NodeIndex DecisionTrace::getLeaf() const {
+    return leaf_;
+}
+
+std::vector<std::string> DecisionTrace::render(const FlatTree& tree) const {
+    std::vector<std::string> lines;
+    lines.reserve(size_ + 2);
+
+    for (std::size_t i = 0; i < size_; ++i) {
+        lines.push_back(describeStep(tree, steps_[i]));
+    }
+
+    if (dropped_) {
+        lines.push_back("... " + std::to_string(dropped_) + " steps not recorded");
+    }
+    lines.push_back(tree.getName(leaf_));
+    return lines;
+}
+
+std::string describeStep(const FlatTree& tree, const TraceStep& step) {
+    const FlatNode& node = tree.getNode(step.node);
+    std::string line = tree.getName(step.node) + ": ";
+    if (node.kind == FlatNodeKind::Decision) {
+        line += step.branch == 0 ? "true" : "false";
+    } else if (step.branch == node.first) {
+        line += "default";
+    } else if (node.kind == FlatNodeKind::Switch) {
+        const auto* source = static_cast<const SwitchNode*>(tree.getSource(step.node));
+        line += "case " + resultToString(source->getCases()[step.branch].first);
+    } else {
+        line += "branch " + std::to_string(step.branch);
+    }
+    return line;
+}
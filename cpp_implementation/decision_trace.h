@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using NodeIndex = std::uint32_t;
+// Dense index of a distinct outcome value in FlatTree::getResults().
+using OutcomeId = std::uint32_t;
+
+class FlatTree;
+
+// A whole decision path packed into one integer. The low 56 bits hold the
+// branches taken, first step in the lowest bits: one bit per decision
+// (0 true, 1 false) and, for a multi-branch or switch with n branches, the
+// branch index or n for the default in just enough bits to hold n. The top byte
+// holds the number of bits used, with kPathOverflow set when later steps
+// did not fit.
+using PathId = std::uint64_t;
+
+constexpr unsigned kPathBits = 56;
+constexpr unsigned kPathOverflow = 0x80;
+
+inline unsigned pathLength(PathId id) {
+  return static_cast<unsigned>(id >> kPathBits) & (kPathOverflow - 1);
+}
+
+inline bool pathOverflowed(PathId id) {
+  return (static_cast<unsigned>(id >> kPathBits) & kPathOverflow) != 0;
+}
+
+// One step of a walk: the node that was tested and the branch taken. For a
+// decision 0 is the true child and 1 the false child; for a multi-branch it
+// is the index of the matching branch, or the branch count for the default;
+// for a switch the index of the matching case, or the case count.
+struct TraceStep {
+  NodeIndex node;
+  std::uint32_t branch;
+};
+
+// The path of one evaluation in a buffer sized up front. Recording a step is
+// a single store; steps beyond the capacity are counted as dropped instead
+// of growing the buffer. Names are rendered from the FlatTree on request.
+class DecisionTrace {
+private:
+  std::vector<TraceStep> steps_;
+  std::size_t size_ = 0;
+  std::size_t dropped_ = 0;
+  NodeIndex leaf_ = 0;
+
+public:
+  static constexpr std::size_t kDefaultCapacity = 64;
+
+  explicit DecisionTrace(std::size_t capacity = 0);
+
+  void clear() {
+    size_ = 0;
+    dropped_ = 0;
+  }
+
+  void record(NodeIndex node, std::uint32_t branch) {
+    if (size_ < steps_.size()) {
+      steps_[size_++] = {node, branch};
+    } else {
+      ++dropped_;
+    }
+  }
+
+  void operator()(NodeIndex node, std::uint32_t branch) {
+    record(node, branch);
+  }
+
+  void finish(NodeIndex leaf) { leaf_ = leaf; }
+
+  void setCapacity(std::size_t capacity);
+  std::size_t capacity() const;
+  std::size_t size() const;
+  std::size_t dropped() const;
+  const TraceStep *steps() const;
+  NodeIndex getLeaf() const;
+
+  // One line per step (see describeStep), then the reached outcome.
+  std::vector<std::string> render(const FlatTree &tree) const;
+};
+
+// "Income Check: true", "Risk Level: branch 2" or "Risk Level: default".
+std::string describeStep(const FlatTree &tree, const TraceStep &step);
@@ -0,0 +1,273 @@
+#include "expr_parser.h"
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+bool isDelimiter(char c) {
+    switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '(':
+        case ')':
+        case '[':
+        case ']':
+        case ',':
+        case '!':
+        case '<':
+        case '>':
+        case '=':
+        case '&':
+        case '|':
+        case '?':
+        case '"':
+        case '`':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// One recursive descent parser per text, following the precedence
+// toString() parenthesizes by: || < && < ! < comparisons and in.
+class ExprParser {
+private:
+    std::string_view text_;
+    std::size_t pos_ = 0;
+    FeatureSchema* schema_;
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::runtime_error("condition \"" + std::string(text_) + "\": " + what +
+                                 " at column " + std::to_string(pos_ + 1));
+    }
+
+    void skipSpace() {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' ||
+                text_[pos_] == '\r')) {
+            ++pos_;
+        }
+    }
+
+    bool accept(std::string_view token) {
+        skipSpace();
+        if (text_.substr(pos_, token.size()) == token) {
+            pos_ += token.size();
+            return true;
+        }
+        return false;
+    }
+
+    void expect(std::string_view token) {
+        if (!accept(token)) {
+            fail("expected '" + std::string(token) + "'");
+        }
+    }
+
+    std::string_view peekWord() {
+        skipSpace();
+        std::size_t end = pos_;
+        while (end < text_.size() && !isDelimiter(text_[end])) {
+            ++end;
+        }
+        return text_.substr(pos_, end - pos_);
+    }
+
+    static bool isLiteralWord(std::string_view word) {
+        return word == "true" || word == "false" || word == "inf" || word == "nan";
+    }
+
+    bool atLiteral() {
+        std::string_view word = peekWord();
+        if (pos_ < text_.size() && text_[pos_] == '"') {
+            return true;
+        }
+        return !word.empty() && ((word[0] >= '0' && word[0] <= '9') || word[0] == '-' ||
+                                 word[0] == '.' || isLiteralWord(word));
+    }
+
+    // The text between quote characters, in which a backslash escapes the
+    // next character.
+    std::string parseQuoted(char quote, const char* what) {
+        std::string value;
+        ++pos_;
+        while (pos_ < text_.size() && text_[pos_] != quote) {
+            if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) {
+                ++pos_;
+            }
+            value += text_[pos_++];
+        }
+        if (pos_ == text_.size()) {
+            fail(std::string("unterminated ") + what);
+        }
+        ++pos_;
+        return value;
+    }
+
+    Result parseString() {
+        return parseQuoted('"', "string");
+    }
+
+    Result parseNumber(std::string_view word) {
+        std::string digits(word);
+        std::string_view magnitude = word.substr(word[0] == '-' ? 1 : 0);
+        if (magnitude == "inf" || magnitude == "nan") {
+            double value = magnitude == "inf" ? HUGE_VAL : std::nan("");
+            pos_ += word.size();
+            return word[0] == '-' ? -value : value;
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        if (word.find_first_of(".eE") == std::string_view::npos) {
+            long long value = std::strtoll(digits.c_str(), &end, 10);
+            if (end == digits.c_str() + digits.size() && errno == 0 && value >= INT_MIN &&
+                value <= INT_MAX) {
+                pos_ += word.size();
+                return static_cast<int>(value);
+            }
+        } else {
+            // Underflow to a subnormal is fine; overflow is written as inf.
+            double value = std::strtod(digits.c_str(), &end);
+            if (end == digits.c_str() + digits.size() && !(errno == ERANGE && std::isinf(value))) {
+                pos_ += word.size();
+                return value;
+            }
+        }
+        fail("invalid number '" + digits + "'");
+    }
+
+public:
+    ExprParser(std::string_view text, FeatureSchema* schema) : text_(text), schema_(schema) {}
+
+    Result parseLiteral() {
+        std::string_view word = peekWord();
+        if (pos_ < text_.size() && text_[pos_] == '"') {
+            return parseString();
+        }
+        if (word == "true" || word == "false") {
+            pos_ += word.size();
+            return word == "true";
+        }
+        if (word.empty()) {
+            fail("expected a literal");
+        }
+        return parseNumber(word);
+    }
+
+    ExprPtr parseOr() {
+        std::vector<ExprPtr> operands{parseAnd()};
+        while (accept("||")) {
+            operands.push_back(parseAnd());
+        }
+        return operands.size() == 1 ? operands[0]
+                                    : ConditionExpr::logical(ExprKind::Or, std::move(operands));
+    }
+
+    ExprPtr parseAnd() {
+        std::vector<ExprPtr> operands{parseNot()};
+        while (accept("&&")) {
+            operands.push_back(parseNot());
+        }
+        return operands.size() == 1 ? operands[0]
+                                    : ConditionExpr::logical(ExprKind::And, std::move(operands));
+    }
+
+    ExprPtr parseNot() {
+        skipSpace();
+        if (text_.substr(pos_, 1) == "!" && text_.substr(pos_, 2) != "!=") {
+            ++pos_;
+            return ConditionExpr::negate(parseNot());
+        }
+        return parseComparison();
+    }
+
+    ExprPtr parseComparison() {
+        ExprPtr lhs = parsePrimary();
+
+        static const std::pair<std::string_view, CompareOp> kOperators[] = {
+            {"<=", CompareOp::Le}, {">=", CompareOp::Ge}, {"==", CompareOp::Eq},
+            {"!=", CompareOp::Ne}, {"<", CompareOp::Lt},  {">", CompareOp::Gt}};
+        for (const auto& [symbol, op] : kOperators) {
+            if (accept(symbol)) {
+                return ConditionExpr::compare(op, lhs, parsePrimary());
+            }
+        }
+
+        if (peekWord() == "in") {
+            pos_ += 2;
+            expect("[");
+            std::vector<Result> values;
+            if (!accept("]")) {
+                do {
+                    values.push_back(parseLiteral());
+                } while (accept(","));
+                expect("]");
+            }
+            return ConditionExpr::in(lhs, std::move(values));
+        }
+        return lhs;
+    }
+
+    ExprPtr parsePrimary() {
+        if (accept("(")) {
+            ExprPtr inner = parseOr();
+            expect(")");
+            return inner;
+        }
+        if (atLiteral()) {
+            return ConditionExpr::constant(parseLiteral());
+        }
+
+        std::string name;
+        if (pos_ < text_.size() && text_[pos_] == '`') {
+            name = parseQuoted('`', "feature name");
+        } else {
+            name = peekWord();
+            if (name.empty()) {
+                fail(pos_ < text_.size() ? "unexpected '" + std::string(1, text_[pos_]) + "'"
+                                         : "unexpected end");
+            }
+            pos_ += name.size();
+        }
+        if (schema_) {
+            schema_->intern(name);
+        }
+        if (accept("??")) {
+            return ConditionExpr::feature(name, parseLiteral(), schema_);
+        }
+        return ConditionExpr::feature(name, schema_);
+    }
+
+    void expectEnd() {
+        skipSpace();
+        if (pos_ != text_.size()) {
+            fail("unexpected '" + std::string(1, text_[pos_]) + "'");
+        }
+    }
+};
+
+}
+
+ExprPtr parseExpr(std::string_view text, FeatureSchema* schema) {
+    ExprParser parser(text, schema);
+    ExprPtr expr = parser.parseOr();
+    parser.expectEnd();
+    return expr;
+}
+
+Result parseLiteral(std::string_view text) {
+    ExprParser parser(text, nullptr);
+    Result value = parser.parseLiteral();
+    parser.expectEnd();
+    return value;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "condition_expr.h"
+
+#include <string_view>
+
+// Parses the condition language ConditionExpr::toString() writes, so
+// parseExpr(expr.toString()) is sameExpr() to expr:
+//   (credit_score ?? 0) >= 650 && !(region in ["EU", "UK"]) || vip
+// Literals are ints, doubles (with a '.' or an exponent, or inf / nan),
+// true / false and double-quoted strings in which a backslash escapes the
+// next character. Any other word is a feature name, optionally followed by
+// ?? and its fallback literal; names that are not plain words (spaces,
+// operators, a leading digit, or a literal keyword) are backquoted with the
+// same escapes, as toString() writes them. NaN constants read back as NaN,
+// which sameExpr() never matches since NaN compares unequal to itself.
+// Features are bound to schema, and interned into it, when one is given.
+// Throws std::runtime_error naming the column of the first error.
+ExprPtr parseExpr(std::string_view text, FeatureSchema *schema = nullptr);
+
+// A single literal, as in a SwitchNode case; throws std::runtime_error
+// unless the whole of text is one.
+Result parseLiteral(std::string_view text);
@@ -0,0 +1,432 @@
+#include "flat_tree.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Spilled PredicateMemo buffers for this thread. A walk may nest inside
+// another (a native predicate evaluating a second tree), so each level
+// borrows its own buffer; moving the outer vector keeps their storage.
+struct MemoScratch {
+    std::vector<std::vector<std::uint64_t>> buffers;
+    std::size_t depth = 0;
+};
+
+thread_local MemoScratch memoScratch;
+
+std::string nodeName(const Node& node) {
+    switch (node.kind()) {
+        case NodeKind::Decision:
+            return static_cast<const DecisionNode&>(node).getName();
+        case NodeKind::MultiBranch:
+            return static_cast<const MultiBranchNode&>(node).getName();
+        case NodeKind::Switch:
+            return static_cast<const SwitchNode&>(node).getName();
+        case NodeKind::Outcome:
+            return resultToString(static_cast<const OutcomeNode&>(node).getValue());
+    }
+    return "";
+}
+
+void collectExprFeatures(const ExprPtr& expr, FeatureSchema& schema) {
+    if (expr->kind() == ExprKind::Feature) {
+        schema.intern(expr->getFeature());
+    }
+    for (const auto& operand : expr->getOperands()) {
+        collectExprFeatures(operand, schema);
+    }
+}
+
+}
+
+std::uint64_t* PredicateMemo::acquireScratch(std::size_t words) {
+    if (memoScratch.depth == memoScratch.buffers.size()) {
+        memoScratch.buffers.emplace_back();
+    }
+    std::vector<std::uint64_t>& buffer = memoScratch.buffers[memoScratch.depth++];
+    buffer.assign(words, 0);
+    return buffer.data();
+}
+
+void PredicateMemo::releaseScratch() {
+    --memoScratch.depth;
+}
+
+OutcomeId FlatTree::intern(const Result& value,
+                           std::map<Result, OutcomeId>& interned) {
+    auto [it, inserted] = interned.emplace(value, static_cast<OutcomeId>(results_.size()));
+    if (inserted) {
+        results_.push_back(value);
+    }
+    return it->second;
+}
+
+NodeIndex FlatTree::addSentinel(const std::string& value,
+                                std::map<Result, OutcomeId>& interned) {
+    NodeIndex index = static_cast<NodeIndex>(nodes_.size());
+    nodes_.push_back({FlatNodeKind::Outcome,
+                      static_cast<std::uint32_t>(outcomes_.size()), 0, 0});
+    outcomes_.push_back({intern(value, interned), nullptr});
+    names_.push_back(value);
+    sources_.push_back(nullptr);
+    return index;
+}
+
+FlatTree FlatTree::freeze(const NodePtr& root) {
+    FlatTree tree;
+    std::map<Result, OutcomeId> interned;
+
+    if (!root) {
+        tree.root_ = tree.addSentinel("NO_ROOT", interned);
+        return tree;
+    }
+
+    std::unordered_map<const Node*, NodeIndex> indices;
+    std::vector<const Node*> order;
+    std::vector<const Node*> pending{root.get()};
+
+    while (!pending.empty()) {
+        const Node* node = pending.back();
+        pending.pop_back();
+
+        if (!node || indices.count(node)) {
+            continue;
+        }
+
+        indices.emplace(node, static_cast<NodeIndex>(order.size()));
+        order.push_back(node);
+
+        if (node->kind() == NodeKind::Decision) {
+            const auto& decision = static_cast<const DecisionNode&>(*node);
+            pending.push_back(decision.getFalseNode().get());
+            pending.push_back(decision.getTrueNode().get());
+        } else if (node->kind() == NodeKind::MultiBranch) {
+            const auto& multi = static_cast<const MultiBranchNode&>(*node);
+            pending.push_back(multi.getDefaultNode().get());
+            const auto& branches = multi.getBranches();
+            for (auto it = branches.rbegin(); it != branches.rend(); ++it) {
+                pending.push_back(it->second.get());
+            }
+        } else if (node->kind() == NodeKind::Switch) {
+            const auto& switchNode = static_cast<const SwitchNode&>(*node);
+            pending.push_back(switchNode.getDefaultNode().get());
+            const auto& cases = switchNode.getCases();
+            for (auto it = cases.rbegin(); it != cases.rend(); ++it) {
+                pending.push_back(it->second.get());
+            }
+        }
+    }
+
+    tree.nodes_.resize(order.size());
+    tree.names_.resize(order.size());
+    tree.sources_.assign(order.begin(), order.end());
+
+    // Expression predicates by hashExpr(), so identical conditions anywhere
+    // in the tree share one index; registered native predicates by their
+    // registration, so one name registered twice stays two predicates.
+    std::unordered_multimap<std::size_t, std::uint32_t> sharedPredicates;
+    std::unordered_map<const void*, std::uint32_t> namedPredicates;
+    auto predicateIndex = [&](const Predicate& predicate) {
+        std::size_t hash = 0;
+        if (predicate.registration()) {
+            auto [named, inserted] = namedPredicates.emplace(
+                predicate.registration(), static_cast<std::uint32_t>(tree.predicates_.size()));
+            if (!inserted) {
+                tree.repeatedPredicates_ = true;
+                ++tree.uses_[named->second];
+                return named->second;
+            }
+        } else if (const ExprPtr& expr = predicate.getExpr()) {
+            hash = hashExpr(*expr);
+            auto [begin, end] = sharedPredicates.equal_range(hash);
+            for (auto it = begin; it != end; ++it) {
+                if (sameExpr(*tree.predicates_[it->second].getExpr(), *expr)) {
+                    tree.repeatedPredicates_ = true;
+                    ++tree.uses_[it->second];
+                    return it->second;
+                }
+            }
+        }
+        auto index = static_cast<std::uint32_t>(tree.predicates_.size());
+        tree.predicates_.push_back(predicate);
+        tree.uses_.push_back(1);
+        if (predicate.getExpr() != nullptr) {
+            sharedPredicates.emplace(hash, index);
+        }
+        return index;
+    };
+
+    NodeIndex noResult = 0;
+    NodeIndex noMatch = 0;
+    bool hasNoResult = false;
+    bool hasNoMatch = false;
+
+    auto childIndex = [&](const NodePtr& child, bool multiBranch) {
+        if (child) {
+            return indices.at(child.get());
+        }
+        if (multiBranch) {
+            if (!hasNoMatch) {
+                noMatch = tree.addSentinel("NO_MATCH", interned);
+                hasNoMatch = true;
+            }
+            return noMatch;
+        }
+        if (!hasNoResult) {
+            noResult = tree.addSentinel("NO_RESULT", interned);
+            hasNoResult = true;
+        }
+        return noResult;
+    };
+
+    for (NodeIndex index = 0; index < order.size(); ++index) {
+        const Node& node = *order[index];
+        FlatNode record{};
+        tree.names_[index] = nodeName(node);
+
+        switch (node.kind()) {
+            case NodeKind::Outcome: {
+                const auto& outcome = static_cast<const OutcomeNode&>(node);
+                record.kind = FlatNodeKind::Outcome;
+                record.operand = static_cast<std::uint32_t>(tree.outcomes_.size());
+                tree.outcomes_.push_back(
+                    {tree.intern(outcome.getValue(), interned), outcome.getAction()});
+                break;
+            }
+            case NodeKind::Decision: {
+                const auto& decision = static_cast<const DecisionNode&>(node);
+                record.kind = FlatNodeKind::Decision;
+                record.operand = predicateIndex(decision.getCondition());
+                record.first = childIndex(decision.getTrueNode(), false);
+                record.second = childIndex(decision.getFalseNode(), false);
+                break;
+            }
+            case NodeKind::MultiBranch: {
+                const auto& multi = static_cast<const MultiBranchNode&>(node);
+                record.kind = FlatNodeKind::MultiBranch;
+                record.operand = static_cast<std::uint32_t>(tree.branches_.size());
+                record.first = static_cast<std::uint32_t>(multi.getBranches().size());
+                for (const auto& [condition, child] : multi.getBranches()) {
+                    tree.branches_.push_back(
+                        {predicateIndex(condition), childIndex(child, true)});
+                }
+                record.second = childIndex(multi.getDefaultNode(), true);
+
+                std::vector<const Predicate*> conditions;
+                for (const auto& branch : multi.getBranches()) {
+                    conditions.push_back(&branch.first);
+                }
+                if (auto ladder = IntervalIndex::build(conditions)) {
+                    tree.indexOf_.resize(order.size(), kNoIndex);
+                    tree.indexOf_[index] = static_cast<std::uint32_t>(tree.indexes_.size());
+                    tree.indexes_.push_back(std::move(*ladder));
+                }
+                break;
+            }
+            case NodeKind::Switch: {
+                const auto& switchNode = static_cast<const SwitchNode&>(node);
+                record.kind = FlatNodeKind::Switch;
+                record.operand = static_cast<std::uint32_t>(tree.switches_.size());
+                record.first = static_cast<std::uint32_t>(switchNode.getCases().size());
+                tree.switches_.push_back({switchNode.getFeature(), switchNode.getTable(),
+                                          static_cast<std::uint32_t>(tree.cases_.size())});
+                for (const auto& entry : switchNode.getCases()) {
+                    tree.cases_.push_back(childIndex(entry.second, true));
+                }
+                record.second = childIndex(switchNode.getDefaultNode(), true);
+                break;
+            }
+        }
+
+        tree.nodes_[index] = record;
+    }
+
+    if (!tree.indexOf_.empty()) {
+        tree.indexOf_.resize(tree.nodes_.size(), kNoIndex);
+    }
+    tree.root_ = 0;
+    return tree;
+}
+
+NodeIndex FlatTree::findLeaf(const Context& context) const {
+    return findLeaf(context, NoVisit());
+}
+
+NodeIndex FlatTree::findLeaf(const FlatContext& context) const {
+    return findLeaf(context, NoVisit());
+}
+
+Result FlatTree::outcomeOf(NodeIndex leaf, const Context& context) const {
+    return results_[outcomeIdOf(leaf, context)];
+}
+
+Result FlatTree::outcomeOf(NodeIndex leaf, const FlatContext& context) const {
+    return results_[outcomeIdOf(leaf, context)];
+}
+
+OutcomeId FlatTree::outcomeIdOf(NodeIndex leaf) const {
+    return outcomes_[nodes_[leaf].operand].id;
+}
+
+OutcomeId FlatTree::outcomeIdOf(NodeIndex leaf, const Context& context) const {
+    const FlatOutcome& outcome = outcomes_[nodes_[leaf].operand];
+    if (outcome.action) {
+        outcome.action(context);
+    }
+    return outcome.id;
+}
+
+OutcomeId FlatTree::outcomeIdOf(NodeIndex leaf, const FlatContext& context) const {
+    const FlatOutcome& outcome = outcomes_[nodes_[leaf].operand];
+    if (outcome.action) {
+        outcome.action(context.toContext());
+    }
+    return outcome.id;
+}
+
+const Result& FlatTree::getResult(OutcomeId id) const {
+    return results_[id];
+}
+
+const std::vector<Result>& FlatTree::getResults() const {
+    return results_;
+}
+
+Result FlatTree::evaluate(const Context& context) const {
+    return outcomeOf(findLeaf(context), context);
+}
+
+Result FlatTree::evaluate(const FlatContext& context) const {
+    return outcomeOf(findLeaf(context), context);
+}
+
+NodeIndex FlatTree::getRoot() const {
+    return root_;
+}
+
+const FlatNode& FlatTree::getNode(NodeIndex index) const {
+    return nodes_[index];
+}
+
+const FlatBranch& FlatTree::getBranch(std::uint32_t index) const {
+    return branches_[index];
+}
+
+const Predicate& FlatTree::getPredicate(std::uint32_t index) const {
+    return predicates_[index];
+}
+
+const FlatOutcome& FlatTree::getOutcome(std::uint32_t index) const {
+    return outcomes_[index];
+}
+
+const std::string& FlatTree::getName(NodeIndex index) const {
+    return names_[index];
+}
+
+const Node* FlatTree::getSource(NodeIndex index) const {
+    return sources_[index];
+}
+
+const FlatSwitch& FlatTree::getSwitch(std::uint32_t index) const {
+    return switches_[index];
+}
+
+NodeIndex FlatTree::getCase(std::uint32_t index) const {
+    return cases_[index];
+}
+
+NodeIndex FlatTree::childOf(NodeIndex index, std::uint32_t branch) const {
+    const FlatNode& node = nodes_[index];
+    switch (node.kind) {
+        case FlatNodeKind::Decision:
+            return branch == 0 ? node.first : node.second;
+        case FlatNodeKind::MultiBranch:
+            return branch == node.first ? node.second : branches_[node.operand + branch].child;
+        case FlatNodeKind::Switch:
+            return branch == node.first ? node.second
+                                        : cases_[switches_[node.operand].firstCase + branch];
+        case FlatNodeKind::Outcome:
+            break;
+    }
+    return index;
+}
+
+const IntervalIndex* FlatTree::getIntervalIndex(NodeIndex index) const {
+    if (indexOf_.empty() || indexOf_[index] == kNoIndex) {
+        return nullptr;
+    }
+    return &indexes_[indexOf_[index]];
+}
+
+std::size_t FlatTree::intervalIndexCount() const {
+    return indexes_.size();
+}
+
+std::size_t FlatTree::nodeCount() const {
+    return nodes_.size();
+}
+
+std::size_t FlatTree::predicateCount() const {
+    return predicates_.size();
+}
+
+std::uint32_t FlatTree::getPredicateUses(std::uint32_t index) const {
+    return uses_[index];
+}
+
+std::size_t FlatTree::conditionCount() const {
+    std::size_t count = 0;
+    for (std::uint32_t uses : uses_) {
+        count += uses;
+    }
+    return count;
+}
+
+bool FlatTree::hasRepeatedPredicates() const {
+    return repeatedPredicates_;
+}
+
+std::size_t FlatTree::memoryFootprint() const {
+    std::size_t bytes = sizeof(FlatTree);
+    bytes += nodes_.capacity() * sizeof(FlatNode);
+    bytes += branches_.capacity() * sizeof(FlatBranch);
+    bytes += predicates_.capacity() * sizeof(Predicate);
+    bytes += uses_.capacity() * sizeof(std::uint32_t);
+    bytes += outcomes_.capacity() * sizeof(FlatOutcome);
+    bytes += results_.capacity() * sizeof(Result);
+    bytes += names_.capacity() * sizeof(std::string);
+    bytes += sources_.capacity() * sizeof(const Node*);
+    bytes += indexOf_.capacity() * sizeof(std::uint32_t);
+    bytes += switches_.capacity() * sizeof(FlatSwitch);
+    bytes += cases_.capacity() * sizeof(NodeIndex);
+
+    for (const auto& result : results_) {
+        if (const auto* str = std::get_if<std::string>(&result)) {
+            bytes += str->capacity();
+        }
+    }
+    for (const auto& name : names_) {
+        bytes += name.capacity();
+    }
+    for (const auto& index : indexes_) {
+        bytes += index.memoryFootprint();
+    }
+    for (const auto& flatSwitch : switches_) {
+        bytes += flatSwitch.table.memoryFootprint() - sizeof(SwitchTable);
+    }
+
+    return bytes;
+}
+
+void FlatTree::collectFeatures(FeatureSchema& schema) const {
+    for (const auto& predicate : predicates_) {
+        if (predicate.getExpr()) {
+            collectExprFeatures(predicate.getExpr(), schema);
+        }
+    }
+    for (const auto& flatSwitch : switches_) {
+        collectExprFeatures(flatSwitch.feature, schema);
+    }
+}
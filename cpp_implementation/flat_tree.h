@@ -0,0 +1,297 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+#include "interval_index.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+enum class FlatNodeKind : std::uint8_t {
+  Outcome,
+  Decision,
+  MultiBranch,
+  Switch
+};
+
+// One record per node. Field meaning depends on kind:
+//   Outcome:     operand = outcome index
+//   Decision:    operand = predicate index, first = true child,
+//                second = false child
+//   MultiBranch: operand = first branch, first = branch count,
+//                second = default child
+//   Switch:      operand = switch index, first = case count,
+//                second = default child
+struct FlatNode {
+  FlatNodeKind kind;
+  std::uint32_t operand;
+  std::uint32_t first;
+  std::uint32_t second;
+};
+
+struct FlatBranch {
+  std::uint32_t predicate;
+  NodeIndex child;
+};
+
+struct FlatOutcome {
+  OutcomeId id;
+  Action action;
+};
+
+// A SwitchNode's feature and table; the case children are
+// getCase(firstCase + i).
+struct FlatSwitch {
+  ExprPtr feature;
+  SwitchTable table;
+  std::uint32_t firstCase;
+
+  template <typename ContextT>
+  std::uint32_t select(const ContextT &context) const {
+    return table.select(feature->read(context));
+  }
+};
+
+// Known and value bits for up to size() predicates or condition atoms,
+// filled in during one evaluation so each is computed at most once. Small
+// memos live inline; larger ones borrow a per-thread scratch buffer, one
+// per nesting level of walks, that is cleared for each walk and kept for
+// the thread's lifetime, so no walk allocates once the thread is warm.
+class PredicateMemo {
+private:
+  static constexpr std::size_t kInlineWords = 4;
+
+  std::uint64_t inline_[2 * kInlineWords] = {};
+  std::uint64_t *known_;
+  std::uint64_t *value_;
+  std::size_t size_;
+  bool borrowed_ = false;
+
+  static std::uint64_t *acquireScratch(std::size_t words);
+  static void releaseScratch();
+
+public:
+  explicit PredicateMemo(std::size_t size) : size_(size) {
+    std::size_t words = (size + 63) / 64;
+    if (words > kInlineWords) {
+      known_ = acquireScratch(2 * words);
+      borrowed_ = true;
+    } else {
+      known_ = inline_;
+    }
+    value_ = known_ + words;
+  }
+  ~PredicateMemo() {
+    if (borrowed_) {
+      releaseScratch();
+    }
+  }
+  PredicateMemo(const PredicateMemo &) = delete;
+  PredicateMemo &operator=(const PredicateMemo &) = delete;
+
+  bool known(std::uint32_t index) const {
+    return (known_[index >> 6] >> (index & 63)) & 1;
+  }
+  bool value(std::uint32_t index) const {
+    return (value_[index >> 6] >> (index & 63)) & 1;
+  }
+  void set(std::uint32_t index, bool value) {
+    std::uint64_t bit = std::uint64_t(1) << (index & 63);
+    known_[index >> 6] |= bit;
+    if (value) {
+      value_[index >> 6] |= bit;
+    }
+  }
+
+  // evaluate() the first time index is asked for, the remembered result
+  // after that.
+  template <typename EvalFn>
+  bool test(std::uint32_t index, EvalFn &&evaluate) {
+    if (known(index)) {
+      return value(index);
+    }
+    bool result = evaluate();
+    set(index, result);
+    return result;
+  }
+
+  std::size_t size() const { return size_; }
+};
+
+struct NoVisit {
+  void operator()(NodeIndex, std::uint32_t) const {}
+};
+
+// A tree compiled into contiguous arrays with child indices instead of
+// pointers. Missing children and absent defaults become sentinel outcome
+// leaves, so every walk ends on an Outcome record. Shared subtrees are
+// frozen once, and identical expression conditions (sameExpr()) share one
+// predicate index; when a predicate is used by more than one node, findLeaf
+// remembers its result in a PredicateMemo for the rest of the walk. Native
+// conditions merge when they come from one NativeRegistry registration;
+// other lambdas never do. Multi-branch nodes that are threshold ladders also
+// get an IntervalIndex.
+class FlatTree {
+private:
+  static constexpr std::uint32_t kNoIndex = static_cast<std::uint32_t>(-1);
+
+  std::vector<FlatNode> nodes_;
+  std::vector<FlatBranch> branches_;
+  std::vector<Predicate> predicates_;
+  // Per predicate, how many decisions and branches test it.
+  std::vector<std::uint32_t> uses_;
+  bool repeatedPredicates_ = false;
+  std::vector<FlatOutcome> outcomes_;
+  std::vector<Result> results_;
+  std::vector<std::string> names_;
+  std::vector<const Node *> sources_;
+  std::vector<FlatSwitch> switches_;
+  std::vector<NodeIndex> cases_;
+  std::vector<IntervalIndex> indexes_;
+  // Per node, the position of its IntervalIndex or kNoIndex; empty when no
+  // node has one.
+  std::vector<std::uint32_t> indexOf_;
+  NodeIndex root_ = 0;
+
+  OutcomeId intern(const Result &value,
+                   std::map<Result, OutcomeId> &interned);
+  NodeIndex addSentinel(const std::string &value,
+                        std::map<Result, OutcomeId> &interned);
+
+public:
+  static FlatTree freeze(const NodePtr &root);
+
+  // Walks from the root to a leaf, asking test(predicateIndex) at each
+  // condition and select(flatSwitch) at each switch, and reporting
+  // visit(node, branch) for every step taken. A multi-branch with an
+  // IntervalIndex asks select(index) for the branch instead when select
+  // accepts one; otherwise its conditions are tested in turn. Every
+  // execution mode shares this loop.
+  template <typename TestFn, typename SelectFn, typename VisitFn = NoVisit>
+  NodeIndex walk(TestFn &&test, SelectFn &&select,
+                 VisitFn &&visit = VisitFn()) const;
+
+  Result evaluate(const Context &context) const;
+  Result evaluate(const FlatContext &context) const;
+
+  NodeIndex findLeaf(const Context &context) const;
+  NodeIndex findLeaf(const FlatContext &context) const;
+  // findLeaf with visit(node, branch) called for every step, e.g. a
+  // DecisionTrace or PathEncoder.
+  template <typename ContextT, typename VisitFn>
+  NodeIndex findLeaf(const ContextT &context, VisitFn &&visit) const;
+
+  Result outcomeOf(NodeIndex leaf, const Context &context) const;
+  Result outcomeOf(NodeIndex leaf, const FlatContext &context) const;
+
+  // Outcome values are interned once at freeze time, sentinels included, so
+  // a leaf resolves to a dense OutcomeId without copying its Result. The
+  // context overloads also run the leaf's action.
+  OutcomeId outcomeIdOf(NodeIndex leaf) const;
+  OutcomeId outcomeIdOf(NodeIndex leaf, const Context &context) const;
+  OutcomeId outcomeIdOf(NodeIndex leaf, const FlatContext &context) const;
+  const Result &getResult(OutcomeId id) const;
+  const std::vector<Result> &getResults() const;
+
+  NodeIndex getRoot() const;
+  const FlatNode &getNode(NodeIndex index) const;
+  const FlatBranch &getBranch(std::uint32_t index) const;
+  const Predicate &getPredicate(std::uint32_t index) const;
+  const FlatOutcome &getOutcome(std::uint32_t index) const;
+  const std::string &getName(NodeIndex index) const;
+  const Node *getSource(NodeIndex index) const;
+  const FlatSwitch &getSwitch(std::uint32_t index) const;
+  NodeIndex getCase(std::uint32_t index) const;
+  // The child reached by taking branch at a decision, multi-branch or switch
+  // (numbered as in TraceStep).
+  NodeIndex childOf(NodeIndex index, std::uint32_t branch) const;
+  // nullptr unless the node is a multi-branch compiled into an index.
+  const IntervalIndex *getIntervalIndex(NodeIndex index) const;
+  std::size_t intervalIndexCount() const;
+
+  std::size_t nodeCount() const;
+  // Distinct predicates, after identical conditions were merged.
+  std::size_t predicateCount() const;
+  std::uint32_t getPredicateUses(std::uint32_t index) const;
+  // Decision and branch conditions before merging.
+  std::size_t conditionCount() const;
+  bool hasRepeatedPredicates() const;
+  std::size_t memoryFootprint() const;
+
+  // Interns every feature read by an expression predicate.
+  void collectFeatures(FeatureSchema &schema) const;
+};
+
+template <typename TestFn, typename SelectFn, typename VisitFn>
+NodeIndex FlatTree::walk(TestFn &&test, SelectFn &&select,
+                         VisitFn &&visit) const {
+  NodeIndex index = root_;
+
+  for (;;) {
+    const FlatNode &node = nodes_[index];
+
+    switch (node.kind) {
+    case FlatNodeKind::Outcome:
+      return index;
+    case FlatNodeKind::Decision: {
+      bool taken = test(node.operand);
+      visit(index, taken ? 0u : 1u);
+      index = taken ? node.first : node.second;
+      break;
+    }
+    case FlatNodeKind::MultiBranch: {
+      if constexpr (std::is_invocable_v<SelectFn &, const IntervalIndex &>) {
+        if (!indexOf_.empty() && indexOf_[index] != kNoIndex) {
+          std::uint32_t taken = select(indexes_[indexOf_[index]]);
+          visit(index, taken);
+          index = taken == node.first ? node.second
+                                      : branches_[node.operand + taken].child;
+          break;
+        }
+      }
+      NodeIndex next = node.second;
+      const FlatBranch *branch = branches_.data() + node.operand;
+      const FlatBranch *end = branch + node.first;
+      for (; branch != end; ++branch) {
+        if (test(branch->predicate)) {
+          next = branch->child;
+          break;
+        }
+      }
+      visit(index, static_cast<std::uint32_t>(node.first - (end - branch)));
+      index = next;
+      break;
+    }
+    case FlatNodeKind::Switch: {
+      const FlatSwitch &flatSwitch = switches_[node.operand];
+      std::uint32_t taken = select(flatSwitch);
+      visit(index, taken);
+      index = taken == node.first ? node.second
+                                  : cases_[flatSwitch.firstCase + taken];
+      break;
+    }
+    }
+  }
+}
+
+template <typename ContextT, typename VisitFn>
+NodeIndex FlatTree::findLeaf(const ContextT &context, VisitFn &&visit) const {
+  if (repeatedPredicates_) {
+    PredicateMemo memo(predicates_.size());
+    return walk(
+        [&](std::uint32_t predicate) {
+          return memo.test(predicate, [&] {
+            return predicates_[predicate].test(context);
+          });
+        },
+        [&](const auto &index) { return index.select(context); }, visit);
+  }
+  return walk(
+      [&](std::uint32_t predicate) {
+        return predicates_[predicate].test(context);
+      },
+      [&](const auto &index) { return index.select(context); }, visit);
+}
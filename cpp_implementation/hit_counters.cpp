@@ -0,0 +1,148 @@
+#include "hit_counters.h"
+#include "flat_tree.h"
+
+#include <sstream>
+
+namespace {
+
+std::uint32_t counterCount(const FlatNode& node) {
+    switch (node.kind) {
+        case FlatNodeKind::Outcome:
+            return 1;
+        case FlatNodeKind::Decision:
+            return 2;
+        case FlatNodeKind::MultiBranch:
+        case FlatNodeKind::Switch:
+            return node.first + 1;
+    }
+    return 0;
+}
+
+}
+
+HitShard::HitShard(const HitCounters& owner, std::size_t counters)
+    : owner_(&owner), base_(nullptr), lines_(new CacheLine[(counters + 7) / 8]) {
+    for (std::size_t line = 0; line < (counters + 7) / 8; ++line) {
+        for (auto& count : lines_[line].counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::uint64_t HitSnapshot::nodeHits(const FlatTree& tree, NodeIndex node) const {
+    std::uint64_t hits = 0;
+    for (std::uint32_t i = 0; i < counterCount(tree.getNode(node)); ++i) {
+        hits += counts_[base_[node] + i];
+    }
+    return hits;
+}
+
+std::uint64_t HitSnapshot::branchHits(NodeIndex node, std::uint32_t branch) const {
+    return counts_[base_[node] + branch];
+}
+
+const std::vector<std::uint64_t>& HitSnapshot::counts() const {
+    return counts_;
+}
+
+HitCounters::HitCounters(const FlatTree& tree) : tree_(&tree) {
+    base_.reserve(tree.nodeCount());
+    for (NodeIndex node = 0; node < tree.nodeCount(); ++node) {
+        base_.push_back(static_cast<std::uint32_t>(counters_));
+        counters_ += counterCount(tree.getNode(node));
+    }
+}
+
+void HitCounters::Release::operator()(HitShard* shard) const {
+    auto& owner = const_cast<HitCounters&>(shard->owner());
+    std::lock_guard<std::mutex> lock(owner.mutex_);
+    owner.free_.push_back(shard);
+}
+
+HitCounters::Lease HitCounters::acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty()) {
+        HitShard* shard = free_.back();
+        free_.pop_back();
+        return Lease(shard);
+    }
+
+    shards_.push_back(std::make_unique<HitShard>(*this, counters_));
+    shards_.back()->base_ = base_.data();
+    return Lease(shards_.back().get());
+}
+
+HitSnapshot HitCounters::snapshot() const {
+    HitSnapshot snapshot;
+    snapshot.base_ = base_;
+    snapshot.counts_.assign(counters_, 0);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_) {
+        for (std::uint32_t i = 0; i < counters_; ++i) {
+            snapshot.counts_[i] += shard->load(i);
+        }
+    }
+    return snapshot;
+}
+
+void HitCounters::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_) {
+        for (std::uint32_t i = 0; i < counters_; ++i) {
+            shard->lines_[i / 8].counts[i % 8].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+const FlatTree& HitCounters::getTree() const {
+    return *tree_;
+}
+
+std::size_t HitCounters::shardCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shards_.size();
+}
+
+std::string hitReport(const FlatTree& tree, const HitSnapshot& snapshot) {
+    std::ostringstream out;
+
+    for (NodeIndex node = 0; node < tree.nodeCount(); ++node) {
+        const FlatNode& record = tree.getNode(node);
+        std::uint64_t reached = snapshot.nodeHits(tree, node);
+        out << tree.getName(node);
+
+        auto branch = [&](const std::string& label, std::uint32_t index) {
+            std::uint64_t hits = snapshot.branchHits(node, index);
+            out << label << ' ' << hits << (hits == 0 ? " (dead)" : "");
+        };
+
+        switch (record.kind) {
+            case FlatNodeKind::Outcome:
+                out << " [outcome] " << reached << (reached == 0 ? " (dead)" : "");
+                break;
+            case FlatNodeKind::Decision:
+                out << " [decision] " << reached << ": ";
+                branch("true", 0);
+                branch(", false", 1);
+                break;
+            case FlatNodeKind::MultiBranch:
+                out << " [multi-branch] " << reached << ": ";
+                for (std::uint32_t i = 0; i < record.first; ++i) {
+                    branch((i ? ", branch " : "branch ") + std::to_string(i), i);
+                }
+                branch(record.first ? ", default" : "default", record.first);
+                break;
+            case FlatNodeKind::Switch:
+                out << " [switch] " << reached << ": ";
+                for (std::uint32_t i = 0; i < record.first; ++i) {
+                    branch((i ? ", case " : "case ") + std::to_string(i), i);
+                }
+                branch(record.first ? ", default" : "default", record.first);
+                break;
+        }
+        out << '\n';
+    }
+
+    return out.str();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "decision_trace.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class FlatTree;
+class HitCounters;
+
+// One thread's counters: a cache-line aligned array with one counter per
+// decision branch, multi-branch branch or default, and outcome. Only the
+// owning thread writes, so an increment is a relaxed load and store with no
+// read-modify-write or shared cache lines.
+class HitShard {
+private:
+  struct alignas(64) CacheLine {
+    std::atomic<std::uint64_t> counts[8];
+  };
+
+  const HitCounters *owner_;
+  const std::uint32_t *base_;
+  std::unique_ptr<CacheLine[]> lines_;
+
+  friend class HitCounters;
+
+public:
+  HitShard(const HitCounters &owner, std::size_t counters);
+
+  void add(std::uint32_t counter) {
+    std::atomic<std::uint64_t> &count = lines_[counter / 8].counts[counter % 8];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  }
+
+  // branch as in TraceStep; outcomes use branch 0.
+  void record(NodeIndex node, std::uint32_t branch) {
+    add(base_[node] + branch);
+  }
+
+  std::uint64_t load(std::uint32_t counter) const {
+    return lines_[counter / 8].counts[counter % 8].load(
+        std::memory_order_relaxed);
+  }
+
+  const HitCounters &owner() const { return *owner_; }
+};
+
+// Merged counts at one point in time.
+class HitSnapshot {
+private:
+  std::vector<std::uint32_t> base_;
+  std::vector<std::uint64_t> counts_;
+
+  friend class HitCounters;
+
+public:
+  // Times the node was reached.
+  std::uint64_t nodeHits(const FlatTree &tree, NodeIndex node) const;
+  // Times branch was taken at node (see TraceStep for the numbering).
+  std::uint64_t branchHits(NodeIndex node, std::uint32_t branch) const;
+  const std::vector<std::uint64_t> &counts() const;
+};
+
+// Hit counters for one FlatTree. Each EvaluationSession leases its own
+// shard; snapshot() sums every shard on read. Released shards go back to a
+// free list with their counts intact, so short-lived sessions do not grow
+// the shard set.
+class HitCounters {
+private:
+  const FlatTree *tree_;
+  std::vector<std::uint32_t> base_;
+  std::size_t counters_ = 0;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<HitShard>> shards_;
+  std::vector<HitShard *> free_;
+
+public:
+  explicit HitCounters(const FlatTree &tree);
+  HitCounters(const HitCounters &) = delete;
+  HitCounters &operator=(const HitCounters &) = delete;
+
+  struct Release {
+    void operator()(HitShard *shard) const;
+  };
+  using Lease = std::unique_ptr<HitShard, Release>;
+
+  Lease acquire();
+
+  HitSnapshot snapshot() const;
+  void reset();
+
+  const FlatTree &getTree() const;
+  std::size_t shardCount() const;
+};
+
+// One line per node, named as in toJson, e.g.
+//   Income Check [decision] 3120: true 2011, false 1109
+//   Risk Level [multi-branch] 4096: branch 0 812, branch 1 0, default 3284
+//   APPROVED [outcome] 2011
+// Branches and outcomes that were never taken are marked "(dead)".
+std::string hitReport(const FlatTree &tree, const HitSnapshot &snapshot);
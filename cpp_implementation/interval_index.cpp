@@ -0,0 +1,283 @@
+#include "interval_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Larger constants are not bounded: int features compare with them as
+// doubles, and rounding could move a value across the bound.
+constexpr double kExactIntegerLimit = 9007199254740992.0;  // 2^53
+
+std::optional<double> numericConstant(const Result& value) {
+    double number = 0.0;
+    if (const auto* i = std::get_if<int>(&value)) {
+        number = *i;
+    } else if (const auto* d = std::get_if<double>(&value)) {
+        number = *d;
+    } else if (const auto* b = std::get_if<bool>(&value)) {
+        number = *b ? 1.0 : 0.0;
+    } else {
+        return std::nullopt;
+    }
+    if (std::isnan(number) || std::fabs(number) >= kExactIntegerLimit) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+CompareOp mirror(CompareOp op) {
+    switch (op) {
+        case CompareOp::Lt:
+            return CompareOp::Gt;
+        case CompareOp::Le:
+            return CompareOp::Ge;
+        case CompareOp::Gt:
+            return CompareOp::Lt;
+        case CompareOp::Ge:
+            return CompareOp::Le;
+        case CompareOp::Eq:
+        case CompareOp::Ne:
+            break;
+    }
+    return op;
+}
+
+FeatureBound& boundOf(const ExprPtr& feature, FeatureConstraints& constraints) {
+    FeatureKey key{feature->getFeature(),
+                   feature->hasFallback() ? std::optional<Result>(feature->getValue())
+                                          : std::nullopt};
+    return constraints.bounds.try_emplace(key, FeatureBound{feature, Interval()}).first->second;
+}
+
+void constrain(const ExprPtr& expr, FeatureConstraints& constraints) {
+    switch (expr->kind()) {
+        case ExprKind::And:
+            for (const auto& operand : expr->getOperands()) {
+                constrain(operand, constraints);
+            }
+            return;
+        case ExprKind::Compare: {
+            const ExprPtr* feature = &expr->getOperands()[0];
+            const ExprPtr* constant = &expr->getOperands()[1];
+            CompareOp op = expr->op();
+            if ((*feature)->kind() == ExprKind::Constant) {
+                std::swap(feature, constant);
+                op = mirror(op);
+            }
+            std::optional<double> value;
+            if ((*feature)->kind() == ExprKind::Feature &&
+                (*constant)->kind() == ExprKind::Constant && op != CompareOp::Ne) {
+                value = numericConstant((*constant)->getValue());
+            }
+            if (!value) {
+                constraints.exact = false;
+                return;
+            }
+
+            Interval& interval = boundOf(*feature, constraints).interval;
+            if (op == CompareOp::Gt || op == CompareOp::Ge || op == CompareOp::Eq) {
+                interval.raiseLow(*value, op != CompareOp::Gt);
+            }
+            if (op == CompareOp::Lt || op == CompareOp::Le || op == CompareOp::Eq) {
+                interval.lowerHigh(*value, op != CompareOp::Lt);
+            }
+            return;
+        }
+        case ExprKind::In: {
+            // A set of several values is bounded by its hull, which is no
+            // longer exact.
+            const ExprPtr& feature = expr->getOperands()[0];
+            const auto& values = expr->getValues();
+            double lo = std::numeric_limits<double>::infinity();
+            double hi = -std::numeric_limits<double>::infinity();
+            for (const auto& value : values) {
+                std::optional<double> number = numericConstant(value);
+                if (!number) {
+                    constraints.exact = false;
+                    return;
+                }
+                lo = std::min(lo, *number);
+                hi = std::max(hi, *number);
+            }
+            if (feature->kind() != ExprKind::Feature || values.empty()) {
+                constraints.exact = false;
+                return;
+            }
+
+            Interval& interval = boundOf(feature, constraints).interval;
+            interval.raiseLow(lo, true);
+            interval.lowerHigh(hi, true);
+            constraints.exact &= lo == hi;
+            return;
+        }
+        case ExprKind::Feature:
+        case ExprKind::Constant:
+        case ExprKind::Or:
+        case ExprKind::Not:
+            constraints.exact = false;
+            return;
+    }
+}
+
+}
+
+bool Interval::intersects(const Interval& other) const {
+    Interval both = *this;
+    both.raiseLow(other.lo, other.loClosed);
+    both.lowerHigh(other.hi, other.hiClosed);
+    return both.lo < both.hi || (both.lo == both.hi && both.loClosed && both.hiClosed);
+}
+
+std::optional<FeatureConstraints> featureConstraints(const Predicate& predicate) {
+    if (const ExprPtr& expr = predicate.getExpr()) {
+        FeatureConstraints constraints;
+        constrain(expr, constraints);
+        return constraints;
+    }
+    return std::nullopt;
+}
+
+bool IntervalIndex::numeric(const FeatureValue& value, double& number) {
+    switch (value.type) {
+        case ValueType::Int:
+            number = static_cast<double>(value.i);
+            return true;
+        case ValueType::Double:
+            number = value.d;
+            return !std::isnan(number);
+        case ValueType::Bool:
+            number = value.b ? 1.0 : 0.0;
+            return true;
+        case ValueType::Missing:
+        case ValueType::String:
+            break;
+    }
+    return false;
+}
+
+std::uint32_t IntervalIndex::regionOf(const FeatureValue& value) const {
+    double number = 0.0;
+    if (!numeric(value, number)) {
+        return static_cast<std::uint32_t>(regionStart_.size() - 2);
+    }
+    auto it = std::lower_bound(points_.begin(), points_.end(), number);
+    auto point = static_cast<std::uint32_t>(it - points_.begin());
+    return it != points_.end() && *it == number ? 2 * point + 1 : 2 * point;
+}
+
+std::optional<IntervalIndex> IntervalIndex::build(const std::vector<const Predicate*>& conditions) {
+    if (conditions.size() < kMinBranches) {
+        return std::nullopt;
+    }
+
+    std::vector<FeatureConstraints> branches;
+    std::map<FeatureKey, std::size_t> uses;
+    for (const Predicate* condition : conditions) {
+        std::optional<FeatureConstraints> constraints = featureConstraints(*condition);
+        if (!constraints || !constraints->exact || constraints->bounds.empty() ||
+            constraints->bounds.size() > 2) {
+            return std::nullopt;
+        }
+        for (const auto& entry : constraints->bounds) {
+            ++uses[entry.first];
+        }
+        branches.push_back(std::move(*constraints));
+    }
+
+    auto primary = std::max_element(uses.begin(), uses.end(), [](const auto& a, const auto& b) {
+        return a.second < b.second;
+    })->first;
+
+    IntervalIndex index;
+    index.branchCount_ = static_cast<std::uint32_t>(conditions.size());
+    std::map<FeatureKey, std::uint32_t> secondaries;
+
+    // Per branch: the primary interval (if bounded) and the other bound.
+    std::vector<std::optional<Interval>> primaryBounds;
+    std::vector<Candidate> residuals;
+    for (std::uint32_t branch = 0; branch < branches.size(); ++branch) {
+        Candidate residual{branch, kNoFeature, Interval()};
+        std::optional<Interval> bound;
+        for (const auto& [key, feature] : branches[branch].bounds) {
+            if (key == primary) {
+                index.primary_ = feature.feature;
+                bound = feature.interval;
+                continue;
+            }
+            if (residual.feature != kNoFeature) {
+                return std::nullopt;
+            }
+            auto [it, inserted] = secondaries.emplace(
+                key, static_cast<std::uint32_t>(index.features_.size()));
+            if (inserted) {
+                index.features_.push_back(feature.feature);
+            }
+            residual.feature = it->second;
+            residual.bound = feature.interval;
+        }
+        primaryBounds.push_back(bound);
+        residuals.push_back(residual);
+
+        if (bound) {
+            for (double point : {bound->lo, bound->hi}) {
+                if (std::isfinite(point)) {
+                    index.points_.push_back(point);
+                }
+            }
+        }
+    }
+
+    std::sort(index.points_.begin(), index.points_.end());
+    index.points_.erase(std::unique(index.points_.begin(), index.points_.end()),
+                        index.points_.end());
+
+    // Regions 2i are the gaps below points_[i] (the last one above every
+    // point), regions 2i + 1 the points themselves, and the final region
+    // holds values that are not numbers.
+    const std::size_t points = index.points_.size();
+    const double infinity = std::numeric_limits<double>::infinity();
+    for (std::size_t region = 0; region <= 2 * points + 1; ++region) {
+        index.regionStart_.push_back(static_cast<std::uint32_t>(index.candidates_.size()));
+        std::size_t point = region / 2;
+
+        for (std::uint32_t branch = 0; branch < branches.size(); ++branch) {
+            const std::optional<Interval>& bound = primaryBounds[branch];
+            bool covered = !bound;
+            if (bound && region == 2 * points + 1) {
+                covered = false;
+            } else if (bound && region % 2 == 1) {
+                covered = bound->contains(index.points_[point]);
+            } else if (bound) {
+                double lo = point == 0 ? -infinity : index.points_[point - 1];
+                double hi = point == points ? infinity : index.points_[point];
+                covered = bound->lo <= lo && bound->hi >= hi;
+            }
+
+            if (covered) {
+                index.candidates_.push_back(residuals[branch]);
+                if (residuals[branch].feature == kNoFeature) {
+                    break;
+                }
+            }
+        }
+    }
+    index.regionStart_.push_back(static_cast<std::uint32_t>(index.candidates_.size()));
+
+    return index;
+}
+
+const ConditionExpr& IntervalIndex::getPrimary() const {
+    return *primary_;
+}
+
+std::size_t IntervalIndex::regionCount() const {
+    return regionStart_.size() - 1;
+}
+
+std::size_t IntervalIndex::memoryFootprint() const {
+    return sizeof(IntervalIndex) + features_.capacity() * sizeof(ExprPtr) +
+           points_.capacity() * sizeof(double) +
+           regionStart_.capacity() * sizeof(std::uint32_t) +
+           candidates_.capacity() * sizeof(Candidate);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A range of the real line; either end may be open or unbounded.
+struct Interval {
+  double lo = -std::numeric_limits<double>::infinity();
+  double hi = std::numeric_limits<double>::infinity();
+  bool loClosed = false;
+  bool hiClosed = false;
+
+  void raiseLow(double value, bool closed) {
+    if (value > lo || (value == lo && !closed)) {
+      lo = value;
+      loClosed = closed;
+    }
+  }
+
+  void lowerHigh(double value, bool closed) {
+    if (value < hi || (value == hi && !closed)) {
+      hi = value;
+      hiClosed = closed;
+    }
+  }
+
+  bool contains(double value) const {
+    return (value > lo || (value == lo && loClosed)) &&
+           (value < hi || (value == hi && hiClosed));
+  }
+
+  bool intersects(const Interval &other) const;
+};
+
+// A feature is identified by its name and fallback: two references with
+// different fallbacks can read different values for the same input.
+using FeatureKey = std::pair<std::string, std::optional<Result>>;
+
+struct FeatureBound {
+  ExprPtr feature;
+  Interval interval;
+};
+
+// The numeric interval an expression forces on each feature it compares
+// with a constant when it holds, through && but not || or !. Only numbers
+// satisfy a bound: missing and string values fail the comparisons. exact is
+// set when the bounds are the whole condition, i.e. the expression holds
+// exactly when every bounded feature is a number inside its interval.
+struct FeatureConstraints {
+  std::map<FeatureKey, FeatureBound> bounds;
+  bool exact = true;
+};
+
+// nullopt for a lambda condition.
+std::optional<FeatureConstraints>
+featureConstraints(const Predicate &predicate);
+
+// The branches of a threshold ladder compiled into a table over one primary
+// feature. The boundary values of every branch interval split the line into
+// regions, each point and open gap its own region, and each region lists
+// the branches that can match there in branch order. A lookup binary
+// searches the region and tests at most the listed branches' bounds on a
+// second feature, instead of every condition in turn.
+class IntervalIndex {
+private:
+  static constexpr std::uint32_t kNoFeature = static_cast<std::uint32_t>(-1);
+
+  struct Candidate {
+    std::uint32_t branch;
+    std::uint32_t feature;
+    Interval bound;
+  };
+
+  ExprPtr primary_;
+  std::vector<ExprPtr> features_;
+  std::vector<double> points_;
+  // Candidates of region r are [regionStart_[r], regionStart_[r + 1]); the
+  // last region is for a primary value that is not a number.
+  std::vector<std::uint32_t> regionStart_;
+  std::vector<Candidate> candidates_;
+  std::uint32_t branchCount_ = 0;
+
+  static bool numeric(const FeatureValue &value, double &number);
+
+  std::uint32_t regionOf(const FeatureValue &value) const;
+
+public:
+  // Ladders shorter than this are left to the linear scan.
+  static constexpr std::size_t kMinBranches = 3;
+
+  // Succeeds when every condition is exactly a conjunction of bounds on the
+  // primary feature and at most one other feature.
+  static std::optional<IntervalIndex>
+  build(const std::vector<const Predicate *> &conditions);
+
+  // The index of the first matching branch, or the branch count when none
+  // matches, as the linear scan would return.
+  template <typename ContextT>
+  std::uint32_t select(const ContextT &context) const;
+
+  const ConditionExpr &getPrimary() const;
+  std::size_t regionCount() const;
+  std::size_t memoryFootprint() const;
+};
+
+template <typename ContextT>
+std::uint32_t IntervalIndex::select(const ContextT &context) const {
+  std::uint32_t region = regionOf(primary_->read(context));
+  const Candidate *candidate = candidates_.data() + regionStart_[region];
+  const Candidate *end = candidates_.data() + regionStart_[region + 1];
+
+  for (; candidate != end; ++candidate) {
+    if (candidate->feature == kNoFeature) {
+      return candidate->branch;
+    }
+    double value = 0.0;
+    if (numeric(features_[candidate->feature]->read(context), value) &&
+        candidate->bound.contains(value)) {
+      return candidate->branch;
+    }
+  }
+  return branchCount_;
+}
@@ -0,0 +1,103 @@
+#include "json_writer.h"
+
+namespace {
+
+void appendEscaped(std::string& out, std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+    for (char c : text) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += kHex[(c >> 4) & 0xf];
+                    out += kHex[c & 0xf];
+                } else {
+                    out += c;
+                }
+        }
+    }
+}
+
+}
+
+JsonWriter::JsonWriter(std::string& out, JsonStyle style) : out_(&out), style_(style) {}
+
+JsonWriter::JsonWriter(std::ostream& out, JsonStyle style)
+    : out_(&buffer_), stream_(&out), style_(style) {
+    buffer_.reserve(kFlushBytes + kFlushBytes / 4);
+}
+
+JsonWriter::~JsonWriter() {
+    flush();
+}
+
+void JsonWriter::maybeFlush() {
+    if (stream_ && buffer_.size() >= kFlushBytes) {
+        flush();
+    }
+}
+
+JsonWriter& JsonWriter::raw(std::string_view text) {
+    out_->append(text);
+    maybeFlush();
+    return *this;
+}
+
+JsonWriter& JsonWriter::raw(char c) {
+    *out_ += c;
+    maybeFlush();
+    return *this;
+}
+
+JsonWriter& JsonWriter::string(std::string_view text) {
+    *out_ += '"';
+    appendEscaped(*out_, text);
+    *out_ += '"';
+    maybeFlush();
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+    string(name);
+    return raw(style_ == JsonStyle::Pretty ? ": " : ":");
+}
+
+JsonWriter& JsonWriter::indent(int width) {
+    if (style_ == JsonStyle::Pretty && width > 0) {
+        out_->append(static_cast<std::size_t>(width), ' ');
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::newline() {
+    if (style_ == JsonStyle::Pretty) {
+        raw('\n');
+    }
+    return *this;
+}
+
+JsonStyle JsonWriter::getStyle() const {
+    return style_;
+}
+
+void JsonWriter::flush() {
+    if (stream_ && !buffer_.empty()) {
+        stream_->write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Pretty matches the indented layout toJson() has always produced; Compact
+// drops every newline and indent.
+enum class JsonStyle { Pretty, Compact };
+
+// Streams JSON text into a std::string, which it appends to directly, or a
+// std::ostream, through a buffer flushed every kFlushBytes and on
+// destruction. Layout is left to the caller: indent() and newline() are
+// no-ops in compact style, and key() drops the space after the colon.
+class JsonWriter {
+private:
+  static constexpr std::size_t kFlushBytes = 64 * 1024;
+
+  std::string buffer_;
+  std::string *out_;
+  std::ostream *stream_ = nullptr;
+  JsonStyle style_;
+
+  void maybeFlush();
+
+public:
+  explicit JsonWriter(std::string &out, JsonStyle style = JsonStyle::Pretty);
+  explicit JsonWriter(std::ostream &out, JsonStyle style = JsonStyle::Pretty);
+  JsonWriter(const JsonWriter &) = delete;
+  JsonWriter &operator=(const JsonWriter &) = delete;
+  ~JsonWriter();
+
+  // text as is.
+  JsonWriter &raw(std::string_view text);
+  JsonWriter &raw(char c);
+  // text quoted, with quotes, backslashes and control characters escaped.
+  JsonWriter &string(std::string_view text);
+  // "name": in pretty style, "name": without the space in compact.
+  JsonWriter &key(std::string_view name);
+  JsonWriter &indent(int width);
+  JsonWriter &newline();
+
+  JsonStyle getStyle() const;
+  // Writes buffered text to the stream; a no-op for string output.
+  void flush();
+};
@@ -1,6 +1,14 @@
 #include "accounting_decision_tree.h"
+#include "benchmark.h"
+
+#include <string>
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return 0;
+    }
 
-int main() {
     loanApprovalExample();
     riskAssessmentExample();
     return 0;
@@ -0,0 +1,626 @@
+#include "native_codegen.h"
+
+#include <dlfcn.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+const char* kPrelude = R"(#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+struct Value {
+  std::uint8_t type;
+  std::uint32_t length;
+  union {
+    std::int64_t i;
+    double d;
+    bool b;
+    const char *s;
+  };
+};
+
+enum : std::uint8_t { MISSING = 0, INT = 1, DOUBLE = 2, BOOL = 3, STRING = 4 };
+enum { LT, LE, GT, GE, EQ, NE };
+
+const Value kMissing = {};
+
+inline const Value &at(const Value *v, std::uint32_t n, std::uint32_t slot) {
+  return slot < n ? v[slot] : kMissing;
+}
+
+inline const Value &orElse(const Value &v, const Value &fallback) {
+  return v.type == MISSING ? fallback : v;
+}
+
+inline Value mkInt(std::int64_t i) { Value v{}; v.type = INT; v.i = i; return v; }
+inline Value mkDouble(double d) { Value v{}; v.type = DOUBLE; v.d = d; return v; }
+inline Value mkBool(bool b) { Value v{}; v.type = BOOL; v.b = b; return v; }
+inline Value mkString(const char *s, std::uint32_t length) {
+  Value v{}; v.type = STRING; v.s = s; v.length = length; return v;
+}
+
+template <int Op, typename T> inline bool apply(T l, T r) {
+  switch (Op) {
+  case LT: return l < r;
+  case LE: return l <= r;
+  case GT: return l > r;
+  case GE: return l >= r;
+  case EQ: return l == r;
+  default: return l != r;
+  }
+}
+
+inline bool numeric(const Value &v) {
+  return v.type == INT || v.type == DOUBLE || v.type == BOOL;
+}
+
+inline double num(const Value &v) {
+  return v.type == INT ? static_cast<double>(v.i)
+         : v.type == DOUBLE ? v.d : (v.b ? 1.0 : 0.0);
+}
+
+template <int Op> inline bool cmp(const Value &l, const Value &r) {
+  if (l.type == MISSING || r.type == MISSING) return false;
+  if (l.type == INT && r.type == INT) return apply<Op>(l.i, r.i);
+  if (numeric(l) && numeric(r)) return apply<Op>(num(l), num(r));
+  if (l.type == STRING && r.type == STRING) {
+    std::uint32_t n = l.length < r.length ? l.length : r.length;
+    int c = n ? std::memcmp(l.s, r.s, n) : 0;
+    if (c == 0) c = (l.length > r.length) - (l.length < r.length);
+    return apply<Op>(c, 0);
+  }
+  return Op == NE;
+}
+
+template <int Op> inline bool cmpInt(const Value &l, std::int64_t k) {
+  if (l.type == INT) return apply<Op>(l.i, k);
+  return cmp<Op>(l, mkInt(k));
+}
+
+inline bool truthy(const Value &v) {
+  return (v.type == BOOL && v.b) || (v.type == INT && v.i == 1) ||
+         (v.type == DOUBLE && v.d == 1.0);
+}
+
+)";
+
+const char* opConstant(CompareOp op) {
+    switch (op) {
+        case CompareOp::Lt:
+            return "LT";
+        case CompareOp::Le:
+            return "LE";
+        case CompareOp::Gt:
+            return "GT";
+        case CompareOp::Ge:
+            return "GE";
+        case CompareOp::Eq:
+            return "EQ";
+        case CompareOp::Ne:
+            return "NE";
+    }
+    return "EQ";
+}
+
+CompareOp mirror(CompareOp op) {
+    switch (op) {
+        case CompareOp::Lt:
+            return CompareOp::Gt;
+        case CompareOp::Le:
+            return CompareOp::Ge;
+        case CompareOp::Gt:
+            return CompareOp::Lt;
+        case CompareOp::Ge:
+            return CompareOp::Le;
+        default:
+            return op;
+    }
+}
+
+std::uint32_t abiSignature() {
+    return static_cast<std::uint32_t>(sizeof(FeatureValue) << 16 |
+                                      offsetof(FeatureValue, i) << 8 |
+                                      offsetof(FeatureValue, length));
+}
+
+std::string doubleLiteral(double d) {
+    if (std::isnan(d)) {
+        return "__builtin_nan(\"\")";
+    }
+    if (std::isinf(d)) {
+        return d > 0 ? "__builtin_inf()" : "-__builtin_inf()";
+    }
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%a", d);
+    return buffer;
+}
+
+std::string stringLiteral(const std::string& text) {
+    std::string out = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            char buffer[8];
+            std::snprintf(buffer, sizeof(buffer), "\\%03o", c);
+            out += buffer;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out + "\"";
+}
+
+// A single-quoted shell word; embedded quotes close the word, add an
+// escaped quote and reopen it.
+std::string shellQuote(const std::string& text) {
+    std::string out = "'";
+    for (char c : text) {
+        if (c == '\'') {
+            out += "'\\''";
+        } else {
+            out += c;
+        }
+    }
+    return out + "'";
+}
+
+class SourceEmitter {
+private:
+    const FeatureSchema& schema_;
+    std::map<Result, std::string> constants_;
+    std::string constantDefinitions_;
+
+    std::string constant(const Result& value) {
+        auto it = constants_.find(value);
+        if (it != constants_.end()) {
+            return it->second;
+        }
+
+        std::string name = "k" + std::to_string(constants_.size());
+        std::string init;
+        if (const auto* str = std::get_if<std::string>(&value)) {
+            init = "mkString(" + stringLiteral(*str) + ", " +
+                   std::to_string(str->size()) + "u)";
+        } else if (const auto* i = std::get_if<int>(&value)) {
+            init = "mkInt(" + std::to_string(*i) + "LL)";
+        } else if (const auto* d = std::get_if<double>(&value)) {
+            init = "mkDouble(" + doubleLiteral(*d) + ")";
+        } else {
+            init = std::get<bool>(value) ? "mkBool(true)" : "mkBool(false)";
+        }
+
+        constantDefinitions_ += "const Value " + name + " = " + init + ";\n";
+        constants_.emplace(value, name);
+        return name;
+    }
+
+    std::string feature(const ConditionExpr& expr) {
+        SlotId slot = expr.getSchema() == &schema_ ? expr.getSlot()
+                                                   : schema_.find(expr.getFeature());
+        std::string read = slot == kInvalidSlot
+                               ? std::string("kMissing")
+                               : "at(v, n, " + std::to_string(slot) + "u)";
+        return expr.hasFallback() ? "orElse(" + read + ", " + constant(expr.getValue()) + ")"
+                                  : read;
+    }
+
+    std::string operand(const ExprPtr& expr) {
+        switch (expr->kind()) {
+            case ExprKind::Feature:
+                return feature(*expr);
+            case ExprKind::Constant:
+                return constant(expr->getValue());
+            default:
+                return "mkBool(" + condition(expr) + ")";
+        }
+    }
+
+public:
+    explicit SourceEmitter(const FeatureSchema& schema) : schema_(schema) {}
+
+    std::string condition(const ExprPtr& expr) {
+        switch (expr->kind()) {
+            case ExprKind::Feature:
+                return "truthy(" + feature(*expr) + ")";
+            case ExprKind::Constant:
+                return expr->evaluate(Context{}) ? "true" : "false";
+            case ExprKind::Compare: {
+                const ExprPtr& lhs = expr->getOperands()[0];
+                const ExprPtr& rhs = expr->getOperands()[1];
+                if (rhs->kind() == ExprKind::Constant &&
+                    std::holds_alternative<int>(rhs->getValue())) {
+                    return std::string("cmpInt<") + opConstant(expr->op()) + ">(" +
+                           operand(lhs) + ", " +
+                           std::to_string(std::get<int>(rhs->getValue())) + "LL)";
+                }
+                if (lhs->kind() == ExprKind::Constant &&
+                    std::holds_alternative<int>(lhs->getValue())) {
+                    return std::string("cmpInt<") + opConstant(mirror(expr->op())) + ">(" +
+                           operand(rhs) + ", " +
+                           std::to_string(std::get<int>(lhs->getValue())) + "LL)";
+                }
+                return std::string("cmp<") + opConstant(expr->op()) + ">(" +
+                       operand(lhs) + ", " + operand(rhs) + ")";
+            }
+            case ExprKind::And:
+            case ExprKind::Or: {
+                std::string joiner = expr->kind() == ExprKind::And ? " && " : " || ";
+                std::string code = "(";
+                const auto& operands = expr->getOperands();
+                for (std::size_t i = 0; i < operands.size(); ++i) {
+                    if (i > 0) {
+                        code += joiner;
+                    }
+                    code += condition(operands[i]);
+                }
+                return code + ")";
+            }
+            case ExprKind::Not:
+                return "!" + condition(expr->getOperands()[0]);
+            case ExprKind::In: {
+                std::string value = operand(expr->getOperands()[0]);
+                std::string code = "(false";
+                for (const auto& candidate : expr->getValues()) {
+                    code += " || cmp<EQ>(" + value + ", " + constant(candidate) + ")";
+                }
+                return code + ")";
+            }
+        }
+        return "false";
+    }
+
+    std::string predicate(const FlatTree& tree, std::uint32_t index) {
+        const Predicate& predicate = tree.getPredicate(index);
+        if (predicate.getExpr()) {
+            return condition(predicate.getExpr());
+        }
+        return "callback(user, " + std::to_string(index) + "u)";
+    }
+
+    // A switch as native dispatch: strings by length then memcmp, integer
+    // keys through a C++ switch, and the remaining numeric keys by equality,
+    // matching SwitchTable::select.
+    std::string switchDispatch(const FlatTree& tree, const FlatNode& node) {
+        const FlatSwitch& flatSwitch = tree.getSwitch(node.operand);
+        auto target = [&](std::uint32_t caseIndex) {
+            return "goto n" + std::to_string(tree.getCase(flatSwitch.firstCase + caseIndex)) +
+                   ";";
+        };
+
+        std::ostringstream code;
+        code << "  {\n"
+             << "    const Value &key = " << feature(*flatSwitch.feature) << ";\n";
+
+        std::map<std::size_t, std::vector<SwitchTable::StringKey>> byLength;
+        for (auto& key : flatSwitch.table.stringKeys()) {
+            byLength[key.key.size()].push_back(std::move(key));
+        }
+        if (!byLength.empty()) {
+            code << "    if (key.type == STRING) {\n"
+                 << "      switch (key.length) {\n";
+            for (const auto& [length, keys] : byLength) {
+                code << "      case " << length << "u:\n";
+                for (const auto& key : keys) {
+                    if (length == 0) {
+                        code << "        " << target(key.caseIndex) << "\n";
+                        continue;
+                    }
+                    code << "        if (std::memcmp(key.s, " << stringLiteral(key.key) << ", "
+                         << length << "u) == 0) " << target(key.caseIndex) << "\n";
+                }
+                code << "        break;\n";
+            }
+            code << "      }\n"
+                 << "    }\n";
+        }
+
+        std::vector<SwitchTable::NumericKey> integers;
+        std::vector<SwitchTable::NumericKey> others;
+        for (const auto& key : flatSwitch.table.numericKeys()) {
+            bool integral = std::floor(key.key) == key.key && std::fabs(key.key) < 0x1p53;
+            (integral ? integers : others).push_back(key);
+        }
+        if (!integers.empty()) {
+            code << "    if (key.type == INT) {\n"
+                 << "      switch (key.i) {\n";
+            for (const auto& key : integers) {
+                code << "      case " << static_cast<std::int64_t>(key.key) << "LL: "
+                     << target(key.caseIndex) << "\n";
+            }
+            code << "      default: break;\n"
+                 << "      }\n"
+                 << "    }\n";
+        }
+        if (!integers.empty() || !others.empty()) {
+            // An int only reaches the chain when it is too large to be exact
+            // as a double, so only keys of that size can match it there.
+            code << "    if (numeric(key)) {\n"
+                 << "      const double d = num(key);\n"
+                 << "      const bool exact = key.type != INT;\n";
+            for (const auto& key : integers) {
+                code << "      if (exact && d == " << doubleLiteral(key.key) << ") "
+                     << target(key.caseIndex) << "\n";
+            }
+            for (const auto& key : others) {
+                code << "      if (d == " << doubleLiteral(key.key) << ") " << target(key.caseIndex)
+                     << "\n";
+            }
+            code << "    }\n";
+        }
+        code << "  }\n"
+             << "  goto n" << node.second << ";\n";
+        return code.str();
+    }
+
+    const std::string& constantDefinitions() const {
+        return constantDefinitions_;
+    }
+};
+
+struct CallbackState {
+    const FlatTree* tree;
+    const FlatContext* context;
+};
+
+bool invokePredicate(void* user, std::uint32_t predicate) {
+    auto* state = static_cast<CallbackState*>(user);
+    return state->tree->getPredicate(predicate).test(*state->context);
+}
+
+void addAround(const ExprPtr& featureExpr, const Result& value, const FeatureSchema& schema,
+               std::vector<std::vector<Result>>& candidates) {
+    SlotId slot = schema.find(featureExpr->getFeature());
+    if (slot == kInvalidSlot) {
+        return;
+    }
+    auto& values = candidates[slot];
+    values.push_back(value);
+    if (const auto* i = std::get_if<int>(&value)) {
+        if (*i > std::numeric_limits<int>::min()) {
+            values.push_back(*i - 1);
+        }
+        if (*i < std::numeric_limits<int>::max()) {
+            values.push_back(*i + 1);
+        }
+        values.push_back(static_cast<double>(*i) + 0.5);
+    } else if (const auto* d = std::get_if<double>(&value)) {
+        values.push_back(std::nextafter(*d, -INFINITY));
+        values.push_back(std::nextafter(*d, INFINITY));
+    }
+}
+
+void collectCandidates(const ExprPtr& expr, const FeatureSchema& schema,
+                       std::vector<std::vector<Result>>& candidates) {
+
+    const auto& operands = expr->getOperands();
+    if (expr->kind() == ExprKind::Compare) {
+        if (operands[0]->kind() == ExprKind::Feature &&
+            operands[1]->kind() == ExprKind::Constant) {
+            addAround(operands[0], operands[1]->getValue(), schema, candidates);
+        } else if (operands[1]->kind() == ExprKind::Feature &&
+                   operands[0]->kind() == ExprKind::Constant) {
+            addAround(operands[1], operands[0]->getValue(), schema, candidates);
+        }
+    } else if (expr->kind() == ExprKind::In && operands[0]->kind() == ExprKind::Feature) {
+        for (const auto& value : expr->getValues()) {
+            addAround(operands[0], value, schema, candidates);
+        }
+    }
+
+    for (const auto& operand : operands) {
+        collectCandidates(operand, schema, candidates);
+    }
+}
+
+void setValue(FlatContext& context, SlotId slot, const Result& value) {
+    std::visit([&](const auto& v) { context.set(slot, v); }, value);
+}
+
+}
+
+std::string generateNativeSource(const FlatTree& tree, const FeatureSchema& schema) {
+    SourceEmitter emitter(schema);
+    std::ostringstream body;
+
+    body << "extern \"C\" std::uint32_t dte_find_leaf(const Value *v, std::uint32_t n,\n"
+         << "    bool (*callback)(void *, std::uint32_t), void *user) {\n"
+         << "  (void)v; (void)n; (void)callback; (void)user;\n"
+         << "  goto n" << tree.getRoot() << ";\n";
+
+    for (NodeIndex index = 0; index < tree.nodeCount(); ++index) {
+        const FlatNode& node = tree.getNode(index);
+        body << "n" << index << ":\n";
+
+        switch (node.kind) {
+            case FlatNodeKind::Outcome:
+                body << "  return " << index << "u;\n";
+                break;
+            case FlatNodeKind::Decision:
+                body << "  if (" << emitter.predicate(tree, node.operand) << ") goto n"
+                     << node.first << ";\n"
+                     << "  goto n" << node.second << ";\n";
+                break;
+            case FlatNodeKind::MultiBranch:
+                for (std::uint32_t i = 0; i < node.first; ++i) {
+                    const FlatBranch& branch = tree.getBranch(node.operand + i);
+                    body << "  if (" << emitter.predicate(tree, branch.predicate)
+                         << ") goto n" << branch.child << ";\n";
+                }
+                body << "  goto n" << node.second << ";\n";
+                break;
+            case FlatNodeKind::Switch:
+                body << emitter.switchDispatch(tree, node);
+                break;
+        }
+    }
+    body << "}\n";
+
+    std::ostringstream source;
+    source << kPrelude << emitter.constantDefinitions() << "\n}\n\n"
+           << "extern \"C\" std::uint32_t dte_abi() {\n"
+           << "  return static_cast<std::uint32_t>(sizeof(Value) << 16 |\n"
+           << "      offsetof(Value, i) << 8 | offsetof(Value, length));\n"
+           << "}\n\n"
+           << body.str();
+    return source.str();
+}
+
+NativeEvaluator::~NativeEvaluator() {
+    if (handle_) {
+        dlclose(handle_);
+    }
+}
+
+std::unique_ptr<NativeEvaluator> NativeEvaluator::compile(const FlatTree& tree,
+                                                          const FeatureSchema& schema,
+                                                          const NativeCompileOptions& options) {
+    std::string dirTemplate = options.workDir + "/dte-native-XXXXXX";
+    std::vector<char> dir(dirTemplate.begin(), dirTemplate.end());
+    dir.push_back('\0');
+    if (!mkdtemp(dir.data())) {
+        throw std::runtime_error("cannot create native build directory in " + options.workDir);
+    }
+
+    std::string base = dir.data();
+    std::string sourcePath = base + "/tree.cpp";
+    std::string libraryPath = base + "/tree.so";
+    std::string logPath = base + "/compile.log";
+
+    {
+        std::ofstream out(sourcePath);
+        out << generateNativeSource(tree, schema);
+        if (!out) {
+            throw std::runtime_error("cannot write " + sourcePath);
+        }
+    }
+
+    std::string command = options.compiler + " " + options.flags + " -o " +
+                          shellQuote(libraryPath) + " " + shellQuote(sourcePath) + " > " +
+                          shellQuote(logPath) + " 2>&1";
+    int status = std::system(command.c_str());
+
+    auto cleanup = [&] {
+        if (!options.keepFiles) {
+            std::remove(sourcePath.c_str());
+            std::remove(libraryPath.c_str());
+            std::remove(logPath.c_str());
+            rmdir(base.c_str());
+        }
+    };
+
+    if (status != 0) {
+        std::ifstream log(logPath);
+        std::string message((std::istreambuf_iterator<char>(log)),
+                            std::istreambuf_iterator<char>());
+        cleanup();
+        throw std::runtime_error("native compilation failed: " + message);
+    }
+
+    std::unique_ptr<NativeEvaluator> evaluator(new NativeEvaluator());
+    evaluator->libraryPath_ = libraryPath;
+    evaluator->handle_ = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!evaluator->handle_) {
+        std::string error = dlerror();
+        cleanup();
+        throw std::runtime_error("dlopen failed: " + error);
+    }
+    cleanup();
+
+    using AbiFn = std::uint32_t (*)();
+    auto abi = reinterpret_cast<AbiFn>(dlsym(evaluator->handle_, "dte_abi"));
+    evaluator->findLeaf_ =
+        reinterpret_cast<NativeFindLeafFn>(dlsym(evaluator->handle_, "dte_find_leaf"));
+    if (!abi || !evaluator->findLeaf_) {
+        throw std::runtime_error("generated library is missing its entry points");
+    }
+    if (abi() != abiSignature()) {
+        throw std::runtime_error("generated library value layout does not match FeatureValue");
+    }
+
+    return evaluator;
+}
+
+NodeIndex NativeEvaluator::findLeaf(const FlatTree& tree, const FlatContext& context) const {
+    CallbackState state{&tree, &context};
+    return findLeaf_(context.data(), static_cast<std::uint32_t>(context.size()),
+                     &invokePredicate, &state);
+}
+
+const std::string& NativeEvaluator::getLibraryPath() const {
+    return libraryPath_;
+}
+
+bool verifyNativeEvaluator(const NativeEvaluator& evaluator,
+                           const FlatTree& tree,
+                           const FeatureSchema& schema,
+                           const std::vector<FlatContext>& samples,
+                           std::size_t generated,
+                           std::string* report) {
+    auto check = [&](const FlatContext& context, const char* origin, std::size_t i) {
+        NodeIndex expected = tree.findLeaf(context);
+        NodeIndex actual = evaluator.findLeaf(tree, context);
+        if (expected == actual) {
+            return true;
+        }
+        if (report) {
+            *report = std::string(origin) + " input " + std::to_string(i) +
+                      ": interpreted reached '" + tree.getName(expected) +
+                      "', native reached '" + tree.getName(actual) + "'";
+        }
+        return false;
+    };
+
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        if (!check(samples[i], "sample", i)) {
+            return false;
+        }
+    }
+
+    std::vector<std::vector<Result>> candidates(schema.size());
+    for (std::uint32_t i = 0; i < tree.predicateCount(); ++i) {
+        if (tree.getPredicate(i).getExpr()) {
+            collectCandidates(tree.getPredicate(i).getExpr(), schema, candidates);
+        }
+    }
+    for (NodeIndex index = 0; index < tree.nodeCount(); ++index) {
+        if (tree.getNode(index).kind == FlatNodeKind::Switch) {
+            const FlatSwitch& flatSwitch = tree.getSwitch(tree.getNode(index).operand);
+            const auto* source = static_cast<const SwitchNode*>(tree.getSource(index));
+            for (const auto& entry : source->getCases()) {
+                addAround(flatSwitch.feature, entry.first, schema, candidates);
+            }
+        }
+    }
+
+    std::mt19937 rng(12345);
+    for (std::size_t i = 0; i < generated; ++i) {
+        FlatContext context(schema);
+        for (SlotId slot = 0; slot < schema.size(); ++slot) {
+            const auto& values = candidates[slot];
+            std::size_t pick = rng() % (values.size() + 1);
+            if (pick < values.size()) {
+                setValue(context, slot, values[pick]);
+            }
+        }
+        if (!check(context, "generated", i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "flat_tree.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Signature of the generated entry point. Values are the FlatContext slots;
+// predicates without an expression are evaluated by calling back into the
+// host with their predicate index.
+using NativePredicateCallback = bool (*)(void *user, std::uint32_t predicate);
+using NativeFindLeafFn = std::uint32_t (*)(const FeatureValue *values,
+                                           std::uint32_t count,
+                                           NativePredicateCallback callback,
+                                           void *user);
+
+// compiler and flags are passed to the shell as written, so they may hold
+// several words; the paths under workDir are quoted.
+struct NativeCompileOptions {
+  std::string compiler = "g++";
+  std::string flags = "-O2 -shared -fPIC";
+  std::string workDir = "/tmp";
+  bool keepFiles = false;
+  std::size_t verificationSamples = 4096;
+};
+
+// Emits straight-line C++ for a frozen tree: one label per node, conditions
+// inlined over the typed slot values, and a return of the reached leaf.
+std::string generateNativeSource(const FlatTree &tree,
+                                 const FeatureSchema &schema);
+
+// A generated evaluator compiled into a shared object and loaded with
+// dlopen. compile() throws std::runtime_error if the compiler fails or the
+// library cannot be loaded.
+class NativeEvaluator {
+private:
+  void *handle_ = nullptr;
+  NativeFindLeafFn findLeaf_ = nullptr;
+  std::string libraryPath_;
+
+  NativeEvaluator() = default;
+
+public:
+  NativeEvaluator(const NativeEvaluator &) = delete;
+  NativeEvaluator &operator=(const NativeEvaluator &) = delete;
+  ~NativeEvaluator();
+
+  static std::unique_ptr<NativeEvaluator>
+  compile(const FlatTree &tree, const FeatureSchema &schema,
+          const NativeCompileOptions &options = {});
+
+  NodeIndex findLeaf(const FlatTree &tree, const FlatContext &context) const;
+
+  const std::string &getLibraryPath() const;
+};
+
+// Checks that the native evaluator reaches the same leaf as the FlatTree on
+// every sample plus generated inputs around each constant the tree compares
+// against. Returns false and describes the first divergence in report.
+bool verifyNativeEvaluator(const NativeEvaluator &evaluator,
+                           const FlatTree &tree, const FeatureSchema &schema,
+                           const std::vector<FlatContext> &samples,
+                           std::size_t generated, std::string *report);
@@ -0,0 +1,49 @@
+#include "native_registry.h"
+
+#include <memory>
+#include <stdexcept>
+
+void NativeRegistry::checkName(const std::string& name) {
+    if (name.empty()) {
+        throw std::runtime_error("native predicates and actions need a name");
+    }
+}
+
+NativeRegistry& NativeRegistry::addAction(const std::string& name, Action action) {
+    checkName(name);
+    if (!action) {
+        throw std::runtime_error("native action \"" + name + "\" is empty");
+    }
+    actions_[name] = {std::move(action), std::make_shared<const std::string>(name)};
+    return *this;
+}
+
+bool NativeRegistry::hasPredicate(const std::string& name) const {
+    return predicates_.count(name) != 0;
+}
+
+bool NativeRegistry::hasAction(const std::string& name) const {
+    return actions_.count(name) != 0;
+}
+
+const Predicate& NativeRegistry::predicate(const std::string& name) const {
+    auto found = predicates_.find(name);
+    if (found == predicates_.end()) {
+        throw std::runtime_error("native predicate \"" + name + "\" is not registered");
+    }
+    return found->second;
+}
+
+const Action& NativeRegistry::action(const std::string& name) const {
+    auto found = actions_.find(name);
+    if (found == actions_.end()) {
+        throw std::runtime_error("native action \"" + name + "\" is not registered");
+    }
+    return found->second.action;
+}
+
+NodePtr NativeRegistry::outcome(Result value, const std::string& action) const {
+    auto node = std::make_shared<OutcomeNode>(std::move(value), this->action(action));
+    node->actionName_ = actions_.at(action).name;
+    return node;
+}
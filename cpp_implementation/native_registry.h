@@ -0,0 +1,59 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Native conditions and actions that no expression can state, registered
+// once under stable names (e.g. "credit_score_ok") so trees using them can
+// be written with toJson() and loaded back. Predicates from predicate() and
+// outcomes from outcome() carry their name: toJson() writes the condition
+// as {"native": "credit_score_ok"} and the outcome with
+// "action": "post_journal", and loadTreeJson() given the registry resolves
+// both back to the same functions. Register everything before loading
+// trees or sharing the registry across threads; lookups are const.
+class NativeRegistry {
+private:
+  std::unordered_map<std::string, Predicate> predicates_;
+  struct RegisteredAction {
+    Action action;
+    std::shared_ptr<const std::string> name;
+  };
+  std::unordered_map<std::string, RegisteredAction> actions_;
+
+  static void checkName(const std::string &name);
+
+public:
+  // condition is a Condition or a SlotCondition and must be pure: the same
+  // input always gives the same answer, with no side effects. Flattened
+  // trees merge every use of one registration into one predicate and
+  // evaluate it at most once per walk. Registering a name again replaces it
+  // for trees built or loaded afterwards, which keep it apart from the
+  // old function; an empty condition throws.
+  template <typename F>
+  NativeRegistry &addPredicate(const std::string &name, F condition) {
+    checkName(name);
+    Predicate predicate(std::move(condition));
+    if (!predicate) {
+      throw std::runtime_error("native predicate \"" + name + "\" is empty");
+    }
+    predicate.name_ = std::make_shared<const std::string>(name);
+    predicates_[name] = std::move(predicate);
+    return *this;
+  }
+  // Like addPredicate(), registering a name again replaces it without
+  // merging with outcomes made from the old action.
+  NativeRegistry &addAction(const std::string &name, Action action);
+
+  bool hasPredicate(const std::string &name) const;
+  bool hasAction(const std::string &name) const;
+  // Both throw std::runtime_error for names never registered.
+  const Predicate &predicate(const std::string &name) const;
+  const Action &action(const std::string &name) const;
+  // An outcome that runs the action registered as action.
+  NodePtr outcome(Result value, const std::string &action) const;
+};
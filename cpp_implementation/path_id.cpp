@@ -0,0 +1,54 @@
+#include "path_id.h"
+
+std::vector<TraceStep> decodePath(const FlatTree& tree, PathId id, NodeIndex* leaf) {
+    std::vector<TraceStep> steps;
+    unsigned length = pathLength(id);
+    unsigned offset = 0;
+    NodeIndex index = tree.getRoot();
+
+    for (;;) {
+        const FlatNode& node = tree.getNode(index);
+        if (node.kind == FlatNodeKind::Outcome) {
+            break;
+        }
+
+        unsigned width = pathStepWidth(node);
+        if (offset + width > length) {
+            break;
+        }
+        std::uint32_t branch = static_cast<std::uint32_t>(
+            (id >> offset) & ((std::uint64_t{1} << width) - 1));
+        offset += width;
+
+        if (node.kind == FlatNodeKind::Decision) {
+            steps.push_back({index, branch});
+            index = branch == 0 ? node.first : node.second;
+        } else {
+            if (branch > node.first) {
+                break;
+            }
+            steps.push_back({index, branch});
+            index = tree.childOf(index, branch);
+        }
+    }
+
+    if (leaf) {
+        *leaf = index;
+    }
+    return steps;
+}
+
+std::vector<std::string> renderPath(const FlatTree& tree, PathId id) {
+    NodeIndex leaf = 0;
+    std::vector<std::string> lines;
+    for (const TraceStep& step : decodePath(tree, id, &leaf)) {
+        lines.push_back(describeStep(tree, step));
+    }
+
+    if (tree.getNode(leaf).kind == FlatNodeKind::Outcome) {
+        lines.push_back(tree.getName(leaf));
+    } else {
+        lines.push_back("... path truncated at " + tree.getName(leaf));
+    }
+    return lines;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "flat_tree.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bits used by one step at node, given the tree the path was taken in.
+inline unsigned pathStepWidth(const FlatNode &node) {
+  if (node.kind == FlatNodeKind::Decision) {
+    return 1;
+  }
+  unsigned width = 0;
+  for (std::uint32_t choices = node.first; choices; choices >>= 1) {
+    ++width;
+  }
+  return width;
+}
+
+// Visitor for FlatTree::walk that packs the steps into a PathId.
+class PathEncoder {
+private:
+  const FlatTree *tree_;
+  std::uint64_t bits_ = 0;
+  unsigned length_ = 0;
+  bool overflow_ = false;
+
+public:
+  explicit PathEncoder(const FlatTree &tree) : tree_(&tree) {}
+
+  void operator()(NodeIndex node, std::uint32_t branch) {
+    unsigned width = pathStepWidth(tree_->getNode(node));
+    if (overflow_ || length_ + width > kPathBits) {
+      overflow_ = true;
+      return;
+    }
+    bits_ |= static_cast<std::uint64_t>(branch) << length_;
+    length_ += width;
+  }
+
+  PathId id() const {
+    std::uint64_t length = length_ | (overflow_ ? kPathOverflow : 0u);
+    return bits_ | (length << kPathBits);
+  }
+};
+
+// Replays id against the tree it was recorded in. Returns the steps and sets
+// leaf to the reached outcome; an overflowed id decodes its stored prefix
+// and reports leaf as the node where the bits ran out.
+std::vector<TraceStep> decodePath(const FlatTree &tree, PathId id,
+                                  NodeIndex *leaf = nullptr);
+
+// describeStep for every decoded step, then the outcome (or a truncation
+// marker for an overflowed id).
+std::vector<std::string> renderPath(const FlatTree &tree, PathId id);
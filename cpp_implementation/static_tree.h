@@ -0,0 +1,303 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <memory>
+#include <string>
+#include <type_traits>
+
+// Compile-time trees for rulesets that are fixed at build time. Structure,
+// features and comparisons are encoded in types, so evaluate() inlines into
+// a single function with no heap, no std::function and no virtual calls:
+//
+//   struct CreditScore {
+//     static constexpr const char *name = "credit_score";
+//     static constexpr SlotId slot = 2;
+//   };
+//   struct CreditCheck {
+//     static constexpr const char *value = "Credit Check";
+//   };
+//   struct Approved { static constexpr const char *value = "APPROVED"; };
+//   struct Denied { static constexpr const char *value = "DENIED"; };
+//
+//   using Loan = static_tree::Tree<static_tree::Decision<
+//       CreditCheck,
+//       static_tree::Ge<static_tree::Feature<CreditScore, static_tree::Int<0>>,
+//                       static_tree::Int<650>>,
+//       static_tree::Outcome<Approved>, static_tree::Outcome<Denied>>>;
+//
+// Inputs are FlatContexts whose schema places each feature at its declared
+// slot (see Tree::bindsTo). toNode() builds the equivalent runtime tree with
+// ConditionExpr conditions, so rules can move between the two forms.
+namespace static_tree {
+
+template <int V> struct Int {
+  static FeatureValue value(const FlatContext &) {
+    FeatureValue v;
+    v.type = ValueType::Int;
+    v.i = V;
+    return v;
+  }
+  static Result result() { return V; }
+  static ExprPtr toExpr(const FeatureSchema &) {
+    return ConditionExpr::constant(result());
+  }
+  static bool bindsTo(const FeatureSchema &) { return true; }
+};
+
+template <long long Num, long long Den = 1> struct Ratio {
+  static FeatureValue value(const FlatContext &) {
+    FeatureValue v;
+    v.type = ValueType::Double;
+    v.d = static_cast<double>(Num) / static_cast<double>(Den);
+    return v;
+  }
+  static Result result() {
+    return static_cast<double>(Num) / static_cast<double>(Den);
+  }
+  static ExprPtr toExpr(const FeatureSchema &) {
+    return ConditionExpr::constant(result());
+  }
+  static bool bindsTo(const FeatureSchema &) { return true; }
+};
+
+template <bool B> struct Bool {
+  static FeatureValue value(const FlatContext &) {
+    FeatureValue v;
+    v.type = ValueType::Bool;
+    v.b = B;
+    return v;
+  }
+  static Result result() { return B; }
+  static ExprPtr toExpr(const FeatureSchema &) {
+    return ConditionExpr::constant(result());
+  }
+  static bool bindsTo(const FeatureSchema &) { return true; }
+};
+
+// Reads Decl::slot as stored, falling back to Fallback when it is missing,
+// exactly as a ConditionExpr feature does: comparisons see the raw value.
+template <typename Decl, typename Fallback = void> struct Feature {
+  static FeatureValue value(const FlatContext &context) {
+    const FeatureValue &v = context.value(Decl::slot);
+    if constexpr (!std::is_void_v<Fallback>) {
+      if (v.type == ValueType::Missing) {
+        return Fallback::value(context);
+      }
+    }
+    return v;
+  }
+
+  static ExprPtr toExpr(const FeatureSchema &schema) {
+    if constexpr (std::is_void_v<Fallback>) {
+      return ConditionExpr::feature(Decl::name, &schema);
+    } else {
+      return ConditionExpr::feature(Decl::name, Fallback::result(), &schema);
+    }
+  }
+
+  static bool bindsTo(const FeatureSchema &schema) {
+    return schema.find(Decl::name) == Decl::slot;
+  }
+};
+
+// Same-typed numbers compare inline; every other pairing goes through
+// compareValues(), so missing values, mixed types and strings behave as
+// they do in a ConditionExpr.
+template <typename Op, typename L, typename R> struct Comparison {
+  static bool test(const FlatContext &context) {
+    FeatureValue lhs = L::value(context);
+    FeatureValue rhs = R::value(context);
+    if (lhs.type == rhs.type) {
+      if (lhs.type == ValueType::Int) {
+        return Op{}(lhs.i, rhs.i);
+      }
+      if (lhs.type == ValueType::Double) {
+        return Op{}(lhs.d, rhs.d);
+      }
+    }
+    return compareValues(Op::op, lhs, rhs);
+  }
+
+  static ExprPtr toExpr(const FeatureSchema &schema) {
+    return ConditionExpr::compare(Op::op, L::toExpr(schema),
+                                  R::toExpr(schema));
+  }
+
+  static bool bindsTo(const FeatureSchema &schema) {
+    return L::bindsTo(schema) && R::bindsTo(schema);
+  }
+};
+
+#define STATIC_TREE_COMPARISON(NAME, SYMBOL, OP)                               \
+  struct NAME##Op {                                                            \
+    static constexpr CompareOp op = CompareOp::OP;                             \
+    template <typename T> bool operator()(T lhs, T rhs) const {                \
+      return lhs SYMBOL rhs;                                                   \
+    }                                                                          \
+  };                                                                           \
+  template <typename L, typename R>                                            \
+  struct NAME : Comparison<NAME##Op, L, R> {};
+
+STATIC_TREE_COMPARISON(Lt, <, Lt)
+STATIC_TREE_COMPARISON(Le, <=, Le)
+STATIC_TREE_COMPARISON(Gt, >, Gt)
+STATIC_TREE_COMPARISON(Ge, >=, Ge)
+STATIC_TREE_COMPARISON(Eq, ==, Eq)
+STATIC_TREE_COMPARISON(Ne, !=, Ne)
+
+#undef STATIC_TREE_COMPARISON
+
+template <typename... Conditions> struct And {
+  static bool test(const FlatContext &context) {
+    return (Conditions::test(context) && ...);
+  }
+  static ExprPtr toExpr(const FeatureSchema &schema) {
+    return ConditionExpr::logical(ExprKind::And,
+                                  {Conditions::toExpr(schema)...});
+  }
+  static bool bindsTo(const FeatureSchema &schema) {
+    return (Conditions::bindsTo(schema) && ...);
+  }
+};
+
+template <typename... Conditions> struct Or {
+  static bool test(const FlatContext &context) {
+    return (Conditions::test(context) || ...);
+  }
+  static ExprPtr toExpr(const FeatureSchema &schema) {
+    return ConditionExpr::logical(ExprKind::Or,
+                                  {Conditions::toExpr(schema)...});
+  }
+  static bool bindsTo(const FeatureSchema &schema) {
+    return (Conditions::bindsTo(schema) && ...);
+  }
+};
+
+template <typename Condition> struct Not {
+  static bool test(const FlatContext &context) {
+    return !Condition::test(context);
+  }
+  static ExprPtr toExpr(const FeatureSchema &schema) {
+    return ConditionExpr::negate(Condition::toExpr(schema));
+  }
+  static bool bindsTo(const FeatureSchema &schema) {
+    return Condition::bindsTo(schema);
+  }
+};
+
+template <typename F, typename... Values> struct In {
+  static bool test(const FlatContext &context) {
+    return (Eq<F, Values>::test(context) || ...);
+  }
+  static ExprPtr toExpr(const FeatureSchema &schema) {
+    return ConditionExpr::in(F::toExpr(schema), {Values::result()...});
+  }
+  static bool bindsTo(const FeatureSchema &schema) {
+    return F::bindsTo(schema);
+  }
+};
+
+// Tag::value is a string literal, int, double or bool.
+template <typename Tag> struct Outcome {
+  static const Result &result() {
+    static const Result value = makeResult();
+    return value;
+  }
+
+  static const Result &evaluate(const FlatContext &) { return result(); }
+
+  static NodePtr toNode(const FeatureSchema &) {
+    return std::make_shared<OutcomeNode>(result());
+  }
+
+  static bool bindsTo(const FeatureSchema &) { return true; }
+
+private:
+  static Result makeResult() {
+    if constexpr (std::is_convertible_v<decltype(Tag::value), const char *>) {
+      return Result(std::in_place_type<std::string>, Tag::value);
+    } else {
+      return Result(Tag::value);
+    }
+  }
+};
+
+template <typename Name, typename Condition, typename TrueNode,
+          typename FalseNode>
+struct Decision {
+  static const Result &evaluate(const FlatContext &context) {
+    return Condition::test(context) ? TrueNode::evaluate(context)
+                                    : FalseNode::evaluate(context);
+  }
+
+  static NodePtr toNode(const FeatureSchema &schema) {
+    return std::make_shared<DecisionNode>(
+        Name::value, Predicate(Condition::toExpr(schema)),
+        TrueNode::toNode(schema), FalseNode::toNode(schema));
+  }
+
+  static bool bindsTo(const FeatureSchema &schema) {
+    return Condition::bindsTo(schema) && TrueNode::bindsTo(schema) &&
+           FalseNode::bindsTo(schema);
+  }
+};
+
+template <typename Condition, typename Node> struct Branch {
+  using condition = Condition;
+  using node = Node;
+};
+
+template <typename Name, typename Default, typename... Branches>
+struct MultiBranch {
+  static const Result &evaluate(const FlatContext &context) {
+    return select<Branches...>(context);
+  }
+
+  static NodePtr toNode(const FeatureSchema &schema) {
+    auto node = std::make_shared<MultiBranchNode>(Name::value);
+    (node->addBranch(Predicate(Branches::condition::toExpr(schema)),
+                     Branches::node::toNode(schema)),
+     ...);
+    node->setDefault(Default::toNode(schema));
+    return node;
+  }
+
+  static bool bindsTo(const FeatureSchema &schema) {
+    return Default::bindsTo(schema) &&
+           ((Branches::condition::bindsTo(schema) &&
+             Branches::node::bindsTo(schema)) &&
+            ...);
+  }
+
+private:
+  template <typename First, typename... Rest>
+  static const Result &select(const FlatContext &context) {
+    if (First::condition::test(context)) {
+      return First::node::evaluate(context);
+    }
+    if constexpr (sizeof...(Rest) > 0) {
+      return select<Rest...>(context);
+    } else {
+      return Default::evaluate(context);
+    }
+  }
+};
+
+template <typename Root> struct Tree {
+  static const Result &evaluate(const FlatContext &context) {
+    return Root::evaluate(context);
+  }
+
+  // Builds the equivalent runtime tree over the same schema.
+  static NodePtr toNode(const FeatureSchema &schema) {
+    return Root::toNode(schema);
+  }
+
+  // True when every feature's declared slot matches the schema.
+  static bool bindsTo(const FeatureSchema &schema) {
+    return Root::bindsTo(schema);
+  }
+};
+
+} // namespace static_tree
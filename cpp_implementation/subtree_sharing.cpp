@@ -0,0 +1,283 @@
+#include "subtree_sharing.h"
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// make_shared keeps the reference counts and a vtable pointer beside the
+// object.
+constexpr std::size_t kControlBlockBytes = 2 * sizeof(long) + sizeof(void*);
+
+std::size_t stringBytes(const Result& value) {
+    const auto* str = std::get_if<std::string>(&value);
+    return str ? str->capacity() : 0;
+}
+
+std::size_t nodeBytes(const Node& node) {
+    switch (node.kind()) {
+        case NodeKind::Outcome:
+            return sizeof(OutcomeNode) +
+                   stringBytes(static_cast<const OutcomeNode&>(node).getValue());
+        case NodeKind::Decision:
+            return sizeof(DecisionNode) +
+                   static_cast<const DecisionNode&>(node).getName().capacity();
+        case NodeKind::MultiBranch: {
+            const auto& multi = static_cast<const MultiBranchNode&>(node);
+            return sizeof(MultiBranchNode) + multi.getName().capacity() +
+                   multi.getBranches().capacity() * sizeof(multi.getBranches()[0]);
+        }
+        case NodeKind::Switch: {
+            const auto& switchNode = static_cast<const SwitchNode&>(node);
+            std::size_t bytes = sizeof(SwitchNode) + switchNode.getName().capacity() +
+                                switchNode.getCases().capacity() *
+                                    sizeof(switchNode.getCases()[0]) +
+                                switchNode.getTable().memoryFootprint() - sizeof(SwitchTable);
+            for (const auto& entry : switchNode.getCases()) {
+                bytes += stringBytes(entry.first);
+            }
+            return bytes;
+        }
+    }
+    return 0;
+}
+
+void mix(std::size_t& hash, std::size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+}
+
+// Children are compared by pointer: they are already shared, so identical
+// subtrees below are the same node.
+class Sharer {
+private:
+    std::unordered_map<const Node*, NodePtr> shared_;
+    std::unordered_multimap<std::size_t, NodePtr> interned_;
+
+    // nullopt for nodes that can only be identical to themselves.
+    static std::optional<std::size_t> hashNode(const Node& node) {
+        std::size_t hash = static_cast<std::size_t>(node.kind());
+        auto condition = [&](const Predicate& predicate) {
+            if (const ExprPtr& expr = predicate.getExpr()) {
+                mix(hash, hashExpr(*expr));
+                return true;
+            }
+            if (!predicate.getName().empty()) {
+                mix(hash, std::hash<std::string>()(predicate.getName()));
+                return true;
+            }
+            return false;
+        };
+        auto child = [&](const NodePtr& ptr) { mix(hash, std::hash<Node*>()(ptr.get())); };
+
+        switch (node.kind()) {
+            case NodeKind::Outcome: {
+                const auto& outcome = static_cast<const OutcomeNode&>(node);
+                if (outcome.getAction() && !outcome.actionRegistration()) {
+                    return std::nullopt;
+                }
+                mix(hash, std::hash<Result>()(outcome.getValue()));
+                mix(hash, std::hash<std::string>()(outcome.getActionName()));
+                break;
+            }
+            case NodeKind::Decision: {
+                const auto& decision = static_cast<const DecisionNode&>(node);
+                mix(hash, std::hash<std::string>()(decision.getName()));
+                if (!condition(decision.getCondition())) {
+                    return std::nullopt;
+                }
+                child(decision.getTrueNode());
+                child(decision.getFalseNode());
+                break;
+            }
+            case NodeKind::MultiBranch: {
+                const auto& multi = static_cast<const MultiBranchNode&>(node);
+                mix(hash, std::hash<std::string>()(multi.getName()));
+                for (const auto& [predicate, next] : multi.getBranches()) {
+                    if (!condition(predicate)) {
+                        return std::nullopt;
+                    }
+                    child(next);
+                }
+                child(multi.getDefaultNode());
+                break;
+            }
+            case NodeKind::Switch: {
+                const auto& switchNode = static_cast<const SwitchNode&>(node);
+                mix(hash, std::hash<std::string>()(switchNode.getName()));
+                mix(hash, hashExpr(*switchNode.getFeature()));
+                for (const auto& [value, next] : switchNode.getCases()) {
+                    mix(hash, std::hash<Result>()(value));
+                    child(next);
+                }
+                child(switchNode.getDefaultNode());
+                break;
+            }
+        }
+        return hash;
+    }
+
+    // Registered native conditions are the same when they come from the
+    // same registration.
+    static bool sameCondition(const Predicate& a, const Predicate& b) {
+        if (a.registration() || b.registration()) {
+            return a.registration() == b.registration();
+        }
+        return a.getExpr() != nullptr && b.getExpr() != nullptr &&
+               sameExpr(*a.getExpr(), *b.getExpr());
+    }
+
+    static bool sameNode(const Node& a, const Node& b) {
+        if (a.kind() != b.kind()) {
+            return false;
+        }
+        switch (a.kind()) {
+            case NodeKind::Outcome: {
+                const auto& x = static_cast<const OutcomeNode&>(a);
+                const auto& y = static_cast<const OutcomeNode&>(b);
+                bool unnamedAction = (x.getAction() && !x.actionRegistration()) ||
+                                     (y.getAction() && !y.actionRegistration());
+                return !unnamedAction && x.actionRegistration() == y.actionRegistration() &&
+                       x.getValue() == y.getValue();
+            }
+            case NodeKind::Decision: {
+                const auto& x = static_cast<const DecisionNode&>(a);
+                const auto& y = static_cast<const DecisionNode&>(b);
+                return x.getName() == y.getName() &&
+                       sameCondition(x.getCondition(), y.getCondition()) &&
+                       x.getTrueNode() == y.getTrueNode() && x.getFalseNode() == y.getFalseNode();
+            }
+            case NodeKind::MultiBranch: {
+                const auto& x = static_cast<const MultiBranchNode&>(a);
+                const auto& y = static_cast<const MultiBranchNode&>(b);
+                if (x.getName() != y.getName() || x.getDefaultNode() != y.getDefaultNode() ||
+                    x.getBranches().size() != y.getBranches().size()) {
+                    return false;
+                }
+                for (std::size_t i = 0; i < x.getBranches().size(); ++i) {
+                    if (!sameCondition(x.getBranches()[i].first, y.getBranches()[i].first) ||
+                        x.getBranches()[i].second != y.getBranches()[i].second) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            case NodeKind::Switch: {
+                const auto& x = static_cast<const SwitchNode&>(a);
+                const auto& y = static_cast<const SwitchNode&>(b);
+                return x.getName() == y.getName() &&
+                       sameExpr(*x.getFeature(), *y.getFeature()) &&
+                       x.getCases() == y.getCases() && x.getDefaultNode() == y.getDefaultNode();
+            }
+        }
+        return false;
+    }
+
+    // node itself when none of its children changed, otherwise a copy over
+    // the shared children.
+    NodePtr withSharedChildren(const NodePtr& node) {
+        switch (node->kind()) {
+            case NodeKind::Outcome:
+                break;
+            case NodeKind::Decision: {
+                const auto& decision = static_cast<const DecisionNode&>(*node);
+                NodePtr trueNode = share(decision.getTrueNode());
+                NodePtr falseNode = share(decision.getFalseNode());
+                if (trueNode != decision.getTrueNode() || falseNode != decision.getFalseNode()) {
+                    return std::make_shared<DecisionNode>(
+                        decision.getName(), decision.getCondition(), trueNode, falseNode);
+                }
+                break;
+            }
+            case NodeKind::MultiBranch: {
+                const auto& multi = static_cast<const MultiBranchNode&>(*node);
+                bool changed = false;
+                std::vector<NodePtr> children;
+                for (const auto& branch : multi.getBranches()) {
+                    children.push_back(share(branch.second));
+                    changed |= children.back() != branch.second;
+                }
+                NodePtr defaultNode = share(multi.getDefaultNode());
+                if (changed || defaultNode != multi.getDefaultNode()) {
+                    auto copy = std::make_shared<MultiBranchNode>(multi.getName());
+                    for (std::size_t i = 0; i < children.size(); ++i) {
+                        copy->addBranch(multi.getBranches()[i].first, children[i]);
+                    }
+                    copy->setDefault(defaultNode);
+                    return copy;
+                }
+                break;
+            }
+            case NodeKind::Switch: {
+                const auto& switchNode = static_cast<const SwitchNode&>(*node);
+                bool changed = false;
+                std::vector<std::pair<Result, NodePtr>> cases;
+                for (const auto& [value, child] : switchNode.getCases()) {
+                    cases.emplace_back(value, share(child));
+                    changed |= cases.back().second != child;
+                }
+                NodePtr defaultNode = share(switchNode.getDefaultNode());
+                if (changed || defaultNode != switchNode.getDefaultNode()) {
+                    auto copy = std::make_shared<SwitchNode>(switchNode.getName(),
+                                                             switchNode.getFeature());
+                    copy->addCases(std::move(cases));
+                    copy->setDefault(defaultNode);
+                    return copy;
+                }
+                break;
+            }
+        }
+        return node;
+    }
+
+public:
+    NodePtr share(const NodePtr& node) {
+        if (!node) {
+            return node;
+        }
+        auto found = shared_.find(node.get());
+        if (found != shared_.end()) {
+            return found->second;
+        }
+
+        NodePtr result = withSharedChildren(node);
+        if (std::optional<std::size_t> hash = hashNode(*result)) {
+            auto [begin, end] = interned_.equal_range(*hash);
+            auto match = std::find_if(begin, end, [&](const auto& entry) {
+                return sameNode(*entry.second, *result);
+            });
+            if (match != end) {
+                result = match->second;
+            } else {
+                interned_.emplace(*hash, result);
+            }
+        }
+
+        shared_.emplace(node.get(), result);
+        return result;
+    }
+};
+
+}
+
+std::size_t nodeGraphFootprint(const NodePtr& root) {
+    std::size_t bytes = 0;
+    for (const Node* node : reachableNodes(root)) {
+        bytes += kControlBlockBytes + nodeBytes(*node);
+    }
+    return bytes;
+}
+
+NodePtr shareSubtrees(const NodePtr& root, SubtreeSharingReport* report) {
+    NodePtr result = Sharer().share(root);
+    if (report) {
+        report->nodesBefore = reachableNodes(root).size();
+        report->nodesAfter = reachableNodes(result).size();
+        report->bytesBefore = nodeGraphFootprint(root);
+        report->bytesAfter = nodeGraphFootprint(result);
+    }
+    return result;
+}
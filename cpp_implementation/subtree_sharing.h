@@ -0,0 +1,31 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <cstddef>
+
+// What shareSubtrees() merged. Bytes are nodeGraphFootprint() estimates.
+struct SubtreeSharingReport {
+  std::size_t nodesBefore = 0;
+  std::size_t nodesAfter = 0;
+  std::size_t bytesBefore = 0;
+  std::size_t bytesAfter = 0;
+};
+
+// Approximate heap bytes held by the distinct nodes reachable from root:
+// each node with its shared_ptr control block, name, branch or case list,
+// switch table and outcome string. Conditions are not counted.
+std::size_t nodeGraphFootprint(const NodePtr &root);
+
+// Returns root with structurally identical subtrees merged into one shared
+// node (hash-consing), which turns the tree into a DAG. Nodes are identical
+// when they have the same kind, name, conditions (sameExpr()) and case
+// values, and identical children; outcomes must also have no action, or
+// one from the same NativeRegistry registration. Registered native
+// conditions match by registration (Predicate::registration()); a node with
+// any other lambda condition is never merged. Evaluation
+// results and toJson() are unchanged. Nodes are reused from root where
+// possible; parents of merged subtrees are copied and root itself is left
+// untouched.
+NodePtr shareSubtrees(const NodePtr &root,
+                      SubtreeSharingReport *report = nullptr);
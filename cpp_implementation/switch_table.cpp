@@ -0,0 +1,242 @@
+#include "switch_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+constexpr double kExactIntegerLimit = 9007199254740992.0;  // 2^53
+constexpr std::uint64_t kHashMultiplier = 0x9E3779B97F4A7C15ull;
+
+std::uint64_t hashKey(std::string_view key) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+double numericKey(const Result& key) {
+    if (const auto* i = std::get_if<int>(&key)) {
+        return *i;
+    }
+    if (const auto* d = std::get_if<double>(&key)) {
+        return *d;
+    }
+    return std::get<bool>(key) ? 1.0 : 0.0;
+}
+
+}
+
+SwitchTable::SwitchTable(const std::vector<Result>& keys)
+    : caseCount_(static_cast<std::uint32_t>(keys.size())) {
+    std::vector<StringKey> strings;
+    std::unordered_set<std::string_view> seen;
+    for (std::uint32_t index = 0; index < keys.size(); ++index) {
+        if (const auto* str = std::get_if<std::string>(&keys[index])) {
+            if (seen.insert(*str).second) {
+                strings.push_back({*str, index});
+            }
+        } else if (!std::isnan(numericKey(keys[index]))) {
+            numbers_.push_back({numericKey(keys[index]), index});
+        }
+    }
+
+    // Stable, so the first of several equal keys is the one kept.
+    std::stable_sort(numbers_.begin(), numbers_.end(),
+                     [](const NumericKey& a, const NumericKey& b) { return a.key < b.key; });
+    numbers_.erase(std::unique(numbers_.begin(), numbers_.end(),
+                               [](const NumericKey& a, const NumericKey& b) {
+                                   return a.key == b.key;
+                               }),
+                   numbers_.end());
+
+    bool integral = !numbers_.empty();
+    for (const auto& number : numbers_) {
+        integral &= std::floor(number.key) == number.key &&
+                    std::fabs(number.key) < kExactIntegerLimit;
+    }
+    if (integral) {
+        double span = numbers_.back().key - numbers_.front().key;
+        if (span < 2.0 * static_cast<double>(numbers_.size()) + 16.0) {
+            denseBase_ = static_cast<std::int64_t>(numbers_.front().key);
+            dense_.assign(static_cast<std::size_t>(span) + 1, caseCount_);
+            for (const auto& number : numbers_) {
+                dense_[static_cast<std::int64_t>(number.key) - denseBase_] = number.caseIndex;
+            }
+        }
+    }
+
+    if (!strings.empty()) {
+        buildPerfectHash(strings);
+    }
+}
+
+// Keys are grouped into buckets by the high bits of their hash; buckets are
+// placed largest first, each trying displacements until all its keys land
+// in free slots of a table at most half full. A bucket that cannot be placed
+// grows the table and starts over.
+void SwitchTable::buildPerfectHash(const std::vector<StringKey>& keys) {
+    constexpr std::uint32_t kMaxDisplacement = 1u << 16;
+
+    unsigned bits = 1;
+    while ((std::size_t{1} << bits) < 2 * keys.size()) {
+        ++bits;
+    }
+    displacements_.assign(keys.size() / 4 + 1, 0);
+
+    std::vector<std::vector<std::size_t>> buckets(displacements_.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        buckets[(hashKey(keys[i].key) >> 32) % buckets.size()].push_back(i);
+    }
+    std::vector<std::size_t> order(buckets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    for (unsigned limit = bits + 8; bits <= limit; ++bits) {
+        shift_ = 64 - bits;
+        strings_.assign(std::size_t{1} << bits, StringKey{std::string(), caseCount_});
+
+        bool placed = true;
+        std::vector<std::size_t> slots;
+        for (std::size_t bucket : order) {
+            placed = false;
+            for (std::uint32_t displacement = 0; displacement < kMaxDisplacement && !placed;
+                 ++displacement) {
+                slots.clear();
+                for (std::size_t key : buckets[bucket]) {
+                    std::size_t slot = slotOf(hashKey(keys[key].key) ^ displacement);
+                    if (strings_[slot].caseIndex != caseCount_ ||
+                        std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+                        break;
+                    }
+                    slots.push_back(slot);
+                }
+                if (slots.size() == buckets[bucket].size()) {
+                    displacements_[bucket] = displacement;
+                    for (std::size_t i = 0; i < slots.size(); ++i) {
+                        strings_[slots[i]] = keys[buckets[bucket][i]];
+                    }
+                    placed = true;
+                }
+            }
+            if (!placed) {
+                break;
+            }
+        }
+        if (placed) {
+            return;
+        }
+    }
+    throw std::runtime_error("switch keys could not be placed in a perfect hash");
+}
+
+std::size_t SwitchTable::slotOf(std::uint64_t hash) const {
+    return static_cast<std::size_t>((hash * kHashMultiplier) >> shift_);
+}
+
+std::size_t SwitchTable::hashSlot(std::string_view key, const std::uint32_t* displacements,
+                                  std::size_t displacementCount, unsigned shift) {
+    std::uint64_t hash = hashKey(key);
+    std::uint32_t displacement = displacements[(hash >> 32) % displacementCount];
+    return static_cast<std::size_t>(((hash ^ displacement) * kHashMultiplier) >> shift);
+}
+
+std::uint32_t SwitchTable::selectNumber(double value) const {
+    if (!dense_.empty()) {
+        double offset = value - static_cast<double>(denseBase_);
+        if (offset >= 0.0 && offset < static_cast<double>(dense_.size()) &&
+            std::floor(offset) == offset) {
+            return dense_[static_cast<std::size_t>(offset)];
+        }
+        return caseCount_;
+    }
+
+    auto it = std::lower_bound(numbers_.begin(), numbers_.end(), value,
+                               [](const NumericKey& n, double v) { return n.key < v; });
+    return it != numbers_.end() && it->key == value ? it->caseIndex : caseCount_;
+}
+
+std::uint32_t SwitchTable::select(const FeatureValue& value) const {
+    switch (value.type) {
+        case ValueType::String: {
+            if (strings_.empty()) {
+                return caseCount_;
+            }
+            std::string_view key(value.s, value.length);
+            const StringKey& slot =
+                strings_[hashSlot(key, displacements_.data(), displacements_.size(), shift_)];
+            return slot.caseIndex != caseCount_ && slot.key == key ? slot.caseIndex : caseCount_;
+        }
+        case ValueType::Int:
+            if (!dense_.empty()) {
+                std::uint64_t offset = static_cast<std::uint64_t>(value.i) -
+                                       static_cast<std::uint64_t>(denseBase_);
+                return offset < dense_.size() ? dense_[offset] : caseCount_;
+            }
+            return selectNumber(static_cast<double>(value.i));
+        case ValueType::Double:
+            return std::isnan(value.d) ? caseCount_ : selectNumber(value.d);
+        case ValueType::Bool:
+            return selectNumber(value.b ? 1.0 : 0.0);
+        case ValueType::Missing:
+            break;
+    }
+    return caseCount_;
+}
+
+std::uint32_t SwitchTable::caseCount() const {
+    return caseCount_;
+}
+
+const std::vector<SwitchTable::NumericKey>& SwitchTable::numericKeys() const {
+    return numbers_;
+}
+
+std::vector<SwitchTable::StringKey> SwitchTable::stringKeys() const {
+    std::vector<StringKey> keys;
+    for (const auto& slot : strings_) {
+        if (slot.caseIndex != caseCount_) {
+            keys.push_back(slot);
+        }
+    }
+    std::sort(keys.begin(), keys.end(),
+              [](const StringKey& a, const StringKey& b) { return a.caseIndex < b.caseIndex; });
+    return keys;
+}
+
+const std::vector<std::uint32_t>& SwitchTable::denseCases() const {
+    return dense_;
+}
+
+std::int64_t SwitchTable::denseBase() const {
+    return denseBase_;
+}
+
+const std::vector<SwitchTable::StringKey>& SwitchTable::hashSlots() const {
+    return strings_;
+}
+
+const std::vector<std::uint32_t>& SwitchTable::displacements() const {
+    return displacements_;
+}
+
+unsigned SwitchTable::hashShift() const {
+    return shift_;
+}
+
+std::size_t SwitchTable::memoryFootprint() const {
+    std::size_t bytes = sizeof(SwitchTable) + numbers_.capacity() * sizeof(NumericKey) +
+                        dense_.capacity() * sizeof(std::uint32_t) +
+                        strings_.capacity() * sizeof(StringKey) +
+                        displacements_.capacity() * sizeof(std::uint32_t);
+    for (const auto& slot : strings_) {
+        bytes += slot.key.capacity();
+    }
+    return bytes;
+}
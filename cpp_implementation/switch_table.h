@@ -0,0 +1,69 @@
+#pragma once
+
+#include "context.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Maps a categorical feature value to the index of the case it equals, with
+// the same equality as feature == value in a condition: numbers compare
+// numerically whatever their type, strings by content, and a missing value
+// or a string against a number never matches. When two cases have equal
+// keys the first one wins. Strings go through a hash-and-displace perfect
+// hash (one hash, one displacement load, one probe and one comparison);
+// numbers through a jump table when the keys are dense integers, otherwise
+// a binary search over the sorted keys.
+class SwitchTable {
+public:
+  struct NumericKey {
+    double key;
+    std::uint32_t caseIndex;
+  };
+
+  struct StringKey {
+    std::string key;
+    std::uint32_t caseIndex;
+  };
+
+private:
+  std::uint32_t caseCount_ = 0;
+  std::vector<NumericKey> numbers_;
+  std::vector<std::uint32_t> dense_;
+  std::int64_t denseBase_ = 0;
+  std::vector<StringKey> strings_;
+  std::vector<std::uint32_t> displacements_;
+  unsigned shift_ = 64;
+
+  void buildPerfectHash(const std::vector<StringKey> &keys);
+  std::size_t slotOf(std::uint64_t hash) const;
+  std::uint32_t selectNumber(double value) const;
+
+public:
+  SwitchTable() = default;
+  explicit SwitchTable(const std::vector<Result> &keys);
+
+  // The matching case index, or caseCount() when no case matches.
+  std::uint32_t select(const FeatureValue &value) const;
+
+  std::uint32_t caseCount() const;
+  // Distinct keys with the case each selects, numbers in ascending order.
+  const std::vector<NumericKey> &numericKeys() const;
+  std::vector<StringKey> stringKeys() const;
+  std::size_t memoryFootprint() const;
+
+  // The lookup structures themselves, for TreeImage to store and probe the
+  // same way: the jump table (empty unless the keys are dense integers)
+  // starting at denseBase(), and the perfect hash's slots, in which
+  // caseIndex == caseCount() marks an empty slot.
+  const std::vector<std::uint32_t> &denseCases() const;
+  std::int64_t denseBase() const;
+  const std::vector<StringKey> &hashSlots() const;
+  const std::vector<std::uint32_t> &displacements() const;
+  unsigned hashShift() const;
+  // The slot key hashes to under the given displacements and shift.
+  static std::size_t hashSlot(std::string_view key,
+                              const std::uint32_t *displacements,
+                              std::size_t displacementCount, unsigned shift);
+};
@@ -0,0 +1,66 @@
+#include "../accounting_decision_tree.h"
+#include "test_support.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+NodePtr thresholdTree() {
+    return std::make_shared<DecisionNode>("X", feature("x", 0) >= 10,
+                                          std::make_shared<OutcomeNode>(std::string("HI")),
+                                          std::make_shared<OutcomeNode>(std::string("LO")));
+}
+
+// x sits at slot 1 here, where the engine's own schema puts it at slot 0.
+FeatureSchema foreignSchema() {
+    FeatureSchema schema;
+    schema.intern("pad");
+    schema.intern("x");
+    return schema;
+}
+
+}
+
+TEST(bytecodeRejectsContextsFromAnotherSchema) {
+    DecisionTreeEngine engine(thresholdTree());
+    const FeatureSchema schema = foreignSchema();
+    FlatContext foreign(schema);
+    foreign.set(schema.find("x"), 50);
+    const Result hi = std::string("HI");
+
+    CHECK(engine.evaluate(foreign) == hi);
+    engine.setExecutionMode(ExecutionMode::Flattened);
+    CHECK(engine.evaluate(foreign) == hi);
+
+    engine.setExecutionMode(ExecutionMode::Bytecode);
+    CHECK_THROWS(engine.evaluate(foreign));
+    CHECK_THROWS(engine.evaluateLeaf(foreign));
+    Result result;
+    CHECK_THROWS(engine.evaluateBatch(&foreign, 1, &result));
+    EvaluationSession tracing(true);
+    CHECK_THROWS(engine.evaluate(foreign, tracing));
+
+    FlatContext own(*engine.getSchema());
+    own.set(engine.getSchema()->find("x"), 50);
+    CHECK(engine.evaluate(own) == hi);
+    CHECK(engine.evaluate(own, tracing) == hi);
+    CHECK(engine.evaluate(Context{{"x", 50}}) == hi);
+}
+
+TEST(nativeRejectsContextsFromAnotherSchema) {
+    DecisionTreeEngine engine(thresholdTree());
+    engine.setExecutionMode(ExecutionMode::Native);
+    const FeatureSchema schema = foreignSchema();
+    FlatContext foreign(schema);
+    foreign.set(schema.find("x"), 50);
+
+    CHECK_THROWS(engine.evaluate(foreign));
+    NodeIndex leaf;
+    CHECK_THROWS(engine.evaluateBatch(&foreign, 1, &leaf));
+
+    FlatContext own(*engine.getSchema());
+    own.set(engine.getSchema()->find("x"), 50);
+    CHECK(engine.evaluate(own) == Result(std::string("HI")));
+}
@@ -0,0 +1,200 @@
+#include "../expr_parser.h"
+#include "test_support.h"
+
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+ExprPtr f(const std::string& name) {
+    return ConditionExpr::feature(name);
+}
+
+ExprPtr k(const Result& value) {
+    return ConditionExpr::constant(value);
+}
+
+bool roundTrips(const ExprPtr& expr) {
+    std::string text = expr->toString();
+    ExprPtr parsed = parseExpr(text);
+    return sameExpr(*parsed, *expr) && parsed->toString() == text;
+}
+
+bool parsesAs(const std::string& text, const ExprPtr& expected) {
+    return sameExpr(*parseExpr(text), *expected);
+}
+
+bool failsAtColumn(const std::string& text, int column) {
+    try {
+        parseExpr(text);
+    } catch (const std::runtime_error& e) {
+        return std::string(e.what()).find("at column " + std::to_string(column)) !=
+               std::string::npos;
+    }
+    return false;
+}
+
+class RandomExprs {
+private:
+    std::mt19937 rng_{23};
+
+    Result literal() {
+        switch (rng_() % 7) {
+            case 0:
+                return static_cast<int>(rng_() % 2001) - 1000;
+            case 1:
+                return static_cast<double>(rng_() % 4000) / 7.0;
+            case 2:
+                return std::string(rng_() % 2 ? "q\"uo\\te" : "two words");
+            case 3:
+                return rng_() % 2 == 0;
+            case 4:
+                return rng_() % 2 ? HUGE_VAL : -HUGE_VAL;
+            case 5:
+                return 2.0;
+            default:
+                return std::ldexp(1.0, -1070);
+        }
+    }
+
+    ExprPtr operand() {
+        static const char* const kNames[] = {"score", "debt.ratio", "in", "x_1",
+                                             "two words", "true", "7up", "a`b\\c"};
+        const char* name = kNames[rng_() % 8];
+        switch (rng_() % 4) {
+            case 0:
+                return ConditionExpr::feature(name, literal());
+            case 1:
+                return k(literal());
+            default:
+                return f(name);
+        }
+    }
+
+public:
+    ExprPtr next(int depth = 0) {
+        static const CompareOp kOps[] = {CompareOp::Lt, CompareOp::Le, CompareOp::Gt,
+                                         CompareOp::Ge, CompareOp::Eq, CompareOp::Ne};
+        switch (depth > 3 ? rng_() % 4 : rng_() % 9) {
+            case 0:
+            case 1:
+                return ConditionExpr::compare(kOps[rng_() % 6], operand(), operand());
+            case 2:
+                return ConditionExpr::in(operand(), {literal(), literal()});
+            case 3:
+                return operand();
+            case 4:
+                return ConditionExpr::negate(next(depth + 1));
+            case 5:
+                return ConditionExpr::logical(ExprKind::And, {next(depth + 1), next(depth + 1)});
+            case 6:
+                return ConditionExpr::logical(ExprKind::Or, {next(depth + 1), next(depth + 1)});
+            case 7:
+                return ConditionExpr::compare(kOps[rng_() % 6], next(depth + 1),
+                                              next(depth + 1));
+            default:
+                return ConditionExpr::in(next(depth + 1), {literal()});
+        }
+    }
+};
+
+}
+
+TEST(parseExprRoundTripsToString) {
+    std::vector<ExprPtr> cases = {
+        ConditionExpr::compare(CompareOp::Ge, ConditionExpr::feature("credit_score", 0), k(650)),
+        ConditionExpr::compare(CompareOp::Eq, f("note"), k(std::string("say \"hi\"\\n"))),
+        ConditionExpr::compare(CompareOp::Ne, f("tab"), k(std::string("a\tb\nc"))),
+        ConditionExpr::compare(CompareOp::Lt, f("ratio"), k(0.1)),
+        ConditionExpr::compare(CompareOp::Lt, f("ratio"), k(2.0)),
+        ConditionExpr::compare(CompareOp::Gt, f("tiny"), k(5e-324)),
+        ConditionExpr::compare(CompareOp::Le, f("big"), k(1.7976931348623157e308)),
+        ConditionExpr::compare(CompareOp::Gt, f("x"), k(-HUGE_VAL)),
+        ConditionExpr::compare(CompareOp::Eq, f("x"), k(-2147483647 - 1)),
+        ConditionExpr::compare(CompareOp::Ne, ConditionExpr::negate(f("a")), f("b")),
+        ConditionExpr::negate(ConditionExpr::compare(CompareOp::Ne, f("a"), k(1))),
+        ConditionExpr::negate(ConditionExpr::negate(f("a"))),
+        ConditionExpr::in(f("region"), {std::string("EU"), 3, 2.5, true}),
+        ConditionExpr::in(f("region"), {}),
+        ConditionExpr::in(ConditionExpr::feature("region", std::string("?")), {1}),
+        ConditionExpr::feature("x", std::string("q\"\\")),
+        ConditionExpr::logical(ExprKind::And,
+                               {ConditionExpr::logical(ExprKind::Or, {f("a"), f("b")}), f("c")}),
+        f("two words"),
+        f("true"),
+        f("-5"),
+        f("a`b\\c"),
+        ConditionExpr::feature("(odd) name", 1),
+        ConditionExpr::logical(ExprKind::And, {f("only")}),
+        ConditionExpr::logical(ExprKind::Or, {}),
+    };
+    for (const ExprPtr& expr : cases) {
+        CHECK(roundTrips(expr));
+    }
+
+    RandomExprs random;
+    for (int i = 0; i < 2000; ++i) {
+        CHECK(roundTrips(random.next()));
+    }
+}
+
+TEST(parseExprPrecedence) {
+    auto cmp = [](CompareOp op, ExprPtr lhs, ExprPtr rhs) {
+        return ConditionExpr::compare(op, std::move(lhs), std::move(rhs));
+    };
+    CHECK(parsesAs("a || b && c",
+                   ConditionExpr::logical(
+                       ExprKind::Or,
+                       {f("a"), ConditionExpr::logical(ExprKind::And, {f("b"), f("c")})})));
+    CHECK(parsesAs("!a == b", ConditionExpr::negate(cmp(CompareOp::Eq, f("a"), f("b")))));
+    CHECK(parsesAs("(!a) == b", cmp(CompareOp::Eq, ConditionExpr::negate(f("a")), f("b"))));
+    CHECK(parsesAs("a != 1", cmp(CompareOp::Ne, f("a"), k(1))));
+    CHECK(parsesAs("!a", ConditionExpr::negate(f("a"))));
+    CHECK(parsesAs("a ?? -3 >= 2", cmp(CompareOp::Ge, ConditionExpr::feature("a", -3), k(2))));
+    CHECK(parsesAs("!(x in [])", ConditionExpr::negate(ConditionExpr::in(f("x"), {}))));
+    CHECK(parsesAs("x in[1,\"a\"]", ConditionExpr::in(f("x"), {1, std::string("a")})));
+    CHECK(parsesAs("inside in [1]", ConditionExpr::in(f("inside"), {1})));
+    CHECK(parsesAs("x == 1e5", cmp(CompareOp::Eq, f("x"), k(100000.0))));
+    CHECK(parsesAs("x == 7", cmp(CompareOp::Eq, f("x"), k(7))));
+    CHECK(parsesAs("`a b` ?? \"\" < \"z\"",
+                   cmp(CompareOp::Lt, ConditionExpr::feature("a b", std::string()),
+                       k(std::string("z")))));
+
+    FeatureSchema schema;
+    ExprPtr bound = parseExpr("income >= 1 && score < 2", &schema);
+    CHECK(schema.find("income") == 0 && schema.find("score") == 1);
+    CHECK(bound->getOperands()[1]->getOperands()[0]->getSchema() == &schema);
+}
+
+TEST(parseExprReportsErrorColumn) {
+    CHECK(failsAtColumn("x >= ", 6));
+    CHECK(failsAtColumn("x >= 1 )", 8));
+    CHECK(failsAtColumn("\"abc", 5));
+    CHECK(failsAtColumn("`abc", 5));
+    CHECK(failsAtColumn("x in [1, ", 10));
+    CHECK(failsAtColumn("x ?? y", 6));
+    CHECK(failsAtColumn("x ?? 1 ?? 2", 8));
+    CHECK(failsAtColumn("", 1));
+    CHECK(failsAtColumn("x == 1.5.2", 6));
+    CHECK(failsAtColumn("(x", 3));
+    CHECK(failsAtColumn("x in 3", 6));
+    CHECK(failsAtColumn("a && || b", 6));
+    CHECK(failsAtColumn("x = 1", 3));
+    CHECK(failsAtColumn("x == 99999999999", 6));
+    CHECK(failsAtColumn("x == 1e999", 6));
+}
+
+TEST(parseLiteralValues) {
+    CHECK(parseLiteral("42") == Result(42));
+    CHECK(parseLiteral(" 2.0 ") == Result(2.0));
+    CHECK(parseLiteral("-inf") == Result(-HUGE_VAL));
+    CHECK(parseLiteral("\"a\\\"b\"") == Result(std::string("a\"b")));
+    CHECK(parseLiteral("false") == Result(false));
+    CHECK(std::isnan(std::get<double>(parseLiteral("nan"))));
+    CHECK_THROWS(parseLiteral("1 2"));
+    CHECK_THROWS(parseLiteral("x"));
+    CHECK_THROWS(parseLiteral(""));
+}
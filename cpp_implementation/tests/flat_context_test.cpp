@@ -0,0 +1,68 @@
+#include "../context.h"
+#include "test_support.h"
+
+#include <any>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+static_assert(std::is_nothrow_move_constructible_v<FlatContext>,
+              "vectors of FlatContext move rather than copy when they grow");
+
+TEST(flatContextBuildsItsContextOnceAcrossThreads) {
+    FeatureSchema schema;
+    SlotId score = schema.intern("score");
+    SlotId region = schema.intern("region");
+    FlatContext context(schema);
+    context.set(score, 700);
+    context.set(region, "EU");
+
+    std::vector<const Context*> seen(8);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < seen.size(); ++t) {
+        threads.emplace_back([&, t] { seen[t] = &context.toContext(); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (const Context* built : seen) {
+        CHECK(built == seen[0]);
+    }
+    CHECK(std::any_cast<int>(seen[0]->at("score")) == 700);
+    CHECK(std::any_cast<std::string>(seen[0]->at("region")) == "EU");
+
+    context.set(score, 710);
+    CHECK(std::any_cast<int>(context.toContext().at("score")) == 710);
+    FlatContext copy(context);
+    CHECK(&copy.toContext() != &context.toContext());
+    CHECK(std::any_cast<int>(copy.toContext().at("score")) == 710);
+}
+
+TEST(flatContextReusesStringSlots) {
+    FeatureSchema schema;
+    SlotId region = schema.intern("region");
+    SlotId city = schema.intern("city");
+    FlatContext context(schema);
+    context.set(region, std::string(64, 'r'));
+    const char* buffer = context.value(region).s;
+    for (int i = 0; i < 100; ++i) {
+        context.set(region, std::string(64, static_cast<char>('a' + i % 26)));
+        CHECK(context.value(region).s == buffer);
+    }
+    CHECK(context.get<std::string>(region, "") == std::string(64, 'a' + 99 % 26));
+
+    context.set(city, "Paris");
+    context.reset();
+    CHECK(!context.has(region) && !context.has(city));
+    context.set(region, "EU");
+    CHECK(context.value(region).s == buffer);
+    CHECK(context.get<std::string>(region, "") == "EU");
+
+    FlatContext copy(context);
+    copy.set(region, "US");
+    CHECK(context.get<std::string>(region, "") == "EU");
+    CHECK(copy.get<std::string>(region, "") == "US");
+    FlatContext moved(std::move(copy));
+    CHECK(moved.get<std::string>(region, "") == "US");
+}
@@ -0,0 +1,69 @@
+#include "../native_registry.h"
+#include "../subtree_sharing.h"
+#include "test_support.h"
+
+#include <memory>
+#include <string>
+
+namespace {
+
+NodePtr outcome(const std::string& value) {
+    return std::make_shared<OutcomeNode>(value);
+}
+
+bool atLeast(const Context& context, int threshold) {
+    return getContextValue<int>(context, "x", 0) >= threshold;
+}
+
+}
+
+TEST(reregisteredPredicatesAreNotMerged) {
+    NativeRegistry natives;
+    natives.addPredicate("big", [](const Context& context) { return atLeast(context, 10); });
+    Predicate before = natives.predicate("big");
+    natives.addPredicate("big", [](const Context& context) { return atLeast(context, 100); });
+    Predicate after = natives.predicate("big");
+    CHECK(before.registration() != after.registration());
+    CHECK(natives.predicate("big").registration() == after.registration());
+
+    auto ladder = std::make_shared<MultiBranchNode>("Ladder");
+    ladder->addBranch(after, outcome("NEW"));
+    ladder->addBranch(before, outcome("OLD"));
+    ladder->setDefault(outcome("NONE"));
+    DecisionTreeEngine engine(ladder);
+    const Context input{{"x", 50}};
+    for (ExecutionMode mode : {ExecutionMode::Interpreted, ExecutionMode::Flattened,
+                               ExecutionMode::Bytecode}) {
+        engine.setExecutionMode(mode);
+        CHECK(engine.evaluate(input) == Result(std::string("OLD")));
+    }
+
+    NodePtr hi = outcome("HI");
+    NodePtr lo = outcome("LO");
+    NodePtr tree = std::make_shared<DecisionNode>(
+        "Pick", feature("pick"), std::make_shared<DecisionNode>("Big", before, hi, lo),
+        std::make_shared<DecisionNode>("Big", after, hi, lo));
+    NodePtr shared = shareSubtrees(tree);
+    CHECK(shared->evaluate(Context{{"x", 50}, {"pick", true}}) == Result(std::string("HI")));
+    CHECK(shared->evaluate(Context{{"x", 50}, {"pick", false}}) == Result(std::string("LO")));
+}
+
+TEST(reregisteredActionsAreNotMerged) {
+    int oldRuns = 0;
+    int newRuns = 0;
+    NativeRegistry natives;
+    natives.addAction("post", [&](const Context&) { ++oldRuns; });
+    NodePtr before = natives.outcome(std::string("POSTED"), "post");
+    natives.addAction("post", [&](const Context&) { ++newRuns; });
+    NodePtr after = natives.outcome(std::string("POSTED"), "post");
+    CHECK(std::static_pointer_cast<OutcomeNode>(natives.outcome(std::string("POSTED"), "post"))
+              ->actionRegistration() ==
+          std::static_pointer_cast<OutcomeNode>(after)->actionRegistration());
+
+    NodePtr tree = std::make_shared<DecisionNode>("Pick", feature("pick"), before, after);
+    NodePtr shared = shareSubtrees(tree);
+    shared->evaluate(Context{{"pick", true}});
+    shared->evaluate(Context{{"pick", false}});
+    CHECK(oldRuns == 1 && newRuns == 1);
+    CHECK(shared->toJson() == tree->toJson());
+}
@@ -0,0 +1,128 @@
+#include "../bytecode_vm.h"
+#include "../flat_tree.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace {
+
+// Every allocation in the test binary goes through the replacements
+// below, so a walk can be checked for allocating nothing.
+std::atomic<std::size_t> allocations{0};
+
+// 300 distinct conditions, each tested twice, so the walk's memo spills
+// past the inline words.
+NodePtr buildRepeatedLadder(FeatureSchema& schema) {
+    schema.intern("x", ValueType::Int);
+    auto ladder = std::make_shared<MultiBranchNode>("Ladder");
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < 300; ++i) {
+            ladder->addBranch(feature(schema, "x", 0) == 2 * i,
+                              std::make_shared<OutcomeNode>(pass * 1000 + i));
+        }
+    }
+    ladder->setDefault(std::make_shared<OutcomeNode>(-1));
+    return ladder;
+}
+
+}
+
+// The replacements form a complete set: every other form forwards to the
+// plain operator new or delete, the only two that call malloc() and free().
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return ::operator new(size);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return ::operator new(size, std::nothrow);
+}
+
+// Once this is inlined into a caller that got p from operator new, GCC
+// flags the free() as mismatched, though the operator new it came from is
+// the malloc() above.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete[](void* p) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    ::operator delete(p);
+}
+
+TEST(largePredicateMemoIsClearedPerWalk) {
+    PredicateMemo outer(1000);
+    outer.set(999, true);
+    {
+        PredicateMemo inner(1000);
+        CHECK(!inner.known(999));
+        inner.set(5, false);
+        CHECK(outer.known(999) && outer.value(999));
+    }
+    PredicateMemo next(700);
+    CHECK(!next.known(5));
+    CHECK(outer.known(999));
+}
+
+TEST(largeMemoWalksDoNotAllocate) {
+    FeatureSchema schema;
+    NodePtr root = buildRepeatedLadder(schema);
+    FlatTree tree = FlatTree::freeze(root);
+    BytecodeProgram program = BytecodeProgram::compile(tree, schema);
+    CHECK(tree.predicateCount() == 300);
+    CHECK(program.memoSlotCount() > 256);
+
+    FlatContext context(schema);
+    context.set(0, 598);
+    NodeIndex leaf = tree.findLeaf(context);
+    CHECK(program.findLeaf(tree, context) == leaf);
+    CHECK(tree.outcomeOf(leaf, context) == Result(299));
+
+    std::size_t before = allocations.load();
+    for (int i = 0; i < 100; ++i) {
+        context.set(0, 2 * i + 1);
+        tree.findLeaf(context);
+        program.findLeaf(tree, context);
+    }
+    CHECK(allocations.load() == before);
+}
@@ -0,0 +1,24 @@
+#include "../accounting_decision_tree.h"
+#include "test_support.h"
+
+#include <stdexcept>
+
+TEST(emptyPredicateThrowsLogicError) {
+    FeatureSchema schema;
+    schema.intern("x");
+    Predicate empty;
+    auto throwsLogicError = [](auto&& call) {
+        try {
+            call();
+        } catch (const std::logic_error&) {
+            return true;
+        }
+        return false;
+    };
+    CHECK(throwsLogicError([&] { empty.test(Context{}); }));
+    CHECK(throwsLogicError([&] { empty.test(FlatContext(schema)); }));
+
+    Predicate slotOnly([](const FlatContext& context) { return context.has(0); });
+    CHECK(throwsLogicError([&] { slotOnly.test(Context{}); }));
+    CHECK(!slotOnly.test(FlatContext(schema)));
+}
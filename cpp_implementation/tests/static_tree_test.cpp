@@ -0,0 +1,88 @@
+#include "../static_tree.h"
+#include "test_support.h"
+
+#include <string>
+#include <vector>
+
+namespace st = static_tree;
+
+namespace {
+
+struct Score {
+    static constexpr const char* name = "score";
+    static constexpr SlotId slot = 0;
+};
+
+using Plain = st::Feature<Score>;
+using Defaulted = st::Feature<Score, st::Int<700>>;
+
+// Every way a slot can disagree with an int rule: exact, integral and
+// fractional doubles, a bool, a string and nothing at all.
+std::vector<FlatContext> probes(const FeatureSchema& schema) {
+    std::vector<FlatContext> contexts;
+    auto add = [&](auto value) {
+        FlatContext context(schema);
+        context.set(0, value);
+        contexts.push_back(context);
+    };
+    add(650);
+    add(651);
+    add(650.0);
+    add(650.7);
+    add(649.3);
+    add(true);
+    add(std::string("650"));
+    contexts.emplace_back(schema);
+    return contexts;
+}
+
+template <typename Condition>
+void checkMatchesExpr(const FeatureSchema& schema) {
+    ExprPtr expr = Condition::toExpr(schema);
+    for (const FlatContext& context : probes(schema)) {
+        CHECK(Condition::test(context) == expr->evaluate(context));
+    }
+}
+
+template <template <typename, typename> class Op>
+void checkOperator(const FeatureSchema& schema) {
+    checkMatchesExpr<Op<Plain, st::Int<650>>>(schema);
+    checkMatchesExpr<Op<Defaulted, st::Int<650>>>(schema);
+    checkMatchesExpr<Op<Plain, st::Ratio<6505, 10>>>(schema);
+    checkMatchesExpr<Op<st::Int<650>, Plain>>(schema);
+}
+
+}
+
+TEST(staticComparisonsMatchConditionExpr) {
+    FeatureSchema schema;
+    schema.intern("score", ValueType::Int);
+    checkOperator<st::Lt>(schema);
+    checkOperator<st::Le>(schema);
+    checkOperator<st::Gt>(schema);
+    checkOperator<st::Ge>(schema);
+    checkOperator<st::Eq>(schema);
+    checkOperator<st::Ne>(schema);
+    checkMatchesExpr<st::In<Plain, st::Int<650>, st::Ratio<6507, 10>>>(schema);
+    checkMatchesExpr<st::Not<st::Ne<Plain, st::Int<650>>>>(schema);
+}
+
+TEST(staticComparisonsOnMistypedValues) {
+    FeatureSchema schema;
+    schema.intern("score", ValueType::Int);
+
+    FlatContext fractional(schema);
+    fractional.set(0, 650.7);
+    CHECK((st::Gt<Plain, st::Int<650>>::test(fractional)));
+    CHECK((st::Ne<Plain, st::Int<650>>::test(fractional)));
+
+    FlatContext text(schema);
+    text.set(0, std::string("650"));
+    CHECK((st::Ne<Plain, st::Int<650>>::test(text)));
+    CHECK(!(st::Eq<Plain, st::Int<650>>::test(text)));
+    CHECK(!(st::Ge<Plain, st::Int<650>>::test(text)));
+
+    FlatContext missing(schema);
+    CHECK(!(st::Ne<Plain, st::Int<650>>::test(missing)));
+    CHECK((st::Gt<Defaulted, st::Int<650>>::test(missing)));
+}
@@ -0,0 +1,40 @@
+#include "test_support.h"
+
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+}
+
+std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+void recordFailure(const char* file, int line, const char* expression) {
+    ++failures;
+    std::printf("  %s:%d: CHECK(%s) failed\n", file, line, expression);
+}
+
+int main() {
+    int failedCases = 0;
+    for (const TestCase& test : testCases()) {
+        int before = failures;
+        try {
+            test.run();
+        } catch (const std::exception& e) {
+            ++failures;
+            std::printf("  %s threw: %s\n", test.name, e.what());
+        }
+        if (failures != before) {
+            ++failedCases;
+            std::printf("FAIL %s\n", test.name);
+        }
+    }
+    std::printf("%zu tests, %d failed\n", testCases().size(), failedCases);
+    return failedCases == 0 ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+// A minimal self-registering test runner: TEST(name) defines a case,
+// CHECK records a failure and carries on, CHECK_THROWS expects any
+// exception. run_tests.sh builds every tests/*.cpp into one binary.
+struct TestCase {
+  const char *name;
+  void (*run)();
+};
+
+std::vector<TestCase> &testCases();
+void recordFailure(const char *file, int line, const char *expression);
+
+struct TestRegistration {
+  TestRegistration(const char *name, void (*run)()) {
+    testCases().push_back({name, run});
+  }
+};
+
+#define TEST(NAME)                                                             \
+  static void NAME();                                                          \
+  static TestRegistration NAME##Registration(#NAME, NAME);                     \
+  static void NAME()
+
+#define CHECK(EXPRESSION)                                                      \
+  do {                                                                         \
+    if (!(EXPRESSION)) {                                                       \
+      recordFailure(__FILE__, __LINE__, #EXPRESSION);                          \
+    }                                                                          \
+  } while (false)
+
+#define CHECK_THROWS(EXPRESSION)                                               \
+  do {                                                                         \
+    bool thrown = false;                                                       \
+    try {                                                                      \
+      (void)(EXPRESSION);                                                      \
+    } catch (const std::exception &) {                                         \
+      thrown = true;                                                           \
+    }                                                                          \
+    if (!thrown) {                                                             \
+      recordFailure(__FILE__, __LINE__, "throws: " #EXPRESSION);               \
+    }                                                                          \
+  } while (false)
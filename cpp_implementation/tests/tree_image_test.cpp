@@ -0,0 +1,386 @@
+#include "../tree_image.h"
+#include "test_support.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+// An image in 8-byte aligned storage, patched in place to corrupt it.
+struct ImageBuffer {
+    std::vector<std::uint64_t> words;
+    std::size_t size = 0;
+
+    char* data() {
+        return reinterpret_cast<char*>(words.data());
+    }
+    ImageHeader& header() {
+        return *reinterpret_cast<ImageHeader*>(data());
+    }
+    template <typename T>
+    T* section(ImageSection which) {
+        return reinterpret_cast<T*>(data() +
+                                    header().sections[static_cast<std::size_t>(which)].offset);
+    }
+    std::uint64_t count(ImageSection which) {
+        return header().sections[static_cast<std::size_t>(which)].count;
+    }
+    TreeImage view() {
+        return TreeImage::view(data(), size);
+    }
+};
+
+NodePtr outcome(const std::string& value) {
+    return std::make_shared<OutcomeNode>(value);
+}
+
+DecisionTreeEngine buildEngine(int minScore = 650) {
+    auto schema = std::make_shared<FeatureSchema>();
+    NodePtr tree = std::make_shared<DecisionNode>(
+        "Region", feature(*schema, "region") == "EU" && feature(*schema, "score", 0) >= minScore,
+        outcome("APPROVED"), outcome("DENIED"));
+    DecisionTreeEngine engine(tree, schema);
+    engine.setExecutionMode(ExecutionMode::Bytecode);
+    return engine;
+}
+
+// Every node kind, a switch with hashed strings and dense ints, a set test,
+// a switch fallback, a shared subtree and an atom in two conditions.
+DecisionTreeEngine buildRichEngine() {
+    auto schema = std::make_shared<FeatureSchema>();
+    auto tier = std::make_shared<MultiBranchNode>("Tier");
+    tier->addBranch(feature(*schema, "score", 0) >= 750 && feature(*schema, "debt", 1.0) < 0.3,
+                    outcome("GOLD"));
+    tier->addBranch(feature(*schema, "score", 0) >= 650, outcome("SILVER"));
+    tier->setDefault(outcome("BRONZE"));
+
+    auto region = std::make_shared<SwitchNode>("Region",
+                                               feature(*schema, "region", std::string("EU")));
+    region->addCase(std::string("EU"), tier);
+    region->addCase(std::string("US"), tier);
+    region->addCase(std::string("APAC"), outcome("ASIA"));
+    for (int code = 1; code <= 6; ++code) {
+        region->addCase(code, code % 2 ? tier : outcome("CODE"));
+    }
+    region->setDefault(outcome("ELSEWHERE"));
+
+    NodePtr tree = std::make_shared<DecisionNode>(
+        "VIP",
+        feature(*schema, "vip") || (feature(*schema, "region").in({std::string("EU"), 3}) &&
+                                    feature(*schema, "score", 0) >= 650),
+        region, tier);
+    DecisionTreeEngine engine(tree, schema);
+    engine.setExecutionMode(ExecutionMode::Bytecode);
+    return engine;
+}
+
+std::vector<Context> sampleContexts() {
+    const Result regions[] = {std::string("EU"), std::string("US"), std::string("APAC"),
+                              std::string("MARS"), 1, 2, 3, 7, 2.5};
+    std::vector<Context> contexts;
+    for (int i = 0; i < 80; ++i) {
+        Context context;
+        if (i % 9 != 8) {
+            std::visit([&](const auto& v) { context["region"] = v; }, regions[i % 9]);
+        }
+        if (i & 1) {
+            context["vip"] = true;
+        }
+        context["score"] = 600 + (i % 4) * 60;
+        context["debt"] = (i % 3) * 0.2;
+        contexts.push_back(context);
+    }
+    return contexts;
+}
+
+ImageBuffer buildImage(const DecisionTreeEngine& engine = buildEngine()) {
+    std::ostringstream out;
+    writeTreeImage(engine, out);
+    std::string bytes = out.str();
+
+    ImageBuffer image;
+    image.size = bytes.size();
+    image.words.resize((bytes.size() + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+    std::memcpy(image.data(), bytes.data(), bytes.size());
+    return image;
+}
+
+ImageValue* firstStringValue(ImageBuffer& image, ImageSection which) {
+    ImageValue* values = image.section<ImageValue>(which);
+    for (std::uint64_t i = 0; i < image.count(which); ++i) {
+        if (values[i].type == static_cast<std::uint32_t>(ValueType::String)) {
+            return &values[i];
+        }
+    }
+    return nullptr;
+}
+
+}
+
+TEST(treeImageEvaluatesInPlace) {
+    ImageBuffer buffer = buildImage();
+    TreeImage image = buffer.view();
+    Context approved;
+    approved["region"] = std::string("EU");
+    approved["score"] = 700;
+    Context denied;
+    denied["region"] = std::string("US");
+    denied["score"] = 700;
+    CHECK(image.evaluate(FlatContext::fromContext(image.getSchema(), approved)) ==
+          Result(std::string("APPROVED")));
+    CHECK(image.evaluate(FlatContext::fromContext(image.getSchema(), denied)) ==
+          Result(std::string("DENIED")));
+}
+
+TEST(treeImageRejectsContextsFromAnotherSchema) {
+    ImageBuffer buffer = buildImage();
+    TreeImage image = buffer.view();
+    FeatureSchema schema;
+    schema.intern("pad");
+    schema.intern("region");
+    schema.intern("score");
+    FlatContext foreign(schema);
+    foreign.set(schema.find("region"), "EU");
+    foreign.set(schema.find("score"), 700);
+    CHECK_THROWS(image.evaluate(foreign));
+    CHECK_THROWS(image.findLeaf(foreign));
+}
+
+TEST(treeImageFileIsReplacedNotRewritten) {
+    const std::string path = "decision_tree_tests_tree.img";
+    Context input;
+    input["region"] = std::string("EU");
+    input["score"] = 700;
+
+    writeTreeImageFile(buildEngine(650), path);
+    TreeImage before = TreeImage::open(path);
+    writeTreeImageFile(buildEngine(750), path);
+    TreeImage after = TreeImage::open(path);
+
+    CHECK(before.evaluate(FlatContext::fromContext(before.getSchema(), input)) ==
+          Result(std::string("APPROVED")));
+    CHECK(after.evaluate(FlatContext::fromContext(after.getSchema(), input)) ==
+          Result(std::string("DENIED")));
+    std::remove(path.c_str());
+}
+
+TEST(treeImageRejectsTruncatedFiles) {
+    ImageBuffer image = buildImage();
+    CHECK_THROWS(TreeImage::view(image.data(), sizeof(ImageHeader) - 1));
+    CHECK_THROWS(TreeImage::view(image.data(), image.size - 8));
+
+    // A header that agrees with the short length still has its sections
+    // checked against it.
+    image.header().size = sizeof(ImageHeader);
+    CHECK_THROWS(TreeImage::view(image.data(), sizeof(ImageHeader)));
+}
+
+TEST(treeImageRejectsOtherVersions) {
+    ImageBuffer image = buildImage();
+    image.header().version = kTreeImageVersion + 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage();
+    image.header().magic[0] ^= 1;
+    CHECK_THROWS(image.view());
+}
+
+TEST(treeImageRejectsStringsOutsideTheStringSection) {
+    const std::uint64_t strings = buildImage().count(ImageSection::Strings);
+
+    ImageBuffer image = buildImage();
+    ImageFeature* features = image.section<ImageFeature>(ImageSection::Features);
+    CHECK(image.count(ImageSection::Features) > 0);
+    features[0].offset = static_cast<std::uint32_t>(strings);
+    features[0].length = 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage();
+    features = image.section<ImageFeature>(ImageSection::Features);
+    features[0].offset = 0xffffffffu;
+    features[0].length = 2;
+    CHECK_THROWS(image.view());
+
+    image = buildImage();
+    ImageValue* constant = firstStringValue(image, ImageSection::Constants);
+    CHECK(constant != nullptr);
+    constant->bits = strings - 1;
+    constant->length = 2;
+    CHECK_THROWS(image.view());
+
+    image = buildImage();
+    ImageValue* result = firstStringValue(image, ImageSection::Results);
+    CHECK(result != nullptr);
+    result->bits = ~std::uint64_t{0};
+    CHECK_THROWS(image.view());
+}
+
+TEST(treeImageRejectsUnknownTypes) {
+    ImageBuffer image = buildImage();
+    firstStringValue(image, ImageSection::Constants)->type = 5;
+    CHECK_THROWS(image.view());
+
+    image = buildImage();
+    firstStringValue(image, ImageSection::Results)->type = 0xffffffffu;
+    CHECK_THROWS(image.view());
+
+    image = buildImage();
+    image.section<ImageFeature>(ImageSection::Features)[0].type = 9;
+    CHECK_THROWS(image.view());
+}
+
+TEST(treeImageMatchesTheEngineOnEveryNodeKind) {
+    DecisionTreeEngine engine = buildRichEngine();
+    ImageBuffer buffer = buildImage(engine);
+    TreeImage image = buffer.view();
+    for (const Context& input : sampleContexts()) {
+        CHECK(image.evaluate(FlatContext::fromContext(image.getSchema(), input)) ==
+              engine.evaluate(input));
+    }
+}
+
+TEST(treeImageRejectsBadNodesAndCycles) {
+    const DecisionTreeEngine engine = buildRichEngine();
+    auto nodeOf = [](ImageBuffer& image, FlatNodeKind kind) -> ImageNode* {
+        ImageNode* nodes = image.section<ImageNode>(ImageSection::Nodes);
+        for (std::uint64_t i = 0; i < image.count(ImageSection::Nodes); ++i) {
+            if (nodes[i].kind == static_cast<std::uint32_t>(kind)) {
+                return &nodes[i];
+            }
+        }
+        return nullptr;
+    };
+
+    ImageBuffer image = buildImage(engine);
+    nodeOf(image, FlatNodeKind::Outcome)->kind = 4;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    nodeOf(image, FlatNodeKind::Decision)->second =
+        static_cast<NodeIndex>(image.count(ImageSection::Nodes));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    nodeOf(image, FlatNodeKind::Decision)->operand =
+        static_cast<std::uint32_t>(image.count(ImageSection::Entries));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    nodeOf(image, FlatNodeKind::MultiBranch)->first += 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    nodeOf(image, FlatNodeKind::Outcome)->operand =
+        static_cast<std::uint32_t>(image.count(ImageSection::Results));
+    CHECK_THROWS(image.view());
+
+    // The tier's default leads back to the root, which reaches the tier.
+    image = buildImage(engine);
+    nodeOf(image, FlatNodeKind::MultiBranch)->second = image.header().root;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    image.section<FlatBranch>(ImageSection::Branches)[0].predicate =
+        static_cast<std::uint32_t>(image.count(ImageSection::Entries));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    image.section<NodeIndex>(ImageSection::Cases)[0] =
+        static_cast<NodeIndex>(image.count(ImageSection::Nodes));
+    CHECK_THROWS(image.view());
+}
+
+TEST(treeImageRejectsBadCode) {
+    const DecisionTreeEngine engine = buildRichEngine();
+    auto instructionOf = [](ImageBuffer& image, OpCode op) -> Instruction* {
+        Instruction* code = image.section<Instruction>(ImageSection::Code);
+        for (std::uint64_t i = 0; i < image.count(ImageSection::Code); ++i) {
+            if (code[i].op == op) {
+                return &code[i];
+            }
+        }
+        return nullptr;
+    };
+
+    ImageBuffer image = buildImage(engine);
+    CHECK(image.header().memoSlots > 0);
+    image.section<std::uint32_t>(ImageSection::Entries)[0] =
+        static_cast<std::uint32_t>(image.count(ImageSection::Code));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    instructionOf(image, OpCode::JumpIfTrue)->a = 0;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    image.section<Instruction>(ImageSection::Code)[image.count(ImageSection::Code) - 1].op =
+        OpCode::Not;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    instructionOf(image, OpCode::StoreMemo)->a = image.header().memoSlots;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    instructionOf(image, OpCode::CompareSlotInt)->b =
+        static_cast<std::uint32_t>(image.count(ImageSection::Constants));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    instructionOf(image, OpCode::InSlot)->b =
+        static_cast<std::uint32_t>(image.count(ImageSection::Sets));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    image.section<ImageRange>(ImageSection::Sets)[0].count += 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    instructionOf(image, OpCode::Return)->op = OpCode::CallPredicate;
+    CHECK_THROWS(image.view());
+}
+
+TEST(treeImageRejectsBadSwitches) {
+    const DecisionTreeEngine engine = buildRichEngine();
+    auto entry = [](ImageBuffer& image) -> ImageSwitch& {
+        return image.section<ImageSwitch>(ImageSection::Switches)[0];
+    };
+
+    ImageBuffer image = buildImage(engine);
+    CHECK(image.count(ImageSection::Switches) == 1);
+    CHECK(entry(image).slotCount > 0 && entry(image).denseCount > 0);
+    entry(image).caseCount += 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    entry(image).fallback = static_cast<std::uint32_t>(image.count(ImageSection::Constants));
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    entry(image).denseCount += 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    image.section<std::uint32_t>(ImageSection::DenseCases)[0] = entry(image).caseCount + 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    entry(image).shift -= 1;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    entry(image).displacementCount = 0;
+    CHECK_THROWS(image.view());
+
+    image = buildImage(engine);
+    image.section<ImageStringKey>(ImageSection::HashSlots)[0].caseIndex =
+        entry(image).caseCount + 1;
+    CHECK_THROWS(image.view());
+}
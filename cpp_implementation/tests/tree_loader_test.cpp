@@ -0,0 +1,222 @@
+#include "../native_registry.h"
+#include "../tree_loader.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+NodePtr outcome(const Result& value) {
+    return std::make_shared<OutcomeNode>(value);
+}
+
+// One of every node type and outcome value type, with a missing decision
+// branch, a multi-branch default and a switch default.
+NodePtr buildEveryNodeType() {
+    auto tiers = std::make_shared<MultiBranchNode>("Tier \"A\"");
+    tiers->addBranch(feature("score", 0) >= 750 && feature("debt", 1.0) < 0.3,
+                     outcome(std::string("GOLD")));
+    tiers->addBranch(feature("score", 0) >= 650, outcome(2.5));
+    tiers->setDefault(outcome(false));
+
+    auto region = std::make_shared<SwitchNode>("Region", feature("region"));
+    region->addCase(std::string("EU"), tiers);
+    region->addCase(7, outcome(7));
+    region->addCase(1.5, outcome(std::string("one and a half")));
+    region->addCase(true, nullptr);
+    region->setDefault(outcome(std::string("ELSEWHERE")));
+
+    return std::make_shared<DecisionNode>(
+        "VIP", feature("vip") || !feature("region").in({std::string("EU"), 3}), region, nullptr);
+}
+
+std::vector<Context> sampleContexts() {
+    std::vector<Context> contexts;
+    for (int i = 0; i < 64; ++i) {
+        Context context;
+        if (i & 1) {
+            context["vip"] = true;
+        }
+        switch ((i >> 1) % 4) {
+            case 0:
+                context["region"] = std::string("EU");
+                break;
+            case 1:
+                context["region"] = 7;
+                break;
+            case 2:
+                context["region"] = 1.5;
+                break;
+            default:
+                break;
+        }
+        if (i & 8) {
+            context["score"] = 600 + 10 * (i % 20);
+        }
+        if (i & 16) {
+            context["debt"] = 0.1 * (i % 6);
+        }
+        contexts.push_back(context);
+    }
+    return contexts;
+}
+
+bool failsAtOffset(const std::string& json, std::size_t offset) {
+    try {
+        loadTreeJson(json);
+    } catch (const std::runtime_error& e) {
+        return std::string(e.what()).find("at offset " + std::to_string(offset)) !=
+               std::string::npos;
+    }
+    return false;
+}
+
+}
+
+TEST(loadTreeJsonRoundTripsEveryNodeType) {
+    NodePtr tree = buildEveryNodeType();
+    std::string json = tree->toJson();
+    NodePtr loaded = loadTreeJson(json);
+    CHECK(loaded->toJson() == json);
+
+    std::ostringstream compact;
+    tree->toJson(compact, JsonStyle::Compact);
+    CHECK(loadTreeJson(compact.str())->toJson() == json);
+
+    for (const Context& context : sampleContexts()) {
+        CHECK(loaded->evaluate(context) == tree->evaluate(context));
+    }
+
+    auto regions = std::static_pointer_cast<SwitchNode>(
+        std::static_pointer_cast<DecisionNode>(loaded)->getTrueNode());
+    CHECK(regions->getDefaultNode() != nullptr);
+    CHECK(regions->getCases().size() == 4 && regions->getCases()[3].second == nullptr);
+    CHECK(std::static_pointer_cast<DecisionNode>(loaded)->getFalseNode() == nullptr);
+}
+
+TEST(loadTreeJsonSharesIdenticalConditionText) {
+    std::string json = R"({"type": "multibranch", "name": "m", "branches": [
+        {"condition": "x >= 1", "node": {"type": "outcome", "value": 1}},
+        {"condition": "x >= 1", "node": {"type": "outcome", "value": 2}},
+        {"condition": "default", "node": {"type": "outcome", "value": 3}}]})";
+    auto multi = std::static_pointer_cast<MultiBranchNode>(loadTreeJson(json));
+    CHECK(multi->getBranches().size() == 2);
+    CHECK(multi->getBranches()[0].first.getExpr() == multi->getBranches()[1].first.getExpr());
+    CHECK(multi->getDefaultNode() != nullptr);
+
+    FeatureSchema schema;
+    loadTreeJson(json, &schema);
+    CHECK(schema.find("x") == 0);
+}
+
+TEST(loadTreeJsonKeepsAFeatureNamedDefault) {
+    auto multi = std::make_shared<MultiBranchNode>("m");
+    multi->addBranch(feature("default"), outcome(1));
+    multi->setDefault(outcome(2));
+    std::string json = multi->toJson();
+    CHECK(json.find("\"`default`\"") != std::string::npos);
+
+    NodePtr loaded = loadTreeJson(json);
+    CHECK(loaded->toJson() == json);
+    auto loadedMulti = std::static_pointer_cast<MultiBranchNode>(loaded);
+    CHECK(loadedMulti->getBranches().size() == 1);
+    CHECK(loaded->evaluate(Context{{"default", true}}) == Result(1));
+    CHECK(loaded->evaluate(Context{}) == Result(2));
+}
+
+TEST(loadTreeJsonResolvesNativeNames) {
+    int posted = 0;
+    NativeRegistry natives;
+    natives.addPredicate("is_vip", [](const Context& context) { return context.count("vip") != 0; })
+        .addAction("post", [&](const Context&) { ++posted; });
+
+    NodePtr tree = std::make_shared<DecisionNode>("VIP", natives.predicate("is_vip"),
+                                                  natives.outcome(std::string("YES"), "post"),
+                                                  outcome(std::string("NO")));
+    std::string json = tree->toJson();
+    CHECK(json.find("{\"native\": \"is_vip\"}") != std::string::npos);
+    CHECK(json.find("\"action\": \"post\"") != std::string::npos);
+
+    NodePtr loaded = loadTreeJson(json, nullptr, &natives);
+    CHECK(loaded->toJson() == json);
+    CHECK(loaded->evaluate(Context{{"vip", true}}) == Result(std::string("YES")));
+    CHECK(posted == 1);
+    CHECK(loaded->evaluate(Context{}) == Result(std::string("NO")));
+
+    CHECK_THROWS(loadTreeJson(json));
+    NativeRegistry empty;
+    CHECK_THROWS(loadTreeJson(json, nullptr, &empty));
+    CHECK_THROWS(loadTreeJson(std::make_shared<OutcomeNode>(1, [](const Context&) {})->toJson(),
+                              nullptr, &natives));
+
+    CHECK_THROWS(natives.addPredicate("unset", Condition()));
+    CHECK_THROWS(natives.addPredicate("unset", SlotCondition()));
+    CHECK_THROWS(natives.addAction("unset", Action()));
+    CHECK(!natives.hasPredicate("unset"));
+}
+
+TEST(loadTreeJsonRejectsMalformedInput) {
+    CHECK(failsAtOffset(R"({"type": "outcome", "value": })", 29));
+    CHECK(failsAtOffset(R"({"type": "outcome", "value": 1)", 30));
+    CHECK(failsAtOffset(R"({"type": "decision", "name": "a", "condition": "x >="})", 54));
+    const char* const malformed[] = {
+        "",
+        "[1]",
+        R"({"type": "outcome"})",
+        R"({"type": "foo"})",
+        R"({"type": "outcome", "value": 1} x)",
+        R"({"type": "outcome", "value": "A", "hasAction": true})",
+        R"({"type": "decision", "name": "a", "condition": null})",
+        R"({"type": "decision", "name": "a", "condition": {"x": 1}})",
+        R"({"type": "switch", "name": "s", "feature": "x > 1", "cases": []})",
+        R"({"type": "switch", "name": "s", "feature": "x", "cases": [{"case": , "node": null}]})",
+        R"({"type": "multibranch", "name": "m", "branches": [{"condition": "x >", "node": null}]})",
+        R"({"type": "outcome", "value": "unterminated})",
+        R"({"type": "outcome", "value": 1e999999})",
+        R"({"type": "outcome", "value": "\ud83d"})",
+        R"({"type": "outcome", "value": "\ud83d\u0041"})",
+        R"({"type": "outcome", "value": "\ud83d\ud83d"})",
+        R"({"type": "outcome", "value": "\ude00"})",
+        R"({"type": "outcome", "value": "\q"})",
+    };
+    for (const char* json : malformed) {
+        CHECK_THROWS(loadTreeJson(json));
+    }
+
+    NodePtr emoji = loadTreeJson(R"({"type": "outcome", "value": "\ud83d\ude00\u00e9\/"})");
+    CHECK(emoji->evaluate(Context{}) == Result(std::string("\xf0\x9f\x98\x80\xc3\xa9/")));
+}
+
+TEST(treeFileKeepsLastGoodTree) {
+    std::string path = "decision_tree_tests_tree.json";
+    {
+        std::ofstream(path) << R"({"type": "outcome", "value": "A"})";
+    }
+    TreeFile file(path);
+    CHECK(file.get()->evaluate(Context{}) == Result(std::string("A")));
+    CHECK(!file.reloadIfChanged());
+
+    {
+        std::ofstream(path) << R"({"type": )";
+    }
+    std::filesystem::last_write_time(path, std::filesystem::last_write_time(path) +
+                                               std::chrono::seconds(1));
+    CHECK_THROWS(file.reloadIfChanged());
+    CHECK(file.get()->evaluate(Context{}) == Result(std::string("A")));
+
+    {
+        std::ofstream(path) << R"({"type": "outcome", "value": 2})";
+    }
+    std::filesystem::last_write_time(path, std::filesystem::last_write_time(path) +
+                                               std::chrono::seconds(2));
+    CHECK(file.reloadIfChanged());
+    CHECK(file.get()->evaluate(Context{}) == Result(2));
+    std::remove(path.c_str());
+}
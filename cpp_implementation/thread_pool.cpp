@@ -0,0 +1,137 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+bool ThreadPool::pop(std::size_t self, Task& task) {
+    Worker& worker = *workers_[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    --queued_;
+    return true;
+}
+
+bool ThreadPool::steal(std::size_t self, Task& task) {
+    for (std::size_t offset = 1; offset <= workers_.size(); ++offset) {
+        Worker& victim = *workers_[(self + offset) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(Task& task) {
+    Job& job = *task.job;
+    try {
+        (*job.body)(task.index);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (!job.error) {
+            job.error = std::current_exception();
+        }
+    }
+
+    if (--job.remaining == 0) {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.done.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(std::size_t self) {
+    while (true) {
+        Task task;
+        if (pop(self, task) || steal(self, task)) {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(std::size_t count,
+                             const std::function<void(std::size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->body = &body;
+    job->remaining = count;
+
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        queued_ += count;
+    }
+
+    // Contiguous index ranges per worker keep neighbouring chunks together;
+    // stealing takes over whatever a slow worker has not started.
+    const std::size_t workers = workers_.size();
+    for (std::size_t w = 0; w < workers; ++w) {
+        std::size_t begin = count * w / workers;
+        std::size_t end = count * (w + 1) / workers;
+        if (begin == end) {
+            continue;
+        }
+        Worker& worker = *workers_[w];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        for (std::size_t i = end; i > begin; --i) {
+            worker.tasks.push_back({job, i - 1});
+        }
+    }
+    wake_.notify_all();
+
+    Task task;
+    while (job->remaining > 0 && steal(0, task)) {
+        run(task);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->done.wait(lock, [&] { return job->remaining == 0; });
+    }
+
+    if (job->error) {
+        std::rethrow_exception(job->error);
+    }
+}
+
+std::size_t ThreadPool::size() const {
+    return workers_.size();
+}
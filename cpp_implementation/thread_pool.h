@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of workers, each with its own task deque. Workers pop their
+// own work from the back and steal from the front of other deques when
+// they run dry, so uneven chunks rebalance without a shared queue.
+class ThreadPool {
+private:
+  struct Job {
+    const std::function<void(std::size_t)> *body = nullptr;
+    std::atomic<std::size_t> remaining{0};
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+  };
+
+  struct Task {
+    std::shared_ptr<Job> job;
+    std::size_t index = 0;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::mutex wakeMutex_;
+  std::condition_variable wake_;
+  std::atomic<std::size_t> queued_{0};
+  bool stop_ = false;
+
+  bool pop(std::size_t self, Task &task);
+  bool steal(std::size_t self, Task &task);
+  void run(Task &task);
+  void workerLoop(std::size_t self);
+
+public:
+  // threads == 0 uses std::thread::hardware_concurrency().
+  explicit ThreadPool(std::size_t threads = 0);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  // Runs body(i) for every i in [0, count) on the workers, with the calling
+  // thread helping, and returns once all have finished. The first exception
+  // thrown by body is rethrown here.
+  void parallelFor(std::size_t count,
+                   const std::function<void(std::size_t)> &body);
+
+  std::size_t size() const;
+};
@@ -0,0 +1,838 @@
+#include "tree_image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr char kMagic[8] = {'D', 'T', 'I', 'M', 'A', 'G', 'E', '\0'};
+constexpr std::uint32_t kByteOrder = 0x01020304;
+constexpr std::size_t kAlignment = 8;
+
+static_assert(std::is_trivially_copyable_v<Instruction> && sizeof(Instruction) == 16,
+              "Instruction is stored in images as is");
+static_assert(std::is_trivially_copyable_v<FlatBranch> && sizeof(FlatBranch) == 8,
+              "FlatBranch is stored in images as is");
+
+bool inRange(std::uint64_t first, std::uint64_t count, std::uint64_t size) {
+    return first <= size && count <= size - first;
+}
+
+[[noreturn]] void corrupt(const std::string& what, std::size_t index) {
+    throw std::runtime_error("tree image: " + what + " " + std::to_string(index) + " is invalid");
+}
+
+class ImageBuilder {
+private:
+    std::string bytes_;
+    std::string strings_;
+    std::unordered_map<std::string, std::uint32_t> stringOffsets_;
+    ImageHeader header_{};
+
+public:
+    ImageBuilder() { bytes_.resize(sizeof(ImageHeader)); }
+
+    std::uint32_t addString(const std::string& text) {
+        auto [it, inserted] =
+            stringOffsets_.emplace(text, static_cast<std::uint32_t>(strings_.size()));
+        if (inserted) {
+            strings_ += text;
+        }
+        return it->second;
+    }
+
+    ImageValue value(const Result& result) {
+        ImageValue out{};
+        if (const auto* str = std::get_if<std::string>(&result)) {
+            out.type = static_cast<std::uint32_t>(ValueType::String);
+            out.length = static_cast<std::uint32_t>(str->size());
+            out.bits = addString(*str);
+        } else if (const auto* i = std::get_if<int>(&result)) {
+            out.type = static_cast<std::uint32_t>(ValueType::Int);
+            out.bits = static_cast<std::uint64_t>(static_cast<std::int64_t>(*i));
+        } else if (const auto* d = std::get_if<double>(&result)) {
+            out.type = static_cast<std::uint32_t>(ValueType::Double);
+            std::memcpy(&out.bits, d, sizeof(double));
+        } else {
+            out.type = static_cast<std::uint32_t>(ValueType::Bool);
+            out.bits = std::get<bool>(result) ? 1 : 0;
+        }
+        return out;
+    }
+
+    template <typename T>
+    void addSection(ImageSection which, const std::vector<T>& records) {
+        bytes_.resize((bytes_.size() + kAlignment - 1) / kAlignment * kAlignment);
+        header_.sections[static_cast<std::size_t>(which)] = {bytes_.size(), records.size()};
+        bytes_.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+    }
+
+    std::string finish(NodeIndex root, std::uint32_t memoSlots) {
+        addSection(ImageSection::Strings, std::vector<char>(strings_.begin(), strings_.end()));
+        std::memcpy(header_.magic, kMagic, sizeof(kMagic));
+        header_.version = kTreeImageVersion;
+        header_.byteOrder = kByteOrder;
+        header_.size = bytes_.size();
+        header_.root = root;
+        header_.memoSlots = memoSlots;
+        std::memcpy(bytes_.data(), &header_, sizeof(header_));
+        return std::move(bytes_);
+    }
+};
+
+std::string buildImage(const DecisionTreeEngine& engine) {
+    const FlatTree& flat = engine.getFlatTree();
+
+    FeatureSchema localSchema;
+    const FeatureSchema* schema = engine.getSchema();
+    if (!schema) {
+        flat.collectFeatures(localSchema);
+        schema = &localSchema;
+    }
+    BytecodeProgram localProgram;
+    const BytecodeProgram* program = engine.getBytecodeProgram();
+    if (!program) {
+        localProgram = BytecodeProgram::compile(flat, *schema);
+        program = &localProgram;
+    }
+    if (program->expressionCount() != 0 || program->callCount() != 0) {
+        throw std::runtime_error("tree image: lambda conditions and conditions outside the "
+                                 "bytecode compiler cannot be stored");
+    }
+
+    ImageBuilder builder;
+    std::vector<ImageNode> nodes;
+    std::uint32_t branchCount = 0;
+    std::uint32_t switchCount = 0;
+    for (NodeIndex index = 0; index < flat.nodeCount(); ++index) {
+        const FlatNode& node = flat.getNode(index);
+        ImageNode out{static_cast<std::uint32_t>(node.kind), node.operand, node.first,
+                      node.second};
+        switch (node.kind) {
+            case FlatNodeKind::Outcome: {
+                const FlatOutcome& outcome = flat.getOutcome(node.operand);
+                if (outcome.action) {
+                    throw std::runtime_error("tree image: outcome actions cannot be stored");
+                }
+                out.operand = outcome.id;
+                break;
+            }
+            case FlatNodeKind::Decision:
+                break;
+            case FlatNodeKind::MultiBranch:
+                branchCount = std::max(branchCount, node.operand + node.first);
+                break;
+            case FlatNodeKind::Switch:
+                switchCount = std::max(switchCount, node.operand + 1);
+                break;
+        }
+        nodes.push_back(out);
+    }
+
+    std::vector<FlatBranch> branches;
+    for (std::uint32_t i = 0; i < branchCount; ++i) {
+        branches.push_back(flat.getBranch(i));
+    }
+
+    // Instructions are copied field by field so padding is written as zero.
+    std::vector<Instruction> code;
+    for (const Instruction& in : program->getCode()) {
+        Instruction out;
+        std::memset(&out, 0, sizeof(out));
+        out.op = in.op;
+        out.cmp = in.cmp;
+        out.a = in.a;
+        out.b = in.b;
+        out.c = in.c;
+        code.push_back(out);
+    }
+
+    std::vector<ImageValue> constants;
+    for (const Result& constant : program->getConstants()) {
+        constants.push_back(builder.value(constant));
+    }
+    std::vector<ImageRange> sets;
+    std::vector<ImageValue> setValues;
+    for (const auto& set : program->getSets()) {
+        sets.push_back({static_cast<std::uint32_t>(setValues.size()),
+                        static_cast<std::uint32_t>(set.size())});
+        for (const Result& value : set) {
+            setValues.push_back(builder.value(value));
+        }
+    }
+
+    std::vector<ImageSwitch> switches;
+    std::vector<ImageNumericKey> numericKeys;
+    std::vector<std::uint32_t> denseCases;
+    std::vector<ImageStringKey> hashSlots;
+    std::vector<std::uint32_t> displacements;
+    std::vector<NodeIndex> cases;
+    for (std::uint32_t i = 0; i < switchCount; ++i) {
+        const FlatSwitch& flatSwitch = flat.getSwitch(i);
+        const ConditionExpr& feature = *flatSwitch.feature;
+        SlotId slot = feature.kind() == ExprKind::Feature ? schema->find(feature.getFeature())
+                                                          : kInvalidSlot;
+        if (slot == kInvalidSlot) {
+            throw std::runtime_error("tree image: switches must read a schema feature");
+        }
+
+        ImageSwitch out{};
+        out.slot = slot;
+        out.fallback = kNoConstant;
+        if (feature.hasFallback()) {
+            out.fallback = static_cast<std::uint32_t>(constants.size());
+            constants.push_back(builder.value(feature.getValue()));
+        }
+
+        const SwitchTable& table = flatSwitch.table;
+        out.firstNumber = static_cast<std::uint32_t>(numericKeys.size());
+        out.numberCount = static_cast<std::uint32_t>(table.numericKeys().size());
+        for (const auto& key : table.numericKeys()) {
+            numericKeys.push_back({key.key, key.caseIndex, 0});
+        }
+        out.firstDense = static_cast<std::uint32_t>(denseCases.size());
+        out.denseCount = static_cast<std::uint32_t>(table.denseCases().size());
+        out.denseBase = table.denseBase();
+        denseCases.insert(denseCases.end(), table.denseCases().begin(), table.denseCases().end());
+        out.firstSlot = static_cast<std::uint32_t>(hashSlots.size());
+        out.slotCount = static_cast<std::uint32_t>(table.hashSlots().size());
+        for (const auto& slot : table.hashSlots()) {
+            hashSlots.push_back({builder.addString(slot.key),
+                                 static_cast<std::uint32_t>(slot.key.size()), slot.caseIndex});
+        }
+        out.firstDisplacement = static_cast<std::uint32_t>(displacements.size());
+        out.displacementCount = static_cast<std::uint32_t>(table.displacements().size());
+        out.shift = table.hashShift();
+        displacements.insert(displacements.end(), table.displacements().begin(),
+                             table.displacements().end());
+
+        out.firstCase = static_cast<std::uint32_t>(cases.size());
+        out.caseCount = table.caseCount();
+        for (std::uint32_t c = 0; c < out.caseCount; ++c) {
+            cases.push_back(flat.getCase(flatSwitch.firstCase + c));
+        }
+        switches.push_back(out);
+    }
+
+    std::vector<ImageValue> results;
+    for (const Result& result : flat.getResults()) {
+        results.push_back(builder.value(result));
+    }
+
+    std::vector<ImageFeature> features;
+    for (SlotId slot = 0; slot < schema->size(); ++slot) {
+        const std::string& name = schema->name(slot);
+        features.push_back({builder.addString(name), static_cast<std::uint32_t>(name.size()),
+                            static_cast<std::uint32_t>(schema->expectedType(slot))});
+    }
+
+    builder.addSection(ImageSection::Nodes, nodes);
+    builder.addSection(ImageSection::Branches, branches);
+    builder.addSection(ImageSection::Entries, program->getEntries());
+    builder.addSection(ImageSection::Code, code);
+    builder.addSection(ImageSection::Constants, constants);
+    builder.addSection(ImageSection::Sets, sets);
+    builder.addSection(ImageSection::SetValues, setValues);
+    builder.addSection(ImageSection::Results, results);
+    builder.addSection(ImageSection::Switches, switches);
+    builder.addSection(ImageSection::NumericKeys, numericKeys);
+    builder.addSection(ImageSection::DenseCases, denseCases);
+    builder.addSection(ImageSection::HashSlots, hashSlots);
+    builder.addSection(ImageSection::Displacements, displacements);
+    builder.addSection(ImageSection::Cases, cases);
+    builder.addSection(ImageSection::Features, features);
+    return builder.finish(flat.getRoot(),
+                          static_cast<std::uint32_t>(program->memoSlotCount()));
+}
+
+}
+
+void writeTreeImage(const DecisionTreeEngine& engine, std::ostream& out) {
+    std::string image = buildImage(engine);
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+}
+
+void writeTreeImageFile(const DecisionTreeEngine& engine, const std::string& path) {
+    std::string image = buildImage(engine);
+    std::string temp = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(image.data(), static_cast<std::streamsize>(image.size()));
+        out.close();
+        if (!out) {
+            std::remove(temp.c_str());
+            throw std::runtime_error("cannot write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("cannot replace " + path);
+    }
+}
+
+TreeImage::TreeImage(const char* data, std::size_t size, bool mapped)
+    : data_(data), size_(size), mapped_(mapped) {
+    if (size_ < sizeof(ImageHeader) || reinterpret_cast<std::uintptr_t>(data_) % kAlignment != 0) {
+        throw std::runtime_error("tree image: truncated or misaligned");
+    }
+    header_ = reinterpret_cast<const ImageHeader*>(data_);
+    if (std::memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("tree image: bad magic");
+    }
+    if (header_->byteOrder != kByteOrder) {
+        throw std::runtime_error("tree image: written with a different byte order");
+    }
+    if (header_->version != kTreeImageVersion) {
+        throw std::runtime_error("tree image: unsupported version " +
+                                 std::to_string(header_->version));
+    }
+    if (header_->size != size_) {
+        throw std::runtime_error("tree image: size does not match its header");
+    }
+
+    nodes_ = section<ImageNode>(ImageSection::Nodes);
+    branches_ = section<FlatBranch>(ImageSection::Branches);
+    entries_ = section<std::uint32_t>(ImageSection::Entries);
+    code_ = section<Instruction>(ImageSection::Code);
+    sets_ = section<ImageRange>(ImageSection::Sets);
+    results_ = section<ImageValue>(ImageSection::Results);
+    switches_ = section<ImageSwitch>(ImageSection::Switches);
+    numericKeys_ = section<ImageNumericKey>(ImageSection::NumericKeys);
+    denseCases_ = section<std::uint32_t>(ImageSection::DenseCases);
+    hashSlots_ = section<ImageStringKey>(ImageSection::HashSlots);
+    displacements_ = section<std::uint32_t>(ImageSection::Displacements);
+    cases_ = section<NodeIndex>(ImageSection::Cases);
+    strings_ = section<char>(ImageSection::Strings);
+    stringsSize_ = count(ImageSection::Strings);
+    if (header_->root >= nodeCount()) {
+        throw std::runtime_error("tree image: root out of range");
+    }
+
+    for (std::size_t i = 0; i < count(ImageSection::Results); ++i) {
+        checkValue(results_[i]);
+    }
+    for (std::size_t i = 0; i < count(ImageSection::HashSlots); ++i) {
+        checkString(hashSlots_[i].offset, hashSlots_[i].length);
+    }
+
+    const ImageValue* constants = section<ImageValue>(ImageSection::Constants);
+    for (std::size_t i = 0; i < count(ImageSection::Constants); ++i) {
+        checkValue(constants[i]);
+        resolved_.push_back(resolve(constants[i]));
+    }
+    const ImageValue* setValues = section<ImageValue>(ImageSection::SetValues);
+    for (std::size_t i = 0; i < count(ImageSection::SetValues); ++i) {
+        checkValue(setValues[i]);
+        resolvedSetValues_.push_back(resolve(setValues[i]));
+    }
+
+    const ImageFeature* features = section<ImageFeature>(ImageSection::Features);
+    for (std::size_t i = 0; i < count(ImageSection::Features); ++i) {
+        const ImageFeature& feature = features[i];
+        checkString(feature.offset, feature.length);
+        if (feature.type > static_cast<std::uint32_t>(ValueType::String)) {
+            throw std::runtime_error("tree image: feature " + std::to_string(i) +
+                                     " has an unknown type");
+        }
+        schema_.intern(std::string(strings_ + feature.offset, feature.length),
+                       static_cast<ValueType>(feature.type));
+    }
+
+    checkCode();
+    checkSwitches();
+    checkNodes();
+}
+
+template <typename T>
+const T* TreeImage::section(ImageSection which) const {
+    const ImageSectionEntry& entry = header_->sections[static_cast<std::size_t>(which)];
+    if (entry.offset % kAlignment != 0 || entry.offset > size_ ||
+        entry.count > (size_ - entry.offset) / sizeof(T)) {
+        throw std::runtime_error("tree image: section " +
+                                 std::to_string(static_cast<std::uint32_t>(which)) +
+                                 " out of bounds");
+    }
+    return reinterpret_cast<const T*>(data_ + entry.offset);
+}
+
+std::size_t TreeImage::count(ImageSection which) const {
+    return header_->sections[static_cast<std::size_t>(which)].count;
+}
+
+void TreeImage::checkString(std::uint64_t offset, std::uint32_t length) const {
+    if (offset > stringsSize_ || length > stringsSize_ - offset) {
+        throw std::runtime_error("tree image: string out of bounds");
+    }
+}
+
+void TreeImage::checkValue(const ImageValue& value) const {
+    if (value.type > static_cast<std::uint32_t>(ValueType::String)) {
+        throw std::runtime_error("tree image: value has an unknown type " +
+                                 std::to_string(value.type));
+    }
+    if (static_cast<ValueType>(value.type) == ValueType::String) {
+        checkString(value.bits, value.length);
+    }
+}
+
+// Jumps only go forward and the code ends in Return, so every predicate
+// terminates inside the code section.
+void TreeImage::checkCode() const {
+    const std::size_t codeCount = count(ImageSection::Code);
+    const std::size_t constantCount = count(ImageSection::Constants);
+    const std::size_t setCount = count(ImageSection::Sets);
+    const std::size_t memoSlots = header_->memoSlots;
+    if (memoSlots > codeCount ||
+        (codeCount != 0 && code_[codeCount - 1].op != OpCode::Return) ||
+        (codeCount == 0 && count(ImageSection::Entries) != 0)) {
+        throw std::runtime_error("tree image: code section is invalid");
+    }
+
+    for (std::size_t i = 0; i < setCount; ++i) {
+        if (!inRange(sets_[i].first, sets_[i].count, count(ImageSection::SetValues))) {
+            corrupt("set", i);
+        }
+    }
+    for (std::size_t i = 0; i < count(ImageSection::Entries); ++i) {
+        if (entries_[i] >= codeCount) {
+            corrupt("entry", i);
+        }
+    }
+
+    auto constant = [&](std::uint32_t index) { return index < constantCount; };
+    auto fallback = [&](std::uint32_t index) {
+        return index == kNoConstant || index < constantCount;
+    };
+    auto target = [&](std::size_t pc, std::uint32_t to) { return to > pc && to < codeCount; };
+    for (std::size_t pc = 0; pc < codeCount; ++pc) {
+        const Instruction& in = code_[pc];
+        bool valid = static_cast<std::uint8_t>(in.cmp) <= static_cast<std::uint8_t>(CompareOp::Ne);
+        switch (in.op) {
+            case OpCode::CompareSlotInt:
+            case OpCode::CompareSlot:
+                valid = valid && constant(in.b) && fallback(in.c);
+                break;
+            case OpCode::InSlot:
+                valid = valid && in.b < setCount && fallback(in.c);
+                break;
+            case OpCode::TestSlot:
+                valid = valid && fallback(in.c);
+                break;
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfTrue:
+                valid = valid && target(pc, in.a);
+                break;
+            case OpCode::LoadMemo:
+                valid = valid && in.a < memoSlots && target(pc, in.b);
+                break;
+            case OpCode::StoreMemo:
+                valid = valid && in.a < memoSlots;
+                break;
+            case OpCode::SetAcc:
+            case OpCode::Not:
+            case OpCode::Return:
+                break;
+            case OpCode::EvalExpr:
+            case OpCode::CallPredicate:
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            corrupt("instruction", pc);
+        }
+    }
+}
+
+// select() returns a case index or caseCount for the default, and indexes
+// every run of the switch's layout; all of them must lie in their sections.
+void TreeImage::checkSwitches() const {
+    for (std::size_t i = 0; i < count(ImageSection::Switches); ++i) {
+        const ImageSwitch& entry = switches_[i];
+        bool valid =
+            (entry.fallback == kNoConstant || entry.fallback < count(ImageSection::Constants)) &&
+            inRange(entry.firstCase, entry.caseCount, count(ImageSection::Cases)) &&
+            inRange(entry.firstNumber, entry.numberCount, count(ImageSection::NumericKeys)) &&
+            inRange(entry.firstDense, entry.denseCount, count(ImageSection::DenseCases)) &&
+            inRange(entry.firstSlot, entry.slotCount, count(ImageSection::HashSlots));
+        if (valid && entry.slotCount != 0) {
+            // hashSlot() yields values below 2^(64 - shift).
+            valid = entry.displacementCount != 0 &&
+                    inRange(entry.firstDisplacement, entry.displacementCount,
+                            count(ImageSection::Displacements)) &&
+                    entry.shift >= 1 && entry.shift < 64 &&
+                    entry.slotCount == std::uint64_t{1} << (64 - entry.shift);
+        }
+        for (std::uint32_t k = 0; valid && k < entry.numberCount; ++k) {
+            valid = numericKeys_[entry.firstNumber + k].caseIndex <= entry.caseCount;
+        }
+        for (std::uint32_t k = 0; valid && k < entry.denseCount; ++k) {
+            valid = denseCases_[entry.firstDense + k] <= entry.caseCount;
+        }
+        for (std::uint32_t k = 0; valid && k < entry.slotCount; ++k) {
+            valid = hashSlots_[entry.firstSlot + k].caseIndex <= entry.caseCount;
+        }
+        if (!valid) {
+            corrupt("switch", i);
+        }
+    }
+}
+
+// Every child index is in range, and a depth-first walk from the root finds
+// no node on its own path, so findLeaf() always reaches an outcome.
+void TreeImage::checkNodes() const {
+    const std::size_t nodes = nodeCount();
+    const std::size_t predicates = count(ImageSection::Entries);
+    for (std::size_t i = 0; i < count(ImageSection::Branches); ++i) {
+        if (branches_[i].predicate >= predicates || branches_[i].child >= nodes) {
+            corrupt("branch", i);
+        }
+    }
+    for (std::size_t i = 0; i < count(ImageSection::Cases); ++i) {
+        if (cases_[i] >= nodes) {
+            corrupt("case", i);
+        }
+    }
+    for (std::size_t i = 0; i < nodes; ++i) {
+        const ImageNode& node = nodes_[i];
+        if (node.kind > static_cast<std::uint32_t>(FlatNodeKind::Switch)) {
+            corrupt("node", i);
+        }
+        bool valid = false;
+        switch (static_cast<FlatNodeKind>(node.kind)) {
+            case FlatNodeKind::Outcome:
+                valid = node.operand < outcomeCount();
+                break;
+            case FlatNodeKind::Decision:
+                valid = node.operand < predicates && node.first < nodes && node.second < nodes;
+                break;
+            case FlatNodeKind::MultiBranch:
+                valid = inRange(node.operand, node.first, count(ImageSection::Branches)) &&
+                        node.second < nodes;
+                break;
+            case FlatNodeKind::Switch:
+                valid = node.operand < count(ImageSection::Switches) && node.second < nodes;
+                break;
+        }
+        if (!valid) {
+            corrupt("node", i);
+        }
+    }
+
+    // Child k of a node, or nodes once k is past its last child.
+    auto child = [&](const ImageNode& node, std::uint32_t k) -> std::size_t {
+        switch (static_cast<FlatNodeKind>(node.kind)) {
+            case FlatNodeKind::Outcome:
+                break;
+            case FlatNodeKind::Decision:
+                return k == 0 ? node.first : k == 1 ? node.second : nodes;
+            case FlatNodeKind::MultiBranch:
+                return k < node.first ? branches_[node.operand + k].child
+                       : k == node.first ? node.second
+                                         : nodes;
+            case FlatNodeKind::Switch: {
+                const ImageSwitch& entry = switches_[node.operand];
+                return k < entry.caseCount ? cases_[entry.firstCase + k]
+                       : k == entry.caseCount ? node.second
+                                              : nodes;
+            }
+        }
+        return nodes;
+    };
+
+    enum : std::uint8_t { Unvisited, OnPath, Done };
+    std::vector<std::uint8_t> state(nodes, Unvisited);
+    std::vector<std::pair<NodeIndex, std::uint32_t>> path{{header_->root, 0}};
+    state[header_->root] = OnPath;
+    while (!path.empty()) {
+        auto& [index, next] = path.back();
+        std::size_t to = child(nodes_[index], next++);
+        if (to == nodes) {
+            state[index] = Done;
+            path.pop_back();
+        } else if (state[to] == OnPath) {
+            throw std::runtime_error("tree image: node " + std::to_string(to) +
+                                     " is its own descendant");
+        } else if (state[to] == Unvisited) {
+            state[to] = OnPath;
+            path.emplace_back(static_cast<NodeIndex>(to), 0);
+        }
+    }
+}
+
+FeatureValue TreeImage::resolve(const ImageValue& value) const {
+    FeatureValue v;
+    v.type = static_cast<ValueType>(value.type);
+    switch (v.type) {
+        case ValueType::Int:
+            v.i = static_cast<std::int64_t>(value.bits);
+            break;
+        case ValueType::Double:
+            std::memcpy(&v.d, &value.bits, sizeof(double));
+            break;
+        case ValueType::Bool:
+            v.b = value.bits != 0;
+            break;
+        case ValueType::String:
+            v.s = strings_ + value.bits;
+            v.length = value.length;
+            break;
+        case ValueType::Missing:
+            break;
+    }
+    return v;
+}
+
+bool TreeImage::Operands::contains(std::uint32_t set, const FeatureValue& value) const {
+    const ImageRange& range = image.sets_[set];
+    for (std::uint32_t i = 0; i < range.count; ++i) {
+        if (compareValues(CompareOp::Eq, value, image.resolvedSetValues_[range.first + i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Images never hold either instruction; see writeTreeImage().
+bool TreeImage::Operands::evaluate(std::uint32_t, const FlatContext&) const {
+    throw std::runtime_error("tree image: unexpected EvalExpr instruction");
+}
+
+bool TreeImage::Operands::call(std::uint32_t, const FlatContext&) const {
+    throw std::runtime_error("tree image: unexpected CallPredicate instruction");
+}
+
+// Mirrors SwitchTable::select() over the stored layout.
+std::uint32_t TreeImage::select(const ImageSwitch& entry, const FlatContext& context) const {
+    FeatureValue v = context.value(entry.slot);
+    if (v.type == ValueType::Missing && entry.fallback != kNoConstant) {
+        v = resolved_[entry.fallback];
+    }
+
+    switch (v.type) {
+        case ValueType::String: {
+            if (entry.slotCount == 0) {
+                return entry.caseCount;
+            }
+            std::string_view key(v.s, v.length);
+            const ImageStringKey& slot =
+                hashSlots_[entry.firstSlot +
+                           SwitchTable::hashSlot(key, displacements_ + entry.firstDisplacement,
+                                                 entry.displacementCount, entry.shift)];
+            return slot.caseIndex != entry.caseCount &&
+                           std::string_view(strings_ + slot.offset, slot.length) == key
+                       ? slot.caseIndex
+                       : entry.caseCount;
+        }
+        case ValueType::Int:
+            if (entry.denseCount != 0) {
+                std::uint64_t offset = static_cast<std::uint64_t>(v.i) -
+                                       static_cast<std::uint64_t>(entry.denseBase);
+                return offset < entry.denseCount ? denseCases_[entry.firstDense + offset]
+                                                 : entry.caseCount;
+            }
+            return selectNumber(entry, static_cast<double>(v.i));
+        case ValueType::Double:
+            return std::isnan(v.d) ? entry.caseCount : selectNumber(entry, v.d);
+        case ValueType::Bool:
+            return selectNumber(entry, v.b ? 1.0 : 0.0);
+        case ValueType::Missing:
+            break;
+    }
+    return entry.caseCount;
+}
+
+std::uint32_t TreeImage::selectNumber(const ImageSwitch& entry, double value) const {
+    if (entry.denseCount != 0) {
+        double offset = value - static_cast<double>(entry.denseBase);
+        if (offset >= 0.0 && offset < static_cast<double>(entry.denseCount) &&
+            std::floor(offset) == offset) {
+            return denseCases_[entry.firstDense + static_cast<std::size_t>(offset)];
+        }
+        return entry.caseCount;
+    }
+
+    const ImageNumericKey* begin = numericKeys_ + entry.firstNumber;
+    const ImageNumericKey* end = begin + entry.numberCount;
+    const ImageNumericKey* it = std::lower_bound(
+        begin, end, value, [](const ImageNumericKey& k, double v) { return k.key < v; });
+    return it != end && it->key == value ? it->caseIndex : entry.caseCount;
+}
+
+void TreeImage::release() {
+    if (mapped_ && data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+}
+
+TreeImage TreeImage::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot read " + path);
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("cannot map " + path);
+    }
+
+    try {
+        return TreeImage(static_cast<const char*>(data), size, true);
+    } catch (...) {
+        munmap(data, size);
+        throw;
+    }
+}
+
+TreeImage TreeImage::view(const void* data, std::size_t size) {
+    return TreeImage(static_cast<const char*>(data), size, false);
+}
+
+void TreeImage::take(TreeImage& other) {
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = other.size_;
+    mapped_ = other.mapped_;
+    header_ = other.header_;
+    nodes_ = other.nodes_;
+    branches_ = other.branches_;
+    entries_ = other.entries_;
+    code_ = other.code_;
+    sets_ = other.sets_;
+    results_ = other.results_;
+    switches_ = other.switches_;
+    numericKeys_ = other.numericKeys_;
+    denseCases_ = other.denseCases_;
+    hashSlots_ = other.hashSlots_;
+    displacements_ = other.displacements_;
+    cases_ = other.cases_;
+    strings_ = other.strings_;
+    stringsSize_ = other.stringsSize_;
+    schema_ = std::move(other.schema_);
+    resolved_ = std::move(other.resolved_);
+    resolvedSetValues_ = std::move(other.resolvedSetValues_);
+}
+
+TreeImage::TreeImage(TreeImage&& other) noexcept {
+    take(other);
+}
+
+TreeImage& TreeImage::operator=(TreeImage&& other) noexcept {
+    if (this != &other) {
+        release();
+        take(other);
+    }
+    return *this;
+}
+
+TreeImage::~TreeImage() {
+    release();
+}
+
+NodeIndex TreeImage::findLeaf(const FlatContext& context) const {
+    if (&context.schema() != &schema_) {
+        throw std::logic_error("FlatContext was not built from the image's schema");
+    }
+    PredicateMemo memo(header_->memoSlots);
+    PredicateMemo* memoPtr = header_->memoSlots != 0 ? &memo : nullptr;
+    auto test = [&](std::uint32_t predicate) {
+        return runBytecode(code_, entries_[predicate], context, Operands{*this}, memoPtr);
+    };
+
+    NodeIndex index = header_->root;
+    for (;;) {
+        const ImageNode& node = nodes_[index];
+
+        switch (static_cast<FlatNodeKind>(node.kind)) {
+            case FlatNodeKind::Outcome:
+                return index;
+            case FlatNodeKind::Decision:
+                index = test(node.operand) ? node.first : node.second;
+                break;
+            case FlatNodeKind::MultiBranch: {
+                NodeIndex next = node.second;
+                const FlatBranch* branch = branches_ + node.operand;
+                const FlatBranch* end = branch + node.first;
+                for (; branch != end; ++branch) {
+                    if (test(branch->predicate)) {
+                        next = branch->child;
+                        break;
+                    }
+                }
+                index = next;
+                break;
+            }
+            case FlatNodeKind::Switch: {
+                const ImageSwitch& entry = switches_[node.operand];
+                std::uint32_t taken = select(entry, context);
+                index = taken == entry.caseCount ? node.second : cases_[entry.firstCase + taken];
+                break;
+            }
+        }
+    }
+}
+
+OutcomeId TreeImage::outcomeIdOf(NodeIndex leaf) const {
+    return nodes_[leaf].operand;
+}
+
+Result TreeImage::getResult(OutcomeId id) const {
+    const ImageValue& value = results_[id];
+    switch (static_cast<ValueType>(value.type)) {
+        case ValueType::String:
+            return std::string(strings_ + value.bits, value.length);
+        case ValueType::Int:
+            return static_cast<int>(static_cast<std::int64_t>(value.bits));
+        case ValueType::Double: {
+            double d;
+            std::memcpy(&d, &value.bits, sizeof(double));
+            return d;
+        }
+        case ValueType::Bool:
+            return value.bits != 0;
+        case ValueType::Missing:
+            break;
+    }
+    throw std::runtime_error("tree image: outcome " + std::to_string(id) + " has no value");
+}
+
+Result TreeImage::evaluate(const FlatContext& context) const {
+    return getResult(outcomeIdOf(findLeaf(context)));
+}
+
+const FeatureSchema& TreeImage::getSchema() const {
+    return schema_;
+}
+
+std::size_t TreeImage::nodeCount() const {
+    return header_->sections[static_cast<std::size_t>(ImageSection::Nodes)].count;
+}
+
+std::size_t TreeImage::outcomeCount() const {
+    return header_->sections[static_cast<std::size_t>(ImageSection::Results)].count;
+}
+
+std::size_t TreeImage::byteSize() const {
+    return size_;
+}
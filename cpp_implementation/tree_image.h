@@ -0,0 +1,223 @@
+#pragma once
+
+#include "bytecode_vm.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A flattened tree and its bytecode as one versioned, position-independent
+// file that is evaluated where it lies: open() maps it and reads nodes,
+// instructions, constants and switch keys in place, with no per-node
+// allocation (constants and set values, typically a handful, are decoded
+// once). Every section starts at an 8-byte aligned offset and holds
+// fixed-size records in the writer's byte order:
+//   nodes     ImageNode; an outcome's operand is its interned OutcomeId
+//   branches  FlatBranch
+//   entries   code offset of each predicate
+//   code      Instruction
+//   constants ImageValue, with the switch fallbacks appended
+//   sets      ImageRange into setValues, which holds ImageValue
+//   results   ImageValue per OutcomeId
+//   switches  ImageSwitch, over the SwitchTable layout: numericKeys in
+//             ascending order, denseCases, and the perfect hash's hashSlots
+//             and displacements
+//   cases     child per switch case
+//   features  ImageFeature per schema slot
+//   strings   every string, referenced by offset and length
+// Only pure-expression trees can be written: actions, lambda conditions and
+// conditions the bytecode compiler leaves to the AST interpreter throw, as
+// do switches on anything but a feature. Interval indexes are not stored;
+// the image tests ladder branches in turn.
+
+constexpr std::uint32_t kTreeImageVersion = 1;
+
+enum class ImageSection : std::uint32_t {
+  Nodes,
+  Branches,
+  Entries,
+  Code,
+  Constants,
+  Sets,
+  SetValues,
+  Results,
+  Switches,
+  NumericKeys,
+  DenseCases,
+  HashSlots,
+  Displacements,
+  Cases,
+  Features,
+  Strings,
+  Count
+};
+
+struct ImageSectionEntry {
+  std::uint64_t offset;
+  std::uint64_t count;
+};
+
+struct ImageHeader {
+  char magic[8];
+  std::uint32_t version;
+  // 0x01020304 as written; a reader with the other byte order sees it
+  // reversed and rejects the file.
+  std::uint32_t byteOrder;
+  std::uint64_t size;
+  NodeIndex root;
+  std::uint32_t memoSlots;
+  ImageSectionEntry sections[static_cast<std::size_t>(ImageSection::Count)];
+};
+
+struct ImageNode {
+  std::uint32_t kind;
+  std::uint32_t operand;
+  std::uint32_t first;
+  std::uint32_t second;
+};
+
+// A Result or constant: bits holds the int, the double's bytes, 0 / 1, or
+// a string's offset into the string section.
+struct ImageValue {
+  std::uint32_t type;
+  std::uint32_t length;
+  std::uint64_t bits;
+};
+
+struct ImageRange {
+  std::uint32_t first;
+  std::uint32_t count;
+};
+
+// Each first / count pair is a run of the section of the same name.
+struct ImageSwitch {
+  SlotId slot;
+  std::uint32_t fallback;
+  std::uint32_t firstCase;
+  std::uint32_t caseCount;
+  std::uint32_t firstNumber;
+  std::uint32_t numberCount;
+  std::uint32_t firstDense;
+  std::uint32_t denseCount;
+  std::int64_t denseBase;
+  std::uint32_t firstSlot;
+  std::uint32_t slotCount;
+  std::uint32_t firstDisplacement;
+  std::uint32_t displacementCount;
+  std::uint32_t shift;
+  std::uint32_t reserved;
+};
+
+struct ImageNumericKey {
+  double key;
+  std::uint32_t caseIndex;
+  std::uint32_t reserved;
+};
+
+struct ImageStringKey {
+  std::uint32_t offset;
+  std::uint32_t length;
+  std::uint32_t caseIndex;
+};
+
+struct ImageFeature {
+  std::uint32_t offset;
+  std::uint32_t length;
+  std::uint32_t type;
+};
+
+// Writes engine's flattened tree, compiling its bytecode against the
+// engine's schema when it has none. Throws std::runtime_error for trees the
+// format cannot hold.
+void writeTreeImage(const DecisionTreeEngine &engine, std::ostream &out);
+// Writes a temporary file beside path and renames it over path, so images
+// already mapped from path keep reading the old tree.
+void writeTreeImageFile(const DecisionTreeEngine &engine,
+                        const std::string &path);
+
+// A mapped or borrowed image. Opening it checks, in one pass, the header
+// and section bounds, value types, string references, every index from one
+// section into another, and that no walk from the root can loop, so a
+// corrupt file throws instead of being read out of bounds. FlatContexts
+// must be built from getSchema(), which is rebuilt from the feature
+// section; any other throws std::logic_error.
+class TreeImage {
+private:
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+  bool mapped_ = false;
+  const ImageHeader *header_ = nullptr;
+  const ImageNode *nodes_ = nullptr;
+  const FlatBranch *branches_ = nullptr;
+  const std::uint32_t *entries_ = nullptr;
+  const Instruction *code_ = nullptr;
+  const ImageRange *sets_ = nullptr;
+  const ImageValue *results_ = nullptr;
+  const ImageSwitch *switches_ = nullptr;
+  const ImageNumericKey *numericKeys_ = nullptr;
+  const std::uint32_t *denseCases_ = nullptr;
+  const ImageStringKey *hashSlots_ = nullptr;
+  const std::uint32_t *displacements_ = nullptr;
+  const NodeIndex *cases_ = nullptr;
+  const char *strings_ = nullptr;
+  std::size_t stringsSize_ = 0;
+  FeatureSchema schema_;
+  // Constants and set values decoded once at open; strings still point
+  // into the image.
+  std::vector<FeatureValue> resolved_;
+  std::vector<FeatureValue> resolvedSetValues_;
+
+  struct Operands {
+    const TreeImage &image;
+
+    const FeatureValue &value(std::uint32_t index) const {
+      return image.resolved_[index];
+    }
+    bool contains(std::uint32_t set, const FeatureValue &value) const;
+    bool evaluate(std::uint32_t index, const FlatContext &context) const;
+    bool call(std::uint32_t index, const FlatContext &context) const;
+  };
+
+  TreeImage(const char *data, std::size_t size, bool mapped);
+  template <typename T> const T *section(ImageSection which) const;
+  std::size_t count(ImageSection which) const;
+  void checkString(std::uint64_t offset, std::uint32_t length) const;
+  void checkValue(const ImageValue &value) const;
+  void checkCode() const;
+  void checkSwitches() const;
+  void checkNodes() const;
+  FeatureValue resolve(const ImageValue &value) const;
+  std::uint32_t select(const ImageSwitch &entry,
+                       const FlatContext &context) const;
+  std::uint32_t selectNumber(const ImageSwitch &entry, double value) const;
+  void release();
+  // Moves other's mapping and schema into this one, leaving other empty.
+  void take(TreeImage &other);
+
+public:
+  // Maps path read-only; throws std::runtime_error if it cannot be read or
+  // is not a valid image.
+  static TreeImage open(const std::string &path);
+  // An image already in memory, which must be 8-byte aligned and outlive
+  // the TreeImage.
+  static TreeImage view(const void *data, std::size_t size);
+
+  TreeImage(TreeImage &&other) noexcept;
+  TreeImage &operator=(TreeImage &&other) noexcept;
+  TreeImage(const TreeImage &) = delete;
+  TreeImage &operator=(const TreeImage &) = delete;
+  ~TreeImage();
+
+  NodeIndex findLeaf(const FlatContext &context) const;
+  OutcomeId outcomeIdOf(NodeIndex leaf) const;
+  // Strings are copied out of the image.
+  Result getResult(OutcomeId id) const;
+  Result evaluate(const FlatContext &context) const;
+
+  const FeatureSchema &getSchema() const;
+  std::size_t nodeCount() const;
+  std::size_t outcomeCount() const;
+  std::size_t byteSize() const;
+};
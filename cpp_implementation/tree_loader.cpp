@@ -0,0 +1,546 @@
+#include "tree_loader.h"
+#include "expr_parser.h"
+#include "native_registry.h"
+
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void appendUtf8(std::string& out, unsigned code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+// A "condition" (or "case") value: text, {"native": name}, or neither for
+// null.
+struct ConditionField {
+    std::optional<std::string> text;
+    std::optional<std::string> native;
+};
+
+// The fields of one node object, gathered in whatever order they appear;
+// children are built as they are read.
+struct NodeFields {
+    std::string type;
+    std::string name;
+    ConditionField condition;
+    std::optional<Result> value;
+    bool hasAction = false;
+    std::optional<std::string> action;
+    NodePtr trueNode;
+    NodePtr falseNode;
+    std::vector<std::pair<Predicate, NodePtr>> branches;
+    std::optional<std::string> feature;
+    std::vector<std::pair<Result, NodePtr>> cases;
+    NodePtr defaultNode;
+};
+
+class TreeReader {
+private:
+    std::string_view json_;
+    std::size_t pos_ = 0;
+    FeatureSchema* schema_;
+    const NativeRegistry* natives_;
+    std::unordered_map<std::string, ExprPtr> conditions_;
+    std::string key_;
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::runtime_error("tree JSON: " + what + " at offset " + std::to_string(pos_));
+    }
+
+    void skipSpace() {
+        while (pos_ < json_.size() && (json_[pos_] == ' ' || json_[pos_] == '\n' ||
+                                       json_[pos_] == '\r' || json_[pos_] == '\t')) {
+            ++pos_;
+        }
+    }
+
+    char peek() {
+        skipSpace();
+        return pos_ < json_.size() ? json_[pos_] : '\0';
+    }
+
+    bool accept(char c) {
+        if (peek() != c) {
+            return false;
+        }
+        ++pos_;
+        return true;
+    }
+
+    void expect(char c) {
+        if (peek() != c) {
+            fail(std::string("expected '") + c + "'");
+        }
+        ++pos_;
+    }
+
+    bool acceptWord(std::string_view word) {
+        skipSpace();
+        if (json_.substr(pos_, word.size()) == word) {
+            pos_ += word.size();
+            return true;
+        }
+        return false;
+    }
+
+    unsigned parseHex4() {
+        if (pos_ + 4 > json_.size()) {
+            fail("truncated \\u escape");
+        }
+        unsigned code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = json_[pos_++];
+            code <<= 4;
+            if (c >= '0' && c <= '9') {
+                code |= static_cast<unsigned>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                code |= static_cast<unsigned>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                code |= static_cast<unsigned>(c - 'A' + 10);
+            } else {
+                fail("invalid \\u escape");
+            }
+        }
+        return code;
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string out;
+        for (;;) {
+            std::size_t run = json_.find_first_of("\"\\", pos_);
+            if (run == std::string_view::npos) {
+                fail("unterminated string");
+            }
+            out.append(json_.substr(pos_, run - pos_));
+            pos_ = run + 1;
+            if (json_[run] == '"') {
+                return out;
+            }
+            if (pos_ >= json_.size()) {
+                fail("unterminated string");
+            }
+            switch (char escaped = json_[pos_++]) {
+                case 'n':
+                    out += '\n';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'u': {
+                    unsigned code = parseHex4();
+                    if (code >= 0xdc00 && code < 0xe000) {
+                        fail("unpaired low surrogate");
+                    }
+                    if (code >= 0xd800 && code < 0xdc00) {
+                        if (json_.substr(pos_, 2) != "\\u") {
+                            fail("unpaired high surrogate");
+                        }
+                        pos_ += 2;
+                        unsigned low = parseHex4();
+                        if (low < 0xdc00 || low >= 0xe000) {
+                            fail("high surrogate not followed by a low surrogate");
+                        }
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    appendUtf8(out, code);
+                    break;
+                }
+                case '"':
+                case '\\':
+                case '/':
+                    out += escaped;
+                    break;
+                default:
+                    fail(std::string("invalid escape \\") + escaped);
+            }
+        }
+    }
+
+    // Keys are compared in place unless they contain escapes.
+    std::string_view parseKey() {
+        skipSpace();
+        std::size_t start = pos_ + 1;
+        std::size_t end = json_.find_first_of("\"\\", start);
+        if (pos_ < json_.size() && json_[pos_] == '"' && end != std::string_view::npos &&
+            json_[end] == '"') {
+            pos_ = end + 1;
+            return json_.substr(start, end - start);
+        }
+        key_ = parseString();
+        return key_;
+    }
+
+    std::optional<std::string> parseNullableString() {
+        if (acceptWord("null")) {
+            return std::nullopt;
+        }
+        return parseString();
+    }
+
+    ConditionField parseConditionField() {
+        ConditionField field;
+        if (peek() != '{') {
+            field.text = parseNullableString();
+            return field;
+        }
+        parseObject([&](std::string_view key) {
+            if (key == "native") {
+                field.native = parseString();
+            } else {
+                skipValue();
+            }
+        });
+        if (!field.native) {
+            fail("condition object without a \"native\" name");
+        }
+        return field;
+    }
+
+    // A number, true, false, inf or nan.
+    Result parseScalar() {
+        skipSpace();
+        std::size_t start = pos_;
+        while (pos_ < json_.size() && json_[pos_] != ',' && json_[pos_] != '}' &&
+               json_[pos_] != ']' && json_[pos_] != ' ' && json_[pos_] != '\n' &&
+               json_[pos_] != '\r' && json_[pos_] != '\t') {
+            ++pos_;
+        }
+        try {
+            return parseLiteral(json_.substr(start, pos_ - start));
+        } catch (const std::runtime_error&) {
+            pos_ = start;
+            fail("expected a value");
+        }
+    }
+
+    Result parseValue() {
+        if (peek() == '"') {
+            return parseString();
+        }
+        return parseScalar();
+    }
+
+    void skipValue() {
+        switch (peek()) {
+            case '"':
+                parseString();
+                return;
+            case '{':
+            case '[': {
+                char close = json_[pos_] == '{' ? '}' : ']';
+                ++pos_;
+                if (accept(close)) {
+                    return;
+                }
+                do {
+                    if (close == '}') {
+                        parseKey();
+                        expect(':');
+                    }
+                    skipValue();
+                } while (accept(','));
+                expect(close);
+                return;
+            }
+            default:
+                if (!acceptWord("null")) {
+                    parseScalar();
+                }
+        }
+    }
+
+    // Calls field(key) for every key of an object; field reads the value.
+    template <typename FieldFn>
+    void parseObject(FieldFn&& field) {
+        expect('{');
+        if (accept('}')) {
+            return;
+        }
+        do {
+            std::string_view key = parseKey();
+            expect(':');
+            field(key);
+        } while (accept(','));
+        expect('}');
+    }
+
+    template <typename ElementFn>
+    void parseArray(ElementFn&& element) {
+        expect('[');
+        if (accept(']')) {
+            return;
+        }
+        do {
+            element();
+        } while (accept(','));
+        expect(']');
+    }
+
+    ExprPtr condition(const std::string& text) {
+        auto found = conditions_.find(text);
+        if (found != conditions_.end()) {
+            return found->second;
+        }
+        try {
+            return conditions_.emplace(text, parseExpr(text, schema_)).first->second;
+        } catch (const std::runtime_error& e) {
+            fail(e.what());
+        }
+    }
+
+    const NativeRegistry& natives(const std::string& what) {
+        if (!natives_) {
+            fail(what + " needs a NativeRegistry to load");
+        }
+        return *natives_;
+    }
+
+    Predicate predicate(const ConditionField& field, const std::string& owner) {
+        if (field.native) {
+            const std::string what = "native predicate \"" + *field.native + "\"";
+            if (!natives(what).hasPredicate(*field.native)) {
+                fail(what + " is not registered");
+            }
+            return natives_->predicate(*field.native);
+        }
+        if (!field.text) {
+            fail(owner + " has no loadable condition");
+        }
+        return condition(*field.text);
+    }
+
+    // One {"condition" or "case", "node"} entry of a branch or case list.
+    template <typename EntryFn>
+    void parseEntries(const char* label, EntryFn&& entry) {
+        parseArray([&] {
+            ConditionField text;
+            bool hasLabel = false;
+            NodePtr node;
+            parseObject([&](std::string_view key) {
+                if (key == label) {
+                    text = parseConditionField();
+                    hasLabel = true;
+                } else if (key == "node") {
+                    node = parseNode();
+                } else {
+                    skipValue();
+                }
+            });
+            if (!hasLabel) {
+                fail(std::string("entry without a \"") + label + "\"");
+            }
+            entry(text, std::move(node));
+        });
+    }
+
+    NodePtr build(NodeFields& fields) {
+        if (fields.type == "outcome") {
+            if (!fields.value) {
+                fail("outcome without a value");
+            }
+            if (fields.action) {
+                const std::string what = "native action \"" + *fields.action + "\"";
+                if (!natives(what).hasAction(*fields.action)) {
+                    fail(what + " is not registered");
+                }
+                return natives_->outcome(std::move(*fields.value), *fields.action);
+            }
+            if (fields.hasAction) {
+                fail("outcome \"" + resultToString(*fields.value) +
+                     "\" has an unnamed action, which JSON cannot carry");
+            }
+            return std::make_shared<OutcomeNode>(std::move(*fields.value));
+        }
+        if (fields.type == "decision") {
+            return std::make_shared<DecisionNode>(
+                fields.name, predicate(fields.condition, "decision \"" + fields.name + "\""),
+                std::move(fields.trueNode), std::move(fields.falseNode));
+        }
+        if (fields.type == "multibranch") {
+            auto multi = std::make_shared<MultiBranchNode>(fields.name);
+            for (auto& [predicate, node] : fields.branches) {
+                multi->addBranch(std::move(predicate), std::move(node));
+            }
+            multi->setDefault(std::move(fields.defaultNode));
+            return multi;
+        }
+        if (fields.type == "switch") {
+            if (!fields.feature) {
+                fail("switch \"" + fields.name + "\" has no feature");
+            }
+            try {
+                auto switchNode =
+                    std::make_shared<SwitchNode>(fields.name, condition(*fields.feature));
+                switchNode->addCases(std::move(fields.cases));
+                switchNode->setDefault(std::move(fields.defaultNode));
+                return switchNode;
+            } catch (const std::runtime_error& e) {
+                fail(e.what());
+            }
+        }
+        fail("unknown node type \"" + fields.type + "\"");
+    }
+
+public:
+    TreeReader(std::string_view json, FeatureSchema* schema, const NativeRegistry* natives)
+        : json_(json), schema_(schema), natives_(natives) {}
+
+    NodePtr parseNode() {
+        if (acceptWord("null")) {
+            return nullptr;
+        }
+
+        NodeFields fields;
+        parseObject([&](std::string_view key) {
+            if (key == "type") {
+                fields.type = parseString();
+            } else if (key == "name") {
+                fields.name = parseString();
+            } else if (key == "condition") {
+                fields.condition = parseConditionField();
+            } else if (key == "value") {
+                fields.value = parseValue();
+            } else if (key == "hasAction") {
+                Result flag = parseScalar();
+                const bool* value = std::get_if<bool>(&flag);
+                if (!value) {
+                    fail("hasAction is not true or false");
+                }
+                fields.hasAction = *value;
+            } else if (key == "action") {
+                fields.action = parseString();
+            } else if (key == "trueBranch") {
+                fields.trueNode = parseNode();
+            } else if (key == "falseBranch") {
+                fields.falseNode = parseNode();
+            } else if (key == "feature") {
+                fields.feature = parseString();
+            } else if (key == "branches") {
+                parseEntries("condition", [&](const ConditionField& field, NodePtr node) {
+                    if (field.text && *field.text == "default") {
+                        fields.defaultNode = std::move(node);
+                    } else {
+                        fields.branches.emplace_back(
+                            predicate(field, "branch of \"" + fields.name + "\""),
+                            std::move(node));
+                    }
+                });
+            } else if (key == "cases") {
+                parseEntries("case", [&](const ConditionField& field, NodePtr node) {
+                    const std::optional<std::string>& text = field.text;
+                    if (!text) {
+                        fail("case of \"" + fields.name + "\" has no value");
+                    }
+                    if (*text == "default") {
+                        fields.defaultNode = std::move(node);
+                        return;
+                    }
+                    try {
+                        fields.cases.emplace_back(parseLiteral(*text), std::move(node));
+                    } catch (const std::runtime_error& e) {
+                        fail(e.what());
+                    }
+                });
+            } else {
+                skipValue();
+            }
+        });
+        return build(fields);
+    }
+
+    void expectEnd() {
+        if (peek() != '\0' || pos_ != json_.size()) {
+            fail("trailing characters");
+        }
+    }
+};
+
+}
+
+NodePtr loadTreeJson(std::string_view json, FeatureSchema* schema,
+                     const NativeRegistry* natives) {
+    TreeReader reader(json, schema, natives);
+    NodePtr root = reader.parseNode();
+    reader.expectEnd();
+    return root;
+}
+
+NodePtr loadTreeJsonFile(const std::string& path, FeatureSchema* schema,
+                         const NativeRegistry* natives) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("cannot open tree file " + path);
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    return loadTreeJson(text.str(), schema, natives);
+}
+
+TreeFile::TreeFile(std::string path, ExecutionMode mode,
+                   std::shared_ptr<const NativeRegistry> natives)
+    : path_(std::move(path)), mode_(mode), natives_(std::move(natives)) {
+    modified_ = std::filesystem::last_write_time(path_);
+    engine_ = load();
+}
+
+std::shared_ptr<const DecisionTreeEngine> TreeFile::load() const {
+    auto engine =
+        std::make_shared<DecisionTreeEngine>(loadTreeJsonFile(path_, nullptr, natives_.get()));
+    engine->setExecutionMode(mode_);
+    return engine;
+}
+
+std::shared_ptr<const DecisionTreeEngine> TreeFile::get() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return engine_;
+}
+
+bool TreeFile::reloadIfChanged() {
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(path_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (modified == modified_) {
+            return false;
+        }
+    }
+
+    std::shared_ptr<const DecisionTreeEngine> engine = load();
+    std::lock_guard<std::mutex> lock(mutex_);
+    modified_ = modified;
+    engine_ = std::move(engine);
+    return true;
+}
+
+const std::string& TreeFile::getPath() const {
+    return path_;
+}
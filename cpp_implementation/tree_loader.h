@@ -0,0 +1,67 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+class NativeRegistry;
+
+// Builds a tree from the JSON toJson() writes, in one pass over the text
+// with no intermediate document. Per node type:
+//   outcome:     "value" is a string, number or boolean; a number with a
+//                '.' or an exponent is a double, otherwise an int.
+//                "action" names a registered native action;
+//                "hasAction": true without one is rejected.
+//   decision:    "name", "condition", optional "trueBranch" and
+//                "falseBranch".
+//   multibranch: "name" and "branches", each {"condition", "node"}; the
+//                condition "default" sets the default node.
+//   switch:      "name", "feature" and "cases", each {"case", "node"}; the
+//                case is a literal, or "default".
+// Conditions are parseExpr() text, or {"native": name} for a predicate
+// registered in natives; identical condition text is parsed once and
+// shared. A null condition (an unnamed lambda when written), an unknown
+// type, and native names without natives or missing from it throw, as do
+// malformed JSON and conditions, with std::runtime_error naming the byte
+// offset. Missing and null nodes load as nullptr. Features are bound to
+// schema when one is given.
+NodePtr loadTreeJson(std::string_view json, FeatureSchema *schema = nullptr,
+                     const NativeRegistry *natives = nullptr);
+NodePtr loadTreeJsonFile(const std::string &path,
+                         FeatureSchema *schema = nullptr,
+                         const NativeRegistry *natives = nullptr);
+
+// A tree served from a JSON file, for shipping rulesets without
+// rebuilding. get() hands out the current engine, which callers keep for
+// as long as they evaluate with it; reloadIfChanged() loads a newer file
+// into a fresh engine (with its own schema) and swaps it in, so threads
+// never see a half-built tree. Threads may call both concurrently.
+class TreeFile {
+private:
+  std::string path_;
+  ExecutionMode mode_;
+  std::shared_ptr<const NativeRegistry> natives_;
+  std::filesystem::file_time_type modified_;
+  std::shared_ptr<const DecisionTreeEngine> engine_;
+  mutable std::mutex mutex_;
+
+  std::shared_ptr<const DecisionTreeEngine> load() const;
+
+public:
+  // Loads path now, and every reload, resolving native names against
+  // natives; throws if it cannot be read or parsed.
+  explicit TreeFile(std::string path,
+                    ExecutionMode mode = ExecutionMode::Flattened,
+                    std::shared_ptr<const NativeRegistry> natives = nullptr);
+
+  std::shared_ptr<const DecisionTreeEngine> get() const;
+  // Reloads when the file's modification time changed and returns whether
+  // a new tree was swapped in. A file that fails to load throws and leaves
+  // the current tree in place.
+  bool reloadIfChanged();
+  const std::string &getPath() const;
+};
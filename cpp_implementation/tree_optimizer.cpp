@@ -0,0 +1,436 @@
+#include "tree_optimizer.h"
+#include "interval_index.h"
+
+#include <cmath>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr double kExactIntegerLimit = 9007199254740992.0;  // 2^53
+
+// What the path to a node says about one feature: when the feature is a
+// number it lies in interval, and numeric is set when it must be one.
+struct Fact {
+    Interval interval;
+    bool numeric = false;
+};
+
+bool operator<(const Fact& a, const Fact& b) {
+    return std::tie(a.interval.lo, a.interval.hi, a.interval.loClosed, a.interval.hiClosed,
+                    a.numeric) <
+           std::tie(b.interval.lo, b.interval.hi, b.interval.loClosed, b.interval.hiClosed,
+                    b.numeric);
+}
+
+using Facts = std::map<FeatureKey, Fact>;
+
+FeatureKey keyOf(const ConditionExpr& feature) {
+    return {feature.getFeature(),
+            feature.hasFallback() ? std::optional<Result>(feature.getValue()) : std::nullopt};
+}
+
+std::optional<double> numericKey(const Result& value) {
+    double number = 0.0;
+    if (const auto* i = std::get_if<int>(&value)) {
+        number = *i;
+    } else if (const auto* d = std::get_if<double>(&value)) {
+        number = *d;
+    } else if (const auto* b = std::get_if<bool>(&value)) {
+        number = *b ? 1.0 : 0.0;
+    } else {
+        return std::nullopt;
+    }
+    if (std::isnan(number) || std::fabs(number) >= kExactIntegerLimit) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+bool within(const Interval& inner, const Interval& outer) {
+    bool lo = outer.lo < inner.lo || (outer.lo == inner.lo && (outer.loClosed || !inner.loClosed));
+    bool hi = outer.hi > inner.hi || (outer.hi == inner.hi && (outer.hiClosed || !inner.hiClosed));
+    return lo && hi;
+}
+
+void restrict(Facts& facts, const FeatureKey& key, const Interval& interval, bool numeric) {
+    Fact& fact = facts[key];
+    fact.interval.raiseLow(interval.lo, interval.loClosed);
+    fact.interval.lowerHigh(interval.hi, interval.hiClosed);
+    fact.numeric |= numeric;
+}
+
+void assumeTrue(Facts& facts, const ExprPtr& condition) {
+    if (auto constraints = featureConstraints(Predicate(condition))) {
+        for (const auto& [key, bound] : constraints->bounds) {
+            restrict(facts, key, bound.interval, true);
+        }
+    }
+}
+
+// Where an exact condition on one feature is false, the feature is not a
+// number or lies outside the interval. Only a one-sided interval leaves a
+// single interval outside it; anything else is not recorded.
+void assumeFalse(Facts& facts, const ExprPtr& condition) {
+    auto constraints = featureConstraints(Predicate(condition));
+    if (!constraints || !constraints->exact || constraints->bounds.size() != 1) {
+        return;
+    }
+    const auto& [key, bound] = *constraints->bounds.begin();
+    const Interval& inside = bound.interval;
+    Interval outside;
+    if (std::isinf(inside.lo) && !std::isinf(inside.hi)) {
+        outside.raiseLow(inside.hi, !inside.hiClosed);
+    } else if (std::isinf(inside.hi) && !std::isinf(inside.lo)) {
+        outside.lowerHigh(inside.lo, !inside.loClosed);
+    } else {
+        return;
+    }
+    restrict(facts, key, outside, false);
+}
+
+bool readsFeature(const ExprPtr& expr) {
+    if (expr->kind() == ExprKind::Feature) {
+        return true;
+    }
+    for (const auto& operand : expr->getOperands()) {
+        if (readsFeature(operand)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool truthOf(const ExprPtr& constant) {
+    return constant->evaluate(Context{});
+}
+
+// true or false when facts (or the lack of feature reads) decide expr.
+std::optional<bool> decide(const ExprPtr& expr, const Facts& facts) {
+    if (!readsFeature(expr)) {
+        return expr->evaluate(Context{});
+    }
+    auto constraints = featureConstraints(Predicate(expr));
+    bool implied = constraints->exact && !constraints->bounds.empty();
+    for (const auto& [key, bound] : constraints->bounds) {
+        auto it = facts.find(key);
+        if (it == facts.end()) {
+            implied = false;
+            continue;
+        }
+        if (!it->second.interval.intersects(bound.interval)) {
+            return false;
+        }
+        implied &= it->second.numeric && within(it->second.interval, bound.interval);
+    }
+    if (implied) {
+        return true;
+    }
+    return std::nullopt;
+}
+
+// expr with every operand that facts decide replaced by its value. Each
+// operand of && (or, negated, of ||) adds to the facts later ones see.
+ExprPtr simplify(const ExprPtr& expr, const Facts& facts) {
+    switch (expr->kind()) {
+        case ExprKind::And:
+        case ExprKind::Or: {
+            bool isAnd = expr->kind() == ExprKind::And;
+            Facts local = facts;
+            std::vector<ExprPtr> operands;
+            bool changed = false;
+            for (const auto& operand : expr->getOperands()) {
+                ExprPtr simplified = simplify(operand, local);
+                if (simplified->kind() == ExprKind::Constant) {
+                    if (truthOf(simplified) != isAnd) {
+                        return ConditionExpr::constant(!isAnd);
+                    }
+                    changed = true;
+                    continue;
+                }
+                changed |= simplified != operand;
+                operands.push_back(simplified);
+                if (isAnd) {
+                    assumeTrue(local, simplified);
+                } else {
+                    assumeFalse(local, simplified);
+                }
+            }
+            if (!changed) {
+                return expr;
+            }
+            if (operands.empty()) {
+                return ConditionExpr::constant(isAnd);
+            }
+            if (operands.size() == 1) {
+                return operands[0];
+            }
+            return ConditionExpr::logical(expr->kind(), std::move(operands));
+        }
+        case ExprKind::Not: {
+            const ExprPtr& operand = expr->getOperands()[0];
+            ExprPtr simplified = simplify(operand, facts);
+            if (simplified->kind() == ExprKind::Constant) {
+                return ConditionExpr::constant(!truthOf(simplified));
+            }
+            return simplified == operand ? expr : ConditionExpr::negate(simplified);
+        }
+        case ExprKind::Constant:
+            return expr;
+        case ExprKind::Feature:
+        case ExprKind::Compare:
+        case ExprKind::In:
+            break;
+    }
+    if (auto truth = decide(expr, facts)) {
+        return ConditionExpr::constant(*truth);
+    }
+    return expr;
+}
+
+std::optional<bool> constantTruth(const Predicate& condition) {
+    const ExprPtr& expr = condition.getExpr();
+    if (expr && expr->kind() == ExprKind::Constant) {
+        return truthOf(expr);
+    }
+    return std::nullopt;
+}
+
+// Two children are interchangeable when they are the same node or equal
+// outcomes without actions.
+bool sameChild(const NodePtr& a, const NodePtr& b) {
+    if (!a || !b) {
+        return false;
+    }
+    if (a == b) {
+        return true;
+    }
+    if (a->kind() != NodeKind::Outcome || b->kind() != NodeKind::Outcome) {
+        return false;
+    }
+    const auto& x = static_cast<const OutcomeNode&>(*a);
+    const auto& y = static_cast<const OutcomeNode&>(*b);
+    return !x.getAction() && !y.getAction() && x.getValue() == y.getValue();
+}
+
+class Optimizer {
+private:
+    TreeOptimizerReport& report_;
+    // A subtree is rebuilt once per distinct set of facts it is reached with.
+    std::map<std::pair<const Node*, Facts>, NodePtr> rebuilt_;
+
+    Predicate simplifyCondition(const Predicate& condition, const Facts& facts) {
+        if (const ExprPtr& expr = condition.getExpr()) {
+            ExprPtr simplified = simplify(expr, facts);
+            if (simplified != expr) {
+                ++(simplified->kind() == ExprKind::Constant ? report_.conditionsFolded
+                                                            : report_.conditionsSimplified);
+                return Predicate(simplified);
+            }
+        }
+        return condition;
+    }
+
+    // A multi-branch or switch left without branches, or whose every child
+    // is the same, is replaced by that child.
+    NodePtr collapse(const std::vector<NodePtr>& children, const NodePtr& defaultNode) {
+        if (children.empty()) {
+            ++report_.nodesCollapsed;
+            return defaultNode ? defaultNode
+                               : std::make_shared<OutcomeNode>(std::string("NO_MATCH"));
+        }
+        for (const auto& child : children) {
+            if (!sameChild(child, defaultNode)) {
+                return nullptr;
+            }
+        }
+        ++report_.nodesCollapsed;
+        return defaultNode;
+    }
+
+    NodePtr rebuildDecision(const NodePtr& node, const Facts& facts) {
+        const auto& decision = static_cast<const DecisionNode&>(*node);
+        Predicate condition = simplifyCondition(decision.getCondition(), facts);
+        if (auto truth = constantTruth(condition)) {
+            const NodePtr& taken = *truth ? decision.getTrueNode() : decision.getFalseNode();
+            if (taken) {
+                ++report_.branchesPruned;
+                return rebuild(taken, facts);
+            }
+        }
+
+        Facts onTrue = facts;
+        Facts onFalse = facts;
+        if (const ExprPtr& expr = condition.getExpr()) {
+            assumeTrue(onTrue, expr);
+            assumeFalse(onFalse, expr);
+        }
+        NodePtr trueNode = rebuild(decision.getTrueNode(), onTrue);
+        NodePtr falseNode = rebuild(decision.getFalseNode(), onFalse);
+
+        if (sameChild(trueNode, falseNode)) {
+            ++report_.nodesCollapsed;
+            return trueNode;
+        }
+        if (trueNode != decision.getTrueNode() || falseNode != decision.getFalseNode() ||
+            condition.getExpr() != decision.getCondition().getExpr()) {
+            return std::make_shared<DecisionNode>(decision.getName(), condition, trueNode,
+                                                  falseNode);
+        }
+        return node;
+    }
+
+    NodePtr rebuildMultiBranch(const NodePtr& node, const Facts& facts) {
+        const auto& multi = static_cast<const MultiBranchNode&>(*node);
+        const auto& branches = multi.getBranches();
+
+        // rest holds where every branch so far was false.
+        Facts rest = facts;
+        std::vector<std::pair<Predicate, NodePtr>> kept;
+        std::vector<NodePtr> children;
+        std::optional<NodePtr> alwaysTaken;
+        bool changed = false;
+        for (std::size_t i = 0; i < branches.size(); ++i) {
+            const auto& [original, child] = branches[i];
+            Predicate condition = simplifyCondition(original, rest);
+            changed |= condition.getExpr() != original.getExpr();
+
+            std::optional<bool> truth = constantTruth(condition);
+            if (truth && !*truth) {
+                ++report_.branchesPruned;
+                changed = true;
+                continue;
+            }
+            if (truth && child) {
+                report_.branchesPruned += branches.size() - i - 1 + (multi.getDefaultNode() ? 1 : 0);
+                alwaysTaken = rebuild(child, rest);
+                changed = true;
+                break;
+            }
+
+            Facts taken = rest;
+            if (const ExprPtr& expr = condition.getExpr()) {
+                assumeTrue(taken, expr);
+                assumeFalse(rest, expr);
+            }
+            NodePtr rebuilt = rebuild(child, taken);
+            changed |= rebuilt != child;
+            kept.emplace_back(condition, rebuilt);
+            children.push_back(rebuilt);
+        }
+
+        NodePtr defaultNode = alwaysTaken ? *alwaysTaken : rebuild(multi.getDefaultNode(), rest);
+        changed |= defaultNode != multi.getDefaultNode();
+        if (!changed) {
+            return node;
+        }
+        if (NodePtr collapsed = collapse(children, defaultNode)) {
+            return collapsed;
+        }
+
+        auto copy = std::make_shared<MultiBranchNode>(multi.getName());
+        for (auto& [condition, child] : kept) {
+            copy->addBranch(std::move(condition), child);
+        }
+        copy->setDefault(defaultNode);
+        return copy;
+    }
+
+    NodePtr rebuildSwitch(const NodePtr& node, const Facts& facts) {
+        const auto& switchNode = static_cast<const SwitchNode&>(*node);
+        FeatureKey key = keyOf(*switchNode.getFeature());
+        auto known = facts.find(key);
+
+        std::vector<std::pair<Result, NodePtr>> cases;
+        std::vector<NodePtr> children;
+        bool changed = false;
+        for (const auto& [value, child] : switchNode.getCases()) {
+            std::optional<double> number = numericKey(value);
+            bool reachable = true;
+            if (known != facts.end()) {
+                reachable = number ? known->second.interval.contains(*number)
+                                   : !(std::holds_alternative<std::string>(value) &&
+                                       known->second.numeric);
+            }
+            if (!reachable) {
+                ++report_.branchesPruned;
+                changed = true;
+                continue;
+            }
+
+            Facts taken = facts;
+            if (number) {
+                Interval point;
+                point.raiseLow(*number, true);
+                point.lowerHigh(*number, true);
+                restrict(taken, key, point, true);
+            }
+            NodePtr rebuilt = rebuild(child, taken);
+            changed |= rebuilt != child;
+            cases.emplace_back(value, rebuilt);
+            children.push_back(rebuilt);
+        }
+
+        NodePtr defaultNode = rebuild(switchNode.getDefaultNode(), facts);
+        changed |= defaultNode != switchNode.getDefaultNode();
+        if (!changed) {
+            return node;
+        }
+        if (NodePtr collapsed = collapse(children, defaultNode)) {
+            return collapsed;
+        }
+
+        auto copy = std::make_shared<SwitchNode>(switchNode.getName(), switchNode.getFeature());
+        copy->addCases(std::move(cases));
+        copy->setDefault(defaultNode);
+        return copy;
+    }
+
+public:
+    explicit Optimizer(TreeOptimizerReport& report) : report_(report) {}
+
+    NodePtr rebuild(const NodePtr& node, const Facts& facts) {
+        if (!node || node->kind() == NodeKind::Outcome) {
+            return node;
+        }
+        auto key = std::make_pair(node.get(), facts);
+        auto found = rebuilt_.find(key);
+        if (found != rebuilt_.end()) {
+            return found->second;
+        }
+
+        NodePtr result = node;
+        switch (node->kind()) {
+            case NodeKind::Decision:
+                result = rebuildDecision(node, facts);
+                break;
+            case NodeKind::MultiBranch:
+                result = rebuildMultiBranch(node, facts);
+                break;
+            case NodeKind::Switch:
+                result = rebuildSwitch(node, facts);
+                break;
+            case NodeKind::Outcome:
+                break;
+        }
+
+        rebuilt_.emplace(std::move(key), result);
+        return result;
+    }
+};
+
+}
+
+NodePtr optimizeTree(const NodePtr& root, TreeOptimizerReport* report) {
+    TreeOptimizerReport local;
+    TreeOptimizerReport& out = report ? *report : local;
+    out = TreeOptimizerReport();
+
+    NodePtr result = Optimizer(out).rebuild(root, Facts());
+    out.nodesBefore = reachableNodes(root).size();
+    out.nodesAfter = reachableNodes(result).size();
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "accounting_decision_tree.h"
+
+#include <cstddef>
+
+// What optimizeTree() changed. Node counts are of distinct reachable nodes.
+struct TreeOptimizerReport {
+  std::size_t conditionsFolded = 0;
+  std::size_t conditionsSimplified = 0;
+  std::size_t branchesPruned = 0;
+  std::size_t nodesCollapsed = 0;
+  std::size_t nodesBefore = 0;
+  std::size_t nodesAfter = 0;
+};
+
+// Returns root with its redundancy removed, evaluating to the same result
+// for every input:
+//  - conditions without feature reads are folded to constants;
+//  - conditions and && / || operands decided by the bounds their ancestors
+//    put on a feature are folded (credit_score >= 550 is always true under
+//    credit_score >= 650), so the untaken subtree is pruned, as are
+//    multi-branch branches and switch cases that can no longer be reached;
+//  - decisions, multi-branches and switches whose children are all the same
+//    outcome collapse into it.
+// Bounds come from featureConstraints(); lambda conditions are kept as they
+// are and never decided. Unchanged subtrees are shared with root; changed
+// nodes are copied and root itself is left untouched. Outcomes with an
+// action only merge when they are the same node.
+NodePtr optimizeTree(const NodePtr &root,
+                     TreeOptimizerReport *report = nullptr);
@@ -0,0 +1 @@
+g++ -std=c++17 -O1 -o decision_tree_tests cpp_implementation/accounting_decision_tree.cpp cpp_implementation/branch_reorder.cpp cpp_implementation/bytecode_vm.cpp cpp_implementation/columnar_batch.cpp cpp_implementation/condition_expr.cpp cpp_implementation/context.cpp cpp_implementation/decision_trace.cpp cpp_implementation/expr_parser.cpp cpp_implementation/flat_tree.cpp cpp_implementation/hit_counters.cpp cpp_implementation/interval_index.cpp cpp_implementation/json_writer.cpp cpp_implementation/native_codegen.cpp cpp_implementation/native_registry.cpp cpp_implementation/path_id.cpp cpp_implementation/subtree_sharing.cpp cpp_implementation/switch_table.cpp cpp_implementation/thread_pool.cpp cpp_implementation/tree_image.cpp cpp_implementation/tree_loader.cpp cpp_implementation/tree_optimizer.cpp cpp_implementation/tests/*.cpp -ldl -pthread && ./decision_tree_tests